@@ -1,7 +1,12 @@
 #version 330 core
+#ifdef COMPACT_GBUFFER
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gAlbedoSpec;
+#else
 layout (location = 0) out vec3 gPosition;
 layout (location = 1) out vec3 gNormal;
 layout (location = 2) out vec4 gAlbedoSpec;
+#endif
 
 in vec3 FragPos;
 in vec2 TexCoords;
@@ -10,13 +15,33 @@ in vec3 Normal;
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 
+#ifdef COMPACT_GBUFFER
+// Octahedron encoding: the sphere folded flat onto a square, then moved into
+// [0, 1] to fit an unsigned normalized target
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = n.xy;
+    if (n.z < 0.0)
+    {
+        folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return folded * 0.5 + 0.5;
+}
+#endif
+
 void main() 
 {
+#ifdef COMPACT_GBUFFER
+    // Position comes back from depth, the normal packs down to two channels
+    gNormal = EncodeNormal(normalize(Normal));
+#else
     // Store the fragment position in the gBuffer texture
     gPosition = FragPos;
 
     // Same with normals
     gNormal = normalize(Normal);
+#endif
 
     // Diffuse color in rgb components
     // gAlbedoSpec.rgb = texture(texture_diffuse1, TexCoords).rgb;
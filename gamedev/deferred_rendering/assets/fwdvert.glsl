@@ -3,8 +3,13 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    mat4 inverseViewProjection;
+};
+
 uniform mat4 model;
 
 void main()
@@ -0,0 +1,28 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aModel; // Per instance, takes locations 3 to 6
+
+out vec3 FragPos;
+out vec2 TexCoords;
+out vec3 Normal;
+
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    mat4 inverseViewProjection;
+};
+
+void main()
+{
+    vec4 worldPos = aModel * vec4(aPos, 1.0);
+    FragPos = worldPos.xyz; 
+    TexCoords = aTexCoords;
+    
+    mat3 normalMatrix = transpose(inverse(mat3(aModel)));
+    Normal = normalMatrix * aNormal;
+
+    gl_Position = projection * view * worldPos;
+}
@@ -3,36 +3,86 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
+#ifdef COMPACT_GBUFFER
+uniform sampler2D gDepth;
+#else
 uniform sampler2D gPosition;
+#endif
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedoSpec;
 
-struct Light 
+layout (std140) uniform FrameData
 {
-    vec3 Position;
-    vec3 Color;
+    mat4 projection;
+    mat4 view;
+    mat4 inverseViewProjection;
 };
 
-const int MAX_LIGHTS = 32;
-uniform Light lights[MAX_LIGHTS];
-uniform int numLights;
+// Two texels per light, position and radius then color
+uniform samplerBuffer lightData;
+
+// An offset and count for each tile, then the light indices they point at
+uniform usamplerBuffer tileLights;
+uniform int tileSize;
+uniform int tilesX;
+
+#ifdef COMPACT_GBUFFER
+vec3 DecodeNormal(vec2 encoded)
+{
+    encoded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// Back out through the projection and view from this pixel and its depth
+vec3 WorldPosition(vec2 texCoords)
+{
+    float depth = texture(gDepth, texCoords).r;
+    vec4 world = inverseViewProjection * vec4(vec3(texCoords, depth) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+#endif
 
 void main()
 {
     // Retrieve data from g buffer
+#ifdef COMPACT_GBUFFER
+    vec3 FragPos = WorldPosition(TexCoords);
+    vec3 Normal = DecodeNormal(texture(gNormal, TexCoords).rg);
+#else
     vec3 FragPos = texture(gPosition, TexCoords).rgb;
     vec3 Normal = texture(gNormal, TexCoords).rgb;
+#endif
     vec3 Albedo = texture(gAlbedoSpec, TexCoords).rgb;
     float Specular = texture(gAlbedoSpec, TexCoords).a;
 
     // TODO: more sophisticated lighting models
     vec3 lighting = Albedo * 0.1; // Hard-coded for now
 
-    for (int i = 0; i < min(numLights, MAX_LIGHTS); ++i)
+    // Only the lights binned into this pixel's tile can reach it
+    ivec2 tile = ivec2(gl_FragCoord.xy) / tileSize;
+    int tileIndex = tile.y * tilesX + tile.x;
+    int offset = int(texelFetch(tileLights, tileIndex * 2).r);
+    int count = int(texelFetch(tileLights, tileIndex * 2 + 1).r);
+    for (int i = 0; i < count; ++i)
     {
+        int light = int(texelFetch(tileLights, offset + i).r);
+        vec4 positionRadius = texelFetch(lightData, light * 2);
+        vec3 color = texelFetch(lightData, light * 2 + 1).rgb;
+
+        // Falls off smoothly to nothing at the radius, so culling by it
+        // doesn't change the picture
+        vec3 lightDir = positionRadius.xyz - FragPos;
+        float dist = max(length(lightDir), 0.0001);
+        float window = clamp(1.0 - pow(dist / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (1.0 + dist * dist);
+
         // Diffuse
-        vec3 lightDir = lights[i].Position - FragPos;
-        vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Albedo * lights[i].Color;
+        vec3 diffuse = max(dot(Normal, lightDir / dist), 0.0) * Albedo * color * attenuation;
         lighting += diffuse;
     }
 
@@ -0,0 +1,70 @@
+#version 330 core
+out vec4 FragColor;
+
+flat in int Light;
+
+#ifdef COMPACT_GBUFFER
+uniform sampler2D gDepth;
+#else
+uniform sampler2D gPosition;
+#endif
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    mat4 inverseViewProjection;
+};
+
+// Two texels per light, position and radius then color
+uniform samplerBuffer lightData;
+
+#ifdef COMPACT_GBUFFER
+vec3 DecodeNormal(vec2 encoded)
+{
+    encoded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// Back out through the projection and view from this pixel and its depth
+vec3 WorldPosition(vec2 texCoords)
+{
+    float depth = texture(gDepth, texCoords).r;
+    vec4 world = inverseViewProjection * vec4(vec3(texCoords, depth) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+#endif
+
+void main()
+{
+    // Blended on top of the ambient pass, so this is just the one light
+#ifdef COMPACT_GBUFFER
+    vec2 TexCoords = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec3 FragPos = WorldPosition(TexCoords);
+    vec3 Normal = DecodeNormal(texture(gNormal, TexCoords).rg);
+#else
+    vec2 TexCoords = gl_FragCoord.xy / vec2(textureSize(gPosition, 0));
+    vec3 FragPos = texture(gPosition, TexCoords).rgb;
+    vec3 Normal = texture(gNormal, TexCoords).rgb;
+#endif
+    vec3 Albedo = texture(gAlbedoSpec, TexCoords).rgb;
+
+    vec4 positionRadius = texelFetch(lightData, Light * 2);
+    vec3 color = texelFetch(lightData, Light * 2 + 1).rgb;
+
+    // Same falloff as the tiled pass, nothing left of it at the radius
+    vec3 lightDir = positionRadius.xyz - FragPos;
+    float dist = max(length(lightDir), 0.0001);
+    float window = clamp(1.0 - pow(dist / positionRadius.w, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (1.0 + dist * dist);
+
+    vec3 diffuse = max(dot(Normal, lightDir / dist), 0.0) * Albedo * color * attenuation;
+    FragColor = vec4(diffuse, 0.0);
+}
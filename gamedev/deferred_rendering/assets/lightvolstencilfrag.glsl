@@ -0,0 +1,6 @@
+#version 330 core
+
+// Light volume front faces only mark the stencil, there's nothing to shade
+void main()
+{
+}
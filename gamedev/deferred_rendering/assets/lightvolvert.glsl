@@ -0,0 +1,23 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    mat4 inverseViewProjection;
+};
+
+// Two texels per light, position and radius then color
+uniform samplerBuffer lightData;
+uniform int light;
+
+flat out int Light;
+
+void main()
+{
+    // The unit sphere scaled out to the light's radius
+    vec4 positionRadius = texelFetch(lightData, light * 2);
+    Light = light;
+    gl_Position = projection * view * vec4(positionRadius.xyz + aPos * positionRadius.w, 1.0);
+}
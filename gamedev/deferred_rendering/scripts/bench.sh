@@ -0,0 +1,4 @@
+#!/usr/bin/bash
+
+# Headless, so this runs under Mesa without a display
+./build/defren-bench ./assets "$@"
@@ -4,6 +4,7 @@ if [[ -z "${BUILD_EMSCRIPTEN}" ]]; then
     rm -rf build
     mkdir build
     gcc -o build/defren src/main.c `sdl2-config --cflags --libs` -lGL -lm
+    gcc -o build/defren-bench src/bench.c -lEGL -lGL -lm
 else
     >&2 echo emscripten build not yet supported
     # rm -rf embuild
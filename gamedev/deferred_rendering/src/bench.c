@@ -0,0 +1,610 @@
+// Headless frame time benchmark. Renders offscreen through a surfaceless EGL
+// context, so it runs under Mesa's software rasterizer without a window.
+//
+// Usage: defren-bench [asset root] [frames]
+
+#define DR_HEADLESS
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <time.h>
+
+#include "common.h"
+
+// Every GL call the renderer makes in a frame is counted on its way through
+u32 g_GLCalls = 0;
+#define BENCH_COUNTED(call) (g_GLCalls++, call)
+#define glActiveTexture(...) BENCH_COUNTED(glActiveTexture(__VA_ARGS__))
+#define glBeginQuery(...) BENCH_COUNTED(glBeginQuery(__VA_ARGS__))
+#define glBindBuffer(...) BENCH_COUNTED(glBindBuffer(__VA_ARGS__))
+#define glBindBufferBase(...) BENCH_COUNTED(glBindBufferBase(__VA_ARGS__))
+#define glBindFramebuffer(...) BENCH_COUNTED(glBindFramebuffer(__VA_ARGS__))
+#define glBindTexture(...) BENCH_COUNTED(glBindTexture(__VA_ARGS__))
+#define glBindVertexArray(...) BENCH_COUNTED(glBindVertexArray(__VA_ARGS__))
+#define glBlendFunc(...) BENCH_COUNTED(glBlendFunc(__VA_ARGS__))
+#define glBlitFramebuffer(...) BENCH_COUNTED(glBlitFramebuffer(__VA_ARGS__))
+#define glBufferData(...) BENCH_COUNTED(glBufferData(__VA_ARGS__))
+#define glBufferSubData(...) BENCH_COUNTED(glBufferSubData(__VA_ARGS__))
+#define glClear(...) BENCH_COUNTED(glClear(__VA_ARGS__))
+#define glClearColor(...) BENCH_COUNTED(glClearColor(__VA_ARGS__))
+#define glColorMask(...) BENCH_COUNTED(glColorMask(__VA_ARGS__))
+#define glCullFace(...) BENCH_COUNTED(glCullFace(__VA_ARGS__))
+#define glDepthFunc(...) BENCH_COUNTED(glDepthFunc(__VA_ARGS__))
+#define glDepthMask(...) BENCH_COUNTED(glDepthMask(__VA_ARGS__))
+#define glDisable(...) BENCH_COUNTED(glDisable(__VA_ARGS__))
+#define glDrawArrays(...) BENCH_COUNTED(glDrawArrays(__VA_ARGS__))
+#define glDrawArraysInstanced(...) BENCH_COUNTED(glDrawArraysInstanced(__VA_ARGS__))
+#define glDrawBuffers(...) BENCH_COUNTED(glDrawBuffers(__VA_ARGS__))
+#define glDrawElements(...) BENCH_COUNTED(glDrawElements(__VA_ARGS__))
+#define glEnable(...) BENCH_COUNTED(glEnable(__VA_ARGS__))
+#define glEndQuery(...) BENCH_COUNTED(glEndQuery(__VA_ARGS__))
+#define glGetUniformLocation(...) BENCH_COUNTED(glGetUniformLocation(__VA_ARGS__))
+#define glMapBufferRange(...) BENCH_COUNTED(glMapBufferRange(__VA_ARGS__))
+#define glStencilFunc(...) BENCH_COUNTED(glStencilFunc(__VA_ARGS__))
+#define glStencilOp(...) BENCH_COUNTED(glStencilOp(__VA_ARGS__))
+#define glStencilOpSeparate(...) BENCH_COUNTED(glStencilOpSeparate(__VA_ARGS__))
+#define glUniform1i(...) BENCH_COUNTED(glUniform1i(__VA_ARGS__))
+#define glUniform3fv(...) BENCH_COUNTED(glUniform3fv(__VA_ARGS__))
+#define glUniformMatrix4fv(...) BENCH_COUNTED(glUniformMatrix4fv(__VA_ARGS__))
+#define glUnmapBuffer(...) BENCH_COUNTED(glUnmapBuffer(__VA_ARGS__))
+#define glUseProgram(...) BENCH_COUNTED(glUseProgram(__VA_ARGS__))
+
+#include "math.c"
+#include "render.c"
+
+// The wall the lights are spread through
+#define BENCH_CUBES_X 24
+#define BENCH_CUBES_Y 18
+#define BENCH_CUBE_SPACING 0.36f
+#define BENCH_CUBE_DEPTH 8.0f
+
+// Roughly fills the view at the wall's depth
+#define BENCH_VIEW_WIDTH 8.6f
+
+#define BENCH_LIGHT_RADIUS 0.9f
+#define BENCH_WARMUP_FRAMES 2
+
+// Two ways of drawing the same frame can differ by rounding, no more
+#define BENCH_MAX_PIXEL_DIFFERENCE 2
+
+// The full size g buffer keeps position as half floats, which are off by
+// up to 1/128 this far out. Rebuilding it from 24-bit depth is closer.
+#define BENCH_MAX_GBUFFER_DIFFERENCE 8
+
+typedef enum
+{
+    BENCH_LIGHTING_TILED,
+    BENCH_LIGHTING_BRUTE_FORCE,
+    BENCH_LIGHTING_VOLUMES
+} BenchLighting_t;
+
+typedef struct
+{
+    Matrix44f* pTransforms;
+    u32 Count;
+    bool Instanced;
+} BenchCubes_t;
+
+RenderContext_t g_RenderContext;
+
+bool Bench_CreateContext()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC pGetPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = pGetPlatformDisplay
+        ? pGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL)
+        : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        fprintf(stderr, "Failed to initialize EGL: 0x%x\n", eglGetError());
+        return false;
+    }
+
+    const EGLint ConfigAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    eglChooseConfig(display, ConfigAttributes, &config, 1, &configCount);
+
+    const EGLint ContextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglBindAPI(EGL_OPENGL_API);
+    EGLContext context = eglCreateContext(
+        display,
+        configCount > 0 ? config : EGL_NO_CONFIG_KHR,
+        EGL_NO_CONTEXT,
+        ContextAttributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        fprintf(stderr, "Failed to create GL 3.3 context: 0x%x\n", eglGetError());
+        return false;
+    }
+
+    fprintf(stdout, "%s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+}
+
+// There's no window to draw to, so the lighting pass goes here instead
+u32 Bench_CreateOutput(u32 width, u32 height)
+{
+    u32 framebuffer, colorBuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    return framebuffer;
+}
+
+void Bench_DestroyOutput(u32 framebuffer)
+{
+    s32 colorBuffer = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER,
+        GL_COLOR_ATTACHMENT0,
+        GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME,
+        &colorBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    const u32 ColorBuffer = colorBuffer;
+    glDeleteRenderbuffers(1, &ColorBuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+// Renderer from scratch for a new size or g buffer layout, looking at the
+// same scene
+bool Bench_StartRenderer(char* pAssetRoot, RenderSettings_t* pSettings)
+{
+    if (g_RenderContext.GBuffer)
+    {
+        Bench_DestroyOutput(g_RenderContext.OutputFramebuffer);
+        DR_Shutdown(&g_RenderContext);
+    }
+
+    if (!DR_Initialize(&g_RenderContext, pAssetRoot, pSettings))
+    {
+        fprintf(stderr, "Failed to initialize renderer\n");
+        return false;
+    }
+
+    Matrix44f projectionMatrix;
+    Matrix44f viewMatrix;
+    Math_Matrix44f_Perspective(
+        &projectionMatrix,
+        Math_ToRadians(45.0f),
+        (float)pSettings->Width / (float)pSettings->Height, 0.1f,
+        100.0f);
+
+    Vector3f cameraPosition = { 0.f, 0.f,  0.f };
+    Vector3f cameraLook     = { 0.f, 0.f, -1.f };
+    Vector3f cameraUp       = { 0.f, 1.f,  0.f };
+    Math_Matrix44f_LookAt(&cameraPosition, &cameraLook, &cameraUp, &viewMatrix);
+
+    DR_SetProjection(&g_RenderContext, &projectionMatrix);
+    DR_SetView(&g_RenderContext, &viewMatrix);
+    DR_SetOutputFramebuffer(&g_RenderContext, Bench_CreateOutput(pSettings->Width, pSettings->Height));
+    return true;
+}
+
+double Bench_Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+float Bench_Random(float min, float max)
+{
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+// A wall of cubes at the same depth, centered in the view
+bool Bench_CreateCubes(BenchCubes_t* pCubes, u32 countX, u32 countY, float spacing)
+{
+    pCubes->Count = countX * countY;
+    pCubes->Instanced = true;
+    pCubes->pTransforms = malloc(pCubes->Count * sizeof(Matrix44f));
+    if (!pCubes->pTransforms)
+    {
+        fprintf(stderr, "Failed to allocate %u cube transforms\n", pCubes->Count);
+        return false;
+    }
+
+    Vector3f scale = { spacing * 0.42f, spacing * 0.42f, spacing * 0.42f };
+    for (u32 y = 0; y < countY; ++y)
+    {
+        for (u32 x = 0; x < countX; ++x)
+        {
+            Vector3f position = {
+                ((float)x - (countX - 1) * 0.5f) * spacing,
+                ((float)y - (countY - 1) * 0.5f) * spacing,
+                BENCH_CUBE_DEPTH
+            };
+            Matrix44f* pTransform = &pCubes->pTransforms[y * countX + x];
+            Math_Matrix44f_Identity(pTransform);
+            Math_Matrix44f_Translate(pTransform, &position);
+            Math_Matrix44f_Scale(pTransform, &scale);
+        }
+    }
+
+    return true;
+}
+
+// Same lights for the same count, spread across the wall of cubes between
+// the two depths
+void Bench_CreateLightsAt(u32 count, float minDepth, float maxDepth)
+{
+    DR_ClearPointLights(&g_RenderContext);
+    srand(count);
+
+    const float HalfWidth = BENCH_CUBES_X * BENCH_CUBE_SPACING * 0.5f;
+    const float HalfHeight = BENCH_CUBES_Y * BENCH_CUBE_SPACING * 0.5f;
+    for (u32 i = 0; i < count; ++i)
+    {
+        PointLight_t light = {
+            .Position = {
+                Bench_Random(-HalfWidth, HalfWidth),
+                Bench_Random(-HalfHeight, HalfHeight),
+                Bench_Random(minDepth, maxDepth)
+            },
+            .Color = { Bench_Random(0.2f, 1.f), Bench_Random(0.2f, 1.f), Bench_Random(0.2f, 1.f) },
+            .Radius = BENCH_LIGHT_RADIUS
+        };
+        DR_CreatePointLight(&g_RenderContext, &light);
+    }
+}
+
+// Just in front of the wall, so every light reaches it
+void Bench_CreateLights(u32 count)
+{
+    Bench_CreateLightsAt(count, BENCH_CUBE_DEPTH - 1.0f, BENCH_CUBE_DEPTH - 0.25f);
+}
+
+// GL calls the last frame took, and the time to make them before waiting
+// for the GPU to finish
+u32 Bench_RenderFrame(const BenchCubes_t* pCubes, double* pSubmitSeconds)
+{
+    g_GLCalls = 0;
+    const double Start = Bench_Now();
+    DR_BeginFrame(&g_RenderContext);
+
+    if (pCubes->Instanced)
+    {
+        DR_RenderCubesInstanced(&g_RenderContext, pCubes->pTransforms, pCubes->Count);
+    }
+    else
+    {
+        for (u32 i = 0; i < pCubes->Count; ++i)
+        {
+            DR_SetShaderParameterMat4(g_RenderContext.GeometryProgram, "model", &pCubes->pTransforms[i]);
+            DR_RenderCube(&g_RenderContext);
+        }
+    }
+
+    DR_EndFrame(&g_RenderContext);
+    const u32 Calls = g_GLCalls;
+    *pSubmitSeconds += Bench_Now() - Start;
+    glFinish();
+    return Calls;
+}
+
+void Bench_SetLighting(BenchLighting_t lighting)
+{
+    DR_SetLightCulling(&g_RenderContext, lighting != BENCH_LIGHTING_BRUTE_FORCE);
+    DR_SetLightVolumes(&g_RenderContext, lighting == BENCH_LIGHTING_VOLUMES);
+}
+
+// Pixels shaded for a light in one more frame, drawn outside any timing.
+// Light volumes count them with occlusion queries, which only that frame
+// pays for. The full screen pass shades one for every light in each pixel's
+// tile.
+uint64_t Bench_GetLightSamples(const BenchCubes_t* pCubes, BenchLighting_t lighting)
+{
+    double submitSeconds = 0.0;
+    DR_SetLightSampleCounting(&g_RenderContext, true);
+    Bench_RenderFrame(pCubes, &submitSeconds);
+    DR_SetLightSampleCounting(&g_RenderContext, false);
+    if (lighting == BENCH_LIGHTING_VOLUMES)
+    {
+        return DR_GetLightVolumeSamples(&g_RenderContext);
+    }
+
+    const uint64_t Pixels = (uint64_t)g_RenderContext.Settings.Width * g_RenderContext.Settings.Height;
+    return Pixels * g_RenderContext.TileLightTotal / (lighting == BENCH_LIGHTING_TILED ? g_RenderContext.TileCount : 1);
+}
+
+// Mean milliseconds per frame, with the GPU finished each time
+double Bench_Run(const char* pLabel, const BenchCubes_t* pCubes, u32 lightCount, BenchLighting_t lighting, u32 frames)
+{
+    Bench_CreateLights(lightCount);
+    Bench_SetLighting(lighting);
+    double submitSeconds = 0.0;
+    for (u32 i = 0; i < BENCH_WARMUP_FRAMES; ++i)
+    {
+        Bench_RenderFrame(pCubes, &submitSeconds);
+    }
+
+    u32 calls = 0;
+    submitSeconds = 0.0;
+    const double Start = Bench_Now();
+    for (u32 i = 0; i < frames; ++i)
+    {
+        calls = Bench_RenderFrame(pCubes, &submitSeconds);
+    }
+    const double Ms = (Bench_Now() - Start) * 1000.0 / frames;
+    const double Pixels = (double)g_RenderContext.Settings.Width * g_RenderContext.Settings.Height;
+    const uint64_t Samples = Bench_GetLightSamples(pCubes, lighting);
+
+    fprintf(
+        stdout,
+        "%-12s %6u cubes %5u lights: %9.2f ms/frame  %7.3f ms submit  %7.1f lights/pixel  %8.2fM light samples"
+        "  %6u GL calls\n",
+        pLabel,
+        pCubes->Count,
+        lightCount,
+        Ms,
+        submitSeconds * 1000.0 / frames,
+        Samples / Pixels,
+        Samples / 1e6,
+        calls);
+    return Ms;
+}
+
+void Bench_CaptureFrame(const BenchCubes_t* pCubes, uint8_t* pPixels)
+{
+    double submitSeconds = 0.0;
+    Bench_RenderFrame(pCubes, &submitSeconds);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_RenderContext.OutputFramebuffer);
+    glReadPixels(
+        0, 0,
+        g_RenderContext.Settings.Width, g_RenderContext.Settings.Height,
+        GL_RGBA, GL_UNSIGNED_BYTE,
+        pPixels);
+}
+
+bool Bench_CompareFrames(
+    const uint8_t* pReference,
+    const uint8_t* pFrame,
+    u32 size,
+    u32 maxDifference,
+    u32 lightCount,
+    const char* pCheck)
+{
+    u32 lit = 0;
+    u32 worst = 0;
+    for (u32 i = 0; i < size; ++i)
+    {
+        const u32 Difference = abs((s32)pFrame[i] - (s32)pReference[i]);
+        worst = Difference > worst ? Difference : worst;
+        lit += pReference[i] > 0 && i % 4 != 3;
+    }
+
+    const bool Valid = worst <= maxDifference && lit > 0;
+    fprintf(
+        Valid ? stdout : stderr,
+        "%u lights, %s %s: worst difference %u, %u lit channels\n",
+        lightCount,
+        pCheck,
+        Valid ? "matches" : "doesn't match",
+        worst,
+        lit);
+    return Valid;
+}
+
+// Culling and instancing mustn't change the picture, only how long it takes
+bool Bench_CheckSameFrames(BenchCubes_t* pCubes, u32 lightCount)
+{
+    const u32 Size = g_RenderContext.Settings.Width * g_RenderContext.Settings.Height * 4;
+    uint8_t* pReference = malloc(Size);
+    uint8_t* pFrame = malloc(Size);
+    if (!pReference || !pFrame)
+    {
+        free(pReference);
+        free(pFrame);
+        return false;
+    }
+
+    // Brute force lighting, then culled, then culled with instancing, then
+    // light volumes
+    Bench_CreateLights(lightCount);
+    Bench_SetLighting(BENCH_LIGHTING_BRUTE_FORCE);
+    pCubes->Instanced = false;
+    Bench_CaptureFrame(pCubes, pReference);
+
+    const char* pChecks[] = { "culled lighting", "instanced cubes", "light volumes" };
+    bool valid = true;
+    for (u32 check = 0; check < 3 && valid; ++check)
+    {
+        Bench_SetLighting(check == 2 ? BENCH_LIGHTING_VOLUMES : BENCH_LIGHTING_TILED);
+        pCubes->Instanced = check >= 1;
+        Bench_CaptureFrame(pCubes, pFrame);
+        valid = Bench_CompareFrames(pReference, pFrame, Size, BENCH_MAX_PIXEL_DIFFERENCE, lightCount, pChecks[check]);
+    }
+
+    free(pReference);
+    free(pFrame);
+    return valid;
+}
+
+// Lights far enough behind the wall that nothing is inside their spheres.
+// Their back faces are still behind the cubes, so only the stencil pass
+// from the front faces keeps the light volumes from shading anything.
+bool Bench_CheckHiddenLights(const BenchCubes_t* pCubes, u32 lightCount)
+{
+    Bench_CreateLightsAt(lightCount, BENCH_CUBE_DEPTH + 1.25f, BENCH_CUBE_DEPTH + 2.0f);
+    Bench_SetLighting(BENCH_LIGHTING_VOLUMES);
+    const uint64_t Samples = Bench_GetLightSamples(pCubes, BENCH_LIGHTING_VOLUMES);
+    Bench_SetLighting(BENCH_LIGHTING_TILED);
+
+    fprintf(
+        Samples == 0 ? stdout : stderr,
+        "%u lights behind the wall %s: %lu light volume samples\n",
+        lightCount,
+        Samples == 0 ? "skipped" : "were shaded",
+        Samples);
+    return Samples == 0;
+}
+
+// Position from depth and packed normals should light the same as the
+// full size g buffer, near enough. Leaves the compact renderer running.
+bool Bench_CheckCompactGBuffer(char* pAssetRoot, RenderSettings_t* pSettings, BenchCubes_t* pCubes, u32 lightCount)
+{
+    const u32 Size = pSettings->Width * pSettings->Height * 4;
+    uint8_t* pReference = malloc(Size);
+    uint8_t* pFrame = malloc(Size);
+    RenderSettings_t settings = *pSettings;
+    bool valid = pReference && pFrame;
+
+    pCubes->Instanced = true;
+    settings.CompactGBuffer = false;
+    if (valid && (valid = Bench_StartRenderer(pAssetRoot, &settings)))
+    {
+        Bench_CreateLights(lightCount);
+        Bench_CaptureFrame(pCubes, pReference);
+    }
+
+    settings.CompactGBuffer = true;
+    if (valid && (valid = Bench_StartRenderer(pAssetRoot, &settings)))
+    {
+        Bench_CreateLights(lightCount);
+        Bench_CaptureFrame(pCubes, pFrame);
+        valid = Bench_CompareFrames(
+            pReference,
+            pFrame,
+            Size,
+            BENCH_MAX_GBUFFER_DIFFERENCE,
+            lightCount,
+            "compact g buffer");
+    }
+
+    if (valid)
+    {
+        Bench_SetLighting(BENCH_LIGHTING_VOLUMES);
+        Bench_CaptureFrame(pCubes, pReference);
+        valid = Bench_CompareFrames(
+            pFrame,
+            pReference,
+            Size,
+            BENCH_MAX_PIXEL_DIFFERENCE,
+            lightCount,
+            "compact light volumes");
+        Bench_SetLighting(BENCH_LIGHTING_TILED);
+    }
+
+    free(pReference);
+    free(pFrame);
+    return valid;
+}
+
+int main(int argc, char** argv)
+{
+    char* pAssetRoot = argc > 1 ? argv[1] : ".";
+    const u32 Frames = argc > 2 ? atoi(argv[2]) : 10;
+    if (!Bench_CreateContext())
+    {
+        return -1;
+    }
+
+    RenderSettings_t settings = {
+        .Width = SCREEN_WIDTH,
+        .Height = SCREEN_HEIGHT
+    };
+    if (!Bench_StartRenderer(pAssetRoot, &settings))
+    {
+        return -1;
+    }
+
+    BenchCubes_t wall;
+    if (!Bench_CreateCubes(&wall, BENCH_CUBES_X, BENCH_CUBES_Y, BENCH_CUBE_SPACING) ||
+        !Bench_CheckSameFrames(&wall, 256) ||
+        !Bench_CheckHiddenLights(&wall, 256))
+    {
+        return 1;
+    }
+
+    fprintf(stdout, "%dx%d, %u frames\n", SCREEN_WIDTH, SCREEN_HEIGHT, Frames);
+    wall.Instanced = true;
+    const u32 LightCounts[] = { 32, 256, 1024, 4096 };
+    for (u32 i = 0; i < sizeof(LightCounts) / sizeof(LightCounts[0]); ++i)
+    {
+        Bench_Run("tiled", &wall, LightCounts[i], BENCH_LIGHTING_TILED, Frames);
+    }
+
+    // Only what each light's sphere covers gets shaded
+    for (u32 i = 0; i < sizeof(LightCounts) / sizeof(LightCounts[0]); ++i)
+    {
+        Bench_Run("volumes", &wall, LightCounts[i], BENCH_LIGHTING_VOLUMES, Frames);
+    }
+
+    // Every light for every pixel is too slow to bother with past this
+    for (u32 i = 0; i < 3; ++i)
+    {
+        Bench_Run("brute force", &wall, LightCounts[i], BENCH_LIGHTING_BRUTE_FORCE, Frames);
+    }
+
+    // A draw call per cube against all of them in one
+    const u32 CubeRows[] = { 80, 250 };
+    for (u32 i = 0; i < sizeof(CubeRows) / sizeof(CubeRows[0]); ++i)
+    {
+        const u32 Columns = CubeRows[i] * 8 / 5;
+        BenchCubes_t cubes;
+        if (!Bench_CreateCubes(&cubes, Columns, CubeRows[i], BENCH_VIEW_WIDTH / Columns))
+        {
+            return 1;
+        }
+
+        cubes.Instanced = false;
+        Bench_Run("per cube", &cubes, 32, BENCH_LIGHTING_TILED, Frames);
+        cubes.Instanced = true;
+        Bench_Run("instanced", &cubes, 32, BENCH_LIGHTING_TILED, Frames);
+        free(cubes.pTransforms);
+    }
+
+    // Full size against compact g buffer, where the bandwidth it saves
+    // starts to matter
+    if (!Bench_CheckCompactGBuffer(pAssetRoot, &settings, &wall, 256))
+    {
+        return 1;
+    }
+
+    const u32 Resolutions[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    for (u32 i = 0; i < sizeof(Resolutions) / sizeof(Resolutions[0]); ++i)
+    {
+        settings.Width = Resolutions[i][0];
+        settings.Height = Resolutions[i][1];
+        for (u32 compact = 0; compact < 2; ++compact)
+        {
+            settings.CompactGBuffer = compact;
+            if (!Bench_StartRenderer(pAssetRoot, &settings))
+            {
+                return 1;
+            }
+
+            const u32 BytesPerPixel = DR_GetGBufferBytesPerPixel(&g_RenderContext);
+            fprintf(
+                stdout,
+                "%ux%u %s g buffer: %u bytes/pixel, %.1f MB\n",
+                settings.Width,
+                settings.Height,
+                compact ? "compact" : "full",
+                BytesPerPixel,
+                (double)BytesPerPixel * settings.Width * settings.Height / (1024.0 * 1024.0));
+            Bench_Run(compact ? "compact" : "full", &wall, 256, BENCH_LIGHTING_TILED, Frames);
+        }
+    }
+
+    free(wall.pTransforms);
+    return 0;
+}
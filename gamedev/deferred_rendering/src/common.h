@@ -21,8 +21,11 @@ typedef int32_t  s32;
 #include <GL/gl.h>
 #include <GL/glext.h>
 
+// The headless benchmark brings its own EGL context instead of a window
+#ifndef DR_HEADLESS
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#endif
 
 #define SCREEN_WIDTH 640
 #define SCREEN_HEIGHT 480
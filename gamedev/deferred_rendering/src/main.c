@@ -29,19 +29,17 @@ void mainloop()
 
     DR_BeginFrame(&g_RenderContext);
 
-    // Draw the cube
-    Matrix44f modelMatrix;
-
-    const u32 NumCubes = sizeof(g_CubePositions) / sizeof(g_CubePositions[0]);
+    // Draw the cubes, all in one go
+    Matrix44f modelMatrices[sizeof(g_CubePositions) / sizeof(g_CubePositions[0])];
+    const u32 NumCubes = sizeof(modelMatrices) / sizeof(modelMatrices[0]);
     Vector3f scale = { 0.25, 0.25, 0.25 };
     for (u32 i = 0; i < NumCubes; ++i)
     {
-        Math_Matrix44f_Identity(&modelMatrix);
-        Math_Matrix44f_Translate(&modelMatrix, &g_CubePositions[i]);
-        Math_Matrix44f_Scale(&modelMatrix, &scale);
-        DR_SetShaderParameterMat4(g_RenderContext.GeometryProgram, "model", &modelMatrix);
-        DR_RenderCube(&g_RenderContext);
+        Math_Matrix44f_Identity(&modelMatrices[i]);
+        Math_Matrix44f_Translate(&modelMatrices[i], &g_CubePositions[i]);
+        Math_Matrix44f_Scale(&modelMatrices[i], &scale);
     }
+    DR_RenderCubesInstanced(&g_RenderContext, modelMatrices, NumCubes);
 
     DR_EndFrame(&g_RenderContext);
 
@@ -73,7 +71,11 @@ int main(int argc, char** argv)
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GLContext GLContext = SDL_GL_CreateContext(g_pWindow);
     char* pAssetRoot = argc > 1 ? argv[1] : ".";
-    if (!DR_Initialize(&g_RenderContext, pAssetRoot))
+    RenderSettings_t settings = {
+        .Width = SCREEN_WIDTH,
+        .Height = SCREEN_HEIGHT
+    };
+    if (!DR_Initialize(&g_RenderContext, pAssetRoot, &settings))
     {
         fprintf(stderr, "Failed to initialize renderer\n");
         return -1;
@@ -103,7 +105,8 @@ int main(int argc, char** argv)
     // Lighting -- one light behind the camera
     PointLight_t pointLight = {
         .Position = { 0.f, 0.f, 4.0f },
-        .Color = { 1.0f, 1.0f, 1.0f }
+        .Color = { 1.0f, 1.0f, 1.0f },
+        .Radius = 10.0f
     };
     DR_CreatePointLight(&g_RenderContext, &pointLight);
 
@@ -10,42 +10,168 @@ typedef u32 HPOINTLIGHT;
 
 #define BUFFER_VERT_SHADER_PATH "vert.glsl"
 #define BUFFER_FRAG_SHADER_PATH "frag.glsl"
+#define INSTANCED_VERT_SHADER_PATH "instvert.glsl"
 
 #define LIGHT_VERT_SHADER_PATH "lightvert.glsl"
 #define LIGHT_FRAG_SHADER_PATH "lightfrag.glsl"
+#define LIGHT_VOLUME_VERT_SHADER_PATH "lightvolvert.glsl"
+#define LIGHT_VOLUME_FRAG_SHADER_PATH "lightvolfrag.glsl"
+#define LIGHT_VOLUME_STENCIL_FRAG_SHADER_PATH "lightvolstencilfrag.glsl"
 
 #define FWD_VERT_SHADER_PATH "fwdvert.glsl"
 #define FWD_FRAG_SHADER_PATH "fwdfrag.glsl"
 
-#define MAX_POINT_LIGHTS 32
+#define MAX_POINT_LIGHTS 4096
+
+// Lights are binned into screen tiles this many pixels square, the lighting
+// pass only looks at the lights in its own tile
+#define LIGHT_TILE_SIZE 16
+
+// Position and radius, then color, as two RGBA32F texels per light
+#define LIGHT_DATA_FLOATS 8
+
+#define LIGHT_DATA_TEXTURE_UNIT 3
+#define TILE_LIGHTS_TEXTURE_UNIT 4
+
+// Light volumes are spheres cut into this many slices around and stacks
+// from pole to pole
+#define LIGHT_VOLUME_SLICES 16
+#define LIGHT_VOLUME_STACKS 12
+
+// Left in the stencil wherever the geometry pass drew something, then one
+// up where a light volume's front faces are in front of the surface
+#define GEOMETRY_STENCIL_VALUE 1
+#define LIGHT_VOLUME_STENCIL_VALUE 2
+
+// First of the four vec4 attributes an instance's model matrix takes up
+#define INSTANCE_MODEL_ATTRIBUTE 3
+
+// Uniform block binding the FrameData block in the shaders is pointed at
+#define FRAME_DATA_BINDING 0
+
+#define MAX_SHADERS 8
+#define MAX_SHADER_UNIFORMS 32
+#define MAX_UNIFORM_NAME 64
+
+// Defined in the geometry and lighting shaders for the compact g buffer
+#define COMPACT_GBUFFER_DEFINE "COMPACT_GBUFFER"
+
+typedef struct
+{
+    u32 Width;
+    u32 Height;
+
+    // Depth, octahedron encoded normals and albedo/specular only. Position is
+    // rebuilt from depth in the lighting pass instead of getting a target.
+    bool CompactGBuffer;
+} RenderSettings_t;
 
 typedef struct
 {
     Vector3f Position;
     Vector3f Color;
+    float Radius; // Falls off to nothing here
 } PointLight_t;
 
+// Matches the std140 FrameData block, everything per frame the shaders share
+typedef struct
+{
+    Matrix44f Projection;
+    Matrix44f View;
+    Matrix44f InverseViewProjection;
+} FrameData_t;
+
+// Uniform locations for a shader, looked up once when it's created so
+// setting a parameter doesn't go through the driver every time
+typedef struct
+{
+    char Name[MAX_UNIFORM_NAME];
+    s32 Location;
+} ShaderUniform_t;
+
+typedef struct
+{
+    HSHADER Shader;
+    u32 UniformCount;
+    ShaderUniform_t Uniforms[MAX_SHADER_UNIFORMS];
+} ShaderUniforms_t;
+
+ShaderUniforms_t g_ShaderUniforms[MAX_SHADERS];
+u32 g_ShaderCount = 0;
+
+// Inclusive tile range a light touches, empty when MinX > MaxX
+typedef struct
+{
+    s32 MinX, MinY;
+    s32 MaxX, MaxY;
+} LightTileBounds_t;
+
 typedef struct {
+    RenderSettings_t Settings;
+
     u32 GBuffer;
-    u32 PositionBuffer;
+    u32 PositionBuffer; // 0 with a compact g buffer
     u32 NormalBuffer;
     u32 AlbedoSpecBuffer;
+    u32 DepthBuffer;
 
     HSHADER GeometryProgram;
+    HSHADER GeometryInstancedProgram;
     HSHADER LightProgram;
+    HSHADER LightVolumeProgram;
+    HSHADER LightVolumeStencilProgram;
     HSHADER ForwardProgram;
 
     Matrix44f Projection;
     Matrix44f View;
+    u32 FrameDataBuffer;
 
     PointLight_t PointLights[MAX_POINT_LIGHTS];
     u32 PointLightCount;
 
+    // Tiled light culling. The tile light buffer holds an offset and count
+    // for each tile, followed by the light indices they point at.
+    bool LightCulling;
+    u32 LightDataBuffer;
+    u32 LightDataTexture;
+    u32 TileLightBuffer;
+    u32 TileLightTexture;
+    s32 MaxTextureBufferSize;
+    float LightData[MAX_POINT_LIGHTS * LIGHT_DATA_FLOATS];
+    LightTileBounds_t LightTileBounds[MAX_POINT_LIGHTS];
+    u32 TilesX;
+    u32 TilesY;
+    u32 TileCount;
+    u32* pTileLightCounts;
+    u32* pTileLightData;
+    u32 TileLightCapacity;
+    u32 TileLightTotal; // Light indices binned last frame
+
+    // Light volumes. Every light is a sphere its radius across, blended into
+    // a lighting target of its own after an ambient only pass. That target
+    // gets a copy of the g buffer's depth and stencil to test the spheres
+    // against, since the g buffer's own is still being read.
+    bool LightVolumes;
+    u32 LightBuffer;
+    u32 LightAccumBuffer;
+    u32 LightDepthStencilBuffer;
+    u32 LightVolumeVAO;
+    u32 LightVolumeVBO;
+    u32 LightVolumeEBO;
+    u32 LightVolumeIndexCount;
+    bool CountLightSamples; // Queries cost two calls a light, off unless asked for
+    u32 LightSamplesQueries[MAX_POINT_LIGHTS]; // One per light shaded
+    u32 LightSamplesQueryCount;
+
     u32 ScreenQuadVAO;
     u32 ScreenQuadVBO;
 
     u32 CubeVAO;
     u32 CubeVBO;
+    u32 CubeInstancedVAO;
+    u32 InstanceVBO;
+
+    u32 OutputFramebuffer; // 0 for the window
 } RenderContext_t;
 
 // DR = Deferred Renderer
@@ -102,6 +228,347 @@ bool _DR_ReadText(char* pAssetRoot, const char* pFilePath, char* pText, u32 maxL
     return true;
 }
 
+// Adds a #define on the line after #version, which has to stay first
+bool _DR_AddShaderDefine(char* pText, u32 maxLen, const char* pDefine)
+{
+    char defineLine[128];
+    const u32 DefineLength = snprintf(defineLine, sizeof(defineLine), "#define %s\n", pDefine);
+    char* pVersionEnd = strchr(pText, '\n');
+    if (!pVersionEnd || DefineLength >= sizeof(defineLine) || strlen(pText) + DefineLength >= maxLen)
+    {
+        fprintf(stderr, "Cannot add %s to shader: no room\n", pDefine);
+        return false;
+    }
+
+    char* pInsert = pVersionEnd + 1;
+    memmove(pInsert + DefineLength, pInsert, strlen(pInsert) + 1);
+    memcpy(pInsert, defineLine, DefineLength);
+    return true;
+}
+
+// Tiles a light's sphere covers, from the lines through the eye that just
+// touch it. Anything reaching the near plane gets the whole screen.
+LightTileBounds_t _DR_GetLightTileBounds(RenderContext_t* pContext, PointLight_t* pLight, float near)
+{
+    LightTileBounds_t bounds = { 0, 0, pContext->TilesX - 1, pContext->TilesY - 1 };
+    const LightTileBounds_t Empty = { 1, 1, 0, 0 };
+
+    Vector3f viewPosition;
+    Math_Matrix44f_TransformPoint(&pContext->View, &pLight->Position, &viewPosition);
+    const float Depth = -viewPosition.z;
+    const float Radius = pLight->Radius;
+    if (Radius <= 0.f || Depth + Radius < near)
+    {
+        return Empty;
+    }
+
+    if (Depth - Radius < near)
+    {
+        return bounds;
+    }
+
+    const float Scale[2] = { pContext->Projection.m[0][0], pContext->Projection.m[1][1] };
+    const float Offset[2] = { viewPosition.x, viewPosition.y };
+    const s32 TileCount[2] = { pContext->TilesX, pContext->TilesY };
+    const s32 Pixels[2] = { pContext->Settings.Width, pContext->Settings.Height };
+    s32 tileMin[2];
+    s32 tileMax[2];
+    for (u32 axis = 0; axis < 2; ++axis)
+    {
+        const float A = Offset[axis];
+        const float T = sqrtf(A * A + Depth * Depth - Radius * Radius);
+        const float First = Scale[axis] * (T * A - Radius * Depth) / (T * Depth + Radius * A);
+        const float Second = Scale[axis] * (T * A + Radius * Depth) / (T * Depth - Radius * A);
+        const float Min = fminf(First, Second);
+        const float Max = fmaxf(First, Second);
+        if (Max < -1.f || Min > 1.f)
+        {
+            return Empty;
+        }
+
+        tileMin[axis] = (s32)((Min * 0.5f + 0.5f) * Pixels[axis]) / LIGHT_TILE_SIZE;
+        tileMax[axis] = (s32)((Max * 0.5f + 0.5f) * Pixels[axis]) / LIGHT_TILE_SIZE;
+        tileMin[axis] = tileMin[axis] < 0 ? 0 : tileMin[axis];
+        tileMax[axis] = tileMax[axis] >= TileCount[axis] ? TileCount[axis] - 1 : tileMax[axis];
+    }
+
+    bounds.MinX = tileMin[0];
+    bounds.MinY = tileMin[1];
+    bounds.MaxX = tileMax[0];
+    bounds.MaxY = tileMax[1];
+    return bounds;
+}
+
+bool _DR_ReserveTileLights(RenderContext_t* pContext, u32 count)
+{
+    if (count <= pContext->TileLightCapacity)
+    {
+        return true;
+    }
+
+    const u32 Capacity = count * 2;
+    u32* pData = realloc(pContext->pTileLightData, Capacity * sizeof(u32));
+    if (!pData)
+    {
+        fprintf(stderr, "Failed to grow tile light list to %u entries\n", Capacity);
+        return false;
+    }
+
+    pContext->pTileLightData = pData;
+    pContext->TileLightCapacity = Capacity;
+    return true;
+}
+
+// Bins every light into the tiles it touches, two passes so the lists pack
+// together without a cap per tile
+bool _DR_CullLights(RenderContext_t* pContext)
+{
+    const u32 HeaderSize = pContext->TileCount * 2;
+    const u32 LightCount = pContext->PointLightCount;
+    u32* pCounts = pContext->pTileLightCounts;
+
+    u32 total = 0;
+    if (!pContext->LightCulling)
+    {
+        total = LightCount;
+        if (!_DR_ReserveTileLights(pContext, HeaderSize + total))
+        {
+            return false;
+        }
+
+        // Every tile shares the one list of every light
+        for (u32 tile = 0; tile < pContext->TileCount; ++tile)
+        {
+            pContext->pTileLightData[tile * 2] = HeaderSize;
+            pContext->pTileLightData[tile * 2 + 1] = LightCount;
+        }
+
+        for (u32 i = 0; i < LightCount; ++i)
+        {
+            pContext->pTileLightData[HeaderSize + i] = i;
+        }
+
+        pContext->TileLightTotal = total;
+        return true;
+    }
+
+    const Matrix44f* pProj = &pContext->Projection;
+    const float Near = pProj->m[3][2] / (pProj->m[2][2] - 1.f);
+    memset(pCounts, 0, pContext->TileCount * sizeof(u32));
+    for (u32 i = 0; i < LightCount; ++i)
+    {
+        const LightTileBounds_t Bounds = _DR_GetLightTileBounds(pContext, &pContext->PointLights[i], Near);
+        pContext->LightTileBounds[i] = Bounds;
+        for (s32 y = Bounds.MinY; y <= Bounds.MaxY; ++y)
+        {
+            for (s32 x = Bounds.MinX; x <= Bounds.MaxX; ++x)
+            {
+                pCounts[y * pContext->TilesX + x]++;
+            }
+        }
+    }
+
+    for (u32 tile = 0; tile < pContext->TileCount; ++tile)
+    {
+        total += pCounts[tile];
+    }
+
+    if (!_DR_ReserveTileLights(pContext, HeaderSize + total))
+    {
+        return false;
+    }
+
+    // Counts become the write cursor for each tile's list
+    u32* pData = pContext->pTileLightData;
+    u32 offset = HeaderSize;
+    for (u32 tile = 0; tile < pContext->TileCount; ++tile)
+    {
+        pData[tile * 2] = offset;
+        pData[tile * 2 + 1] = pCounts[tile];
+        pCounts[tile] = offset;
+        offset += pData[tile * 2 + 1];
+    }
+
+    for (u32 i = 0; i < LightCount; ++i)
+    {
+        const LightTileBounds_t* pBounds = &pContext->LightTileBounds[i];
+        for (s32 y = pBounds->MinY; y <= pBounds->MaxY; ++y)
+        {
+            for (s32 x = pBounds->MinX; x <= pBounds->MaxX; ++x)
+            {
+                pData[pCounts[y * pContext->TilesX + x]++] = i;
+            }
+        }
+    }
+
+    pContext->TileLightTotal = total;
+    return true;
+}
+
+void _DR_UploadLights(RenderContext_t* pContext)
+{
+    const u32 LightCount = pContext->PointLightCount;
+    for (u32 i = 0; i < LightCount; ++i)
+    {
+        PointLight_t* pLight = &pContext->PointLights[i];
+        float* pData = &pContext->LightData[i * LIGHT_DATA_FLOATS];
+        pData[0] = pLight->Position.x;
+        pData[1] = pLight->Position.y;
+        pData[2] = pLight->Position.z;
+        pData[3] = pLight->Radius;
+        pData[4] = pLight->Color.r;
+        pData[5] = pLight->Color.g;
+        pData[6] = pLight->Color.b;
+        pData[7] = 0.f;
+    }
+
+    // Too many to bin gets every tile an empty list rather than no lights
+    // at all being a special case in the shader. Light volumes want the
+    // same, the full screen pass is only ambient then.
+    const u32 HeaderSize = pContext->TileCount * 2;
+    u32 tileLightSize = HeaderSize;
+    if (!pContext->LightVolumes && _DR_CullLights(pContext))
+    {
+        tileLightSize += pContext->TileLightTotal;
+    }
+
+    if (tileLightSize == HeaderSize || tileLightSize > (u32)pContext->MaxTextureBufferSize)
+    {
+        if (tileLightSize > HeaderSize)
+        {
+            fprintf(stderr, "Too many tile lights (%u), skipping lighting\n", tileLightSize);
+        }
+        tileLightSize = HeaderSize;
+        pContext->TileLightTotal = 0;
+        memset(pContext->pTileLightData, 0, HeaderSize * sizeof(u32));
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, pContext->LightDataBuffer);
+    glBufferData(
+        GL_TEXTURE_BUFFER,
+        LightCount * LIGHT_DATA_FLOATS * sizeof(float),
+        pContext->LightData,
+        GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, pContext->TileLightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, tileLightSize * sizeof(u32), pContext->pTileLightData, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// How far out the light volume's vertices sit for its flat faces to still
+// cover the whole of the round sphere
+float _DR_GetLightVolumeScale()
+{
+    return 1.f / (cosf(PI / LIGHT_VOLUME_SLICES) * cosf(PI / LIGHT_VOLUME_STACKS));
+}
+
+// Unit sphere, pushed out by _DR_GetLightVolumeScale()
+void _DR_CreateLightVolume(RenderContext_t* pContext)
+{
+    const u32 VertexCount = (LIGHT_VOLUME_STACKS + 1) * LIGHT_VOLUME_SLICES;
+    const float Scale = _DR_GetLightVolumeScale();
+    float vertices[(LIGHT_VOLUME_STACKS + 1) * LIGHT_VOLUME_SLICES * 3];
+    u32 indices[LIGHT_VOLUME_STACKS * LIGHT_VOLUME_SLICES * 6];
+    for (u32 stack = 0; stack <= LIGHT_VOLUME_STACKS; ++stack)
+    {
+        const float Theta = PI * stack / LIGHT_VOLUME_STACKS;
+        for (u32 slice = 0; slice < LIGHT_VOLUME_SLICES; ++slice)
+        {
+            const float Phi = 2.f * PI * slice / LIGHT_VOLUME_SLICES;
+            float* pVertex = &vertices[(stack * LIGHT_VOLUME_SLICES + slice) * 3];
+            pVertex[0] = Scale * sinf(Theta) * cosf(Phi);
+            pVertex[1] = Scale * cosf(Theta);
+            pVertex[2] = Scale * sinf(Theta) * sinf(Phi);
+        }
+    }
+
+    // Two triangles a quad, counter clockwise from outside
+    u32 indexCount = 0;
+    for (u32 stack = 0; stack < LIGHT_VOLUME_STACKS; ++stack)
+    {
+        for (u32 slice = 0; slice < LIGHT_VOLUME_SLICES; ++slice)
+        {
+            const u32 Next = (slice + 1) % LIGHT_VOLUME_SLICES;
+            const u32 TopLeft = stack * LIGHT_VOLUME_SLICES + slice;
+            const u32 TopRight = stack * LIGHT_VOLUME_SLICES + Next;
+            const u32 BottomLeft = (stack + 1) * LIGHT_VOLUME_SLICES + slice;
+            const u32 BottomRight = (stack + 1) * LIGHT_VOLUME_SLICES + Next;
+            indices[indexCount++] = TopLeft;
+            indices[indexCount++] = TopRight;
+            indices[indexCount++] = BottomLeft;
+            indices[indexCount++] = TopRight;
+            indices[indexCount++] = BottomRight;
+            indices[indexCount++] = BottomLeft;
+        }
+    }
+
+    glGenVertexArrays(1, &pContext->LightVolumeVAO);
+    glGenBuffers(1, &pContext->LightVolumeVBO);
+    glGenBuffers(1, &pContext->LightVolumeEBO);
+    glBindVertexArray(pContext->LightVolumeVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, pContext->LightVolumeVBO);
+    glBufferData(GL_ARRAY_BUFFER, VertexCount * 3 * sizeof(float), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pContext->LightVolumeEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(u32), indices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    pContext->LightVolumeIndexCount = indexCount;
+}
+
+bool _DR_IsSamplerType(GLenum type)
+{
+    switch (type)
+    {
+        case GL_SAMPLER_2D:
+        case GL_SAMPLER_2D_SHADOW:
+        case GL_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_BUFFER:
+        case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+ShaderUniforms_t* _DR_FindShaderUniforms(HSHADER shaderHandle)
+{
+    for (u32 i = 0; i < g_ShaderCount; ++i)
+    {
+        if (g_ShaderUniforms[i].Shader == shaderHandle)
+        {
+            return &g_ShaderUniforms[i];
+        }
+    }
+
+    return NULL;
+}
+
+void _DR_ForgetShaderUniforms(HSHADER shaderHandle)
+{
+    ShaderUniforms_t* pUniforms = _DR_FindShaderUniforms(shaderHandle);
+    if (pUniforms)
+    {
+        *pUniforms = g_ShaderUniforms[--g_ShaderCount];
+    }
+}
+
+// Anything that wasn't cached, array elements say, still goes to GL
+s32 _DR_GetUniformLocation(HSHADER shaderHandle, const char* pName)
+{
+    ShaderUniforms_t* pUniforms = _DR_FindShaderUniforms(shaderHandle);
+    for (u32 i = 0; pUniforms && i < pUniforms->UniformCount; ++i)
+    {
+        if (strcmp(pUniforms->Uniforms[i].Name, pName) == 0)
+        {
+            return pUniforms->Uniforms[i].Location;
+        }
+    }
+
+    return glGetUniformLocation(shaderHandle, pName);
+}
+
 // Public functions
 HSHADER DR_CreateShader(const char* pVertText, const char* pFragText) 
 {
@@ -160,6 +627,56 @@ HSHADER DR_CreateShader(const char* pVertText, const char* pFragText)
         goto fail;
     }
 
+    // Cache every uniform's location now rather than look it up each time
+    // it's set. Samplers all start out on unit 0 too, which won't validate
+    // once there's more than one kind of them, so each gets its own until
+    // they're set.
+    ShaderUniforms_t* pUniforms = NULL;
+    if (g_ShaderCount < MAX_SHADERS)
+    {
+        pUniforms = &g_ShaderUniforms[g_ShaderCount++];
+        pUniforms->Shader = shaderProgram;
+        pUniforms->UniformCount = 0;
+    }
+
+    s32 uniformCount = 0;
+    s32 samplerUnit = 0;
+    glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glUseProgram(shaderProgram);
+    for (s32 i = 0; i < uniformCount; ++i)
+    {
+        char uniformName[MAX_UNIFORM_NAME];
+        s32 uniformSize;
+        GLenum uniformType;
+        glGetActiveUniform(shaderProgram, i, sizeof(uniformName), NULL, &uniformSize, &uniformType, uniformName);
+
+        // Members of uniform blocks have no location of their own
+        const s32 Location = glGetUniformLocation(shaderProgram, uniformName);
+        if (Location < 0)
+        {
+            continue;
+        }
+
+        if (pUniforms && pUniforms->UniformCount < MAX_SHADER_UNIFORMS)
+        {
+            ShaderUniform_t* pUniform = &pUniforms->Uniforms[pUniforms->UniformCount++];
+            strcpy(pUniform->Name, uniformName);
+            pUniform->Location = Location;
+        }
+
+        if (_DR_IsSamplerType(uniformType))
+        {
+            glUniform1i(Location, samplerUnit++);
+        }
+    }
+    glUseProgram(0);
+
+    const u32 FrameDataIndex = glGetUniformBlockIndex(shaderProgram, "FrameData");
+    if (FrameDataIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(shaderProgram, FrameDataIndex, FRAME_DATA_BINDING);
+    }
+
     glValidateProgram(shaderProgram);
     s32 validateSuccess;
     glGetProgramiv(shaderProgram, GL_VALIDATE_STATUS, &validateSuccess);
@@ -174,12 +691,24 @@ HSHADER DR_CreateShader(const char* pVertText, const char* pFragText)
     return shaderProgram;
 
 fail:
+    _DR_ForgetShaderUniforms(shaderProgram);
     glDeleteShader(vertObject);
     glDeleteShader(fragObject);
     glDeleteProgram(shaderProgram);
     return INVALID_SHADER_HANDLE;
 }
 
+void DR_DestroyShader(HSHADER shaderHandle)
+{
+    if (shaderHandle == INVALID_SHADER_HANDLE)
+    {
+        return;
+    }
+
+    _DR_ForgetShaderUniforms(shaderHandle);
+    glDeleteProgram(shaderHandle);
+}
+
 HPOINTLIGHT DR_CreatePointLight(RenderContext_t* pContext, PointLight_t* pLight) 
 {
     if (!pLight || !pContext || pContext->PointLightCount >= MAX_POINT_LIGHTS)
@@ -212,6 +741,11 @@ PointLight_t* DR_GetPointLight(RenderContext_t* pContext, HPOINTLIGHT lightHandl
     return &pContext->PointLights[Index];
 }
 
+void DR_ClearPointLights(RenderContext_t* pContext)
+{
+    pContext->PointLightCount = 0;
+}
+
 // TODO:
 // DR_DestroyPointLight
 
@@ -237,21 +771,60 @@ void DR_SetView(RenderContext_t* pContext, Matrix44f* pView)
     pContext->View = *pView;
 }
 
+// Off, every pixel is lit by every light -- only useful to compare against
+void DR_SetLightCulling(RenderContext_t* pContext, bool enabled)
+{
+    pContext->LightCulling = enabled;
+}
+
+// Each light drawn as a sphere instead of binned into tiles, shading only
+// the pixels it covers
+void DR_SetLightVolumes(RenderContext_t* pContext, bool enabled)
+{
+    pContext->LightVolumes = enabled;
+}
+
+// Occlusion queries around every light volume, so DR_GetLightVolumeSamples
+// has something to add up
+void DR_SetLightSampleCounting(RenderContext_t* pContext, bool enabled)
+{
+    pContext->CountLightSamples = enabled;
+}
+
+// Pixels the last light volume pass shaded, waiting on it if need be. Only
+// meaningful once a frame has been drawn with light volumes and sample
+// counting on. The stencil marking pass isn't counted.
+uint64_t DR_GetLightVolumeSamples(RenderContext_t* pContext)
+{
+    uint64_t samples = 0;
+    for (u32 i = 0; pContext->LightVolumes && i < pContext->LightSamplesQueryCount; ++i)
+    {
+        uint64_t lightSamples = 0;
+        glGetQueryObjectui64v(pContext->LightSamplesQueries[i], GL_QUERY_RESULT, &lightSamples);
+        samples += lightSamples;
+    }
+    return samples;
+}
+
+void DR_SetOutputFramebuffer(RenderContext_t* pContext, u32 framebuffer)
+{
+    pContext->OutputFramebuffer = framebuffer;
+}
+
 // Shader parameters
 void DR_SetShaderParameteri(HSHADER shaderHandle, char* pName, u32 value)
 {
-    glUniform1i(glGetUniformLocation(shaderHandle, pName), value);
+    glUniform1i(_DR_GetUniformLocation(shaderHandle, pName), value);
 }
 
 void DR_SetShaderParameterMat4(HSHADER shaderHandle, char* pName, Matrix44f* pMat)
 {
-    glUniformMatrix4fv(glGetUniformLocation(shaderHandle, pName), 1, GL_FALSE, &pMat->m[0][0]);
+    glUniformMatrix4fv(_DR_GetUniformLocation(shaderHandle, pName), 1, GL_FALSE, &pMat->m[0][0]);
 }
 
 void DR_SetShaderParameterVec3(HSHADER shaderHandle, char* pName, Vector3f* pVec)
 {
-    const GLint loc = glGetUniformLocation(shaderHandle, pName);
-    glUniform3fv(glGetUniformLocation(shaderHandle, pName), 1, &pVec->data[0]);
+    glUniform3fv(_DR_GetUniformLocation(shaderHandle, pName), 1, &pVec->data[0]);
 }
 
 bool DR_IsContextValid(RenderContext_t* pContext)
@@ -264,17 +837,25 @@ bool DR_IsContextValid(RenderContext_t* pContext)
     // None of the buffer names should be zero
     return 
         pContext->GBuffer &&
-        pContext->PositionBuffer &&
+        (pContext->PositionBuffer || pContext->Settings.CompactGBuffer) &&
         pContext->NormalBuffer &&
         pContext->AlbedoSpecBuffer &&
+        pContext->DepthBuffer &&
+        pContext->LightBuffer &&
+        pContext->FrameDataBuffer &&
+        pContext->LightDataTexture &&
+        pContext->TileLightTexture &&
         pContext->GeometryProgram != INVALID_SHADER_HANDLE &&
+        pContext->GeometryInstancedProgram != INVALID_SHADER_HANDLE &&
         pContext->LightProgram != INVALID_SHADER_HANDLE &&
+        pContext->LightVolumeProgram != INVALID_SHADER_HANDLE &&
+        pContext->LightVolumeStencilProgram != INVALID_SHADER_HANDLE &&
         pContext->ForwardProgram != INVALID_SHADER_HANDLE;
 }
 
-bool DR_Initialize(RenderContext_t* pContext, char* pAssetRoot)
+bool DR_Initialize(RenderContext_t* pContext, char* pAssetRoot, RenderSettings_t* pSettings)
 {
-    if (!pContext)
+    if (!pContext || !pSettings)
     {
         fprintf(stderr, "Cannot initialize render context: invalid pointer\n");
         return false;
@@ -283,55 +864,118 @@ bool DR_Initialize(RenderContext_t* pContext, char* pAssetRoot)
     // Zero out everything first, mark shaders as invalid
     memset(pContext, 0, sizeof(*pContext));
     pContext->GeometryProgram = INVALID_SHADER_HANDLE;
+    pContext->GeometryInstancedProgram = INVALID_SHADER_HANDLE;
     pContext->LightProgram = INVALID_SHADER_HANDLE;
+    pContext->LightVolumeProgram = INVALID_SHADER_HANDLE;
+    pContext->LightVolumeStencilProgram = INVALID_SHADER_HANDLE;
     pContext->ForwardProgram = INVALID_SHADER_HANDLE;
 
+    pContext->Settings = *pSettings;
+    const u32 Width = pSettings->Width;
+    const u32 Height = pSettings->Height;
+    const bool Compact = pSettings->CompactGBuffer;
+
+    pContext->TilesX = (Width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    pContext->TilesY = (Height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    pContext->TileCount = pContext->TilesX * pContext->TilesY;
+    pContext->pTileLightCounts = calloc(pContext->TileCount, sizeof(u32));
+    if (!pContext->pTileLightCounts)
+    {
+        fprintf(stderr, "Cannot initialize render context: no memory for %u tiles\n", pContext->TileCount);
+        return false;
+    }
+
     // Create and bind the g buffer
     glGenFramebuffers(1, &pContext->GBuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, pContext->GBuffer);
 
-    // Position color buffer
-    glGenTextures(1, &pContext->PositionBuffer);
-    glBindTexture(GL_TEXTURE_2D, pContext->PositionBuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pContext->PositionBuffer, 0);
+    // Position color buffer, rebuilt from depth when compact
+    u32 attachment = GL_COLOR_ATTACHMENT0;
+    if (!Compact)
+    {
+        glGenTextures(1, &pContext->PositionBuffer);
+        glBindTexture(GL_TEXTURE_2D, pContext->PositionBuffer);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, Width, Height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment++, GL_TEXTURE_2D, pContext->PositionBuffer, 0);
+    }
 
-    // Normal color buffer
+    // Normal color buffer, two 16-bit channels of octahedron encoded normal
+    // when compact
     glGenTextures(1, &pContext->NormalBuffer);
     glBindTexture(GL_TEXTURE_2D, pContext->NormalBuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+    if (Compact)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, Width, Height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, Width, Height, 0, GL_RGBA, GL_FLOAT, NULL);
+    }
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, pContext->NormalBuffer, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment++, GL_TEXTURE_2D, pContext->NormalBuffer, 0);
 
     // Color/specular component buffer (albedo)
     // Note the use of 8-bit precision
     glGenTextures(1, &pContext->AlbedoSpecBuffer);
     glBindTexture(GL_TEXTURE_2D, pContext->AlbedoSpecBuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Width, Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, pContext->AlbedoSpecBuffer, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment++, GL_TEXTURE_2D, pContext->AlbedoSpecBuffer, 0);
 
     // Tell OpenGL which buffers we'll be using to draw for the bound frame buffer
     u32 attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-    glDrawBuffers(3, attachments);
+    glDrawBuffers(attachment - GL_COLOR_ATTACHMENT0, attachments);
+
+    // Depth is a texture either way, the compact lighting pass reads it back.
+    // Stencil marks what the light volumes need to shade.
+    glGenTextures(1, &pContext->DepthBuffer);
+    glBindTexture(GL_TEXTURE_2D, pContext->DepthBuffer);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, Width, Height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, pContext->DepthBuffer, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+    // Light volumes add up in half floats so lots of dim lights don't lose
+    // anything to rounding, then get copied out
+    glGenFramebuffers(1, &pContext->LightBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, pContext->LightBuffer);
+    glGenTextures(1, &pContext->LightAccumBuffer);
+    glBindTexture(GL_TEXTURE_2D, pContext->LightAccumBuffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, Width, Height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pContext->LightAccumBuffer, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    u32 rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCREEN_WIDTH, SCREEN_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+    glGenRenderbuffers(1, &pContext->LightDepthStencilBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, pContext->LightDepthStencilBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, Width, Height);
+    glFramebufferRenderbuffer(
+        GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, pContext->LightDepthStencilBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, pContext->GBuffer);
 
+    // Per frame data, bound once and refilled every frame
+    glGenBuffers(1, &pContext->FrameDataBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, pContext->FrameDataBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData_t), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, pContext->FrameDataBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
     // Get and compile shaders
-    char vertText[2048] = {};
-    char fragText[2048] = {};
+    char vertText[4096] = {};
+    char fragText[4096] = {};
     if (!_DR_ReadText(pAssetRoot, BUFFER_VERT_SHADER_PATH, vertText, sizeof(vertText)))
     {
         return false;
@@ -342,9 +986,24 @@ bool DR_Initialize(RenderContext_t* pContext, char* pAssetRoot)
         return false;
     }
 
+    if (Compact && !_DR_AddShaderDefine(fragText, sizeof(fragText), COMPACT_GBUFFER_DEFINE))
+    {
+        return false;
+    }
+
     pContext->GeometryProgram = DR_CreateShader(vertText, fragText);
     assert(pContext->GeometryProgram != INVALID_SHADER_HANDLE);
 
+    // Same fragment shader, the model matrix comes in per instance instead
+    memset(vertText, 0, sizeof(vertText));
+    if (!_DR_ReadText(pAssetRoot, INSTANCED_VERT_SHADER_PATH, vertText, sizeof(vertText)))
+    {
+        return false;
+    }
+
+    pContext->GeometryInstancedProgram = DR_CreateShader(vertText, fragText);
+    assert(pContext->GeometryInstancedProgram != INVALID_SHADER_HANDLE);
+
     memset(vertText, 0, sizeof(vertText));
     memset(fragText, 0, sizeof(fragText));
     if (!_DR_ReadText(pAssetRoot, LIGHT_VERT_SHADER_PATH, vertText, sizeof(vertText)))
@@ -357,9 +1016,63 @@ bool DR_Initialize(RenderContext_t* pContext, char* pAssetRoot)
         return false;
     }
 
+    if (Compact && !_DR_AddShaderDefine(fragText, sizeof(fragText), COMPACT_GBUFFER_DEFINE))
+    {
+        return false;
+    }
+
     pContext->LightProgram = DR_CreateShader(vertText, fragText);
     assert(pContext->LightProgram != INVALID_SHADER_HANDLE);
 
+    // None of the lighting pass's own parameters change between frames
+    DR_UseShader(pContext->LightProgram);
+    DR_SetShaderParameteri(pContext->LightProgram, Compact ? "gDepth" : "gPosition", 0);
+    DR_SetShaderParameteri(pContext->LightProgram, "gNormal", 1);
+    DR_SetShaderParameteri(pContext->LightProgram, "gAlbedoSpec", 2);
+    DR_SetShaderParameteri(pContext->LightProgram, "lightData", LIGHT_DATA_TEXTURE_UNIT);
+    DR_SetShaderParameteri(pContext->LightProgram, "tileLights", TILE_LIGHTS_TEXTURE_UNIT);
+    DR_SetShaderParameteri(pContext->LightProgram, "tileSize", LIGHT_TILE_SIZE);
+    DR_SetShaderParameteri(pContext->LightProgram, "tilesX", pContext->TilesX);
+
+    memset(vertText, 0, sizeof(vertText));
+    memset(fragText, 0, sizeof(fragText));
+    if (!_DR_ReadText(pAssetRoot, LIGHT_VOLUME_VERT_SHADER_PATH, vertText, sizeof(vertText)))
+    {
+        return false;
+    }
+
+    if (!_DR_ReadText(pAssetRoot, LIGHT_VOLUME_FRAG_SHADER_PATH, fragText, sizeof(fragText)))
+    {
+        return false;
+    }
+
+    if (Compact && !_DR_AddShaderDefine(fragText, sizeof(fragText), COMPACT_GBUFFER_DEFINE))
+    {
+        return false;
+    }
+
+    pContext->LightVolumeProgram = DR_CreateShader(vertText, fragText);
+    assert(pContext->LightVolumeProgram != INVALID_SHADER_HANDLE);
+
+    // Reads the same textures on the same units as the lighting pass
+    DR_UseShader(pContext->LightVolumeProgram);
+    DR_SetShaderParameteri(pContext->LightVolumeProgram, Compact ? "gDepth" : "gPosition", 0);
+    DR_SetShaderParameteri(pContext->LightVolumeProgram, "gNormal", 1);
+    DR_SetShaderParameteri(pContext->LightVolumeProgram, "gAlbedoSpec", 2);
+    DR_SetShaderParameteri(pContext->LightVolumeProgram, "lightData", LIGHT_DATA_TEXTURE_UNIT);
+
+    // Same spheres, marking the stencil for the pass above
+    memset(fragText, 0, sizeof(fragText));
+    if (!_DR_ReadText(pAssetRoot, LIGHT_VOLUME_STENCIL_FRAG_SHADER_PATH, fragText, sizeof(fragText)))
+    {
+        return false;
+    }
+
+    pContext->LightVolumeStencilProgram = DR_CreateShader(vertText, fragText);
+    assert(pContext->LightVolumeStencilProgram != INVALID_SHADER_HANDLE);
+    DR_UseShader(pContext->LightVolumeStencilProgram);
+    DR_SetShaderParameteri(pContext->LightVolumeStencilProgram, "lightData", LIGHT_DATA_TEXTURE_UNIT);
+
     memset(vertText, 0, sizeof(vertText));
     memset(fragText, 0, sizeof(fragText));
     if (!_DR_ReadText(pAssetRoot, FWD_VERT_SHADER_PATH, vertText, sizeof(vertText)))
@@ -457,11 +1170,217 @@ bool DR_Initialize(RenderContext_t* pContext, char* pAssetRoot)
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 
+	// Instanced cubes share the same vertices, with a model matrix for each
+	// instance streamed in alongside
+	glGenVertexArrays(1, &pContext->CubeInstancedVAO);
+	glGenBuffers(1, &pContext->InstanceVBO);
+	glBindVertexArray(pContext->CubeInstancedVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, pContext->CubeVBO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+	glBindBuffer(GL_ARRAY_BUFFER, pContext->InstanceVBO);
+	for (u32 column = 0; column < 4; ++column)
+	{
+		const u32 Attribute = INSTANCE_MODEL_ATTRIBUTE + column;
+		glEnableVertexAttribArray(Attribute);
+		glVertexAttribPointer(Attribute, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix44f), (void*)(column * 4 * sizeof(float)));
+		glVertexAttribDivisor(Attribute, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+    _DR_CreateLightVolume(pContext);
+    glGenQueries(MAX_POINT_LIGHTS, pContext->LightSamplesQueries);
+
+    // Light and tile light buffers, filled in every frame
+    glGenBuffers(1, &pContext->LightDataBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, pContext->LightDataBuffer);
+    glGenTextures(1, &pContext->LightDataTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, pContext->LightDataTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, pContext->LightDataBuffer);
+
+    glGenBuffers(1, &pContext->TileLightBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, pContext->TileLightBuffer);
+    glGenTextures(1, &pContext->TileLightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, pContext->TileLightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, pContext->TileLightBuffer);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &pContext->MaxTextureBufferSize);
+    pContext->LightCulling = true;
+    if (!_DR_ReserveTileLights(pContext, pContext->TileCount * 2))
+    {
+        return false;
+    }
+
+    glViewport(0, 0, Width, Height);
     glEnable(GL_DEPTH_TEST);
 
     return true;
 }
 
+void DR_Shutdown(RenderContext_t* pContext)
+{
+    if (!pContext)
+    {
+        return;
+    }
+
+    DR_DestroyShader(pContext->GeometryProgram);
+    DR_DestroyShader(pContext->GeometryInstancedProgram);
+    DR_DestroyShader(pContext->LightProgram);
+    DR_DestroyShader(pContext->LightVolumeProgram);
+    DR_DestroyShader(pContext->LightVolumeStencilProgram);
+    DR_DestroyShader(pContext->ForwardProgram);
+
+    // Deleting the name 0 is ignored, so a half initialized context is fine
+    const u32 Textures[] = {
+        pContext->PositionBuffer,
+        pContext->NormalBuffer,
+        pContext->AlbedoSpecBuffer,
+        pContext->DepthBuffer,
+        pContext->LightAccumBuffer,
+        pContext->LightDataTexture,
+        pContext->TileLightTexture
+    };
+    const u32 Buffers[] = {
+        pContext->FrameDataBuffer,
+        pContext->LightDataBuffer,
+        pContext->TileLightBuffer,
+        pContext->ScreenQuadVBO,
+        pContext->CubeVBO,
+        pContext->InstanceVBO,
+        pContext->LightVolumeVBO,
+        pContext->LightVolumeEBO
+    };
+    const u32 VertexArrays[] = {
+        pContext->ScreenQuadVAO,
+        pContext->CubeVAO,
+        pContext->CubeInstancedVAO,
+        pContext->LightVolumeVAO
+    };
+    glDeleteTextures(sizeof(Textures) / sizeof(Textures[0]), Textures);
+    glDeleteBuffers(sizeof(Buffers) / sizeof(Buffers[0]), Buffers);
+    glDeleteVertexArrays(sizeof(VertexArrays) / sizeof(VertexArrays[0]), VertexArrays);
+    glDeleteRenderbuffers(1, &pContext->LightDepthStencilBuffer);
+    glDeleteQueries(MAX_POINT_LIGHTS, pContext->LightSamplesQueries);
+    glDeleteFramebuffers(1, &pContext->GBuffer);
+    glDeleteFramebuffers(1, &pContext->LightBuffer);
+
+    free(pContext->pTileLightCounts);
+    free(pContext->pTileLightData);
+    memset(pContext, 0, sizeof(*pContext));
+    pContext->GeometryProgram = INVALID_SHADER_HANDLE;
+    pContext->GeometryInstancedProgram = INVALID_SHADER_HANDLE;
+    pContext->LightProgram = INVALID_SHADER_HANDLE;
+    pContext->LightVolumeProgram = INVALID_SHADER_HANDLE;
+    pContext->LightVolumeStencilProgram = INVALID_SHADER_HANDLE;
+    pContext->ForwardProgram = INVALID_SHADER_HANDLE;
+}
+
+// Bytes every pixel of the g buffer takes, depth included
+u32 DR_GetGBufferBytesPerPixel(RenderContext_t* pContext)
+{
+    // RGBA16F position and normal, or RG16 normal, then RGBA8 albedo and a
+    // 24-bit depth padded out to 32
+    return pContext->Settings.CompactGBuffer ? 4 + 4 + 4 : 8 + 8 + 4 + 4;
+}
+
+// Shades the pixels between one light volume's front and back faces. The
+// front faces mark the stencil where they're in front of the surface, with
+// nothing written to color, then the back faces shade the marked pixels the
+// surface is in front of and put the stencil back for the next light. A
+// volume the near plane cuts into has no front faces to mark with, so those
+// take the back faces alone and shade everything in front of them.
+void _DR_DrawLightVolume(RenderContext_t* pContext, u32 light, bool nearPlaneInside)
+{
+    glBindVertexArray(pContext->LightVolumeVAO);
+    if (!nearPlaneInside)
+    {
+        glUseProgram(pContext->LightVolumeStencilProgram);
+        DR_SetShaderParameteri(pContext->LightVolumeStencilProgram, "light", light);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glCullFace(GL_BACK);
+        glDepthFunc(GL_LESS);
+        glStencilFunc(GL_EQUAL, GEOMETRY_STENCIL_VALUE, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+        glDrawElements(GL_TRIANGLES, pContext->LightVolumeIndexCount, GL_UNSIGNED_INT, (void*)0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    glUseProgram(pContext->LightVolumeProgram);
+    DR_SetShaderParameteri(pContext->LightVolumeProgram, "light", light);
+    glCullFace(GL_FRONT);
+    glDepthFunc(GL_GEQUAL);
+    if (nearPlaneInside)
+    {
+        glStencilFunc(GL_EQUAL, GEOMETRY_STENCIL_VALUE, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    }
+    else
+    {
+        // Every pixel a front face marked has exactly one back face behind
+        // it, pass or fail, so the marks all come back off here
+        glStencilFunc(GL_EQUAL, LIGHT_VOLUME_STENCIL_VALUE, 0xFF);
+        glStencilOp(GL_KEEP, GL_DECR, GL_DECR);
+    }
+
+    if (pContext->CountLightSamples)
+    {
+        glBeginQuery(GL_SAMPLES_PASSED, pContext->LightSamplesQueries[pContext->LightSamplesQueryCount++]);
+        glDrawElements(GL_TRIANGLES, pContext->LightVolumeIndexCount, GL_UNSIGNED_INT, (void*)0);
+        glEndQuery(GL_SAMPLES_PASSED);
+    }
+    else
+    {
+        glDrawElements(GL_TRIANGLES, pContext->LightVolumeIndexCount, GL_UNSIGNED_INT, (void*)0);
+    }
+    glBindVertexArray(0);
+}
+
+void _DR_DrawLightVolumes(RenderContext_t* pContext)
+{
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_CLAMP); // Back faces past the far plane still count
+    glDepthMask(GL_FALSE);
+    glEnable(GL_STENCIL_TEST);
+
+    // Lights off screen are skipped, the same test the tiles use
+    const Matrix44f* pProj = &pContext->Projection;
+    const float Near = pProj->m[3][2] / (pProj->m[2][2] - 1.f);
+    const float VolumeScale = _DR_GetLightVolumeScale();
+    pContext->LightSamplesQueryCount = 0;
+    for (u32 i = 0; i < pContext->PointLightCount; ++i)
+    {
+        PointLight_t* pLight = &pContext->PointLights[i];
+        const LightTileBounds_t Bounds = _DR_GetLightTileBounds(pContext, pLight, Near);
+        if (Bounds.MinX > Bounds.MaxX || Bounds.MinY > Bounds.MaxY)
+        {
+            continue;
+        }
+
+        Vector3f viewPosition;
+        Math_Matrix44f_TransformPoint(&pContext->View, &pLight->Position, &viewPosition);
+        _DR_DrawLightVolume(pContext, i, -viewPosition.z - pLight->Radius * VolumeScale < Near);
+    }
+
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDisable(GL_STENCIL_TEST);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    glDisable(GL_DEPTH_CLAMP);
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+}
+
 void DR_BeginFrame(RenderContext_t* pContext)
 {
     if (!DR_IsContextValid(pContext))
@@ -472,17 +1391,25 @@ void DR_BeginFrame(RenderContext_t* pContext)
 
     glBindFramebuffer(GL_FRAMEBUFFER, pContext->GBuffer);
     glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    // Mark everything drawn for the light volumes to shade
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, GEOMETRY_STENCIL_VALUE, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
     DR_UseShader(pContext->GeometryProgram);
-    DR_SetShaderParameterMat4(
-        pContext->GeometryProgram,
-        "projection",
-        &pContext->Projection);
-    DR_SetShaderParameterMat4(
-        pContext->GeometryProgram,
-        "view",
-        &pContext->View);
+
+    // Everything per frame the shaders share goes up in one go
+    FrameData_t FrameData = {
+        .Projection = pContext->Projection,
+        .View = pContext->View
+    };
+    Matrix44f viewProjection;
+    Math_Matrix44f_Multiply(&pContext->Projection, &pContext->View, &viewProjection);
+    Math_Matrix44f_Inverse(&viewProjection, &FrameData.InverseViewProjection);
+    glBindBuffer(GL_UNIFORM_BUFFER, pContext->FrameDataBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &FrameData);
 }
 
 void DR_EndFrame(RenderContext_t* pContext)
@@ -493,50 +1420,68 @@ void DR_EndFrame(RenderContext_t* pContext)
         return;
     }
 
-    // Perform the lighting pass
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_STENCIL_TEST);
+    const u32 Width = pContext->Settings.Width;
+    const u32 Height = pContext->Settings.Height;
+    if (pContext->LightVolumes)
+    {
+        // The spheres test against the scene's depth and stencil
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, pContext->GBuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pContext->LightBuffer);
+        glBlitFramebuffer(
+            0, 0, Width, Height,
+            0, 0, Width, Height,
+            GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT,
+            GL_NEAREST);
+    }
+
+    // Perform the lighting pass, only ambient with light volumes
+    if (pContext->LightVolumes)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, pContext->LightBuffer);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glDisable(GL_DEPTH_TEST);
+    }
+    else
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, pContext->OutputFramebuffer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
     DR_UseShader(pContext->LightProgram);
 
-    DR_SetShaderParameteri(pContext->LightProgram, "gPosition", 0);
-    DR_SetShaderParameteri(pContext->LightProgram, "gNormal", 1);
-    DR_SetShaderParameteri(pContext->LightProgram, "gAlbedoSpec", 2);
-
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, pContext->PositionBuffer);
+    glBindTexture(
+        GL_TEXTURE_2D,
+        pContext->Settings.CompactGBuffer ? pContext->DepthBuffer : pContext->PositionBuffer);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, pContext->NormalBuffer);
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_2D, pContext->AlbedoSpecBuffer);
 
-    DR_SetShaderParameteri(
-        pContext->LightProgram,
-        "numLights",
-        pContext->PointLightCount);
-    for (u32 i = 0; i < pContext->PointLightCount; ++i)
-    {
-        PointLight_t* pLight = &pContext->PointLights[i];
+    _DR_UploadLights(pContext);
+
+    glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, pContext->LightDataTexture);
+    glActiveTexture(GL_TEXTURE0 + TILE_LIGHTS_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, pContext->TileLightTexture);
 
-        char positionParamName[256] = {};
-        sprintf(positionParamName, "lights[%u].Position", i);
-        DR_SetShaderParameterVec3(
-            pContext->LightProgram,
-            positionParamName,
-            &pLight->Position);
 
-        char colorParamName[256] = {};
-        sprintf(colorParamName, "lights[%u].Color", i);
-        DR_SetShaderParameterVec3(
-            pContext->LightProgram,
-            colorParamName,
-            &pLight->Color);
-    }
-    
     // Render the screen quad
     glBindVertexArray(pContext->ScreenQuadVAO);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     glBindVertexArray(0);
+
+    if (pContext->LightVolumes)
+    {
+        glEnable(GL_DEPTH_TEST);
+        _DR_DrawLightVolumes(pContext);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, pContext->LightBuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pContext->OutputFramebuffer);
+        glBlitFramebuffer(0, 0, Width, Height, 0, 0, Width, Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, pContext->OutputFramebuffer);
+    }
 }
 
 void DR_RenderCube(RenderContext_t* pContext)
@@ -545,3 +1490,27 @@ void DR_RenderCube(RenderContext_t* pContext)
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
 }
+
+// Every cube in one draw, one model matrix each
+void DR_RenderCubesInstanced(RenderContext_t* pContext, Matrix44f* pTransforms, u32 count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    DR_UseShader(pContext->GeometryInstancedProgram);
+
+    // Respecifying the storage orphans whatever the last call drew from, so
+    // this never waits on a draw that's still reading it
+    glBindBuffer(GL_ARRAY_BUFFER, pContext->InstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(Matrix44f), pTransforms, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindVertexArray(pContext->CubeInstancedVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, count);
+    glBindVertexArray(0);
+
+    // Back to what DR_RenderCube expects
+    DR_UseShader(pContext->GeometryProgram);
+}
@@ -0,0 +1,737 @@
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+#include "tcp.h"
+
+#define DNS_BATCH_FREE_ID -1
+
+// Servers passed over lose 1/64th of their SRTT each time, so one that had a
+// slow patch gets tried again after a few hundred queries. Not while the last
+// one sent it could still be on its way back though, or a busy batch sends it
+// a burst before the first answer's in, and not while it's failing either.
+#define DNS_BATCH_SRTT_DECAY_SHIFT 6
+
+struct dns_batch_server {
+    bool measured;
+    uint64_t srtt_ns;
+    int failures;
+    uint64_t down_until_ns;
+    uint64_t last_sent_ns;
+};
+
+struct dns_batch_slot {
+    size_t query;
+    uint64_t first_sent_ns;
+    uint64_t sent_ns; // 0 until the kernel has taken it
+    uint32_t tried;   // Bit per server it's been sent to
+    uint64_t server_sent_ns[DNS_BATCH_MAX_SERVERS]; // Latest attempt to each still waiting, or 0
+    bool tcp;
+    int server;       // The one that truncated it, where TCP goes
+    size_t len;
+    uint8_t packet[DNS_MAX_UDP_SIZE];
+};
+
+struct dns_batch;
+
+// Which server a TCP pool's answers come from
+struct dns_batch_tcp_context {
+    struct dns_batch* batch;
+    int server;
+};
+
+struct dns_batch {
+    const struct dns_batch_config* config;
+    struct dns_batch_query* queries;
+    dns_batch_answer_fn answer_callback;
+    void* context;
+    struct dns_batch_stats* stats;
+    int socket;
+    struct dns_tcp_pool tcp_pools[DNS_BATCH_MAX_SERVERS];
+    struct dns_batch_tcp_context tcp_contexts[DNS_BATCH_MAX_SERVERS];
+    struct dns_batch_server servers[DNS_BATCH_MAX_SERVERS];
+    uint32_t rng;
+
+    // Slot in flight for each ID
+    int16_t* id_table;
+
+    struct dns_batch_slot* slots;
+    int* free_slots;
+    int num_free;
+    int num_unsent;
+
+    // Nothing in flight times out before this, so there's no need to scan
+    uint64_t next_due_ns;
+};
+
+void dns_batch_config_default(struct dns_batch_config* config, const struct sockaddr_in* server)
+{
+    memset(config, 0, sizeof(*config));
+    dns_batch_add_server(config, server);
+    config->window = DNS_BATCH_DEFAULT_WINDOW;
+    config->timeout_ms = DNS_BATCH_DEFAULT_TIMEOUT_MS;
+    config->attempts = DNS_BATCH_DEFAULT_ATTEMPTS;
+    config->edns_udp_size = DNS_EDNS_DEFAULT_UDP_SIZE;
+    config->tcp_connections = DNS_TCP_DEFAULT_CONNECTIONS;
+}
+
+bool dns_batch_add_server(struct dns_batch_config* config, const struct sockaddr_in* server)
+{
+    if (config->num_servers == DNS_BATCH_MAX_SERVERS)
+    {
+        return false;
+    }
+
+    config->servers[config->num_servers++] = *server;
+    return true;
+}
+
+static uint16_t _dns_batch_slot_id(const struct dns_batch_slot* slot)
+{
+    return (uint16_t)((slot->packet[0] << 8) | slot->packet[1]);
+}
+
+// Scattered rather than sequential, so IDs that were just freed aren't handed
+// straight back out while late answers to them may still be on the way. Not
+// meant to stand up to a spoofing attacker.
+static uint16_t _dns_batch_next_id(struct dns_batch* batch)
+{
+    for (;;)
+    {
+        batch->rng ^= batch->rng << 13;
+        batch->rng ^= batch->rng >> 17;
+        batch->rng ^= batch->rng << 5;
+        const uint16_t id = (uint16_t)(batch->rng >> 8);
+        if (batch->id_table[id] == DNS_BATCH_FREE_ID)
+        {
+            return id;
+        }
+    }
+}
+
+// Healthy before any being left alone, then ones that haven't answered yet,
+// fewest sent first, then the lowest SRTT
+static bool _dns_batch_better_server(const struct dns_batch* batch, int lhs, int rhs, uint64_t now_ns)
+{
+    const struct dns_batch_server* a = &batch->servers[lhs];
+    const struct dns_batch_server* b = &batch->servers[rhs];
+    const bool a_up = now_ns >= a->down_until_ns;
+    const bool b_up = now_ns >= b->down_until_ns;
+    if (a_up != b_up)
+    {
+        return a_up;
+    }
+    if (!a_up)
+    {
+        return a->down_until_ns < b->down_until_ns;
+    }
+    if (a->measured != b->measured)
+    {
+        return !a->measured;
+    }
+    if (!a->measured)
+    {
+        return batch->stats->servers[lhs].sent < batch->stats->servers[rhs].sent;
+    }
+    return a->srtt_ns < b->srtt_ns;
+}
+
+// -1 if every one's excluded
+static int _dns_batch_pick_server(const struct dns_batch* batch, uint32_t exclude, uint64_t now_ns)
+{
+    int best = -1;
+    for (int s = 0; s < batch->config->num_servers; ++s)
+    {
+        if (!(exclude & (1u << s)) && (best < 0 || _dns_batch_better_server(batch, s, best, now_ns)))
+        {
+            best = s;
+        }
+    }
+
+    return best;
+}
+
+// RFC 6298's gain of 1/8, with the first sample taken as it is
+static void _dns_batch_sample_rtt(struct dns_batch* batch, int server, uint64_t rtt_ns)
+{
+    struct dns_batch_server* state = &batch->servers[server];
+    state->srtt_ns = state->measured ? state->srtt_ns - (state->srtt_ns >> 3) + (rtt_ns >> 3) : rtt_ns;
+    state->measured = true;
+}
+
+// A timeout counts as a round trip that long, so a server that's stopped
+// answering drops down the list before it's left alone altogether
+static void _dns_batch_server_lost(struct dns_batch* batch, int server, uint64_t now_ns)
+{
+    const uint64_t timeout_ns = (uint64_t)batch->config->timeout_ms * DNS_NS_PER_MS;
+    struct dns_batch_server* state = &batch->servers[server];
+    _dns_batch_sample_rtt(batch, server, timeout_ns);
+    ++state->failures;
+    ++batch->stats->servers[server].lost;
+    if (state->failures >= DNS_BATCH_SERVER_MAX_FAILURES)
+    {
+        const int backoff = state->failures - DNS_BATCH_SERVER_MAX_FAILURES;
+        state->down_until_ns = now_ns + (timeout_ns << (backoff < DNS_BATCH_SERVER_MAX_BACKOFF
+                                                            ? backoff
+                                                            : DNS_BATCH_SERVER_MAX_BACKOFF));
+    }
+}
+
+// Every attempt still waiting on the slot timed out
+static void _dns_batch_slot_lost(struct dns_batch* batch, struct dns_batch_slot* slot, uint64_t now_ns)
+{
+    for (int s = 0; s < batch->config->num_servers; ++s)
+    {
+        if (slot->server_sent_ns[s] != 0)
+        {
+            _dns_batch_server_lost(batch, s, now_ns);
+            slot->server_sent_ns[s] = 0;
+        }
+    }
+}
+
+// False if the socket wouldn't take it right now
+static bool _dns_batch_send_udp(struct dns_batch* batch, const struct dns_batch_slot* slot, int server)
+{
+    const struct sockaddr_in* address = &batch->config->servers[server];
+    if (sendto(batch->socket, slot->packet, slot->len, 0, (const struct sockaddr*)address, sizeof(*address)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        {
+            return false;
+        }
+
+        // Anything else won't go away by retrying straight away, so count it
+        // as an attempt and let it time out
+        fprintf(stderr, "Failed to send query - errno: %d\n", errno);
+    }
+
+    return true;
+}
+
+static void _dns_batch_sent_to(struct dns_batch* batch, struct dns_batch_slot* slot, int server, uint64_t now_ns)
+{
+    slot->tried |= 1u << server;
+    slot->server_sent_ns[server] = now_ns;
+    batch->servers[server].last_sent_ns = now_ns;
+    ++batch->stats->servers[server].sent;
+    ++batch->stats->sent;
+}
+
+// Sends to the best server it hasn't tried yet, and the next best too when
+// racing. Once it's tried them all it starts over.
+static bool _dns_batch_send_best(struct dns_batch* batch, struct dns_batch_slot* slot, uint64_t now_ns)
+{
+    const int num_servers = batch->config->num_servers;
+    const uint32_t tried = slot->tried == (1u << num_servers) - 1 ? 0 : slot->tried;
+    const int server = _dns_batch_pick_server(batch, tried, now_ns);
+    if (!_dns_batch_send_udp(batch, slot, server))
+    {
+        return false;
+    }
+
+    _dns_batch_sent_to(batch, slot, server, now_ns);
+    for (int s = 0; s < num_servers; ++s)
+    {
+        struct dns_batch_server* state = &batch->servers[s];
+        if (s != server && state->failures == 0 && now_ns - state->last_sent_ns > state->srtt_ns)
+        {
+            state->srtt_ns -= state->srtt_ns >> DNS_BATCH_SRTT_DECAY_SHIFT;
+        }
+    }
+
+    if (batch->config->race && num_servers > 1)
+    {
+        int second = _dns_batch_pick_server(batch, tried | (1u << server), now_ns);
+        second = second >= 0 ? second : _dns_batch_pick_server(batch, 1u << server, now_ns);
+        if (_dns_batch_send_udp(batch, slot, second))
+        {
+            _dns_batch_sent_to(batch, slot, second, now_ns);
+        }
+    }
+
+    return true;
+}
+
+// False if the socket wouldn't take it right now, in which case the slot is
+// left unsent and tried again on the next pass
+static bool _dns_batch_send(struct dns_batch* batch, struct dns_batch_slot* slot, uint64_t now_ns)
+{
+    // TCP queues whatever the socket won't take yet, so only a connection
+    // that can't be made fails, and that's an attempt like any other
+    if (slot->tcp)
+    {
+        dns_tcp_pool_send(&batch->tcp_pools[slot->server], slot->packet, slot->len);
+        _dns_batch_sent_to(batch, slot, slot->server, now_ns);
+    }
+    else if (!_dns_batch_send_best(batch, slot, now_ns))
+    {
+        if (slot->sent_ns != 0)
+        {
+            slot->sent_ns = 0;
+            ++batch->num_unsent;
+        }
+        return false;
+    }
+
+    if (slot->sent_ns == 0)
+    {
+        --batch->num_unsent;
+    }
+
+    if (slot->first_sent_ns == 0)
+    {
+        slot->first_sent_ns = now_ns;
+    }
+    slot->sent_ns = now_ns;
+    ++batch->queries[slot->query].attempts;
+    return true;
+}
+
+static void _dns_batch_release(struct dns_batch* batch, int slot_index)
+{
+    struct dns_batch_slot* slot = &batch->slots[slot_index];
+    if (slot->sent_ns == 0)
+    {
+        --batch->num_unsent;
+    }
+
+    batch->id_table[_dns_batch_slot_id(slot)] = DNS_BATCH_FREE_ID;
+    batch->free_slots[batch->num_free++] = slot_index;
+    slot->query = SIZE_MAX;
+}
+
+// Takes a slot for the query and sends it. False if the name isn't valid.
+static bool _dns_batch_start(struct dns_batch* batch, size_t query_index, uint64_t now_ns)
+{
+    struct dns_batch_query* query = &batch->queries[query_index];
+    const int slot_index = batch->free_slots[batch->num_free - 1];
+    struct dns_batch_slot* slot = &batch->slots[slot_index];
+    const uint16_t id = _dns_batch_next_id(batch);
+    slot->len = dns_encode_query(
+        id, query->name, query->qtype, batch->config->edns_udp_size, slot->packet, sizeof(slot->packet));
+    if (slot->len == 0)
+    {
+        query->status = DNS_BATCH_INVALID;
+        ++batch->stats->invalid;
+        return false;
+    }
+
+    --batch->num_free;
+    batch->id_table[id] = (int16_t)slot_index;
+    slot->query = query_index;
+    slot->first_sent_ns = 0;
+    slot->sent_ns = 0;
+    slot->tried = 0;
+    memset(slot->server_sent_ns, 0, sizeof(slot->server_sent_ns));
+    slot->tcp = false;
+    ++batch->num_unsent;
+    _dns_batch_send(batch, slot, now_ns);
+    return true;
+}
+
+static void _dns_batch_receive(
+    struct dns_batch* batch,
+    const uint8_t* response,
+    size_t len,
+    int server,
+    bool tcp,
+    uint64_t now_ns)
+{
+    struct dns_header header;
+    if (!dns_read_header(response, len, &header) || !(header.flags & DNS_FLAG_QR))
+    {
+        ++batch->stats->unmatched;
+        return;
+    }
+
+    const int slot_index = batch->id_table[header.id];
+    if (slot_index == DNS_BATCH_FREE_ID || !(batch->slots[slot_index].tried & (1u << server)))
+    {
+        ++batch->stats->unmatched;
+        return;
+    }
+
+    // The question is echoed back as sent, checking it stops a stray answer
+    // for a recycled ID being taken for this one
+    struct dns_batch_slot* slot = &batch->slots[slot_index];
+    const size_t question_len = dns_question_length(slot->packet, slot->len);
+    if (header.qdcount != 1 ||
+        len < DNS_HEADER_SIZE + question_len ||
+        memcmp(response + DNS_HEADER_SIZE, slot->packet + DNS_HEADER_SIZE, question_len) != 0)
+    {
+        ++batch->stats->mismatched;
+        return;
+    }
+
+    // A late answer to an attempt that already timed out still counts, but
+    // it's no round trip time
+    const uint64_t rtt_ns = slot->server_sent_ns[server] != 0 ? now_ns - slot->server_sent_ns[server] : 0;
+    if (rtt_ns != 0)
+    {
+        _dns_batch_sample_rtt(batch, server, rtt_ns);
+        slot->server_sent_ns[server] = 0;
+    }
+    batch->servers[server].failures = 0;
+    batch->servers[server].down_until_ns = 0;
+
+    // Already gone over to TCP, a truncated answer to an earlier UDP attempt
+    // is no use. A whole one still is.
+    struct dns_batch_query* query = &batch->queries[slot->query];
+    const bool truncated = (header.flags & DNS_FLAG_TC) != 0;
+    if (truncated && !tcp && slot->tcp)
+    {
+        return;
+    }
+
+    if (truncated && !tcp && batch->config->tcp_connections > 0)
+    {
+        slot->tcp = true;
+        slot->server = server;
+        memset(slot->server_sent_ns, 0, sizeof(slot->server_sent_ns));
+        query->tcp = true;
+        query->attempts = 0;
+        ++batch->stats->tcp;
+        _dns_batch_send(batch, slot, now_ns);
+        return;
+    }
+
+    query->status = DNS_BATCH_ANSWERED;
+    query->rcode = header.flags & DNS_RCODE_MASK;
+    query->ancount = header.ancount;
+    query->truncated = truncated;
+    query->latency_ns = now_ns - slot->first_sent_ns;
+    ++batch->stats->answered;
+    struct dns_batch_server_stats* server_stats = &batch->stats->servers[server];
+    ++server_stats->answered;
+    server_stats->total_rtt_ns += rtt_ns;
+    server_stats->max_rtt_ns = rtt_ns > server_stats->max_rtt_ns ? rtt_ns : server_stats->max_rtt_ns;
+    batch->stats->truncated += query->truncated;
+    if (batch->answer_callback)
+    {
+        batch->answer_callback(query, response, len, batch->context);
+    }
+
+    _dns_batch_release(batch, slot_index);
+}
+
+// Resends or gives up on anything past its timeout, and sends whatever the
+// socket refused last time. Returns ms until the next slot is due.
+static int _dns_batch_expire(struct dns_batch* batch, uint64_t now_ns)
+{
+    if (batch->num_unsent == 0 && now_ns < batch->next_due_ns)
+    {
+        return (int)((batch->next_due_ns - now_ns + DNS_NS_PER_MS - 1) / DNS_NS_PER_MS);
+    }
+
+    // Anything started after this has a later deadline, so next_due_ns only
+    // needs working out again here
+    const uint64_t timeout_ns = (uint64_t)batch->config->timeout_ms * DNS_NS_PER_MS;
+    uint64_t next_ns = timeout_ns;
+    for (int s = 0; s < batch->config->window; ++s)
+    {
+        struct dns_batch_slot* slot = &batch->slots[s];
+        if (slot->query == SIZE_MAX)
+        {
+            continue;
+        }
+
+        struct dns_batch_query* query = &batch->queries[slot->query];
+        if (slot->sent_ns == 0)
+        {
+            if (!_dns_batch_send(batch, slot, now_ns))
+            {
+                return 1;
+            }
+            continue;
+        }
+
+        const uint64_t waited_ns = now_ns - slot->sent_ns;
+        if (waited_ns < timeout_ns)
+        {
+            next_ns = timeout_ns - waited_ns < next_ns ? timeout_ns - waited_ns : next_ns;
+            continue;
+        }
+
+        _dns_batch_slot_lost(batch, slot, now_ns);
+        if (query->attempts >= batch->config->attempts)
+        {
+            query->status = DNS_BATCH_TIMED_OUT;
+            ++batch->stats->timed_out;
+            _dns_batch_release(batch, s);
+            continue;
+        }
+
+        ++batch->stats->retries;
+        if (!_dns_batch_send(batch, slot, now_ns))
+        {
+            return 1;
+        }
+    }
+
+    batch->next_due_ns = now_ns + next_ns;
+    return (int)((next_ns + DNS_NS_PER_MS - 1) / DNS_NS_PER_MS);
+}
+
+static void _dns_batch_on_tcp_answer(const uint8_t* response, size_t len, void* context)
+{
+    const struct dns_batch_tcp_context* tcp_context = (const struct dns_batch_tcp_context*)context;
+    _dns_batch_receive(tcp_context->batch, response, len, tcp_context->server, true, dns_now_ns());
+}
+
+// Which server an answer came from, -1 if none of them
+static int _dns_batch_find_server(const struct dns_batch* batch, const struct sockaddr_in* from)
+{
+    for (int s = 0; s < batch->config->num_servers; ++s)
+    {
+        const struct sockaddr_in* server = &batch->config->servers[s];
+        if (server->sin_addr.s_addr == from->sin_addr.s_addr && server->sin_port == from->sin_port)
+        {
+            return s;
+        }
+    }
+
+    return -1;
+}
+
+static bool _dns_batch_open(struct dns_batch* batch)
+{
+    batch->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (batch->socket < 0)
+    {
+        fprintf(stderr, "Failed to create socket - errno: %d\n", errno);
+        return false;
+    }
+
+    // Not connected, answers can come from any of the servers and are
+    // checked against them as they're read
+    const int rcvbuf = batch->config->window * DNS_BATCH_RCVBUF_PER_QUERY;
+    const int flags = fcntl(batch->socket, F_GETFL, 0);
+    if (setsockopt(batch->socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0 ||
+        flags < 0 || fcntl(batch->socket, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        fprintf(stderr, "Failed to set up socket - errno: %d\n", errno);
+        return false;
+    }
+
+    for (int s = 0; s < batch->config->num_servers && batch->config->tcp_connections > 0; ++s)
+    {
+        batch->tcp_contexts[s] = (struct dns_batch_tcp_context){ .batch = batch, .server = s };
+        if (!dns_tcp_pool_open(&batch->tcp_pools[s], &batch->config->servers[s], batch->config->tcp_connections))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void _dns_batch_drain(struct dns_batch* batch, uint8_t* response)
+{
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t received;
+    const uint64_t now_ns = dns_now_ns();
+    while ((received = recvfrom(
+                batch->socket, response, DNS_MAX_EDNS_UDP_SIZE, 0, (struct sockaddr*)&from, &from_len)) >= 0)
+    {
+        const int server = _dns_batch_find_server(batch, &from);
+        if (server < 0)
+        {
+            ++batch->stats->unmatched;
+        }
+        else if (received > 0)
+        {
+            _dns_batch_receive(batch, response, (size_t)received, server, false, now_ns);
+        }
+        from_len = sizeof(from);
+    }
+}
+
+bool dns_batch_resolve(
+    const struct dns_batch_config* config,
+    struct dns_batch_query* queries,
+    size_t count,
+    dns_batch_answer_fn answer_callback,
+    void* context,
+    struct dns_batch_stats* stats_out)
+{
+    if (config->window < 1 || config->window > DNS_BATCH_MAX_WINDOW ||
+        config->timeout_ms < 1 || config->attempts < 1 ||
+        config->num_servers < 1 || config->num_servers > DNS_BATCH_MAX_SERVERS ||
+        config->tcp_connections < 0 || config->tcp_connections > DNS_TCP_MAX_CONNECTIONS)
+    {
+        fprintf(stderr,
+                "Invalid batch config - window: %d timeout_ms: %d attempts: %d servers: %d tcp_connections: %d\n",
+                config->window,
+                config->timeout_ms,
+                config->attempts,
+                config->num_servers,
+                config->tcp_connections);
+        return false;
+    }
+
+    memset(stats_out, 0, sizeof(*stats_out));
+    struct dns_batch batch = {
+        .config = config,
+        .queries = queries,
+        .answer_callback = answer_callback,
+        .context = context,
+        .stats = stats_out,
+        .socket = -1,
+        .rng = (uint32_t)dns_now_ns() ^ ((uint32_t)getpid() << 16) ^ 0x9E3779B9u,
+        .id_table = malloc(DNS_BATCH_NUM_IDS * sizeof(int16_t)),
+        .slots = malloc(config->window * sizeof(struct dns_batch_slot)),
+        .free_slots = malloc(config->window * sizeof(int)),
+        .num_free = config->window
+    };
+    for (int s = 0; s < DNS_BATCH_MAX_SERVERS; ++s)
+    {
+        batch.tcp_pools[s].epoll = -1;
+    }
+
+    bool valid = batch.id_table && batch.slots && batch.free_slots && _dns_batch_open(&batch);
+    if (valid)
+    {
+        memset(batch.id_table, 0xFF, DNS_BATCH_NUM_IDS * sizeof(int16_t));
+        for (int s = 0; s < config->window; ++s)
+        {
+            batch.slots[s].query = SIZE_MAX;
+            batch.free_slots[s] = config->window - 1 - s;
+        }
+
+        for (size_t q = 0; q < count; ++q)
+        {
+            queries[q].status = DNS_BATCH_PENDING;
+            queries[q].attempts = 0;
+            queries[q].tcp = false;
+        }
+    }
+
+    const uint64_t start_ns = dns_now_ns();
+    size_t next = 0;
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    while (valid && (next < count || batch.num_free < config->window))
+    {
+        const uint64_t now_ns = dns_now_ns();
+        while (batch.num_free > 0 && next < count && batch.num_unsent == 0)
+        {
+            _dns_batch_start(&batch, next++, now_ns);
+        }
+
+        const int wait_ms = _dns_batch_expire(&batch, now_ns);
+        if (batch.num_free == config->window)
+        {
+            continue;
+        }
+
+        // Each TCP pool's epoll fd reads ready whenever one of its
+        // connections does, they're left out until there's one to watch
+        struct pollfd poll_fds[1 + DNS_BATCH_MAX_SERVERS];
+        poll_fds[0] = (struct pollfd){
+            .fd = batch.socket,
+            .events = POLLIN | (batch.num_unsent > 0 ? POLLOUT : 0)
+        };
+        nfds_t num_fds = 1;
+        for (int s = 0; s < config->num_servers && batch.stats->tcp > 0; ++s)
+        {
+            poll_fds[num_fds++] = (struct pollfd){ .fd = batch.tcp_pools[s].epoll, .events = POLLIN };
+        }
+
+        if (poll(poll_fds, num_fds, wait_ms) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "Failed to poll - errno: %d\n", errno);
+            valid = false;
+            break;
+        }
+
+        // Drain everything that's arrived before topping the window back up
+        _dns_batch_drain(&batch, response);
+        for (nfds_t f = 1; f < num_fds; ++f)
+        {
+            const int server = (int)f - 1;
+            if (poll_fds[f].revents & POLLIN)
+            {
+                dns_tcp_pool_service(&batch.tcp_pools[server], _dns_batch_on_tcp_answer, &batch.tcp_contexts[server]);
+            }
+        }
+    }
+
+    stats_out->elapsed_ns = dns_now_ns() - start_ns;
+    stats_out->queries_per_sec =
+        stats_out->elapsed_ns > 0 ? (double)stats_out->answered * DNS_NS_PER_SEC / stats_out->elapsed_ns : 0.0;
+
+    for (int s = 0; s < config->num_servers; ++s)
+    {
+        stats_out->servers[s].srtt_ns = batch.servers[s].srtt_ns;
+        stats_out->servers[s].failures = batch.servers[s].failures;
+        stats_out->tcp_connects += batch.tcp_pools[s].stats.connects;
+        stats_out->tcp_failed += batch.tcp_pools[s].stats.failed;
+        if (batch.tcp_pools[s].epoll >= 0)
+        {
+            dns_tcp_pool_close(&batch.tcp_pools[s]);
+        }
+    }
+
+    if (batch.socket >= 0)
+    {
+        close(batch.socket);
+    }
+    free(batch.id_table);
+    free(batch.slots);
+    free(batch.free_slots);
+    return valid;
+}
+
+void dns_batch_print_stats(const struct dns_batch_config* config, const struct dns_batch_stats* stats, FILE* stream)
+{
+    fprintf(stream,
+            "%zu answered, %zu timed out, %zu invalid in %.3f s, %.0f queries/sec\n",
+            stats->answered,
+            stats->timed_out,
+            stats->invalid,
+            (double)stats->elapsed_ns / DNS_NS_PER_SEC,
+            stats->queries_per_sec);
+    fprintf(stream,
+            "%zu sent, %zu retries, %zu truncated, %zu unmatched, %zu mismatched\n",
+            stats->sent,
+            stats->retries,
+            stats->truncated,
+            stats->unmatched,
+            stats->mismatched);
+    if (stats->tcp > 0)
+    {
+        fprintf(stream,
+                "%zu asked again over TCP, %zu connects, %zu failed\n",
+                stats->tcp,
+                stats->tcp_connects,
+                stats->tcp_failed);
+    }
+
+    for (int s = 0; s < config->num_servers && config->num_servers > 1; ++s)
+    {
+        const struct dns_batch_server_stats* server = &stats->servers[s];
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &config->servers[s].sin_addr, address, sizeof(address));
+        fprintf(stream,
+                "%s:%d  %zu sent, %zu answered, %zu lost  srtt %.3f ms  mean %.3f ms  max %.3f ms%s\n",
+                address,
+                ntohs(config->servers[s].sin_port),
+                server->sent,
+                server->answered,
+                server->lost,
+                (double)server->srtt_ns / DNS_NS_PER_MS,
+                server->answered > 0 ? (double)server->total_rtt_ns / server->answered / DNS_NS_PER_MS : 0.0,
+                (double)server->max_rtt_ns / DNS_NS_PER_MS,
+                server->failures >= DNS_BATCH_SERVER_MAX_FAILURES ? "  down" : "");
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+// Pipelined resolver. Keeps up to window queries in flight on one
+// non-blocking UDP socket, each with its own ID, and matches responses back
+// through a table indexed by ID so they can arrive in any order. Queries that
+// don't hear back within the timeout are resent with the same ID, so a late
+// answer to an earlier attempt still counts.
+//
+// An answer with TC set means the server had more than fits in UDP. The
+// query is then asked again over a small pool of pipelined TCP connections
+// (see tcp.h) with the same ID, and gets a fresh set of attempts there.
+//
+// With more than one server, each keeps a smoothed round trip time and a
+// count of timeouts in a row. Queries go to the healthy server with the
+// lowest SRTT, and a retry goes to one the query hasn't tried yet. Servers
+// that haven't answered yet are tried first, so every one gets measured, and
+// the SRTT of the ones passed over decays so they get tried again now and
+// then. A server that times out DNS_BATCH_SERVER_MAX_FAILURES times in a row
+// is left alone for a while, longer each time. With race set every query
+// goes to the best two at once and the first answer wins. What's learned
+// only lasts the batch.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <netinet/in.h>
+
+#define DNS_BATCH_DEFAULT_WINDOW 256
+#define DNS_BATCH_DEFAULT_TIMEOUT_MS 1000
+#define DNS_BATCH_DEFAULT_ATTEMPTS 3
+
+// Well under the 64K IDs, so picking a free one at random stays cheap
+#define DNS_BATCH_MAX_WINDOW 4096
+
+// Receive buffer asked for per query in the window, so a whole window of
+// answers arriving at once isn't dropped before it's read. The kernel caps it
+// at net.core.rmem_max.
+#define DNS_BATCH_RCVBUF_PER_QUERY 2048
+
+#define DNS_BATCH_MAX_SERVERS 8
+
+// Timeouts in a row before a server's left alone, for a timeout to start
+// with and doubling up to DNS_BATCH_SERVER_MAX_BACKOFF times
+#define DNS_BATCH_SERVER_MAX_FAILURES 3
+#define DNS_BATCH_SERVER_MAX_BACKOFF 5
+
+// Number of possible IDs, the size of the ID table
+#define DNS_BATCH_NUM_IDS 65536
+
+enum dns_batch_status
+{
+    DNS_BATCH_PENDING = 0,
+    DNS_BATCH_ANSWERED,
+    DNS_BATCH_TIMED_OUT,
+    DNS_BATCH_INVALID
+};
+
+struct dns_batch_query {
+    const char* name; // Not copied, must outlive the batch
+    uint16_t qtype;
+
+    // Filled in as the batch runs
+    enum dns_batch_status status;
+    int attempts;
+    int rcode;
+    uint16_t ancount;
+    bool truncated;
+    bool tcp; // Truncated over UDP and asked again over TCP
+    uint64_t latency_ns; // First send to answer, the UDP round trip included
+};
+
+struct dns_batch_config {
+    struct sockaddr_in servers[DNS_BATCH_MAX_SERVERS];
+    int num_servers;
+    bool race;
+    int window;
+    int timeout_ms;
+    int attempts;
+    uint16_t edns_udp_size; // 0 for plain 512 byte DNS
+    int tcp_connections;    // 0 to take truncated answers as they are
+};
+
+struct dns_batch_server_stats {
+    size_t sent;
+    size_t answered;   // Answers taken from it, races it won
+    size_t lost;       // Attempts that timed out
+    int failures;      // Timeouts in a row, at the end
+    uint64_t srtt_ns;  // At the end
+    uint64_t total_rtt_ns; // Over the answers taken from it
+    uint64_t max_rtt_ns;
+};
+
+struct dns_batch_stats {
+    size_t answered;
+    size_t timed_out;
+    size_t invalid;    // Names that couldn't be encoded
+    size_t sent;
+    size_t retries;
+    size_t truncated;
+    size_t unmatched;  // No query in flight with that ID, usually a duplicate answer
+    size_t mismatched; // ID in flight, but a different question
+    size_t tcp;        // Queries asked again over TCP
+    size_t tcp_connects;
+    size_t tcp_failed; // Connections that failed or closed with queries in flight
+    struct dns_batch_server_stats servers[DNS_BATCH_MAX_SERVERS];
+    uint64_t elapsed_ns;
+    double queries_per_sec;
+};
+
+// Called once per answered query, with the raw response
+typedef void (*dns_batch_answer_fn)(struct dns_batch_query* query, const uint8_t* response, size_t len, void* context);
+
+// One server to start with
+void dns_batch_config_default(struct dns_batch_config* config, const struct sockaddr_in* server);
+
+// False if there's no room for another
+bool dns_batch_add_server(struct dns_batch_config* config, const struct sockaddr_in* server);
+
+// Resolves every query, returns once each is answered, timed out or invalid.
+// False only if the batch couldn't run at all.
+bool dns_batch_resolve(
+    const struct dns_batch_config* config,
+    struct dns_batch_query* queries,
+    size_t count,
+    dns_batch_answer_fn answer_callback,
+    void* context,
+    struct dns_batch_stats* stats_out);
+
+// Each server gets a line of its own, if there's more than one
+void dns_batch_print_stats(const struct dns_batch_config* config, const struct dns_batch_stats* stats, FILE* stream);
+
+#endif // __BATCH_H__
@@ -0,0 +1,409 @@
+// Batch resolver against the stub responder on a thread in the same process.
+// Checks every answer is the one the stub gives for that name, shows what
+// pipelining buys by running the same names at a few window sizes, then runs
+// against a stub that drops some of its answers to check retries cover it.
+// Last come big- names, too many addresses for the default EDNS0 size, so
+// every one is truncated and asked again over TCP. They run over one TCP
+// connection and a few, and over UDP with a 4096 byte EDNS0 size for
+// comparison.
+//
+// Then the tail with more than one server. One stub holds back some of its
+// answers, and the same names go to it alone, to it and a fast one picked
+// between by SRTT, and to both at once racing. Last, a server that never
+// answers is put first, to check the batch stops sending it anything.
+//
+// Usage: dns-bench [--count n]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "dns.h"
+#include "parse.h"
+#include "stub.h"
+#include "tcp.h"
+
+#define DNS_BENCH_DEFAULT_COUNT 20000
+
+// One name in this many is an nx- name, to mix in some NXDOMAINs
+#define DNS_BENCH_NX_EVERY 10
+
+// Window 1 is a query per round trip, so it only gets a slice of the names
+#define DNS_BENCH_SERIAL_DIVISOR 10
+
+#define DNS_BENCH_DROP_PERCENT 5
+#define DNS_BENCH_DROP_TIMEOUT_MS 20
+#define DNS_BENCH_DROP_ATTEMPTS 8
+
+// Every big- answer is a couple of KB over TCP, so fewer of them
+#define DNS_BENCH_BIG_DIVISOR 4
+#define DNS_BENCH_BIG_CONNECTIONS 4
+
+// The slow stub holds back one answer in this many percent, for this long
+#define DNS_BENCH_SLOW_PERCENT 10
+#define DNS_BENCH_SLOW_DELAY_MS 20
+
+// Short, so the server that never answers is found out quickly, but well
+// over anything the stub takes
+#define DNS_BENCH_DEAD_TIMEOUT_MS 100
+
+#define DNS_BENCH_NAME_LENGTH 48
+
+struct dns_bench_check {
+    size_t wrong;
+};
+
+static void _dns_bench_on_answer(struct dns_batch_query* query, const uint8_t* response, size_t len, void* context)
+{
+    struct dns_bench_check* check = (struct dns_bench_check*)context;
+    if (strncmp(query->name, "nx", 2) == 0)
+    {
+        if (query->rcode != DNS_RCODE_NXDOMAIN || query->ancount != 0)
+        {
+            ++check->wrong;
+        }
+        return;
+    }
+
+    // One A record for the name asked about, with the stub's address for it,
+    // or all of a big- name's with that first
+    struct dns_parser parser;
+    struct dns_question question;
+    struct dns_answer answer;
+    uint8_t qname[DNS_MAX_NAME_LENGTH];
+    uint32_t address;
+    const uint16_t ancount = strncmp(query->name, "big", 3) == 0 ? DNS_STUB_BIG_RECORDS : 1;
+    if (query->rcode != DNS_RCODE_NOERROR || query->ancount != ancount || query->truncated ||
+        !dns_parser_init(&parser, response, len) ||
+        !dns_parser_next_question(&parser, &question) ||
+        !dns_parser_next_record(&parser, &answer) ||
+        answer.type != DNS_TYPE_A ||
+        !dns_name_equals_text(&answer.name, query->name))
+    {
+        ++check->wrong;
+        return;
+    }
+
+    memcpy(&address, answer.rdata, sizeof(address));
+    if (ntohl(address) != dns_stub_address(qname, dns_name_to_wire(&question.qname, qname, sizeof(qname))))
+    {
+        ++check->wrong;
+    }
+}
+
+static int _dns_bench_compare_latency(const void* a, const void* b)
+{
+    const uint64_t lhs = ((const struct dns_batch_query*)a)->latency_ns;
+    const uint64_t rhs = ((const struct dns_batch_query*)b)->latency_ns;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static double _dns_bench_percentile_ms(struct dns_batch_query* queries, size_t count, double percentile)
+{
+    qsort(queries, count, sizeof(struct dns_batch_query), _dns_bench_compare_latency);
+    const size_t index = (size_t)(percentile * (count - 1));
+    return (double)queries[index].latency_ns / DNS_NS_PER_MS;
+}
+
+// Runs one batch, checks it all came back right and prints a line for it
+static bool _dns_bench_run(
+    const char* label,
+    const struct dns_batch_config* config,
+    struct dns_batch_query* queries,
+    size_t count)
+{
+    struct dns_bench_check check = {0};
+    struct dns_batch_stats stats;
+    if (!dns_batch_resolve(config, queries, count, _dns_bench_on_answer, &check, &stats))
+    {
+        return false;
+    }
+
+    fprintf(stdout,
+            "%-12s window %4d: %6zu queries %9.0f queries/sec  p50 %6.3f ms  p99 %6.3f ms  %zu retries",
+            label,
+            config->window,
+            count,
+            stats.queries_per_sec,
+            _dns_bench_percentile_ms(queries, count, 0.5),
+            _dns_bench_percentile_ms(queries, count, 0.99),
+            stats.retries);
+    if (stats.tcp > 0)
+    {
+        fprintf(stdout, "  %zu over TCP on %zu connections", stats.tcp, stats.tcp_connects);
+    }
+    fprintf(stdout, "\n");
+
+    for (int s = 0; s < config->num_servers && config->num_servers > 1; ++s)
+    {
+        const struct dns_batch_server_stats* server = &stats.servers[s];
+        fprintf(stdout,
+                "    server %d: %6zu sent %6zu answered %4zu lost  srtt %6.3f ms  mean %6.3f ms  max %6.3f ms\n",
+                s,
+                server->sent,
+                server->answered,
+                server->lost,
+                (double)server->srtt_ns / DNS_NS_PER_MS,
+                server->answered > 0 ? (double)server->total_rtt_ns / server->answered / DNS_NS_PER_MS : 0.0,
+                (double)server->max_rtt_ns / DNS_NS_PER_MS);
+    }
+
+    // Connections are only opened once, however many queries go over them
+    if (stats.tcp_connects > (size_t)config->tcp_connections || stats.tcp_failed != 0)
+    {
+        fprintf(stderr,
+                "TCP connections weren't reused - connects: %zu failed: %zu pool: %d\n",
+                stats.tcp_connects,
+                stats.tcp_failed,
+                config->tcp_connections);
+        return false;
+    }
+
+    if (stats.answered != count || check.wrong != 0 || stats.mismatched != 0)
+    {
+        fprintf(stderr,
+                "Batch went wrong - answered: %zu/%zu wrong: %zu mismatched: %zu\n",
+                stats.answered,
+                count,
+                check.wrong,
+                stats.mismatched);
+        return false;
+    }
+
+    return true;
+}
+
+static bool _dns_bench_with_stub(
+    const char* label,
+    int drop_percent,
+    const int* windows,
+    size_t num_windows,
+    struct dns_batch_query* queries,
+    size_t count)
+{
+    struct dns_stub stub;
+    const struct dns_stub_config stub_config = {
+        .port = 0,
+        .drop_percent = drop_percent
+    };
+    if (!dns_stub_open(&stub, &stub_config) || !dns_stub_start(&stub))
+    {
+        return false;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons((uint16_t)stub.config.port);
+
+    bool valid = true;
+    for (size_t w = 0; w < num_windows && valid; ++w)
+    {
+        struct dns_batch_config config;
+        dns_batch_config_default(&config, &server);
+        config.window = windows[w];
+        if (drop_percent > 0)
+        {
+            config.timeout_ms = DNS_BENCH_DROP_TIMEOUT_MS;
+            config.attempts = DNS_BENCH_DROP_ATTEMPTS;
+        }
+
+        const size_t batch_count = windows[w] == 1 ? count / DNS_BENCH_SERIAL_DIVISOR : count;
+        valid = _dns_bench_run(label, &config, queries, batch_count);
+    }
+
+    dns_stub_stop(&stub);
+    dns_stub_close(&stub);
+    if (drop_percent > 0 && stub.stats.dropped == 0)
+    {
+        fprintf(stderr, "Stub never dropped anything, retries went untested\n");
+        valid = false;
+    }
+
+    return valid;
+}
+
+// Same big- names over UDP with room for them, then falling back to TCP from
+// the default EDNS0 size with a pool of one connection and of a few
+static bool _dns_bench_truncated(struct dns_batch_query* queries, size_t count)
+{
+    struct dns_stub stub;
+    const struct dns_stub_config stub_config = { .port = 0 };
+    if (!dns_stub_open(&stub, &stub_config) || !dns_stub_start(&stub))
+    {
+        return false;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons((uint16_t)stub.config.port);
+
+    const int windows[] = { 1, DNS_BATCH_DEFAULT_WINDOW };
+    const int connections[] = { 0, 1, DNS_BENCH_BIG_CONNECTIONS };
+    const char* labels[] = { "big udp4096", "big tcp x1", "big tcp x4" };
+    bool valid = true;
+    for (size_t c = 0; c < sizeof(connections) / sizeof(connections[0]) && valid; ++c)
+    {
+        for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]) && valid; ++w)
+        {
+            struct dns_batch_config config;
+            dns_batch_config_default(&config, &server);
+            config.window = windows[w];
+            config.tcp_connections = connections[c];
+            if (connections[c] == 0)
+            {
+                config.edns_udp_size = DNS_MAX_EDNS_UDP_SIZE;
+            }
+
+            const size_t batch_count = windows[w] == 1 ? count / DNS_BENCH_SERIAL_DIVISOR : count;
+            valid = _dns_bench_run(labels[c], &config, queries, batch_count);
+        }
+    }
+
+    dns_stub_stop(&stub);
+    dns_stub_close(&stub);
+    return valid;
+}
+
+static struct sockaddr_in _dns_bench_loopback(int port)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    return address;
+}
+
+// The slow stub alone, then with a fast one, by SRTT and racing, then behind
+// a server that never answers
+static bool _dns_bench_servers(struct dns_batch_query* queries, size_t count)
+{
+    struct dns_stub fast;
+    struct dns_stub slow;
+    const struct dns_stub_config fast_config = { .port = 0 };
+    const struct dns_stub_config slow_config = {
+        .port = 0,
+        .delay_percent = DNS_BENCH_SLOW_PERCENT,
+        .delay_ms = DNS_BENCH_SLOW_DELAY_MS
+    };
+    if (!dns_stub_open(&fast, &fast_config) || !dns_stub_start(&fast))
+    {
+        return false;
+    }
+    if (!dns_stub_open(&slow, &slow_config) || !dns_stub_start(&slow))
+    {
+        dns_stub_stop(&fast);
+        dns_stub_close(&fast);
+        return false;
+    }
+
+    // Bound and never read, so whatever's sent to it goes unanswered
+    struct sockaddr_in dead = _dns_bench_loopback(0);
+    socklen_t dead_len = sizeof(dead);
+    const int dead_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    bool valid = dead_socket >= 0 &&
+                 bind(dead_socket, (const struct sockaddr*)&dead, sizeof(dead)) == 0 &&
+                 getsockname(dead_socket, (struct sockaddr*)&dead, &dead_len) == 0;
+
+    const struct sockaddr_in fast_address = _dns_bench_loopback(fast.config.port);
+    const struct sockaddr_in slow_address = _dns_bench_loopback(slow.config.port);
+    const int windows[] = { 1, 16 };
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]) && valid; ++w)
+    {
+        struct dns_batch_config config;
+        dns_batch_config_default(&config, &slow_address);
+        config.window = windows[w];
+        const size_t batch_count = windows[w] == 1 ? count / DNS_BENCH_SERIAL_DIVISOR : count;
+        valid = _dns_bench_run("slow", &config, queries, batch_count);
+
+        dns_batch_add_server(&config, &fast_address);
+        valid = valid && _dns_bench_run("slow+fast", &config, queries, batch_count);
+
+        config.race = true;
+        valid = valid && _dns_bench_run("slow+fast race", &config, queries, batch_count);
+
+        dns_batch_config_default(&config, &dead);
+        dns_batch_add_server(&config, &fast_address);
+        config.window = windows[w];
+        config.timeout_ms = DNS_BENCH_DEAD_TIMEOUT_MS;
+        valid = valid && _dns_bench_run("dead+fast", &config, queries, batch_count);
+    }
+
+    if (dead_socket >= 0)
+    {
+        close(dead_socket);
+    }
+    dns_stub_stop(&slow);
+    dns_stub_close(&slow);
+    dns_stub_stop(&fast);
+    dns_stub_close(&fast);
+    return valid;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = DNS_BENCH_DEFAULT_COUNT;
+    if (argc == 3 && strcmp(argv[1], "--count") == 0 && atoi(argv[2]) >= DNS_BENCH_SERIAL_DIVISOR)
+    {
+        count = (size_t)atoi(argv[2]);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: %s [--count n]\n", argv[0]);
+        return -1;
+    }
+
+    char (*names)[DNS_BENCH_NAME_LENGTH] = malloc(count * DNS_BENCH_NAME_LENGTH);
+    struct dns_batch_query* queries = calloc(count, sizeof(struct dns_batch_query));
+    if (!names || !queries)
+    {
+        fprintf(stderr, "Out of memory for %zu names\n", count);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        snprintf(names[i],
+                 DNS_BENCH_NAME_LENGTH,
+                 "%s-%zu.Bench.Example.Test",
+                 i % DNS_BENCH_NX_EVERY == 0 ? "nx" : "host",
+                 i);
+        queries[i].name = names[i];
+        queries[i].qtype = DNS_TYPE_A;
+    }
+
+    const int windows[] = { 1, 16, 256, DNS_BATCH_MAX_WINDOW };
+    const int drop_windows[] = { DNS_BATCH_DEFAULT_WINDOW };
+    bool valid =
+        _dns_bench_with_stub("stub", 0, windows, sizeof(windows) / sizeof(windows[0]), queries, count) &&
+        _dns_bench_with_stub("stub+5%drop", DNS_BENCH_DROP_PERCENT, drop_windows, 1, queries, count);
+
+    const size_t big_count = count / DNS_BENCH_BIG_DIVISOR;
+    for (size_t i = 0; i < big_count; ++i)
+    {
+        snprintf(names[i], DNS_BENCH_NAME_LENGTH, "big-%zu.Bench.Example.Test", i);
+        queries[i].name = names[i];
+    }
+    valid = valid && _dns_bench_truncated(queries, big_count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        snprintf(names[i], DNS_BENCH_NAME_LENGTH, "host-%zu.Servers.Example.Test", i);
+        queries[i].name = names[i];
+    }
+    valid = valid && _dns_bench_servers(queries, count);
+
+    free(queries);
+    free(names);
+    return valid ? 0 : -1;
+}
@@ -0,0 +1,34 @@
+#!/usr/bin/bash
+#
+# Usage: build.sh [extra gcc flags]
+#
+#   build/dns-dumbclient  the client, one name or a --batch of them
+#   build/dns-stub        local responder to point it at
+#   build/dns-bench       batch resolver against in-process stubs, UDP, TCP fallback, several servers
+#   build/dns-parse-bench response parser throughput
+#   build/dns-encode-bench query encoder throughput, checks it never allocates
+#   build/dns-cache-bench resolver cache checks and lookup latency at 1M entries
+#   build/dns-forwarder   caching forwarder daemon, --upstream to send misses to
+#   build/dns-forward-bench forwarder checks, then queries/sec and latency against the stub
+#   build/dns-fuzz        parser fuzzer, give it fuzz/corpus/*
+#
+# e.g. ./build.sh -O0 -g -fsanitize=address,undefined
+
+set -e
+
+SCRIPT_DIR=$(dirname ${BASH_SOURCE[0]})
+BUILD_DIR=build
+CFLAGS="-std=gnu11 -Wall -O2 $@"
+
+cd "$SCRIPT_DIR"
+mkdir -p "$BUILD_DIR"
+
+gcc $CFLAGS main.c dns.c parse.c batch.c tcp.c -o "$BUILD_DIR/dns-dumbclient"
+gcc $CFLAGS -pthread stub_main.c stub.c parse.c dns.c -o "$BUILD_DIR/dns-stub"
+gcc $CFLAGS -pthread bench.c batch.c tcp.c stub.c parse.c dns.c -o "$BUILD_DIR/dns-bench"
+gcc $CFLAGS parse_bench.c parse.c samples.c dns.c -o "$BUILD_DIR/dns-parse-bench"
+gcc $CFLAGS fuzz/fuzz.c cache.c parse.c dns.c -o "$BUILD_DIR/dns-fuzz"
+gcc $CFLAGS -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc encode_bench.c parse.c dns.c -o "$BUILD_DIR/dns-encode-bench"
+gcc $CFLAGS -pthread cache_bench.c cache.c stub.c samples.c parse.c dns.c -o "$BUILD_DIR/dns-cache-bench"
+gcc $CFLAGS -pthread forward_main.c forward.c tcp.c cache.c parse.c dns.c -o "$BUILD_DIR/dns-forwarder"
+gcc $CFLAGS -pthread forward_bench.c forward.c tcp.c cache.c batch.c stub.c samples.c parse.c dns.c -o "$BUILD_DIR/dns-forward-bench"
@@ -0,0 +1,771 @@
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns.h"
+#include "parse.h"
+
+// Arena offset 0 is never a name, so it can mark an empty name slot
+#define DNS_CACHE_ARENA_RESERVED 1
+#define DNS_CACHE_ARENA_INITIAL (64 * 1024)
+
+// Past this the arena's offsets would stop fitting, so it's flushed first
+#define DNS_CACHE_ARENA_MAX (1u << 31)
+
+// Most names one response can intern: an owner and a target per record, the
+// question and the SOA's owner
+#define DNS_CACHE_NAMES_PER_STORE (2 * DNS_CACHE_MAX_RECORDS + 2)
+
+// Five 32 bit numbers after an SOA's two names
+#define DNS_CACHE_SOA_FIXED_SIZE 20
+
+// Names are folded a word at a time, so the last word can run past the end
+#define DNS_CACHE_FOLDED_SIZE (DNS_MAX_NAME_LENGTH + sizeof(uint64_t))
+
+static size_t _dns_cache_slots_for(size_t count)
+{
+    size_t slots = 1;
+    while (slots < count)
+    {
+        slots <<= 1;
+    }
+
+    return slots;
+}
+
+static void _dns_cache_write_u16(uint8_t* buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+}
+
+static uint16_t _dns_cache_read_u16(const uint8_t* buffer)
+{
+    return (uint16_t)((buffer[0] << 8) | buffer[1]);
+}
+
+bool dns_cache_init(struct dns_cache* cache, size_t capacity)
+{
+    memset(cache, 0, sizeof(*cache));
+    if (capacity == 0 || capacity > DNS_CACHE_MAX_CAPACITY)
+    {
+        fprintf(stderr, "Bad cache capacity - capacity: %zu max: %d\n", capacity, DNS_CACHE_MAX_CAPACITY);
+        return false;
+    }
+
+    cache->capacity = capacity;
+    cache->max_ttl = DNS_CACHE_DEFAULT_MAX_TTL;
+
+    // Entries at most half the slots, names at most half theirs with room for
+    // twice as many names as entries, plus one more response's worth
+    const size_t entry_slots = _dns_cache_slots_for(capacity * 2);
+    const size_t name_slots = _dns_cache_slots_for((capacity * 2 + DNS_CACHE_NAMES_PER_STORE) * 2);
+    cache->entries = calloc(entry_slots, sizeof(struct dns_cache_entry));
+    cache->names = calloc(name_slots, sizeof(struct dns_cache_name_slot));
+    cache->arena = malloc(DNS_CACHE_ARENA_INITIAL);
+    if (!cache->entries || !cache->names || !cache->arena)
+    {
+        fprintf(stderr, "Out of memory for cache - capacity: %zu\n", capacity);
+        dns_cache_free(cache);
+        return false;
+    }
+
+    cache->entry_mask = entry_slots - 1;
+    cache->name_mask = name_slots - 1;
+    cache->arena_cap = DNS_CACHE_ARENA_INITIAL;
+    cache->arena_len = DNS_CACHE_ARENA_RESERVED;
+    return true;
+}
+
+void dns_cache_free(struct dns_cache* cache)
+{
+    for (size_t e = 0; cache->entries && e <= cache->entry_mask; ++e)
+    {
+        free(cache->entries[e].records);
+    }
+
+    free(cache->entries);
+    free(cache->names);
+    free(cache->arena);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void dns_cache_flush(struct dns_cache* cache)
+{
+    for (size_t e = 0; e <= cache->entry_mask; ++e)
+    {
+        free(cache->entries[e].records);
+    }
+
+    memset(cache->entries, 0, (cache->entry_mask + 1) * sizeof(struct dns_cache_entry));
+    memset(cache->names, 0, (cache->name_mask + 1) * sizeof(struct dns_cache_name_slot));
+    cache->num_entries = 0;
+    cache->num_names = 0;
+    cache->arena_len = DNS_CACHE_ARENA_RESERVED;
+    cache->records_bytes = 0;
+    ++cache->stats.flushed;
+}
+
+// Folds eight bytes at a time. Each byte's top bit ends up set in upper only
+// if it's 'A' to 'Z', and that shifted down two is the 0x20 that lower cases
+// it. Length bytes are at most 63, below 'A', so they come through as they
+// are and there's no need to walk the labels.
+static uint64_t _dns_cache_fold_word(uint64_t word)
+{
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t low = word & (0x7F * ones);
+    const uint64_t upper = ((low + (0x80 - 'A') * ones) ^ (low + (0x80 - 'Z' - 1) * ones)) & ~word & (0x80 * ones);
+    return word | (upper >> 2);
+}
+
+// Folds name into folded_out, which needs DNS_CACHE_FOLDED_SIZE bytes, and
+// returns the hash of the folded name
+static uint32_t _dns_cache_fold_and_hash(const uint8_t* name, size_t len, uint8_t* folded_out)
+{
+    uint64_t hash = len * 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < len; i += sizeof(uint64_t))
+    {
+        // Past the end is zeroes, so what's hashed only depends on the name
+        uint64_t word = 0;
+        memcpy(&word, name + i, len - i < sizeof(word) ? len - i : sizeof(word));
+        word = _dns_cache_fold_word(word);
+        memcpy(folded_out + i, &word, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+
+    return (uint32_t)hash;
+}
+
+static bool _dns_cache_name_is(const struct dns_cache* cache, uint32_t offset, const uint8_t* folded, size_t len)
+{
+    return cache->arena[offset] == len && memcmp(&cache->arena[offset + 1], folded, len) == 0;
+}
+
+// Offset of the name in the arena, interning it if it isn't there yet. 0 if
+// the arena can't grow. Callers make sure there's room in the name table
+// first, see _dns_cache_make_room.
+static uint32_t _dns_cache_intern(struct dns_cache* cache, const uint8_t* name, size_t len, uint32_t* hash_out)
+{
+    uint8_t folded[DNS_CACHE_FOLDED_SIZE];
+    const uint32_t hash = _dns_cache_fold_and_hash(name, len, folded);
+    *hash_out = hash;
+
+    size_t slot = hash & cache->name_mask;
+    for (; cache->names[slot].offset != 0; slot = (slot + 1) & cache->name_mask)
+    {
+        if (cache->names[slot].hash == hash && _dns_cache_name_is(cache, cache->names[slot].offset, folded, len))
+        {
+            return cache->names[slot].offset;
+        }
+    }
+
+    if (cache->arena_len + 1 + len > cache->arena_cap)
+    {
+        const size_t grown_cap = cache->arena_cap * 2;
+        uint8_t* grown = realloc(cache->arena, grown_cap);
+        if (!grown)
+        {
+            return 0;
+        }
+        cache->arena = grown;
+        cache->arena_cap = grown_cap;
+    }
+
+    const uint32_t offset = (uint32_t)cache->arena_len;
+    cache->arena[offset] = (uint8_t)len;
+    memcpy(&cache->arena[offset + 1], folded, len);
+    cache->arena_len += 1 + len;
+    cache->names[slot].offset = offset;
+    cache->names[slot].hash = hash;
+    ++cache->num_names;
+    return offset;
+}
+
+// Flushes if one more response's worth of names might not fit
+static void _dns_cache_make_room(struct dns_cache* cache)
+{
+    if (cache->num_names + DNS_CACHE_NAMES_PER_STORE > (cache->name_mask + 1) / 2 ||
+        cache->arena_len + DNS_CACHE_NAMES_PER_STORE * (1 + DNS_MAX_NAME_LENGTH) > DNS_CACHE_ARENA_MAX)
+    {
+        dns_cache_flush(cache);
+    }
+}
+
+static size_t _dns_cache_home(const struct dns_cache* cache, uint32_t hash)
+{
+    // The hash is already mixed, a multiply and 32-bit xor-shift per word,
+    // but its low bits are also what the name table probes from. Another
+    // Fibonacci multiply, taking the high half, spreads entries differently
+    // so the two tables don't cluster on the same names.
+    return (size_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> 32) & cache->entry_mask;
+}
+
+// Interned names can be told apart by offset. Anything else, name is 0 and
+// it's compared against folded once the hash and type match.
+static size_t _dns_cache_find(
+    const struct dns_cache* cache,
+    uint32_t name,
+    const uint8_t* folded,
+    size_t len,
+    uint32_t hash,
+    uint16_t type)
+{
+    for (size_t slot = _dns_cache_home(cache, hash);; slot = (slot + 1) & cache->entry_mask)
+    {
+        const struct dns_cache_entry* entry = &cache->entries[slot];
+        if (entry->type == 0)
+        {
+            return SIZE_MAX;
+        }
+
+        if (entry->hash == hash && entry->type == type &&
+            (name != 0 ? entry->name == name : _dns_cache_name_is(cache, entry->name, folded, len)))
+        {
+            return slot;
+        }
+    }
+}
+
+// Backward shift, so no tombstones: anything after the hole that could have
+// lived in it moves up, until an empty slot ends the run
+static void _dns_cache_remove(struct dns_cache* cache, size_t slot)
+{
+    cache->records_bytes -= cache->entries[slot].records_len;
+    free(cache->entries[slot].records);
+    --cache->num_entries;
+
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & cache->entry_mask; cache->entries[next].type != 0;
+         next = (next + 1) & cache->entry_mask)
+    {
+        const size_t home = _dns_cache_home(cache, cache->entries[next].hash);
+        if (((next - home) & cache->entry_mask) >= ((next - hole) & cache->entry_mask))
+        {
+            cache->entries[hole] = cache->entries[next];
+            hole = next;
+        }
+    }
+
+    memset(&cache->entries[hole], 0, sizeof(struct dns_cache_entry));
+}
+
+// What a lookup wants from one name's run of slots: the type asked for, and
+// failing that the name's NXDOMAIN or CNAME
+struct dns_cache_probe {
+    struct dns_cache_entry* type;
+    struct dns_cache_entry* nxdomain;
+    struct dns_cache_entry* cname;
+};
+
+// Finds all three in one pass. The name is only compared in the arena the
+// first time, after that its offset is known. Anything expired is dropped
+// and the run scanned again, since dropping it may have moved the others.
+static void _dns_cache_probe(
+    struct dns_cache* cache,
+    const uint8_t* folded,
+    size_t len,
+    uint32_t hash,
+    uint16_t type,
+    uint64_t now_ns,
+    struct dns_cache_probe* probe_out)
+{
+    for (;;)
+    {
+        memset(probe_out, 0, sizeof(*probe_out));
+        uint32_t name = 0;
+        size_t expired = SIZE_MAX;
+        for (size_t slot = _dns_cache_home(cache, hash); cache->entries[slot].type != 0 && expired == SIZE_MAX;
+             slot = (slot + 1) & cache->entry_mask)
+        {
+            struct dns_cache_entry* entry = &cache->entries[slot];
+            const bool wanted = entry->type == type || entry->type == DNS_TYPE_ANY || entry->type == DNS_TYPE_CNAME;
+            if (entry->hash != hash || !wanted ||
+                (name != 0 ? entry->name != name : !_dns_cache_name_is(cache, entry->name, folded, len)))
+            {
+                continue;
+            }
+
+            name = entry->name;
+            if (entry->expires_ns <= now_ns)
+            {
+                expired = slot;
+            }
+            else if (entry->type == type)
+            {
+                probe_out->type = entry;
+            }
+            else if (entry->type == DNS_TYPE_ANY)
+            {
+                probe_out->nxdomain = entry;
+            }
+            else
+            {
+                probe_out->cname = entry;
+            }
+        }
+
+        if (expired == SIZE_MAX)
+        {
+            return;
+        }
+
+        _dns_cache_remove(cache, expired);
+        ++cache->stats.expired;
+    }
+}
+
+// Whatever expires soonest of the entries after home, anything expired
+// first. False if there was nothing there to evict.
+static bool _dns_cache_evict(struct dns_cache* cache, size_t home, uint64_t now_ns)
+{
+    size_t victim = SIZE_MAX;
+    for (size_t i = 0; i < DNS_CACHE_EVICT_SCAN; ++i)
+    {
+        const size_t slot = (home + i) & cache->entry_mask;
+        const struct dns_cache_entry* entry = &cache->entries[slot];
+        if (entry->type != 0 && (victim == SIZE_MAX || entry->expires_ns < cache->entries[victim].expires_ns))
+        {
+            victim = slot;
+            if (entry->expires_ns <= now_ns)
+            {
+                break;
+            }
+        }
+    }
+
+    if (victim == SIZE_MAX)
+    {
+        return false;
+    }
+
+    _dns_cache_remove(cache, victim);
+    ++cache->stats.evicted;
+    return true;
+}
+
+// Takes records, freeing them if there's nowhere to put them
+static bool _dns_cache_put(struct dns_cache* cache, const struct dns_cache_entry* put, uint64_t now_ns)
+{
+    const size_t home = _dns_cache_home(cache, put->hash);
+    size_t slot = _dns_cache_find(cache, put->name, NULL, 0, put->hash, put->type);
+    if (slot != SIZE_MAX)
+    {
+        _dns_cache_remove(cache, slot);
+    }
+    else if (cache->num_entries >= cache->capacity && !_dns_cache_evict(cache, home, now_ns))
+    {
+        free(put->records);
+        return false;
+    }
+
+    for (slot = home; cache->entries[slot].type != 0; slot = (slot + 1) & cache->entry_mask)
+    {
+    }
+
+    cache->entries[slot] = *put;
+    cache->records_bytes += put->records_len;
+    ++cache->num_entries;
+    ++cache->stats.stored;
+    return true;
+}
+
+// Bytes a record's rdata takes with its names expanded, 0 for types whose
+// rdata we don't know the shape of and so can't safely copy
+static size_t _dns_cache_rdata_length(const struct dns_answer* answer)
+{
+    switch (answer->type)
+    {
+        case DNS_TYPE_A:
+        case DNS_TYPE_AAAA:
+        case DNS_TYPE_TXT:
+            return answer->rdlength;
+
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_NS:
+            return answer->data.target.length;
+
+        case DNS_TYPE_MX:
+            return sizeof(uint16_t) + answer->data.mx.exchange.length;
+
+        case DNS_TYPE_SOA:
+            return answer->data.soa.mname.length + answer->data.soa.rname.length + DNS_CACHE_SOA_FIXED_SIZE;
+
+        default:
+            return 0;
+    }
+}
+
+static void _dns_cache_write_rdata(const struct dns_answer* answer, uint8_t* out, size_t len)
+{
+    switch (answer->type)
+    {
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_NS:
+            dns_name_to_wire(&answer->data.target, out, len);
+            break;
+
+        case DNS_TYPE_MX:
+            _dns_cache_write_u16(out, answer->data.mx.preference);
+            dns_name_to_wire(&answer->data.mx.exchange, out + sizeof(uint16_t), len - sizeof(uint16_t));
+            break;
+
+        case DNS_TYPE_SOA:
+        {
+            const size_t mname_len = dns_name_to_wire(&answer->data.soa.mname, out, len);
+            const size_t rname_len = dns_name_to_wire(&answer->data.soa.rname, out + mname_len, len - mname_len);
+            memcpy(out + mname_len + rname_len,
+                   answer->rdata + answer->rdlength - DNS_CACHE_SOA_FIXED_SIZE,
+                   DNS_CACHE_SOA_FIXED_SIZE);
+            break;
+        }
+
+        default:
+            memcpy(out, answer->rdata, len);
+            break;
+    }
+}
+
+static uint32_t _dns_cache_intern_name(struct dns_cache* cache, const struct dns_name* name, uint32_t* hash_out)
+{
+    uint8_t wire[DNS_MAX_NAME_LENGTH];
+    const size_t len = dns_name_to_wire(name, wire, sizeof(wire));
+    return len > 0 ? _dns_cache_intern(cache, wire, len, hash_out) : 0;
+}
+
+static uint64_t _dns_cache_expiry(const struct dns_cache* cache, uint32_t ttl, uint64_t now_ns)
+{
+    return now_ns + (uint64_t)(ttl < cache->max_ttl ? ttl : cache->max_ttl) * DNS_NS_PER_SEC;
+}
+
+// Every record with the same owner and type as records[first], which is the
+// first of them, as one entry
+static bool _dns_cache_store_rrset(
+    struct dns_cache* cache,
+    const struct dns_answer* records,
+    size_t num_records,
+    size_t first,
+    uint64_t now_ns)
+{
+    const struct dns_answer* head = &records[first];
+    size_t records_len = 0;
+    uint32_t ttl = head->ttl;
+    uint16_t count = 0;
+    for (size_t r = first; r < num_records; ++r)
+    {
+        if (records[r].type == head->type && dns_name_equals(&records[r].name, &head->name))
+        {
+            records_len += sizeof(uint16_t) + _dns_cache_rdata_length(&records[r]);
+            ttl = records[r].ttl < ttl ? records[r].ttl : ttl;
+            ++count;
+        }
+    }
+
+    uint32_t hash;
+    const uint32_t name = _dns_cache_intern_name(cache, &head->name, &hash);
+    uint8_t* blob = records_len <= UINT16_MAX ? malloc(records_len) : NULL;
+    if (ttl == 0 || name == 0 || !blob)
+    {
+        free(blob);
+        return false;
+    }
+
+    uint8_t* write = blob;
+    for (size_t r = first; r < num_records; ++r)
+    {
+        if (records[r].type == head->type && dns_name_equals(&records[r].name, &head->name))
+        {
+            const size_t rdata_len = _dns_cache_rdata_length(&records[r]);
+            _dns_cache_write_u16(write, (uint16_t)rdata_len);
+            _dns_cache_write_rdata(&records[r], write + sizeof(uint16_t), rdata_len);
+            write += sizeof(uint16_t) + rdata_len;
+        }
+    }
+
+    const struct dns_cache_entry entry = {
+        .expires_ns = _dns_cache_expiry(cache, ttl, now_ns),
+        .records = blob,
+        .name = name,
+        .hash = hash,
+        .records_len = (uint16_t)records_len,
+        .type = head->type,
+        .count = count,
+        .rcode = DNS_RCODE_NOERROR
+    };
+    return _dns_cache_put(cache, &entry, now_ns);
+}
+
+// NXDOMAIN or no data for name, kept along with the SOA that says for how
+// long, so it can be handed back in the authority section
+static bool _dns_cache_store_negative(
+    struct dns_cache* cache,
+    const struct dns_name* name,
+    uint16_t type,
+    int rcode,
+    const struct dns_answer* soa,
+    uint64_t now_ns)
+{
+    const uint32_t ttl = soa->ttl < soa->data.soa.minimum ? soa->ttl : soa->data.soa.minimum;
+    const size_t rdata_len = _dns_cache_rdata_length(soa);
+    const size_t records_len = 1 + soa->name.length + sizeof(uint16_t) + rdata_len;
+    uint32_t hash;
+    const uint32_t owner = _dns_cache_intern_name(cache, name, &hash);
+    uint8_t* blob = malloc(records_len);
+    if (ttl == 0 || owner == 0 || !blob)
+    {
+        free(blob);
+        return false;
+    }
+
+    blob[0] = soa->name.length;
+    dns_name_to_wire(&soa->name, blob + 1, soa->name.length);
+    uint8_t* record = blob + 1 + soa->name.length;
+    _dns_cache_write_u16(record, (uint16_t)rdata_len);
+    _dns_cache_write_rdata(soa, record + sizeof(uint16_t), rdata_len);
+    const struct dns_cache_entry entry = {
+        .expires_ns = _dns_cache_expiry(cache, ttl, now_ns),
+        .records = blob,
+        .name = owner,
+        .hash = hash,
+        .records_len = (uint16_t)records_len,
+        .type = rcode == DNS_RCODE_NXDOMAIN ? DNS_TYPE_ANY : type,
+        .count = 1,
+        .rcode = (uint8_t)rcode,
+        .negative = true
+    };
+    return _dns_cache_put(cache, &entry, now_ns);
+}
+
+size_t dns_cache_store(struct dns_cache* cache, const uint8_t* response, size_t len, uint64_t now_ns)
+{
+    struct dns_parser parser;
+    struct dns_question question;
+    if (!dns_parser_init(&parser, response, len) || !(parser.header.flags & DNS_FLAG_QR) ||
+        (parser.header.flags & DNS_FLAG_TC) || parser.header.qdcount != 1 ||
+        !dns_parser_next_question(&parser, &question) || question.qclass != DNS_CLASS_IN)
+    {
+        return 0;
+    }
+
+    const int rcode = parser.header.flags & DNS_RCODE_MASK;
+    if (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)
+    {
+        return 0;
+    }
+
+    // Answers we can cache, and the SOA if there is one. All or nothing, so
+    // an RRset is never cached with some of its records missing.
+    struct dns_answer records[DNS_CACHE_MAX_RECORDS];
+    struct dns_answer soa;
+    struct dns_answer record;
+    size_t num_records = 0;
+    bool has_soa = false;
+    while (dns_parser_next_record(&parser, &record) && record.section != DNS_SECTION_ADDITIONAL)
+    {
+        if (record.class != DNS_CLASS_IN)
+        {
+            continue;
+        }
+
+        if (record.section == DNS_SECTION_AUTHORITY)
+        {
+            if (record.type == DNS_TYPE_SOA && !has_soa)
+            {
+                soa = record;
+                has_soa = true;
+            }
+            continue;
+        }
+
+        if (num_records == DNS_CACHE_MAX_RECORDS)
+        {
+            return 0;
+        }
+
+        if (_dns_cache_rdata_length(&record) > 0)
+        {
+            records[num_records++] = record;
+        }
+    }
+
+    if (parser.failed)
+    {
+        return 0;
+    }
+
+    _dns_cache_make_room(cache);
+    size_t stored = 0;
+    for (size_t r = 0; r < num_records; ++r)
+    {
+        bool seen = false;
+        for (size_t earlier = 0; earlier < r && !seen; ++earlier)
+        {
+            seen = records[earlier].type == records[r].type &&
+                   dns_name_equals(&records[earlier].name, &records[r].name);
+        }
+
+        if (!seen && _dns_cache_store_rrset(cache, records, num_records, r, now_ns))
+        {
+            ++stored;
+        }
+    }
+
+    // Follow the answer's CNAMEs from the question to the name that has the
+    // data, or doesn't, which is what a negative answer is about
+    struct dns_name name = question.qname;
+    bool answered = false;
+    bool chain_ended = false;
+    for (int depth = 0; depth <= DNS_CACHE_MAX_CHAIN && !chain_ended; ++depth)
+    {
+        const struct dns_answer* cname = NULL;
+        for (size_t r = 0; r < num_records; ++r)
+        {
+            if (dns_name_equals(&records[r].name, &name))
+            {
+                if (records[r].type == question.qtype || question.qtype == DNS_TYPE_ANY)
+                {
+                    answered = true;
+                }
+                else if (records[r].type == DNS_TYPE_CNAME)
+                {
+                    cname = &records[r];
+                }
+            }
+        }
+
+        chain_ended = answered || !cname;
+        if (cname)
+        {
+            name = cname->data.target;
+        }
+    }
+
+    if (chain_ended && !answered && has_soa && (rcode == DNS_RCODE_NXDOMAIN || question.qtype != DNS_TYPE_ANY) &&
+        _dns_cache_store_negative(cache, &name, question.qtype, rcode, &soa, now_ns))
+    {
+        ++stored;
+    }
+
+    return stored;
+}
+
+static void _dns_cache_add_to_chain(
+    const struct dns_cache* cache,
+    struct dns_cache_result* result,
+    const struct dns_cache_entry* entry,
+    uint64_t now_ns)
+{
+    struct dns_cache_rrset* rrset = &result->chain[result->chain_length++];
+    if (entry->negative)
+    {
+        rrset->name = entry->records + 1;
+        rrset->name_length = entry->records[0];
+        rrset->type = DNS_TYPE_SOA;
+        rrset->records = entry->records + 1 + rrset->name_length;
+        rrset->records_len = entry->records_len - 1 - rrset->name_length;
+    }
+    else
+    {
+        rrset->name = &cache->arena[entry->name + 1];
+        rrset->name_length = cache->arena[entry->name];
+        rrset->type = entry->type;
+        rrset->records = entry->records;
+        rrset->records_len = entry->records_len;
+    }
+
+    rrset->ttl = (uint32_t)((entry->expires_ns - now_ns) / DNS_NS_PER_SEC);
+    rrset->count = entry->count;
+    if (result->chain_length == 1 || rrset->ttl < result->ttl)
+    {
+        result->ttl = rrset->ttl;
+    }
+}
+
+bool dns_cache_lookup(
+    struct dns_cache* cache,
+    const uint8_t* qname,
+    size_t qname_len,
+    uint16_t qtype,
+    uint64_t now_ns,
+    struct dns_cache_result* result_out)
+{
+    memset(result_out, 0, offsetof(struct dns_cache_result, chain));
+    result_out->chain_length = 0;
+
+    uint8_t folded[DNS_CACHE_FOLDED_SIZE];
+    size_t len = qname_len;
+    uint32_t hash = len > 0 && len <= DNS_MAX_NAME_LENGTH ? _dns_cache_fold_and_hash(qname, len, folded) : 0;
+    for (int depth = 0; depth <= DNS_CACHE_MAX_CHAIN && len > 0 && len <= DNS_MAX_NAME_LENGTH; ++depth)
+    {
+        // The type asked for, or failing that no data for it or no such name
+        // at all, or failing that a CNAME to follow
+        struct dns_cache_probe probe;
+        _dns_cache_probe(cache, folded, len, hash, qtype, now_ns, &probe);
+        const struct dns_cache_entry* entry = probe.type ? probe.type : probe.nxdomain;
+        if (entry)
+        {
+            _dns_cache_add_to_chain(cache, result_out, entry, now_ns);
+            result_out->status = entry->negative ? DNS_CACHE_NEGATIVE : DNS_CACHE_HIT;
+            result_out->rcode = entry->rcode;
+            break;
+        }
+
+        if (!probe.cname || depth == DNS_CACHE_MAX_CHAIN)
+        {
+            break;
+        }
+
+        _dns_cache_add_to_chain(cache, result_out, probe.cname, now_ns);
+        len = _dns_cache_read_u16(probe.cname->records);
+        if (len > 0 && len <= DNS_MAX_NAME_LENGTH)
+        {
+            hash = _dns_cache_fold_and_hash(probe.cname->records + sizeof(uint16_t), len, folded);
+        }
+    }
+
+    if (result_out->status == DNS_CACHE_MISS)
+    {
+        result_out->chain_length = 0;
+        ++cache->stats.misses;
+        return false;
+    }
+
+    ++cache->stats.hits;
+    if (result_out->status == DNS_CACHE_NEGATIVE)
+    {
+        ++cache->stats.negative_hits;
+    }
+
+    return true;
+}
+
+size_t dns_cache_memory(const struct dns_cache* cache)
+{
+    return (cache->entry_mask + 1) * sizeof(struct dns_cache_entry) +
+           (cache->name_mask + 1) * sizeof(struct dns_cache_name_slot) +
+           cache->arena_cap +
+           cache->records_bytes;
+}
+
+void dns_cache_print_stats(const struct dns_cache* cache, FILE* stream)
+{
+    const struct dns_cache_stats* stats = &cache->stats;
+    const uint64_t lookups = stats->hits + stats->misses;
+    fprintf(stream,
+            "%lu hits (%lu negative), %lu misses (%lu expired), %.1f%% hit rate\n",
+            stats->hits,
+            stats->negative_hits,
+            stats->misses,
+            stats->expired,
+            lookups > 0 ? 100.0 * stats->hits / lookups : 0.0);
+    fprintf(stream,
+            "%zu/%zu entries, %zu names, %lu stored, %lu evicted, %lu flushed, %.1f MB\n",
+            cache->num_entries,
+            cache->capacity,
+            cache->num_names,
+            stats->stored,
+            stats->evicted,
+            stats->flushed,
+            dns_cache_memory(cache) / (1024.0 * 1024.0));
+}
@@ -0,0 +1,150 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+// Resolver cache keyed by (name, type). Names are case-folded and interned
+// once into an arena as they're stored. Entries sit in an open addressing
+// table with linear probing, at most half full, homed by the name's hash
+// alone, so every type for a name is in the same run of slots. A lookup that
+// misses its type and goes on to look for a CNAME or an NXDOMAIN stays in the
+// cache lines it has already pulled in. Probing compares the hash and type,
+// and only goes out to the arena to compare names once both match.
+//
+// Each RRset expires with the smallest TTL in it, capped at max_ttl.
+// NXDOMAIN is cached under (name, ANY), since it answers every type, and an
+// empty NOERROR under (name, type). Both last for the SOA's negative TTL (RFC
+// 2308), and aren't cached at all without one. Lookups follow CNAMEs that are
+// already in the cache.
+//
+// A full entry table evicts whichever of a few entries near the new one's
+// slot expires first. Interned names are only dropped by a flush, which
+// happens when the name table fills. That's rare with capacity sized to the
+// working set, and much cheaper than counting references to every name.
+//
+// Nothing is locked, it's one cache per thread.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DNS_CACHE_DEFAULT_CAPACITY 65536
+#define DNS_CACHE_MAX_CAPACITY (1 << 24)
+#define DNS_CACHE_DEFAULT_MAX_TTL 86400
+
+// CNAMEs followed before a lookup gives up
+#define DNS_CACHE_MAX_CHAIN 8
+
+// Records looked at in one response, more than this and it isn't cached
+#define DNS_CACHE_MAX_RECORDS 64
+
+// Slots after the new entry's looked at to pick something to evict
+#define DNS_CACHE_EVICT_SCAN 16
+
+enum dns_cache_status
+{
+    DNS_CACHE_MISS = 0,
+    DNS_CACHE_HIT,
+    DNS_CACHE_NEGATIVE
+};
+
+// 32 bytes, two to a cache line
+struct dns_cache_entry {
+    uint64_t expires_ns;
+    uint8_t* records;     // See dns_cache_rrset, negative answers put the
+                          // SOA's owner first, a length byte then wire form
+    uint32_t name;        // Offset of the interned name
+    uint32_t hash;        // Of the folded name
+    uint16_t records_len;
+    uint16_t type;        // 0 for an empty slot
+    uint16_t count;
+    uint8_t rcode;
+    bool negative;
+};
+
+struct dns_cache_name_slot {
+    uint32_t offset; // 0 for an empty slot
+    uint32_t hash;
+};
+
+struct dns_cache_stats {
+    uint64_t hits;
+    uint64_t negative_hits; // Included in hits
+    uint64_t misses;
+    uint64_t expired;       // Entries found past their TTL, each also a miss
+    uint64_t stored;        // RRsets and negative answers
+    uint64_t evicted;
+    uint64_t flushed;
+};
+
+struct dns_cache {
+    size_t capacity;
+    uint32_t max_ttl;
+
+    struct dns_cache_entry* entries;
+    size_t entry_mask;
+    size_t num_entries;
+
+    struct dns_cache_name_slot* names;
+    size_t name_mask;
+    size_t num_names;
+
+    // Interned names, each a length byte then the folded wire form
+    uint8_t* arena;
+    size_t arena_len;
+    size_t arena_cap;
+
+    size_t records_bytes;
+    struct dns_cache_stats stats;
+};
+
+// Records of one RRset, each a 16 bit big-endian length then its rdata with
+// any names expanded, so they can go into a response as they are
+struct dns_cache_rrset {
+    const uint8_t* name; // Wire form, case-folded but for a negative's zone
+    uint8_t name_length;
+    uint16_t type;
+    uint32_t ttl;        // Seconds left
+    uint16_t count;
+    const uint8_t* records;
+    uint32_t records_len;
+};
+
+// Any CNAMEs followed, then the RRset asked for. Negative answers end with
+// the SOA instead, owned by its zone. Everything points into the cache and
+// is only good until the next call into it.
+struct dns_cache_result {
+    enum dns_cache_status status;
+    int rcode;
+    uint32_t ttl;        // Smallest across the chain
+    struct dns_cache_rrset chain[DNS_CACHE_MAX_CHAIN + 1];
+    int chain_length;
+};
+
+bool dns_cache_init(struct dns_cache* cache, size_t capacity);
+void dns_cache_free(struct dns_cache* cache);
+
+// Drops every entry and interned name
+void dns_cache_flush(struct dns_cache* cache);
+
+// Caches what it can from a response: the answer section's RRsets for the
+// types whose rdata it knows, and a negative answer if there's an SOA to time
+// it. Truncated responses and anything but NOERROR or NXDOMAIN are skipped.
+// Returns how many RRsets and negative answers were stored.
+size_t dns_cache_store(struct dns_cache* cache, const uint8_t* response, size_t len, uint64_t now_ns);
+
+// qname is uncompressed wire form, case doesn't matter. True for a hit,
+// negative or not, with the answer in result_out.
+bool dns_cache_lookup(
+    struct dns_cache* cache,
+    const uint8_t* qname,
+    size_t qname_len,
+    uint16_t qtype,
+    uint64_t now_ns,
+    struct dns_cache_result* result_out);
+
+// Table and arena bytes, plus what the RRsets hold
+size_t dns_cache_memory(const struct dns_cache* cache);
+
+void dns_cache_print_stats(const struct dns_cache* cache, FILE* stream);
+
+#endif // __CACHE_H__
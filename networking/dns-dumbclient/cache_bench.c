@@ -0,0 +1,352 @@
+// Resolver cache checks and lookup latency. The canned responses in samples.c
+// go in first, to check RRsets, CNAME chains, negative answers and expiry
+// come back out right. A small cache checks eviction. Then the cache is
+// filled with a million stub answers, a tenth of them NXDOMAIN, and random
+// lookups over them are timed, in bulk and one at a time for percentiles.
+// The one at a time numbers include a clock read.
+//
+// Usage: dns-cache-bench [--count n]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "dns.h"
+#include "parse.h"
+#include "samples.h"
+#include "stub.h"
+
+#define DNS_CACHE_BENCH_DEFAULT_COUNT 1000000
+#define DNS_CACHE_BENCH_NAME_LENGTH 48
+
+// One name in this many is an nx- name, cached as NXDOMAIN
+#define DNS_CACHE_BENCH_NX_EVERY 10
+
+#define DNS_CACHE_BENCH_LOOKUPS 4000000
+#define DNS_CACHE_BENCH_TIMED_LOOKUPS 200000
+
+#define DNS_CACHE_BENCH_EVICT_CAPACITY 64
+#define DNS_CACHE_BENCH_EVICT_STORES 1000
+
+static uint32_t s_rng = 0x9E3779B9u;
+
+static uint32_t _dns_cache_bench_random()
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static bool _dns_cache_bench_lookup(
+    struct dns_cache* cache,
+    const char* name,
+    uint16_t qtype,
+    uint64_t now_ns,
+    struct dns_cache_result* result_out)
+{
+    uint8_t wire[DNS_MAX_NAME_LENGTH];
+    const size_t len = dns_encode_name(name, wire, sizeof(wire));
+    return dns_cache_lookup(cache, wire, len, qtype, now_ns, result_out);
+}
+
+// What the stub would answer for name, as a response to store
+static size_t _dns_cache_bench_stub_response(const char* name, uint16_t qtype, uint8_t* response, size_t cap)
+{
+    uint8_t query[DNS_MAX_UDP_SIZE];
+    const size_t query_len = dns_encode_query(0x1234, name, qtype, 0, query, sizeof(query));
+    return dns_stub_answer(query, query_len, false, response, cap);
+}
+
+static bool _dns_cache_bench_expect(
+    struct dns_cache* cache,
+    const char* name,
+    uint16_t qtype,
+    uint64_t now_ns,
+    enum dns_cache_status status,
+    int chain_length,
+    uint32_t ttl)
+{
+    struct dns_cache_result result;
+    _dns_cache_bench_lookup(cache, name, qtype, now_ns, &result);
+    if (result.status != status || result.chain_length != chain_length ||
+        (status != DNS_CACHE_MISS && result.ttl != ttl))
+    {
+        fprintf(stderr,
+                "Wrong cache answer - name: %s type: %u status: %d/%d chain: %d/%d ttl: %u/%u\n",
+                name,
+                qtype,
+                result.status,
+                status,
+                result.chain_length,
+                chain_length,
+                result.ttl,
+                ttl);
+        return false;
+    }
+
+    return true;
+}
+
+static bool _dns_cache_bench_check(uint64_t now_ns)
+{
+    struct dns_cache cache;
+    if (!dns_cache_init(&cache, DNS_CACHE_DEFAULT_CAPACITY))
+    {
+        return false;
+    }
+
+    size_t num_samples;
+    const struct dns_sample* samples = dns_samples(&num_samples);
+    for (size_t s = 0; s < num_samples; ++s)
+    {
+        dns_cache_store(&cache, samples[s].packet, samples[s].len, now_ns);
+    }
+
+    const uint64_t sec = DNS_NS_PER_SEC;
+    bool valid = true;
+    valid &= _dns_cache_bench_expect(&cache, "www.example.com", DNS_TYPE_A, now_ns, DNS_CACHE_HIT, 1, 300);
+    valid &= _dns_cache_bench_expect(&cache, "WWW.Example.COM.", DNS_TYPE_A, now_ns, DNS_CACHE_HIT, 1, 300);
+    valid &= _dns_cache_bench_expect(&cache, "www.example.com", DNS_TYPE_A, now_ns + 299 * sec, DNS_CACHE_HIT, 1, 1);
+    valid &= _dns_cache_bench_expect(&cache, "www.example.com", DNS_TYPE_A, now_ns + 300 * sec, DNS_CACHE_MISS, 0, 0);
+    valid &= _dns_cache_bench_expect(&cache, "www.example.com", DNS_TYPE_AAAA, now_ns, DNS_CACHE_MISS, 0, 0);
+
+    // Two CNAMEs to the A records, the chain as short-lived as its shortest
+    valid &= _dns_cache_bench_expect(&cache, "www.example.org", DNS_TYPE_A, now_ns, DNS_CACHE_HIT, 3, 20);
+    valid &= _dns_cache_bench_expect(&cache, "www.example.org", DNS_TYPE_CNAME, now_ns, DNS_CACHE_HIT, 1, 3600);
+    valid &= _dns_cache_bench_expect(&cache, "edge.cdn.example.net", DNS_TYPE_A, now_ns, DNS_CACHE_HIT, 2, 20);
+    valid &= _dns_cache_bench_expect(&cache, "www.example.org", DNS_TYPE_A, now_ns + 20 * sec, DNS_CACHE_MISS, 0, 0);
+
+    // NXDOMAIN holds for every type, for the SOA's minimum
+    valid &= _dns_cache_bench_expect(&cache, "nope.example.com", DNS_TYPE_A, now_ns, DNS_CACHE_NEGATIVE, 1, 3600);
+    valid &= _dns_cache_bench_expect(&cache, "nope.example.com", DNS_TYPE_MX, now_ns, DNS_CACHE_NEGATIVE, 1, 3600);
+
+    // Records come back with their names expanded
+    struct dns_cache_result result;
+    char text[DNS_MAX_NAME_TEXT];
+    uint8_t expected_exchange[DNS_MAX_NAME_LENGTH];
+    const size_t exchange_len = dns_encode_name("mail.example.com", expected_exchange, sizeof(expected_exchange));
+    _dns_cache_bench_lookup(&cache, "example.com", DNS_TYPE_MX, now_ns, &result);
+    const uint8_t* mx = result.chain[0].records;
+    if (result.status != DNS_CACHE_HIT || result.chain[0].count != 2 ||
+        mx[0] != 0 || mx[1] != sizeof(uint16_t) + exchange_len || mx[3] != 10 ||
+        memcmp(mx + 4, expected_exchange, exchange_len) != 0)
+    {
+        fprintf(stderr, "Wrong MX records from cache\n");
+        valid = false;
+    }
+
+    _dns_cache_bench_lookup(&cache, "nope.example.com", DNS_TYPE_A, now_ns, &result);
+    const struct dns_cache_rrset* soa = &result.chain[0];
+    const struct dns_name zone = { soa->name, soa->name_length, 0, soa->name_length };
+    if (result.rcode != DNS_RCODE_NXDOMAIN || soa->type != DNS_TYPE_SOA || !dns_name_equals_text(&zone, "example.com"))
+    {
+        dns_name_to_text(&zone, text, sizeof(text));
+        fprintf(stderr, "Wrong negative answer from cache - rcode: %d zone: %s\n", result.rcode, text);
+        valid = false;
+    }
+    valid &= _dns_cache_bench_expect(&cache, "nope.example.com", DNS_TYPE_A, now_ns + 3600 * sec, DNS_CACHE_MISS, 0, 0);
+
+    // The stub's NXDOMAIN and no data answers carry an SOA, so they cache too
+    uint8_t response[DNS_MAX_UDP_SIZE];
+    size_t len = _dns_cache_bench_stub_response("nx-1.stub.test", DNS_TYPE_A, response, sizeof(response));
+    dns_cache_store(&cache, response, len, now_ns);
+    len = _dns_cache_bench_stub_response("host-1.stub.test", DNS_TYPE_TXT, response, sizeof(response));
+    dns_cache_store(&cache, response, len, now_ns);
+    const uint32_t negative_ttl = DNS_STUB_NEGATIVE_TTL;
+    const enum dns_cache_status negative = DNS_CACHE_NEGATIVE;
+    valid &= _dns_cache_bench_expect(&cache, "nx-1.stub.test", DNS_TYPE_AAAA, now_ns, negative, 1, negative_ttl);
+    valid &= _dns_cache_bench_expect(&cache, "host-1.stub.test", DNS_TYPE_TXT, now_ns, negative, 1, negative_ttl);
+    valid &= _dns_cache_bench_expect(&cache, "host-1.stub.test", DNS_TYPE_A, now_ns, DNS_CACHE_MISS, 0, 0);
+    valid &= _dns_cache_bench_expect(&cache, "never.stored.test", DNS_TYPE_A, now_ns, DNS_CACHE_MISS, 0, 0);
+    if (cache.stats.expired == 0)
+    {
+        fprintf(stderr, "Nothing expired\n");
+        valid = false;
+    }
+
+    dns_cache_free(&cache);
+
+    // A full cache evicts rather than refusing, flushes once its names fill
+    // up, and either way keeps what was just stored
+    if (!dns_cache_init(&cache, DNS_CACHE_BENCH_EVICT_CAPACITY))
+    {
+        return false;
+    }
+
+    char name[DNS_CACHE_BENCH_NAME_LENGTH];
+    for (int i = 0; i < DNS_CACHE_BENCH_EVICT_STORES && valid; ++i)
+    {
+        snprintf(name, sizeof(name), "evict-%d.stub.test", i);
+        len = _dns_cache_bench_stub_response(name, DNS_TYPE_A, response, sizeof(response));
+        dns_cache_store(&cache, response, len, now_ns + i);
+        valid = _dns_cache_bench_expect(&cache, name, DNS_TYPE_A, now_ns + i, DNS_CACHE_HIT, 1, DNS_STUB_TTL);
+    }
+
+    if (cache.num_entries > DNS_CACHE_BENCH_EVICT_CAPACITY || cache.stats.evicted == 0 || cache.stats.flushed == 0)
+    {
+        fprintf(stderr,
+                "Cache didn't evict - entries: %zu evicted: %lu flushed: %lu\n",
+                cache.num_entries,
+                cache.stats.evicted,
+                cache.stats.flushed);
+        valid = false;
+    }
+
+    dns_cache_free(&cache);
+    return valid;
+}
+
+static int _dns_cache_bench_compare_u64(const void* a, const void* b)
+{
+    const uint64_t lhs = *(const uint64_t*)a;
+    const uint64_t rhs = *(const uint64_t*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Stub answers for count names, then lookups over them in random order
+static bool _dns_cache_bench_run(size_t count, uint64_t now_ns)
+{
+    struct dns_cache cache;
+    uint8_t (*names)[DNS_CACHE_BENCH_NAME_LENGTH] = malloc(count * DNS_CACHE_BENCH_NAME_LENGTH);
+    uint8_t* name_lengths = malloc(count);
+    uint64_t* latencies = malloc(DNS_CACHE_BENCH_TIMED_LOOKUPS * sizeof(uint64_t));
+    if (!names || !name_lengths || !latencies || !dns_cache_init(&cache, count))
+    {
+        fprintf(stderr, "Out of memory for %zu names\n", count);
+        return false;
+    }
+
+    uint8_t response[DNS_MAX_UDP_SIZE];
+    char name[DNS_CACHE_BENCH_NAME_LENGTH];
+    uint64_t start_ns = dns_now_ns();
+    for (size_t i = 0; i < count; ++i)
+    {
+        snprintf(name, sizeof(name), "%s-%zu.Cache.Test", i % DNS_CACHE_BENCH_NX_EVERY == 0 ? "nx" : "host", i);
+        name_lengths[i] = (uint8_t)dns_encode_name(name, names[i], DNS_CACHE_BENCH_NAME_LENGTH);
+        const size_t len = _dns_cache_bench_stub_response(name, DNS_TYPE_A, response, sizeof(response));
+        dns_cache_store(&cache, response, len, now_ns);
+    }
+    const uint64_t store_ns = dns_now_ns() - start_ns;
+
+    // Every name, with the stub's address for it or NXDOMAIN
+    bool valid = cache.num_entries == count;
+    struct dns_cache_result result;
+    for (size_t i = 0; i < count && valid; ++i)
+    {
+        dns_cache_lookup(&cache, names[i], name_lengths[i], DNS_TYPE_A, now_ns, &result);
+        if (i % DNS_CACHE_BENCH_NX_EVERY == 0)
+        {
+            valid = result.status == DNS_CACHE_NEGATIVE && result.rcode == DNS_RCODE_NXDOMAIN;
+        }
+        else
+        {
+            const uint8_t* rdata = result.chain[0].records + sizeof(uint16_t);
+            const uint32_t address =
+                ((uint32_t)rdata[0] << 24) | ((uint32_t)rdata[1] << 16) | ((uint32_t)rdata[2] << 8) | rdata[3];
+            valid = result.status == DNS_CACHE_HIT && address == dns_stub_address(names[i], name_lengths[i]);
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "Wrong answer at scale - index: %zu status: %d\n", i, result.status);
+        }
+    }
+
+    // Bulk, with the random picks made up front out of the timing
+    uint32_t* picks = malloc(DNS_CACHE_BENCH_LOOKUPS * sizeof(uint32_t));
+    for (size_t l = 0; l < DNS_CACHE_BENCH_LOOKUPS && picks; ++l)
+    {
+        picks[l] = _dns_cache_bench_random() % count;
+    }
+
+    const uint64_t hits_before = cache.stats.hits;
+    uint64_t bulk_ns = 0;
+    if (picks && valid)
+    {
+        start_ns = dns_now_ns();
+        for (size_t l = 0; l < DNS_CACHE_BENCH_LOOKUPS; ++l)
+        {
+            dns_cache_lookup(&cache, names[picks[l]], name_lengths[picks[l]], DNS_TYPE_A, now_ns, &result);
+        }
+        bulk_ns = dns_now_ns() - start_ns;
+        valid = cache.stats.hits - hits_before == DNS_CACHE_BENCH_LOOKUPS;
+    }
+
+    // Just reading the picked names, which is a cache miss of its own before
+    // the lookup even starts. What's left of the hit time is the cache's.
+    uint64_t checksum = 0;
+    start_ns = dns_now_ns();
+    for (size_t l = 0; l < DNS_CACHE_BENCH_LOOKUPS && picks; ++l)
+    {
+        checksum += names[picks[l]][name_lengths[picks[l]] - 2];
+    }
+    const uint64_t read_ns = dns_now_ns() - start_ns;
+
+    // Names that are cached, but not for this type, which misses after one
+    // run of slots
+    start_ns = dns_now_ns();
+    for (size_t l = 0; l < DNS_CACHE_BENCH_LOOKUPS && picks; ++l)
+    {
+        dns_cache_lookup(&cache, names[picks[l]], name_lengths[picks[l]], DNS_TYPE_AAAA, now_ns, &result);
+    }
+    const uint64_t type_miss_ns = dns_now_ns() - start_ns;
+
+    for (size_t l = 0; l < DNS_CACHE_BENCH_TIMED_LOOKUPS && picks; ++l)
+    {
+        const uint64_t lookup_start_ns = dns_now_ns();
+        dns_cache_lookup(&cache, names[picks[l]], name_lengths[picks[l]], DNS_TYPE_A, now_ns, &result);
+        latencies[l] = dns_now_ns() - lookup_start_ns;
+    }
+    qsort(latencies, DNS_CACHE_BENCH_TIMED_LOOKUPS, sizeof(uint64_t), _dns_cache_bench_compare_u64);
+
+    fprintf(stdout,
+            "%zu entries stored in %.3f s, %.0f stores/sec\n",
+            count,
+            (double)store_ns / DNS_NS_PER_SEC,
+            count / ((double)store_ns / DNS_NS_PER_SEC));
+    fprintf(stdout,
+            "hit        %6.1f ns/lookup %11.0f lookups/sec\n",
+            (double)bulk_ns / DNS_CACHE_BENCH_LOOKUPS,
+            DNS_CACHE_BENCH_LOOKUPS / ((double)bulk_ns / DNS_NS_PER_SEC));
+    fprintf(stdout, "miss       %6.1f ns/lookup\n", (double)type_miss_ns / DNS_CACHE_BENCH_LOOKUPS);
+    fprintf(stdout, "name only  %6.1f ns/lookup  (%lu)\n", (double)read_ns / DNS_CACHE_BENCH_LOOKUPS, checksum & 0xFF);
+    fprintf(stdout,
+            "one by one p50 %lu ns  p99 %lu ns  p99.9 %lu ns  max %lu ns\n",
+            latencies[DNS_CACHE_BENCH_TIMED_LOOKUPS / 2],
+            latencies[DNS_CACHE_BENCH_TIMED_LOOKUPS * 99 / 100],
+            latencies[DNS_CACHE_BENCH_TIMED_LOOKUPS * 999 / 1000],
+            latencies[DNS_CACHE_BENCH_TIMED_LOOKUPS - 1]);
+    dns_cache_print_stats(&cache, stdout);
+
+    free(picks);
+    free(latencies);
+    free(name_lengths);
+    free(names);
+    dns_cache_free(&cache);
+    return valid;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = DNS_CACHE_BENCH_DEFAULT_COUNT;
+    if (argc == 3 && strcmp(argv[1], "--count") == 0 && atoi(argv[2]) > 0 && atoi(argv[2]) <= DNS_CACHE_MAX_CAPACITY)
+    {
+        count = (size_t)atoi(argv[2]);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: %s [--count n]\n", argv[0]);
+        return -1;
+    }
+
+    // Any fixed time works, the cache only ever compares against what it's given
+    const uint64_t now_ns = dns_now_ns();
+    if (!_dns_cache_bench_check(now_ns))
+    {
+        return -1;
+    }
+
+    return _dns_cache_bench_run(count, now_ns) ? 0 : -1;
+}
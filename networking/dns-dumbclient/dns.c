@@ -0,0 +1,280 @@
+#include "dns.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static void _dns_write_u16(uint8_t* buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+}
+
+static uint16_t _dns_read_u16(const uint8_t* buffer)
+{
+    return (uint16_t)((buffer[0] << 8) | buffer[1]);
+}
+
+size_t dns_encode_name(const char* name, uint8_t* buffer, size_t cap)
+{
+    if (name == NULL || cap == 0)
+    {
+        return 0;
+    }
+
+    // One pass, copying each character in after its label's length byte and
+    // going back to fill that in at the dot. A trailing dot is fine, "." or
+    // "" is the root.
+    const size_t limit = cap < DNS_MAX_NAME_LENGTH ? cap : DNS_MAX_NAME_LENGTH;
+    size_t length_at = 0;
+    size_t offset = 1;
+    const char* read = name;
+    if (read[0] == '.' && read[1] == '\0')
+    {
+        ++read;
+    }
+
+    for (; *read != '\0'; ++read)
+    {
+        if (*read != '.')
+        {
+            if (offset >= limit)
+            {
+                return 0;
+            }
+            buffer[offset++] = (uint8_t)*read;
+            continue;
+        }
+
+        const size_t label_len = offset - length_at - 1;
+        if (label_len == 0 || label_len > DNS_MAX_LABEL_LENGTH)
+        {
+            return 0;
+        }
+        buffer[length_at] = (uint8_t)label_len;
+        length_at = offset++;
+        if (read[1] == '\0')
+        {
+            break;
+        }
+    }
+
+    // Whatever's left is the last label, or nothing after a trailing dot, in
+    // which case the root goes where its length byte would have
+    const size_t label_len = offset - length_at - 1;
+    const size_t end = label_len > 0 ? offset + 1 : offset;
+    if (label_len > DNS_MAX_LABEL_LENGTH || end > limit)
+    {
+        return 0;
+    }
+
+    buffer[length_at] = (uint8_t)label_len;
+    if (label_len > 0)
+    {
+        buffer[offset] = 0;
+    }
+    return end;
+}
+
+size_t dns_encode_query(
+    uint16_t id,
+    const char* name,
+    uint16_t qtype,
+    uint16_t edns_udp_size,
+    uint8_t* buffer,
+    size_t cap)
+{
+    if (cap < DNS_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    memset(buffer, 0, DNS_HEADER_SIZE);
+    _dns_write_u16(buffer, id);
+    _dns_write_u16(buffer + 2, DNS_FLAG_RD);
+    _dns_write_u16(buffer + 4, 1);
+
+    const size_t name_len = dns_encode_name(name, buffer + DNS_HEADER_SIZE, cap - DNS_HEADER_SIZE);
+    size_t offset = DNS_HEADER_SIZE + name_len;
+    if (name_len == 0 || offset + 2 * sizeof(uint16_t) > cap)
+    {
+        return 0;
+    }
+
+    _dns_write_u16(buffer + offset, qtype);
+    _dns_write_u16(buffer + offset + 2, DNS_CLASS_IN);
+    offset += 2 * sizeof(uint16_t);
+    if (edns_udp_size == 0)
+    {
+        return offset;
+    }
+
+    // OPT pseudo-record: root name, the UDP size we can take where the class
+    // goes, extended rcode, version and flags all zero, no options
+    if (offset + DNS_OPT_RECORD_SIZE > cap)
+    {
+        return 0;
+    }
+
+    uint8_t* opt = buffer + offset;
+    memset(opt, 0, DNS_OPT_RECORD_SIZE);
+    _dns_write_u16(opt + 1, DNS_TYPE_OPT);
+    _dns_write_u16(opt + 3, edns_udp_size < DNS_MAX_UDP_SIZE ? DNS_MAX_UDP_SIZE : edns_udp_size);
+    _dns_write_u16(buffer + 10, 1);
+    return offset + DNS_OPT_RECORD_SIZE;
+}
+
+bool dns_read_header(const uint8_t* packet, size_t len, struct dns_header* header_out)
+{
+    if (len < DNS_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    header_out->id = _dns_read_u16(packet);
+    header_out->flags = _dns_read_u16(packet + 2);
+    header_out->qdcount = _dns_read_u16(packet + 4);
+    header_out->ancount = _dns_read_u16(packet + 6);
+    header_out->nscount = _dns_read_u16(packet + 8);
+    header_out->arcount = _dns_read_u16(packet + 10);
+    return true;
+}
+
+size_t dns_question_length(const uint8_t* packet, size_t len)
+{
+    size_t offset = DNS_HEADER_SIZE;
+    while (offset < len)
+    {
+        // Room for this length byte and nothing past it, RFC 1035 2.3.4
+        if (offset - DNS_HEADER_SIZE >= DNS_MAX_NAME_LENGTH)
+        {
+            return 0;
+        }
+
+        const uint8_t label_len = packet[offset];
+        if (label_len == 0)
+        {
+            offset += 1 + 2 * sizeof(uint16_t);
+            return offset <= len ? offset - DNS_HEADER_SIZE : 0;
+        }
+
+        if (label_len > DNS_MAX_LABEL_LENGTH)
+        {
+            return 0;
+        }
+        offset += 1 + label_len;
+    }
+
+    return 0;
+}
+
+const char* dns_rcode_name(int rcode)
+{
+    switch (rcode)
+    {
+        case DNS_RCODE_NOERROR: return "NOERROR";
+        case DNS_RCODE_FORMERR: return "FORMERR";
+        case DNS_RCODE_SERVFAIL: return "SERVFAIL";
+        case DNS_RCODE_NXDOMAIN: return "NXDOMAIN";
+        case DNS_RCODE_NOTIMP: return "NOTIMP";
+        case DNS_RCODE_REFUSED: return "REFUSED";
+        default: return "UNKNOWN";
+    }
+}
+
+const char* dns_type_name(uint16_t type)
+{
+    switch (type)
+    {
+        case DNS_TYPE_A: return "A";
+        case DNS_TYPE_NS: return "NS";
+        case DNS_TYPE_CNAME: return "CNAME";
+        case DNS_TYPE_SOA: return "SOA";
+        case DNS_TYPE_MX: return "MX";
+        case DNS_TYPE_TXT: return "TXT";
+        case DNS_TYPE_AAAA: return "AAAA";
+        case DNS_TYPE_OPT: return "OPT";
+        case DNS_TYPE_ANY: return "ANY";
+        default: return NULL;
+    }
+}
+
+uint16_t dns_type_from_name(const char* name)
+{
+    static const uint16_t s_types[] = {
+        DNS_TYPE_A, DNS_TYPE_NS, DNS_TYPE_CNAME, DNS_TYPE_SOA, DNS_TYPE_MX, DNS_TYPE_TXT, DNS_TYPE_AAAA, DNS_TYPE_ANY
+    };
+
+    for (size_t t = 0; t < sizeof(s_types) / sizeof(s_types[0]); ++t)
+    {
+        if (strcasecmp(name, dns_type_name(s_types[t])) == 0)
+        {
+            return s_types[t];
+        }
+    }
+
+    return 0;
+}
+
+bool dns_parse_address(const char* text, uint16_t default_port, struct sockaddr_in* address_out)
+{
+    char host[64];
+    const char* colon = strchr(text, ':');
+    const size_t host_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (host_len >= sizeof(host))
+    {
+        return false;
+    }
+
+    memcpy(host, text, host_len);
+    host[host_len] = '\0';
+    const int port = colon ? atoi(colon + 1) : default_port;
+    memset(address_out, 0, sizeof(*address_out));
+    address_out->sin_family = AF_INET;
+    if (inet_pton(AF_INET, host, &address_out->sin_addr) != 1 || port <= 0 || port > 65535)
+    {
+        return false;
+    }
+
+    address_out->sin_port = htons((uint16_t)port);
+    return true;
+}
+
+int dns_read_resolv_conf(const char* path, struct sockaddr_in* servers_out, int max)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        return 0;
+    }
+
+    // IPv6 ones are skipped, they don't parse as IPv4
+    int count = 0;
+    char line[256];
+    while (count < max && fgets(line, sizeof(line), file))
+    {
+        char* save = NULL;
+        const char* keyword = strtok_r(line, " \t\r\n", &save);
+        const char* value = strtok_r(NULL, " \t\r\n", &save);
+        if (keyword && value && strcmp(keyword, "nameserver") == 0 &&
+            dns_parse_address(value, DNS_PORT, &servers_out[count]))
+        {
+            ++count;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+uint64_t dns_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * DNS_NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
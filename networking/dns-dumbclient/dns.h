@@ -0,0 +1,224 @@
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sockaddr_in;
+
+#define DNS_PORT 53
+
+// Classic UDP limit, anything bigger needs EDNS0 or TCP
+#define DNS_MAX_UDP_SIZE 512
+
+// What queries advertise with EDNS0 by default, the size the 2020 DNS flag
+// day settled on to stay clear of fragmentation. Answers are never bigger
+// than DNS_MAX_EDNS_UDP_SIZE, whatever was advertised.
+#define DNS_EDNS_DEFAULT_UDP_SIZE 1232
+#define DNS_MAX_EDNS_UDP_SIZE 4096
+
+// Root name, type, class, TTL and RDLENGTH, with no options
+#define DNS_OPT_RECORD_SIZE 11
+
+// Wire lengths, including the length bytes and the root label
+#define DNS_MAX_NAME_LENGTH 255
+#define DNS_MAX_LABEL_LENGTH 63
+
+#define DNS_HEADER_SIZE 12
+
+// Top two bits of a length byte set means the other 14 are an offset to the
+// rest of the name
+#define DNS_POINTER_MASK 0xC0
+#define DNS_POINTER_OFFSET_MASK 0x3FFF
+
+#define DNS_NS_PER_MS 1000000ull
+#define DNS_NS_PER_SEC 1000000000ull
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_OPCODE_MASK 0x7800
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+#define DNS_RCODE_MASK 0x000F
+
+enum dns_rcode
+{
+    DNS_RCODE_NOERROR = 0,
+    DNS_RCODE_FORMERR = 1,
+    DNS_RCODE_SERVFAIL = 2,
+    DNS_RCODE_NXDOMAIN = 3,
+    DNS_RCODE_NOTIMP = 4,
+    DNS_RCODE_REFUSED = 5
+};
+
+enum dns_type
+{
+    DNS_TYPE_A = 1,
+    DNS_TYPE_NS = 2,
+    DNS_TYPE_CNAME = 5,
+    DNS_TYPE_SOA = 6,
+    DNS_TYPE_MX = 15,
+    DNS_TYPE_TXT = 16,
+    DNS_TYPE_AAAA = 28,
+    DNS_TYPE_OPT = 41,
+    DNS_TYPE_ANY = 255
+};
+
+enum dns_section
+{
+    DNS_SECTION_ANSWER = 0,
+    DNS_SECTION_AUTHORITY,
+    DNS_SECTION_ADDITIONAL
+};
+
+#define DNS_CLASS_IN 1
+
+//                                     1  1  1  1  1  1
+//       0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//     |                      ID                       |
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//     |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//     |                    QDCOUNT                    |
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//     |                    ANCOUNT                    |
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//     |                    NSCOUNT                    |
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//     |                    ARCOUNT                    |
+//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+
+struct dns_header {
+    uint16_t  id;
+    uint16_t  flags;
+    uint16_t  qdcount; // Number of entries in question section
+    uint16_t  ancount; // Number of resource records in answer section
+    uint16_t  nscount; // Number of name server resources in auth records section
+    uint16_t  arcount; // Number of resource records in additional records section
+};
+
+//                                     1  1  1  1  1  1
+//      0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                                               |
+//    /                     QNAME                     /
+//    /                                               /
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                     QTYPE                     |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                     QCLASS                    |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+
+// A name where it sits in a packet, compression pointers and all. Only ever
+// made by the parser, which has already checked it ends in bounds, doesn't
+// loop and fits in DNS_MAX_NAME_LENGTH once expanded.
+struct dns_name {
+    const uint8_t* packet;
+    size_t packet_len;
+    uint16_t offset;
+    uint8_t length; // Expanded wire length, root label included
+};
+
+struct dns_question {
+    struct dns_name qname;
+    uint16_t qtype;
+    uint16_t qclass;
+};
+
+//                                    1  1  1  1  1  1
+//      0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                                               |
+//    /                                               /
+//    /                      NAME                     /
+//    |                                               |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                      TYPE                     |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                     CLASS                     |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                      TTL                      |
+//    |                                               |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//    |                   RDLENGTH                    |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--|
+//    /                     RDATA                     /
+//    /                                               /
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+
+// Any resource record, answer section or not. rdata points into the packet,
+// and the types the parser knows about are also broken out into data.
+struct dns_answer {
+    struct dns_name name;
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t rdlength;
+    const uint8_t* rdata;
+    enum dns_section section;
+
+    union {
+        struct dns_name target; // CNAME, NS
+        struct {
+            uint16_t preference;
+            struct dns_name exchange;
+        } mx;
+        struct {
+            struct dns_name mname;
+            struct dns_name rname;
+            uint32_t serial;
+            uint32_t refresh;
+            uint32_t retry;
+            uint32_t expire;
+            uint32_t minimum; // Negative answer TTL, RFC 2308
+        } soa;
+    } data;
+};
+
+// Dotted text to wire labels, straight into buffer. Returns the length, or 0
+// if the name isn't valid or doesn't fit in cap.
+size_t dns_encode_name(const char* name, uint8_t* buffer, size_t cap);
+
+// Writes a recursive query for one name into buffer, with an EDNS0 OPT record
+// advertising edns_udp_size unless it's 0. Never allocates. Returns the
+// length, or 0 if the name isn't valid or it doesn't fit in cap.
+size_t dns_encode_query(
+    uint16_t id,
+    const char* name,
+    uint16_t qtype,
+    uint16_t edns_udp_size,
+    uint8_t* buffer,
+    size_t cap);
+
+// Copies the header out in host order, false if the packet is too short
+bool dns_read_header(const uint8_t* packet, size_t len, struct dns_header* header_out);
+
+// Length of the first question, which starts right after the header. 0 if it
+// runs off the end, has a name longer than DNS_MAX_NAME_LENGTH or uses
+// compression, which a question we sent never does.
+size_t dns_question_length(const uint8_t* packet, size_t len);
+
+const char* dns_rcode_name(int rcode);
+
+// NULL for anything not in dns_type
+const char* dns_type_name(uint16_t type);
+
+// Case-insensitive, 0 if it isn't one a query can ask for
+uint16_t dns_type_from_name(const char* name);
+
+// "ip" or "ip:port", IPv4 only. False if either part doesn't parse.
+bool dns_parse_address(const char* text, uint16_t default_port, struct sockaddr_in* address_out);
+
+// Every IPv4 nameserver line in a resolv.conf, in order, up to max. Returns
+// how many, 0 if there's no file or none in it.
+int dns_read_resolv_conf(const char* path, struct sockaddr_in* servers_out, int max);
+
+#define DNS_RESOLV_CONF_PATH "/etc/resolv.conf"
+
+// Monotonic, for timeouts and latency
+uint64_t dns_now_ns();
+
+#endif // __DNS_H__
@@ -0,0 +1,248 @@
+// Query encoder throughput, and a check that it never allocates. malloc,
+// calloc and realloc are wrapped at link time (-Wl,--wrap, see build.sh) and
+// counted around each timed loop. "heap" is the same encode into a buffer
+// malloc'd per query, the way dns_build_request used to, for comparison.
+//
+// Every name is encoded once and read back through the parser first, so a
+// fast but wrong encoder doesn't pass.
+//
+// Usage: dns-encode-bench [--ms n]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns.h"
+#include "parse.h"
+
+#define DNS_ENCODE_BENCH_DEFAULT_MS 500
+#define DNS_ENCODE_BENCH_NUM_NAMES 1024
+#define DNS_ENCODE_BENCH_NAME_LENGTH 64
+
+// Queries encoded between clock reads
+#define DNS_ENCODE_BENCH_BATCH 4096
+
+static size_t s_allocations;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    ++s_allocations;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    ++s_allocations;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size)
+{
+    ++s_allocations;
+    return __real_realloc(pointer, size);
+}
+
+struct dns_encode_bench_case {
+    const char* label;
+    const uint16_t* qtypes;
+    size_t num_qtypes;
+    uint16_t edns_udp_size;
+    bool heap;
+};
+
+static char s_names[DNS_ENCODE_BENCH_NUM_NAMES][DNS_ENCODE_BENCH_NAME_LENGTH];
+
+static size_t _dns_encode_bench_one(const struct dns_encode_bench_case* bench_case, uint32_t i, uint8_t* buffer)
+{
+    const char* name = s_names[i % DNS_ENCODE_BENCH_NUM_NAMES];
+    const uint16_t qtype = bench_case->qtypes[i % bench_case->num_qtypes];
+    if (!bench_case->heap)
+    {
+        return dns_encode_query((uint16_t)i, name, qtype, bench_case->edns_udp_size, buffer, DNS_MAX_UDP_SIZE);
+    }
+
+    uint8_t* packet = malloc(DNS_MAX_UDP_SIZE);
+    const size_t len = dns_encode_query((uint16_t)i, name, qtype, bench_case->edns_udp_size, packet, DNS_MAX_UDP_SIZE);
+    memcpy(buffer, packet, len);
+    free(packet);
+    return len;
+}
+
+// Reads every encoding back, checking the name, type and OPT record
+static bool _dns_encode_bench_check(const struct dns_encode_bench_case* bench_case)
+{
+    uint8_t packet[DNS_MAX_UDP_SIZE];
+    for (uint32_t i = 0; i < DNS_ENCODE_BENCH_NUM_NAMES; ++i)
+    {
+        struct dns_parser parser;
+        struct dns_question question;
+        struct dns_answer opt;
+        const size_t len = _dns_encode_bench_one(bench_case, i, packet);
+        const bool has_opt = bench_case->edns_udp_size != 0;
+        const bool valid =
+            len > 0 &&
+            dns_parser_init(&parser, packet, len) &&
+            parser.header.id == (uint16_t)i &&
+            parser.header.flags == DNS_FLAG_RD &&
+            dns_parser_next_question(&parser, &question) &&
+            dns_name_equals_text(&question.qname, s_names[i]) &&
+            question.qtype == bench_case->qtypes[i % bench_case->num_qtypes] &&
+            question.qclass == DNS_CLASS_IN &&
+            dns_parser_next_record(&parser, &opt) == has_opt &&
+            (!has_opt || (opt.type == DNS_TYPE_OPT && opt.class == bench_case->edns_udp_size)) &&
+            !parser.failed &&
+            parser.offset == len;
+        if (!valid)
+        {
+            fprintf(stderr, "Bad encoding - case: %s name: %s len: %zu\n", bench_case->label, s_names[i], len);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Names at the edges, with the wire length each should come out as, 0 for
+// refused
+static bool _dns_encode_bench_edges()
+{
+    char long_label[DNS_MAX_LABEL_LENGTH + 3];
+    memset(long_label, 'a', sizeof(long_label));
+    long_label[DNS_MAX_LABEL_LENGTH + 2] = '\0';
+
+    // 4 labels of 63 is 257 on the wire, 2 shorter is the 255 most there can be
+    char long_name[4 * (DNS_MAX_LABEL_LENGTH + 1) + 1];
+    memset(long_name, 'b', sizeof(long_name));
+    for (int l = 1; l <= 4; ++l)
+    {
+        long_name[l * (DNS_MAX_LABEL_LENGTH + 1) - 1] = '.';
+    }
+    long_name[sizeof(long_name) - 1] = '\0';
+
+    struct {
+        const char* name;
+        size_t expected;
+    } const edges[] = {
+        { "", 1 },
+        { ".", 1 },
+        { "a", 3 },
+        { "a.", 3 },
+        { "a.b", 5 },
+        { "a..b", 0 },
+        { ".a", 0 },
+        { "..", 0 },
+        { long_label + 2, DNS_MAX_LABEL_LENGTH + 2 },
+        { long_label + 1, 0 },
+        { long_name, 0 },
+        { long_name + 2, DNS_MAX_NAME_LENGTH },
+        { long_name + 1, 0 },
+    };
+
+    bool valid = true;
+    uint8_t wire[DNS_MAX_NAME_LENGTH + 16];
+    for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); ++e)
+    {
+        const size_t len = dns_encode_name(edges[e].name, wire, sizeof(wire));
+        if (len != edges[e].expected || (len > 0 && wire[len - 1] != 0))
+        {
+            fprintf(stderr, "Bad edge encoding - name: \"%s\" len: %zu expected: %zu\n", edges[e].name, len, edges[e].expected);
+            valid = false;
+        }
+    }
+
+    // Too small a buffer is refused rather than overrun
+    if (dns_encode_name("example.com", wire, 12) != 0 || dns_encode_name("example.com", wire, 13) != 13)
+    {
+        fprintf(stderr, "Bad encoding into a short buffer\n");
+        valid = false;
+    }
+
+    return valid;
+}
+
+static bool _dns_encode_bench_run(const struct dns_encode_bench_case* bench_case, uint64_t duration_ns)
+{
+    uint8_t buffer[DNS_MAX_UDP_SIZE] = {0};
+    uint64_t encodes = 0;
+    uint64_t bytes = 0;
+    uint64_t elapsed_ns = 0;
+    const size_t allocations_before = s_allocations;
+    const uint64_t start_ns = dns_now_ns();
+    do
+    {
+        for (uint32_t i = 0; i < DNS_ENCODE_BENCH_BATCH; ++i)
+        {
+            bytes += _dns_encode_bench_one(bench_case, (uint32_t)encodes + i, buffer);
+        }
+        encodes += DNS_ENCODE_BENCH_BATCH;
+        elapsed_ns = dns_now_ns() - start_ns;
+    } while (elapsed_ns < duration_ns);
+
+    const size_t allocations = s_allocations - allocations_before;
+    fprintf(stdout,
+            "%-18s %6.1f ns/query %11.0f encodes/sec %6.1f bytes/query %6.2f allocations/query\n",
+            bench_case->label,
+            (double)elapsed_ns / encodes,
+            encodes / ((double)elapsed_ns / DNS_NS_PER_SEC),
+            (double)bytes / encodes,
+            (double)allocations / encodes);
+
+    if (!bench_case->heap && allocations != 0)
+    {
+        fprintf(stderr, "Encoder allocated - case: %s allocations: %zu\n", bench_case->label, allocations);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int duration_ms = DNS_ENCODE_BENCH_DEFAULT_MS;
+    if (argc == 3 && strcmp(argv[1], "--ms") == 0 && atoi(argv[2]) > 0)
+    {
+        duration_ms = atoi(argv[2]);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: %s [--ms n]\n", argv[0]);
+        return -1;
+    }
+
+    // A spread of depths and label lengths, some with a trailing dot
+    for (int i = 0; i < DNS_ENCODE_BENCH_NUM_NAMES; ++i)
+    {
+        snprintf(s_names[i],
+                 DNS_ENCODE_BENCH_NAME_LENGTH,
+                 i % 3 == 0 ? "host-%d.example.com" : i % 3 == 1 ? "api.%d.eu-west.cdn.example.net." : "x%d.io",
+                 i);
+    }
+
+    static const uint16_t s_a[] = { DNS_TYPE_A };
+    static const uint16_t s_aaaa[] = { DNS_TYPE_AAAA };
+    static const uint16_t s_mixed[] = { DNS_TYPE_MX, DNS_TYPE_TXT, DNS_TYPE_ANY, DNS_TYPE_AAAA };
+    const struct dns_encode_bench_case cases[] = {
+        { "A", s_a, 1, 0, false },
+        { "AAAA+edns", s_aaaa, 1, DNS_EDNS_DEFAULT_UDP_SIZE, false },
+        { "MX/TXT/ANY+edns", s_mixed, 4, DNS_MAX_EDNS_UDP_SIZE, false },
+        { "A heap", s_a, 1, 0, true },
+    };
+
+    bool valid = _dns_encode_bench_edges();
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+    {
+        valid &= _dns_encode_bench_check(&cases[c]);
+    }
+
+    const uint64_t duration_ns = (uint64_t)duration_ms * DNS_NS_PER_MS;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]) && valid; ++c)
+    {
+        valid &= _dns_encode_bench_run(&cases[c], duration_ns);
+    }
+
+    return valid ? 0 : -1;
+}
@@ -0,0 +1,1065 @@
+#include "forward.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "cache.h"
+#include "dns.h"
+#include "parse.h"
+#include "tcp.h"
+
+#define DNS_FORWARD_NONE -1
+#define DNS_FORWARD_POLL_MS 50
+#define DNS_FORWARD_NUM_IDS 65536
+
+// Upstream queries in flight are found by question through these, twice as
+// many as there can be so chains stay short
+#define DNS_FORWARD_BUCKETS (2 * DNS_FORWARD_MAX_PENDING)
+
+// Name, type and class
+#define DNS_FORWARD_MAX_QUESTION (DNS_MAX_NAME_LENGTH + 2 * sizeof(uint16_t))
+
+// Header, question and OPT, all an upstream query ever has
+#define DNS_FORWARD_QUERY_SIZE (DNS_HEADER_SIZE + DNS_FORWARD_MAX_QUESTION + DNS_OPT_RECORD_SIZE)
+
+// Type, class, ttl and rdlength, after the owner name
+#define DNS_FORWARD_RECORD_FIXED_SIZE (2 + 2 + 4 + 2)
+#define DNS_FORWARD_QUESTION_POINTER 0xC00C
+
+// A client's query, as much of it as goes back in the answer
+struct dns_forward_request {
+    struct sockaddr_in client;
+    uint16_t id;
+    bool rd;
+    bool edns;
+    uint16_t udp_size; // Biggest answer the client takes
+    uint16_t question_len;
+    uint8_t question[DNS_FORWARD_MAX_QUESTION];
+    int next;          // Next waiting on the same upstream query, or free
+};
+
+struct dns_forward_pending {
+    int waiters;        // DNS_FORWARD_NONE when the slot is free
+    int next_in_bucket;
+    uint32_t hash;
+    int attempts;
+    uint64_t sent_ns;   // 0 until the kernel has taken it
+    bool tcp;
+    uint16_t question_len;
+    size_t len;
+    uint8_t packet[DNS_FORWARD_QUERY_SIZE];
+};
+
+struct dns_forward_worker {
+    struct dns_forwarder* forwarder;
+    int socket;
+    int upstream;
+    struct dns_tcp_pool tcp_pool;
+    int epoll;
+    uint32_t rng;
+    struct dns_cache cache;
+    struct dns_forward_stats stats;
+
+    // Slot in flight for each upstream ID
+    int16_t* id_table;
+
+    struct dns_forward_pending* pending;
+    int* free_pending;
+    int num_free_pending;
+    int num_unsent;
+    int buckets[DNS_FORWARD_BUCKETS];
+
+    struct dns_forward_request* requests;
+    int free_requests;
+
+    // Nothing in flight times out before this, so there's no need to scan
+    uint64_t next_due_ns;
+
+    pthread_t thread;
+    bool started;
+};
+
+static void _dns_forward_write_u16(uint8_t* buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+}
+
+static void _dns_forward_write_u32(uint8_t* buffer, uint32_t value)
+{
+    _dns_forward_write_u16(buffer, (uint16_t)(value >> 16));
+    _dns_forward_write_u16(buffer + 2, (uint16_t)value);
+}
+
+static uint16_t _dns_forward_read_u16(const uint8_t* buffer)
+{
+    return (uint16_t)((buffer[0] << 8) | buffer[1]);
+}
+
+void dns_forward_config_default(struct dns_forward_config* config, const struct sockaddr_in* upstream)
+{
+    memset(config, 0, sizeof(*config));
+    config->address.sin_family = AF_INET;
+    config->address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    config->address.sin_port = htons(DNS_FORWARD_DEFAULT_PORT);
+    config->upstream = *upstream;
+    config->tcp_connections = DNS_TCP_DEFAULT_CONNECTIONS;
+    config->threads = 1;
+    config->cache_capacity = DNS_CACHE_DEFAULT_CAPACITY;
+    config->timeout_ms = DNS_FORWARD_DEFAULT_TIMEOUT_MS;
+    config->attempts = DNS_FORWARD_DEFAULT_ATTEMPTS;
+}
+
+// FNV-1a over the folded name, then the type and class as they are. Label
+// lengths never reach 'A', so folding the whole name is safe.
+static uint32_t _dns_forward_hash_question(const uint8_t* question, size_t len)
+{
+    const size_t name_len = len - 2 * sizeof(uint16_t);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= i < name_len ? (uint8_t)tolower(question[i]) : question[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool _dns_forward_same_question(const uint8_t* lhs, const uint8_t* rhs, size_t len)
+{
+    const size_t name_len = len - 2 * sizeof(uint16_t);
+    for (size_t i = 0; i < name_len; ++i)
+    {
+        if (tolower(lhs[i]) != tolower(rhs[i]))
+        {
+            return false;
+        }
+    }
+
+    return memcmp(lhs + name_len, rhs + name_len, 2 * sizeof(uint16_t)) == 0;
+}
+
+// False if it's not worth answering at all. Otherwise fills in request_out,
+// and rcode_out with anything but NOERROR if all it can get is an error.
+static bool _dns_forward_read_request(
+    const uint8_t* query,
+    size_t len,
+    struct dns_forward_request* request_out,
+    int* rcode_out)
+{
+    struct dns_header header;
+    if (!dns_read_header(query, len, &header) || (header.flags & DNS_FLAG_QR))
+    {
+        return false;
+    }
+
+    request_out->id = header.id;
+    request_out->rd = (header.flags & DNS_FLAG_RD) != 0;
+    request_out->edns = false;
+    request_out->udp_size = DNS_MAX_UDP_SIZE;
+    request_out->question_len = 0;
+    request_out->next = DNS_FORWARD_NONE;
+
+    // dns_question_length caps the name, the size check is so the copy
+    // below can't overrun whatever it's changed to
+    const size_t question_len = dns_question_length(query, len);
+    if (header.qdcount != 1 || question_len == 0 || question_len > DNS_FORWARD_MAX_QUESTION)
+    {
+        *rcode_out = DNS_RCODE_FORMERR;
+        return true;
+    }
+
+    memcpy(request_out->question, query + DNS_HEADER_SIZE, question_len);
+    request_out->question_len = (uint16_t)question_len;
+    const uint16_t qclass = _dns_forward_read_u16(query + DNS_HEADER_SIZE + question_len - sizeof(uint16_t));
+    *rcode_out = (header.flags & DNS_OPCODE_MASK) != 0 || qclass != DNS_CLASS_IN ? DNS_RCODE_NOTIMP
+                                                                                 : DNS_RCODE_NOERROR;
+
+    // EDNS0 says how big an answer can come back over UDP, RFC 6891 6.2.3
+    struct dns_parser parser;
+    struct dns_answer record;
+    dns_parser_init(&parser, query, len);
+    while (header.arcount > 0 && dns_parser_next_record(&parser, &record))
+    {
+        if (record.type == DNS_TYPE_OPT && record.section == DNS_SECTION_ADDITIONAL)
+        {
+            request_out->edns = true;
+            request_out->udp_size = record.class < DNS_MAX_UDP_SIZE       ? DNS_MAX_UDP_SIZE
+                                    : record.class > DNS_MAX_EDNS_UDP_SIZE ? DNS_MAX_EDNS_UDP_SIZE
+                                                                           : record.class;
+            break;
+        }
+    }
+
+    return true;
+}
+
+static size_t _dns_forward_write_opt(uint8_t* response, size_t offset)
+{
+    uint8_t* opt = response + offset;
+    memset(opt, 0, DNS_OPT_RECORD_SIZE);
+    _dns_forward_write_u16(opt + 1, DNS_TYPE_OPT);
+    _dns_forward_write_u16(opt + 3, DNS_MAX_EDNS_UDP_SIZE);
+    _dns_forward_write_u16(response + 10, _dns_forward_read_u16(response + 10) + 1);
+    return offset + DNS_OPT_RECORD_SIZE;
+}
+
+static uint16_t _dns_forward_flags(const struct dns_forward_request* request, int rcode)
+{
+    return DNS_FLAG_QR | DNS_FLAG_RA | (request->rd ? DNS_FLAG_RD : 0) | (uint16_t)rcode;
+}
+
+static void _dns_forward_send_client(
+    struct dns_forward_worker* worker,
+    const struct dns_forward_request* request,
+    const uint8_t* response,
+    size_t len)
+{
+    // A client that isn't reading loses its answer, as it would have anyway
+    sendto(worker->socket, response, len, 0, (const struct sockaddr*)&request->client, sizeof(request->client));
+}
+
+// Header and question alone, for errors and answers too big for the client
+static void _dns_forward_reply_short(
+    struct dns_forward_worker* worker,
+    const struct dns_forward_request* request,
+    uint16_t flags)
+{
+    uint8_t response[DNS_HEADER_SIZE + DNS_FORWARD_MAX_QUESTION + DNS_OPT_RECORD_SIZE];
+    memset(response, 0, DNS_HEADER_SIZE);
+    _dns_forward_write_u16(response, request->id);
+    _dns_forward_write_u16(response + 2, flags);
+    _dns_forward_write_u16(response + 4, request->question_len > 0);
+    memcpy(response + DNS_HEADER_SIZE, request->question, request->question_len);
+    size_t len = DNS_HEADER_SIZE + request->question_len;
+    if (request->edns)
+    {
+        len = _dns_forward_write_opt(response, len);
+    }
+
+    _dns_forward_send_client(worker, request, response, len);
+}
+
+// Any CNAMEs followed and the RRset asked for go in the answer section, or
+// for a negative answer the SOA goes in authority. Owner names point back at
+// the question, or at the CNAME that led to them, so they come back in the
+// client's case. Returns the length, 0 if it doesn't fit in cap.
+static size_t _dns_forward_write_cached(
+    const struct dns_forward_request* request,
+    const struct dns_cache_result* result,
+    uint8_t* response,
+    size_t cap)
+{
+    size_t offset = DNS_HEADER_SIZE + request->question_len;
+    if (offset > cap)
+    {
+        return 0;
+    }
+
+    memset(response, 0, DNS_HEADER_SIZE);
+    memcpy(response + DNS_HEADER_SIZE, request->question, request->question_len);
+    uint16_t name_pointer = DNS_FORWARD_QUESTION_POINTER;
+    uint16_t ancount = 0;
+    uint16_t nscount = 0;
+    for (int c = 0; c < result->chain_length; ++c)
+    {
+        const struct dns_cache_rrset* rrset = &result->chain[c];
+        const bool authority = result->status == DNS_CACHE_NEGATIVE && c == result->chain_length - 1;
+        if (authority)
+        {
+            // The SOA's owner is its zone, which nothing before it names
+            name_pointer = 0;
+        }
+
+        size_t first_rdata = 0;
+        size_t read = 0;
+        for (uint16_t r = 0; r < rrset->count; ++r)
+        {
+            const uint16_t rdlength = _dns_forward_read_u16(rrset->records + read);
+            const size_t name_size = name_pointer ? sizeof(uint16_t) : rrset->name_length;
+            if (offset + name_size + DNS_FORWARD_RECORD_FIXED_SIZE + rdlength > cap)
+            {
+                return 0;
+            }
+
+            uint8_t* record = response + offset;
+            if (name_pointer)
+            {
+                _dns_forward_write_u16(record, name_pointer);
+            }
+            else
+            {
+                memcpy(record, rrset->name, name_size);
+            }
+
+            record += name_size;
+            _dns_forward_write_u16(record, rrset->type);
+            _dns_forward_write_u16(record + 2, DNS_CLASS_IN);
+            _dns_forward_write_u32(record + 4, rrset->ttl);
+            _dns_forward_write_u16(record + 8, rdlength);
+            memcpy(record + DNS_FORWARD_RECORD_FIXED_SIZE, rrset->records + read + sizeof(uint16_t), rdlength);
+            if (r == 0)
+            {
+                first_rdata = offset + name_size + DNS_FORWARD_RECORD_FIXED_SIZE;
+            }
+
+            offset += name_size + DNS_FORWARD_RECORD_FIXED_SIZE + rdlength;
+            read += sizeof(uint16_t) + rdlength;
+        }
+
+        if (authority)
+        {
+            nscount += rrset->count;
+        }
+        else
+        {
+            ancount += rrset->count;
+        }
+
+        // A CNAME's target is the next RRset's owner
+        name_pointer = rrset->type == DNS_TYPE_CNAME && first_rdata <= DNS_POINTER_OFFSET_MASK
+                           ? (uint16_t)((DNS_POINTER_MASK << 8) | first_rdata)
+                           : 0;
+    }
+
+    _dns_forward_write_u16(response, request->id);
+    _dns_forward_write_u16(response + 2, _dns_forward_flags(request, result->rcode));
+    _dns_forward_write_u16(response + 4, 1);
+    _dns_forward_write_u16(response + 6, ancount);
+    _dns_forward_write_u16(response + 8, nscount);
+    return offset;
+}
+
+static void _dns_forward_reply_cached(
+    struct dns_forward_worker* worker,
+    const struct dns_forward_request* request,
+    const struct dns_cache_result* result)
+{
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    const size_t cap = request->udp_size - (request->edns ? DNS_OPT_RECORD_SIZE : 0);
+    size_t len = _dns_forward_write_cached(request, result, response, cap);
+    if (len == 0)
+    {
+        ++worker->stats.truncated;
+        _dns_forward_reply_short(worker, request, _dns_forward_flags(request, result->rcode) | DNS_FLAG_TC);
+        return;
+    }
+
+    if (request->edns)
+    {
+        len = _dns_forward_write_opt(response, len);
+    }
+    _dns_forward_send_client(worker, request, response, len);
+}
+
+// Scattered rather than sequential, for the same reason as the batch
+// resolver's: late answers to freed IDs shouldn't find them already reused
+static uint16_t _dns_forward_next_id(struct dns_forward_worker* worker)
+{
+    for (;;)
+    {
+        worker->rng ^= worker->rng << 13;
+        worker->rng ^= worker->rng >> 17;
+        worker->rng ^= worker->rng << 5;
+        const uint16_t id = (uint16_t)(worker->rng >> 8);
+        if (worker->id_table[id] == DNS_FORWARD_NONE)
+        {
+            return id;
+        }
+    }
+}
+
+// False if the socket wouldn't take it right now, in which case it's left
+// unsent and tried again on the next pass
+static bool _dns_forward_send_upstream(
+    struct dns_forward_worker* worker,
+    struct dns_forward_pending* pending,
+    uint64_t now_ns)
+{
+    // TCP queues what the socket won't take yet, and a connection that can't
+    // be made is left to time out like a lost datagram
+    if (pending->tcp)
+    {
+        dns_tcp_pool_send(&worker->tcp_pool, pending->packet, pending->len);
+    }
+    else if (send(worker->upstream, pending->packet, pending->len, 0) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == ECONNREFUSED)
+        {
+            if (pending->sent_ns != 0)
+            {
+                pending->sent_ns = 0;
+                ++worker->num_unsent;
+            }
+            return false;
+        }
+
+        fprintf(stderr, "Failed to forward query - errno: %d\n", errno);
+    }
+
+    if (pending->sent_ns == 0)
+    {
+        --worker->num_unsent;
+    }
+
+    pending->sent_ns = now_ns;
+    ++pending->attempts;
+    return true;
+}
+
+static void _dns_forward_release(struct dns_forward_worker* worker, int pending_index)
+{
+    struct dns_forward_pending* pending = &worker->pending[pending_index];
+    if (pending->sent_ns == 0)
+    {
+        --worker->num_unsent;
+    }
+
+    int* link = &worker->buckets[pending->hash & (DNS_FORWARD_BUCKETS - 1)];
+    while (*link != pending_index)
+    {
+        link = &worker->pending[*link].next_in_bucket;
+    }
+    *link = pending->next_in_bucket;
+
+    worker->id_table[_dns_forward_read_u16(pending->packet)] = DNS_FORWARD_NONE;
+    worker->free_pending[worker->num_free_pending++] = pending_index;
+    pending->waiters = DNS_FORWARD_NONE;
+}
+
+static void _dns_forward_free_request(struct dns_forward_worker* worker, int request_index)
+{
+    worker->requests[request_index].next = worker->free_requests;
+    worker->free_requests = request_index;
+}
+
+// Joins the query already in flight for the same question, or sends one
+static void _dns_forward_wait_upstream(
+    struct dns_forward_worker* worker,
+    const struct dns_forward_request* request,
+    uint64_t now_ns)
+{
+    const uint32_t hash = _dns_forward_hash_question(request->question, request->question_len);
+    int* bucket = &worker->buckets[hash & (DNS_FORWARD_BUCKETS - 1)];
+    int pending_index = *bucket;
+    while (pending_index != DNS_FORWARD_NONE)
+    {
+        const struct dns_forward_pending* pending = &worker->pending[pending_index];
+        if (pending->hash == hash &&
+            pending->question_len == request->question_len &&
+            _dns_forward_same_question(pending->packet + DNS_HEADER_SIZE, request->question, request->question_len))
+        {
+            break;
+        }
+        pending_index = pending->next_in_bucket;
+    }
+
+    if (worker->free_requests == DNS_FORWARD_NONE ||
+        (pending_index == DNS_FORWARD_NONE && worker->num_free_pending == 0))
+    {
+        ++worker->stats.servfail;
+        _dns_forward_reply_short(worker, request, _dns_forward_flags(request, DNS_RCODE_SERVFAIL));
+        return;
+    }
+
+    const int request_index = worker->free_requests;
+    worker->free_requests = worker->requests[request_index].next;
+    worker->requests[request_index] = *request;
+    if (pending_index != DNS_FORWARD_NONE)
+    {
+        struct dns_forward_pending* pending = &worker->pending[pending_index];
+        worker->requests[request_index].next = pending->waiters;
+        pending->waiters = request_index;
+        ++worker->stats.coalesced;
+        return;
+    }
+
+    // Sent with the client's question as it is, case and all, and our own
+    // EDNS0 size
+    pending_index = worker->free_pending[--worker->num_free_pending];
+    struct dns_forward_pending* pending = &worker->pending[pending_index];
+    const uint16_t id = _dns_forward_next_id(worker);
+    memset(pending->packet, 0, DNS_HEADER_SIZE);
+    _dns_forward_write_u16(pending->packet, id);
+    _dns_forward_write_u16(pending->packet + 2, DNS_FLAG_RD);
+    _dns_forward_write_u16(pending->packet + 4, 1);
+    memcpy(pending->packet + DNS_HEADER_SIZE, request->question, request->question_len);
+    uint8_t* opt = pending->packet + DNS_HEADER_SIZE + request->question_len;
+    memset(opt, 0, DNS_OPT_RECORD_SIZE);
+    _dns_forward_write_u16(opt + 1, DNS_TYPE_OPT);
+    _dns_forward_write_u16(opt + 3, DNS_EDNS_DEFAULT_UDP_SIZE);
+    _dns_forward_write_u16(pending->packet + 10, 1);
+    pending->len = DNS_HEADER_SIZE + request->question_len + DNS_OPT_RECORD_SIZE;
+
+    worker->requests[request_index].next = DNS_FORWARD_NONE;
+    pending->waiters = request_index;
+    pending->hash = hash;
+    pending->question_len = request->question_len;
+    pending->next_in_bucket = *bucket;
+    *bucket = pending_index;
+    pending->attempts = 0;
+    pending->sent_ns = 0;
+    pending->tcp = false;
+    worker->id_table[id] = (int16_t)pending_index;
+    ++worker->num_unsent;
+    ++worker->stats.forwarded;
+    _dns_forward_send_upstream(worker, pending, now_ns);
+}
+
+static void _dns_forward_handle_query(
+    struct dns_forward_worker* worker,
+    const uint8_t* query,
+    size_t len,
+    const struct sockaddr_in* from,
+    uint64_t now_ns)
+{
+    ++worker->stats.queries;
+    struct dns_forward_request request;
+    int rcode;
+    if (!_dns_forward_read_request(query, len, &request, &rcode))
+    {
+        ++worker->stats.malformed;
+        return;
+    }
+
+    request.client = *from;
+    if (rcode != DNS_RCODE_NOERROR)
+    {
+        worker->stats.malformed += rcode == DNS_RCODE_FORMERR;
+        _dns_forward_reply_short(worker, &request, _dns_forward_flags(&request, rcode));
+        return;
+    }
+
+    const size_t qname_len = request.question_len - 2 * sizeof(uint16_t);
+    const uint16_t qtype = _dns_forward_read_u16(request.question + qname_len);
+    struct dns_cache_result result;
+    if (dns_cache_lookup(&worker->cache, request.question, qname_len, qtype, now_ns, &result))
+    {
+        ++worker->stats.cache_hits;
+        _dns_forward_reply_cached(worker, &request, &result);
+        return;
+    }
+
+    _dns_forward_wait_upstream(worker, &request, now_ns);
+}
+
+// Offset of an OPT that's the last thing in the response, so clients that
+// didn't send one can have it cut off. 0 if there isn't one there.
+static size_t _dns_forward_find_opt(const uint8_t* response, size_t len)
+{
+    struct dns_parser parser;
+    struct dns_question question;
+    struct dns_answer record;
+    if (!dns_parser_init(&parser, response, len) || parser.header.arcount == 0 ||
+        !dns_parser_next_question(&parser, &question))
+    {
+        return 0;
+    }
+
+    size_t start = parser.offset;
+    while (dns_parser_next_record(&parser, &record))
+    {
+        if (record.type == DNS_TYPE_OPT && record.section == DNS_SECTION_ADDITIONAL && parser.offset == len)
+        {
+            return start;
+        }
+        start = parser.offset;
+    }
+
+    return 0;
+}
+
+// Every client waiting gets the upstream answer with its own ID and its own
+// question, so the case it asked in comes back to it
+static void _dns_forward_receive(
+    struct dns_forward_worker* worker,
+    const uint8_t* response,
+    size_t len,
+    bool tcp,
+    uint64_t now_ns)
+{
+    struct dns_header header;
+    if (!dns_read_header(response, len, &header) || !(header.flags & DNS_FLAG_QR))
+    {
+        ++worker->stats.unmatched;
+        return;
+    }
+
+    const int pending_index = worker->id_table[header.id];
+    if (pending_index == DNS_FORWARD_NONE)
+    {
+        ++worker->stats.unmatched;
+        return;
+    }
+
+    struct dns_forward_pending* pending = &worker->pending[pending_index];
+    const size_t question_len = pending->question_len;
+    if (header.qdcount != 1 ||
+        len < DNS_HEADER_SIZE + question_len ||
+        memcmp(response + DNS_HEADER_SIZE, pending->packet + DNS_HEADER_SIZE, question_len) != 0)
+    {
+        ++worker->stats.unmatched;
+        return;
+    }
+
+    // Once it's gone over to TCP, a truncated answer to an earlier UDP
+    // attempt is no use
+    const bool truncated = (header.flags & DNS_FLAG_TC) != 0;
+    if (truncated && !tcp && pending->tcp)
+    {
+        return;
+    }
+
+    if (truncated && !tcp && worker->forwarder->config.tcp_connections > 0)
+    {
+        pending->tcp = true;
+        pending->attempts = 0;
+        ++worker->stats.tcp;
+        _dns_forward_send_upstream(worker, pending, now_ns);
+        return;
+    }
+
+    dns_cache_store(&worker->cache, response, len, now_ns);
+    const size_t opt_offset = _dns_forward_find_opt(response, len);
+    uint8_t reply[DNS_MAX_EDNS_UDP_SIZE];
+    int request_index = pending->waiters;
+    while (request_index != DNS_FORWARD_NONE)
+    {
+        const struct dns_forward_request* request = &worker->requests[request_index];
+        const bool strip_opt = !request->edns && opt_offset != 0;
+        const size_t reply_len = strip_opt ? opt_offset : len;
+        const uint16_t flags = (header.flags & ~DNS_FLAG_RD) | (request->rd ? DNS_FLAG_RD : 0);
+        if (reply_len > request->udp_size)
+        {
+            ++worker->stats.truncated;
+            _dns_forward_reply_short(worker, request, flags | DNS_FLAG_TC);
+        }
+        else
+        {
+            memcpy(reply, response, reply_len);
+            _dns_forward_write_u16(reply, request->id);
+            _dns_forward_write_u16(reply + 2, flags);
+            memcpy(reply + DNS_HEADER_SIZE, request->question, question_len);
+            if (strip_opt)
+            {
+                _dns_forward_write_u16(reply + 10, header.arcount - 1);
+            }
+            _dns_forward_send_client(worker, request, reply, reply_len);
+        }
+
+        ++worker->stats.answered;
+        const int next = request->next;
+        _dns_forward_free_request(worker, request_index);
+        request_index = next;
+    }
+
+    _dns_forward_release(worker, pending_index);
+}
+
+static void _dns_forward_give_up(struct dns_forward_worker* worker, int pending_index)
+{
+    int request_index = worker->pending[pending_index].waiters;
+    while (request_index != DNS_FORWARD_NONE)
+    {
+        const struct dns_forward_request* request = &worker->requests[request_index];
+        _dns_forward_reply_short(worker, request, _dns_forward_flags(request, DNS_RCODE_SERVFAIL));
+        ++worker->stats.servfail;
+        const int next = request->next;
+        _dns_forward_free_request(worker, request_index);
+        request_index = next;
+    }
+
+    _dns_forward_release(worker, pending_index);
+}
+
+// Resends or gives up on anything past its timeout, and sends whatever the
+// socket refused last time. Returns ms until the next one is due.
+static int _dns_forward_expire(struct dns_forward_worker* worker, uint64_t now_ns)
+{
+    if (worker->num_unsent == 0 && now_ns < worker->next_due_ns)
+    {
+        const uint64_t wait_ms = (worker->next_due_ns - now_ns + DNS_NS_PER_MS - 1) / DNS_NS_PER_MS;
+        return wait_ms < DNS_FORWARD_POLL_MS ? (int)wait_ms : DNS_FORWARD_POLL_MS;
+    }
+
+    const struct dns_forward_config* config = &worker->forwarder->config;
+    const uint64_t timeout_ns = (uint64_t)config->timeout_ms * DNS_NS_PER_MS;
+    uint64_t next_ns = timeout_ns;
+    for (int p = 0; p < DNS_FORWARD_MAX_PENDING; ++p)
+    {
+        struct dns_forward_pending* pending = &worker->pending[p];
+        if (pending->waiters == DNS_FORWARD_NONE)
+        {
+            continue;
+        }
+
+        if (pending->sent_ns == 0)
+        {
+            if (!_dns_forward_send_upstream(worker, pending, now_ns))
+            {
+                return 1;
+            }
+            continue;
+        }
+
+        const uint64_t waited_ns = now_ns - pending->sent_ns;
+        if (waited_ns < timeout_ns)
+        {
+            next_ns = timeout_ns - waited_ns < next_ns ? timeout_ns - waited_ns : next_ns;
+            continue;
+        }
+
+        if (pending->attempts >= config->attempts)
+        {
+            _dns_forward_give_up(worker, p);
+            continue;
+        }
+
+        ++worker->stats.retries;
+        if (!_dns_forward_send_upstream(worker, pending, now_ns))
+        {
+            return 1;
+        }
+    }
+
+    worker->next_due_ns = now_ns + next_ns;
+    const uint64_t wait_ms = (next_ns + DNS_NS_PER_MS - 1) / DNS_NS_PER_MS;
+    return wait_ms < DNS_FORWARD_POLL_MS ? (int)wait_ms : DNS_FORWARD_POLL_MS;
+}
+
+static void _dns_forward_drain_clients(struct dns_forward_worker* worker, uint8_t* buffer)
+{
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t received;
+    const uint64_t now_ns = dns_now_ns();
+    while ((received = recvfrom(
+                worker->socket, buffer, DNS_MAX_EDNS_UDP_SIZE, 0, (struct sockaddr*)&from, &from_len)) >= 0)
+    {
+        _dns_forward_handle_query(worker, buffer, (size_t)received, &from, now_ns);
+        from_len = sizeof(from);
+    }
+}
+
+static void _dns_forward_drain_upstream(struct dns_forward_worker* worker, uint8_t* buffer)
+{
+    ssize_t received;
+    const uint64_t now_ns = dns_now_ns();
+    while ((received = recv(worker->upstream, buffer, DNS_MAX_EDNS_UDP_SIZE, 0)) >= 0 || errno == ECONNREFUSED)
+    {
+        if (received > 0)
+        {
+            _dns_forward_receive(worker, buffer, (size_t)received, false, now_ns);
+        }
+    }
+}
+
+static void _dns_forward_on_tcp_answer(const uint8_t* response, size_t len, void* context)
+{
+    _dns_forward_receive((struct dns_forward_worker*)context, response, len, true, dns_now_ns());
+}
+
+static void* _dns_forward_loop(void* context)
+{
+    struct dns_forward_worker* worker = (struct dns_forward_worker*)context;
+    struct epoll_event events[3];
+    uint8_t buffer[DNS_MAX_EDNS_UDP_SIZE];
+    while (atomic_load(&worker->forwarder->running))
+    {
+        const int wait_ms = _dns_forward_expire(worker, dns_now_ns());
+        const int ready = epoll_wait(worker->epoll, events, 3, wait_ms);
+        if (ready < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "Forwarder failed to wait - errno: %d\n", errno);
+            break;
+        }
+
+        // Upstream first, so its answers free up room for new queries
+        for (int e = ready - 1; e >= 0; --e)
+        {
+            if (events[e].data.fd == worker->upstream)
+            {
+                _dns_forward_drain_upstream(worker, buffer);
+            }
+            else if (events[e].data.fd == worker->tcp_pool.epoll)
+            {
+                dns_tcp_pool_service(&worker->tcp_pool, _dns_forward_on_tcp_answer, worker);
+            }
+        }
+
+        for (int e = 0; e < ready; ++e)
+        {
+            if (events[e].data.fd == worker->socket)
+            {
+                _dns_forward_drain_clients(worker, buffer);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static bool _dns_forward_set_nonblocking(int socket)
+{
+    const int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+static bool _dns_forward_open_worker(struct dns_forwarder* forwarder, struct dns_forward_worker* worker)
+{
+    struct dns_forward_config* config = &forwarder->config;
+    worker->forwarder = forwarder;
+    worker->rng = (uint32_t)dns_now_ns() ^ ((uint32_t)(uintptr_t)worker << 7) ^ 0x9E3779B9u;
+    worker->num_free_pending = DNS_FORWARD_MAX_PENDING;
+    worker->free_requests = 0;
+    worker->id_table = malloc(DNS_FORWARD_NUM_IDS * sizeof(int16_t));
+    worker->pending = malloc(DNS_FORWARD_MAX_PENDING * sizeof(struct dns_forward_pending));
+    worker->free_pending = malloc(DNS_FORWARD_MAX_PENDING * sizeof(int));
+    worker->requests = malloc(DNS_FORWARD_MAX_WAITERS * sizeof(struct dns_forward_request));
+    if (!worker->id_table || !worker->pending || !worker->free_pending || !worker->requests ||
+        !dns_cache_init(&worker->cache, config->cache_capacity))
+    {
+        fprintf(stderr, "Out of memory for forwarder\n");
+        return false;
+    }
+
+    memset(worker->id_table, 0xFF, DNS_FORWARD_NUM_IDS * sizeof(int16_t));
+    memset(worker->buckets, 0xFF, sizeof(worker->buckets));
+    for (int p = 0; p < DNS_FORWARD_MAX_PENDING; ++p)
+    {
+        worker->pending[p].waiters = DNS_FORWARD_NONE;
+        worker->free_pending[p] = DNS_FORWARD_MAX_PENDING - 1 - p;
+    }
+
+    for (int r = 0; r < DNS_FORWARD_MAX_WAITERS; ++r)
+    {
+        worker->requests[r].next = r + 1 < DNS_FORWARD_MAX_WAITERS ? r + 1 : DNS_FORWARD_NONE;
+    }
+
+    // Every worker binds the same address, the first one finding out which
+    // port that is if it wasn't given one
+    const int reuse = 1;
+    const int rcvbuf = DNS_FORWARD_RCVBUF;
+    socklen_t address_len = sizeof(config->address);
+    worker->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (worker->socket < 0 ||
+        (config->threads > 1 && setsockopt(worker->socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) ||
+        setsockopt(worker->socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0 ||
+        !_dns_forward_set_nonblocking(worker->socket) ||
+        bind(worker->socket, (const struct sockaddr*)&config->address, sizeof(config->address)) < 0 ||
+        getsockname(worker->socket, (struct sockaddr*)&config->address, &address_len) < 0)
+    {
+        fprintf(stderr,
+                "Failed to bind forwarder - port: %d errno: %d\n",
+                ntohs(config->address.sin_port),
+                errno);
+        return false;
+    }
+
+    // Connected, so the kernel drops anything that isn't from upstream
+    worker->upstream = socket(AF_INET, SOCK_DGRAM, 0);
+    if (worker->upstream < 0 ||
+        setsockopt(worker->upstream, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0 ||
+        !_dns_forward_set_nonblocking(worker->upstream) ||
+        connect(worker->upstream, (const struct sockaddr*)&config->upstream, sizeof(config->upstream)) < 0)
+    {
+        fprintf(stderr, "Failed to set up upstream socket - errno: %d\n", errno);
+        return false;
+    }
+
+    if (config->tcp_connections > 0 &&
+        !dns_tcp_pool_open(&worker->tcp_pool, &config->upstream, config->tcp_connections))
+    {
+        return false;
+    }
+
+    struct epoll_event client_event = { .events = EPOLLIN, .data.fd = worker->socket };
+    struct epoll_event upstream_event = { .events = EPOLLIN, .data.fd = worker->upstream };
+    struct epoll_event tcp_event = { .events = EPOLLIN, .data.fd = worker->tcp_pool.epoll };
+    worker->epoll = epoll_create1(0);
+    if (worker->epoll < 0 ||
+        epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->socket, &client_event) < 0 ||
+        epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->upstream, &upstream_event) < 0 ||
+        (worker->tcp_pool.epoll >= 0 &&
+         epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->tcp_pool.epoll, &tcp_event) < 0))
+    {
+        fprintf(stderr, "Failed to set up epoll - errno: %d\n", errno);
+        return false;
+    }
+
+    return true;
+}
+
+bool dns_forward_open(struct dns_forwarder* forwarder, const struct dns_forward_config* config)
+{
+    memset(forwarder, 0, sizeof(*forwarder));
+    forwarder->config = *config;
+    if (config->threads < 1 || config->threads > DNS_FORWARD_MAX_THREADS ||
+        config->timeout_ms < 1 || config->attempts < 1 ||
+        config->cache_capacity < 1 || config->cache_capacity > DNS_CACHE_MAX_CAPACITY ||
+        config->tcp_connections < 0 || config->tcp_connections > DNS_TCP_MAX_CONNECTIONS)
+    {
+        fprintf(stderr,
+                "Invalid forwarder config - threads: %d timeout_ms: %d attempts: %d cache: %zu tcp: %d\n",
+                config->threads,
+                config->timeout_ms,
+                config->attempts,
+                config->cache_capacity,
+                config->tcp_connections);
+        return false;
+    }
+
+    forwarder->workers = calloc(config->threads, sizeof(struct dns_forward_worker));
+    if (!forwarder->workers)
+    {
+        fprintf(stderr, "Out of memory for forwarder\n");
+        return false;
+    }
+
+    for (int w = 0; w < config->threads; ++w)
+    {
+        forwarder->workers[w].socket = -1;
+        forwarder->workers[w].upstream = -1;
+        forwarder->workers[w].tcp_pool.epoll = -1;
+        forwarder->workers[w].epoll = -1;
+    }
+
+    for (int w = 0; w < config->threads; ++w)
+    {
+        if (!_dns_forward_open_worker(forwarder, &forwarder->workers[w]))
+        {
+            dns_forward_close(forwarder);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void dns_forward_close(struct dns_forwarder* forwarder)
+{
+    for (int w = 0; forwarder->workers && w < forwarder->config.threads; ++w)
+    {
+        struct dns_forward_worker* worker = &forwarder->workers[w];
+        const int fds[] = { worker->socket, worker->upstream, worker->epoll };
+        for (size_t f = 0; f < sizeof(fds) / sizeof(fds[0]); ++f)
+        {
+            if (fds[f] >= 0)
+            {
+                close(fds[f]);
+            }
+        }
+
+        if (worker->tcp_pool.epoll >= 0)
+        {
+            dns_tcp_pool_close(&worker->tcp_pool);
+        }
+
+        dns_cache_free(&worker->cache);
+        free(worker->id_table);
+        free(worker->pending);
+        free(worker->free_pending);
+        free(worker->requests);
+    }
+
+    free(forwarder->workers);
+    forwarder->workers = NULL;
+}
+
+static bool _dns_forward_start_threads(struct dns_forwarder* forwarder, int first)
+{
+    for (int w = first; w < forwarder->config.threads; ++w)
+    {
+        struct dns_forward_worker* worker = &forwarder->workers[w];
+        if (pthread_create(&worker->thread, NULL, _dns_forward_loop, worker) != 0)
+        {
+            fprintf(stderr, "Failed to start forwarder thread - worker: %d\n", w);
+            dns_forward_stop(forwarder);
+            return false;
+        }
+        worker->started = true;
+    }
+
+    return true;
+}
+
+bool dns_forward_run(struct dns_forwarder* forwarder)
+{
+    atomic_store(&forwarder->running, true);
+    if (!_dns_forward_start_threads(forwarder, 1))
+    {
+        return false;
+    }
+
+    _dns_forward_loop(&forwarder->workers[0]);
+    dns_forward_stop(forwarder);
+    return true;
+}
+
+bool dns_forward_start(struct dns_forwarder* forwarder)
+{
+    atomic_store(&forwarder->running, true);
+    return _dns_forward_start_threads(forwarder, 0);
+}
+
+void dns_forward_stop(struct dns_forwarder* forwarder)
+{
+    atomic_store(&forwarder->running, false);
+    for (int w = 0; w < forwarder->config.threads; ++w)
+    {
+        struct dns_forward_worker* worker = &forwarder->workers[w];
+        if (worker->started)
+        {
+            pthread_join(worker->thread, NULL);
+            worker->started = false;
+        }
+    }
+}
+
+void dns_forward_get_stats(const struct dns_forwarder* forwarder, struct dns_forward_stats* stats_out)
+{
+    memset(stats_out, 0, sizeof(*stats_out));
+    for (int w = 0; w < forwarder->config.threads; ++w)
+    {
+        const struct dns_forward_stats* stats = &forwarder->workers[w].stats;
+        stats_out->queries += stats->queries;
+        stats_out->cache_hits += stats->cache_hits;
+        stats_out->coalesced += stats->coalesced;
+        stats_out->forwarded += stats->forwarded;
+        stats_out->retries += stats->retries;
+        stats_out->tcp += stats->tcp;
+        stats_out->answered += stats->answered;
+        stats_out->servfail += stats->servfail;
+        stats_out->truncated += stats->truncated;
+        stats_out->malformed += stats->malformed;
+        stats_out->unmatched += stats->unmatched;
+    }
+}
+
+void dns_forward_print_stats(const struct dns_forward_stats* stats, FILE* stream)
+{
+    fprintf(stream,
+            "%lu queries, %lu cache hits (%.1f%%), %lu coalesced, %lu forwarded, %lu retries, %lu over TCP\n",
+            stats->queries,
+            stats->cache_hits,
+            stats->queries > 0 ? 100.0 * stats->cache_hits / stats->queries : 0.0,
+            stats->coalesced,
+            stats->forwarded,
+            stats->retries,
+            stats->tcp);
+    fprintf(stream,
+            "%lu answered from upstream, %lu servfail, %lu truncated, %lu malformed, %lu unmatched\n",
+            stats->answered,
+            stats->servfail,
+            stats->truncated,
+            stats->malformed,
+            stats->unmatched);
+}
@@ -0,0 +1,92 @@
+#ifndef __FORWARD_H__
+#define __FORWARD_H__
+
+// Caching forwarder. Listens for queries on UDP, answers what it can from a
+// resolver cache and sends the rest on to one upstream server. Queries for a
+// name and type that's already on its way upstream don't go again, they wait
+// on the one in flight and all get its answer.
+//
+// Each worker is one thread on one epoll loop, with its own listening socket,
+// upstream socket, cache and table of queries in flight, so workers share
+// nothing and nothing is locked. With more than one, every listening socket
+// is bound to the same address with SO_REUSEPORT and the kernel spreads
+// clients across them. A name asked for through two workers is cached twice.
+//
+// An upstream answer with TC set is asked for again over the worker's own
+// pool of pipelined TCP connections (see tcp.h). Clients only ever talk UDP
+// to the forwarder, and get TC if the whole answer is more than they take.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <netinet/in.h>
+
+#define DNS_FORWARD_DEFAULT_PORT 5301
+#define DNS_FORWARD_DEFAULT_TIMEOUT_MS 1000
+#define DNS_FORWARD_DEFAULT_ATTEMPTS 3
+#define DNS_FORWARD_MAX_THREADS 64
+
+// Upstream queries in flight per worker, and clients that can be waiting on
+// them. Past either, clients get SERVFAIL straight away.
+#define DNS_FORWARD_MAX_PENDING 4096
+#define DNS_FORWARD_MAX_WAITERS 8192
+
+// Asked for per socket, so bursts aren't dropped before a worker gets to them
+#define DNS_FORWARD_RCVBUF (4 * 1024 * 1024)
+
+struct dns_forward_config {
+    struct sockaddr_in address; // Port 0 for any free one, filled in once open
+    struct sockaddr_in upstream;
+    int threads;
+    size_t cache_capacity;      // Per worker
+    int timeout_ms;
+    int attempts;
+    int tcp_connections;        // Upstream, per worker, 0 to pass truncated answers on as they are
+};
+
+struct dns_forward_stats {
+    uint64_t queries;
+    uint64_t cache_hits;   // Negative ones included
+    uint64_t coalesced;    // Waited on a query already in flight
+    uint64_t forwarded;    // Upstream queries, not counting retries
+    uint64_t retries;
+    uint64_t tcp;          // Truncated upstream and asked again over TCP
+    uint64_t answered;     // Clients answered from upstream, coalesced included
+    uint64_t servfail;     // Upstream never answered, or no room to wait for it
+    uint64_t truncated;    // Too big for the client, sent back with TC
+    uint64_t malformed;
+    uint64_t unmatched;    // Upstream answers to nothing in flight
+};
+
+struct dns_forward_worker;
+
+struct dns_forwarder {
+    struct dns_forward_config config;
+    struct dns_forward_worker* workers;
+    atomic_bool running;
+};
+
+void dns_forward_config_default(struct dns_forward_config* config, const struct sockaddr_in* upstream);
+
+// Opens every worker's sockets and cache
+bool dns_forward_open(struct dns_forwarder* forwarder, const struct dns_forward_config* config);
+void dns_forward_close(struct dns_forwarder* forwarder);
+
+// Runs worker 0 on the calling thread and the rest on their own, until
+// running is cleared, which a signal handler can do
+bool dns_forward_run(struct dns_forwarder* forwarder);
+
+// Runs every worker on its own thread, for tests that want the forwarder in
+// process
+bool dns_forward_start(struct dns_forwarder* forwarder);
+void dns_forward_stop(struct dns_forwarder* forwarder);
+
+// Summed across workers, only safe once they've stopped
+void dns_forward_get_stats(const struct dns_forwarder* forwarder, struct dns_forward_stats* stats_out);
+void dns_forward_print_stats(const struct dns_forward_stats* stats, FILE* stream);
+
+#endif // __FORWARD_H__
@@ -0,0 +1,706 @@
+// Forwarder checks and load, all in one process. First against an upstream
+// the bench answers by hand: a burst of clients asking the same thing sends
+// one query upstream and every client gets the answer back in the case it
+// asked in, asking again comes from the cache, a CNAME chain comes back out
+// of the cache the way it went in, and an upstream that never answers gets
+// SERVFAIL. Then the batch resolver runs through the forwarder to the stub,
+// once with every name a miss that goes upstream and again with every one
+// cached, and the queries/sec and latency percentiles are printed for each.
+// Last, a name with too many addresses for UDP comes back whole to a client
+// that takes 4096 bytes, the forwarder having asked the stub again over TCP,
+// and with TC to one that doesn't.
+//
+// With --threads the forwarder runs that many SO_REUSEPORT workers, and the
+// load comes from as many client threads on their own sockets. The kernel
+// picks a worker per client socket and each batch opens a new one, so a name
+// cached by one worker can miss on another. Hit counts are only checked with
+// one worker.
+//
+// Usage: dns-forward-bench [--count n] [--threads n]
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "dns.h"
+#include "forward.h"
+#include "parse.h"
+#include "samples.h"
+#include "stub.h"
+
+#define DNS_FORWARD_BENCH_DEFAULT_COUNT 20000
+#define DNS_FORWARD_BENCH_NAME_LENGTH 48
+
+// One name in this many is an nx- name, to mix in some NXDOMAINs
+#define DNS_FORWARD_BENCH_NX_EVERY 10
+
+// Window 1 is a query per round trip, so it only gets a slice of the names
+#define DNS_FORWARD_BENCH_SERIAL_DIVISOR 10
+
+// Clients asking the same question at once
+#define DNS_FORWARD_BENCH_BURST 64
+
+// Long enough for anything the forwarder was going to send to have arrived
+#define DNS_FORWARD_BENCH_SETTLE_MS 50
+#define DNS_FORWARD_BENCH_WAIT_MS 1000
+
+#define DNS_FORWARD_BENCH_GIVE_UP_TIMEOUT_MS 20
+#define DNS_FORWARD_BENCH_GIVE_UP_ATTEMPTS 2
+
+// Ten 63 byte labels, a 641 byte name
+#define DNS_FORWARD_BENCH_OVERSIZED_LABELS 10
+
+static struct sockaddr_in _dns_forward_bench_loopback(int port)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    return address;
+}
+
+// Bound to a free loopback port, blocking
+static int _dns_forward_bench_socket(struct sockaddr_in* address_out)
+{
+    *address_out = _dns_forward_bench_loopback(0);
+    socklen_t address_len = sizeof(*address_out);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 ||
+        bind(fd, (const struct sockaddr*)address_out, sizeof(*address_out)) < 0 ||
+        getsockname(fd, (struct sockaddr*)address_out, &address_len) < 0)
+    {
+        fprintf(stderr, "Failed to open bench socket - errno: %d\n", errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    return fd;
+}
+
+// Into a buffer of DNS_MAX_EDNS_UDP_SIZE, 0 if nothing arrives within
+// timeout_ms
+static size_t _dns_forward_bench_receive(int fd, uint8_t* buffer, int timeout_ms, struct sockaddr_in* from_out)
+{
+    struct pollfd poll_fd = { .fd = fd, .events = POLLIN };
+    socklen_t from_len = sizeof(*from_out);
+    if (poll(&poll_fd, 1, timeout_ms) <= 0)
+    {
+        return 0;
+    }
+
+    const ssize_t received = recvfrom(fd, buffer, DNS_MAX_EDNS_UDP_SIZE, 0, (struct sockaddr*)from_out, &from_len);
+    return received > 0 ? (size_t)received : 0;
+}
+
+static bool _dns_forward_bench_send(int fd, const uint8_t* packet, size_t len, const struct sockaddr_in* to)
+{
+    if (sendto(fd, packet, len, 0, (const struct sockaddr*)to, sizeof(*to)) != (ssize_t)len)
+    {
+        fprintf(stderr, "Failed to send - errno: %d\n", errno);
+        return false;
+    }
+
+    return true;
+}
+
+// Answer section records, zone file style, with TTLs left out since they tick
+// down in the cache
+static size_t _dns_forward_bench_answers_text(const uint8_t* response, size_t len, char* buffer, size_t cap)
+{
+    struct dns_parser parser;
+    struct dns_answer record;
+    size_t offset = 0;
+    dns_parser_init(&parser, response, len);
+    while (dns_parser_next_record(&parser, &record) && record.section == DNS_SECTION_ANSWER)
+    {
+        record.ttl = 0;
+        const size_t written = dns_answer_to_text(&record, buffer + offset, cap - offset - 1);
+        if (written == 0)
+        {
+            return 0;
+        }
+        offset += written;
+        buffer[offset++] = '\n';
+    }
+
+    buffer[offset] = '\0';
+    return parser.failed ? 0 : offset;
+}
+
+// Same question as the query, exactly, and one A record with the stub's
+// address for it
+static bool _dns_forward_bench_check_stub_answer(
+    const uint8_t* query,
+    size_t query_len,
+    const uint8_t* response,
+    size_t len)
+{
+    struct dns_header header;
+    struct dns_parser parser;
+    struct dns_question question;
+    struct dns_answer answer;
+    uint8_t qname[DNS_MAX_NAME_LENGTH];
+    const size_t question_len = dns_question_length(query, query_len);
+    uint32_t address;
+    if (!dns_read_header(response, len, &header) ||
+        (header.flags & DNS_RCODE_MASK) != DNS_RCODE_NOERROR || header.ancount != 1 ||
+        len < DNS_HEADER_SIZE + question_len ||
+        memcmp(response + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, question_len) != 0 ||
+        !dns_parser_init(&parser, response, len) ||
+        !dns_parser_next_question(&parser, &question) ||
+        !dns_parser_next_record(&parser, &answer) ||
+        answer.type != DNS_TYPE_A)
+    {
+        return false;
+    }
+
+    memcpy(&address, answer.rdata, sizeof(address));
+    return ntohl(address) == dns_stub_address(qname, dns_name_to_wire(&question.qname, qname, sizeof(qname)));
+}
+
+// Every client in the burst gets the one upstream answer, with its own ID,
+// its own question and an OPT only if it sent one
+static bool _dns_forward_bench_burst(int client, int upstream, const struct sockaddr_in* forwarder)
+{
+    static const char* s_names[] = { "burst.example.test", "BURST.Example.Test", "bUrSt.eXaMpLe.tEsT" };
+    uint8_t queries[DNS_FORWARD_BENCH_BURST][DNS_MAX_UDP_SIZE];
+    size_t query_lens[DNS_FORWARD_BENCH_BURST];
+    bool answered[DNS_FORWARD_BENCH_BURST] = {false};
+    for (int q = 0; q < DNS_FORWARD_BENCH_BURST; ++q)
+    {
+        const uint16_t edns_udp_size = q % 2 ? DNS_EDNS_DEFAULT_UDP_SIZE : 0;
+        query_lens[q] =
+            dns_encode_query((uint16_t)q, s_names[q % 3], DNS_TYPE_A, edns_udp_size, queries[q], sizeof(queries[q]));
+        if (!_dns_forward_bench_send(client, queries[q], query_lens[q], forwarder))
+        {
+            return false;
+        }
+    }
+
+    uint8_t query[DNS_MAX_EDNS_UDP_SIZE];
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    struct sockaddr_in from;
+    const size_t query_len = _dns_forward_bench_receive(upstream, query, DNS_FORWARD_BENCH_WAIT_MS, &from);
+    struct sockaddr_in extra_from;
+    int extra = 0;
+    while (_dns_forward_bench_receive(upstream, response, DNS_FORWARD_BENCH_SETTLE_MS, &extra_from) > 0)
+    {
+        ++extra;
+    }
+
+    if (query_len == 0 || extra != 0)
+    {
+        fprintf(stderr, "Burst wasn't coalesced - upstream queries: %d\n", (query_len > 0) + extra);
+        return false;
+    }
+
+    const size_t response_len = dns_stub_answer(query, query_len, false, response, sizeof(response));
+    if (!_dns_forward_bench_send(upstream, response, response_len, &from))
+    {
+        return false;
+    }
+
+    for (int a = 0; a < DNS_FORWARD_BENCH_BURST; ++a)
+    {
+        const size_t len = _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from);
+        struct dns_header header;
+        if (len == 0 || !dns_read_header(response, len, &header))
+        {
+            fprintf(stderr, "Burst answers missing - answered: %d/%d\n", a, DNS_FORWARD_BENCH_BURST);
+            return false;
+        }
+
+        const int q = header.id;
+        if (q >= DNS_FORWARD_BENCH_BURST || answered[q] ||
+            !_dns_forward_bench_check_stub_answer(queries[q], query_lens[q], response, len) ||
+            header.arcount != q % 2)
+        {
+            fprintf(stderr, "Wrong burst answer - id: %d\n", q);
+            return false;
+        }
+        answered[q] = true;
+    }
+
+    // Asked again, it's answered without going upstream
+    const size_t again_len =
+        dns_encode_query(0x4242, "Burst.Example.Test", DNS_TYPE_A, 0, query, sizeof(query));
+    size_t len = 0;
+    if (!_dns_forward_bench_send(client, query, again_len, forwarder) ||
+        (len = _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from)) == 0 ||
+        !_dns_forward_bench_check_stub_answer(query, again_len, response, len) ||
+        _dns_forward_bench_receive(upstream, response, DNS_FORWARD_BENCH_SETTLE_MS, &from) != 0)
+    {
+        fprintf(stderr, "Burst name wasn't answered from the cache\n");
+        return false;
+    }
+
+    return true;
+}
+
+// The CNAME sample goes through once from upstream, then comes back out of
+// the cache with the same records
+static bool _dns_forward_bench_chain(int client, int upstream, const struct sockaddr_in* forwarder)
+{
+    size_t num_samples = 0;
+    const struct dns_sample* samples = dns_samples(&num_samples);
+    const struct dns_sample* sample = NULL;
+    for (size_t s = 0; s < num_samples; ++s)
+    {
+        sample = strcmp(samples[s].name, "cname") == 0 ? &samples[s] : sample;
+    }
+
+    uint8_t query[DNS_MAX_EDNS_UDP_SIZE];
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    char upstream_text[DNS_MAX_UDP_SIZE * 4];
+    char cached_text[DNS_MAX_UDP_SIZE * 4];
+    struct sockaddr_in from;
+    size_t query_len = dns_encode_query(1, "www.example.org", DNS_TYPE_A, 0, query, sizeof(query));
+    if (!sample || !_dns_forward_bench_send(client, query, query_len, forwarder))
+    {
+        return false;
+    }
+
+    // Same question as the sample, so it only needs the forwarder's ID
+    query_len = _dns_forward_bench_receive(upstream, query, DNS_FORWARD_BENCH_WAIT_MS, &from);
+    memcpy(response, sample->packet, sample->len);
+    memcpy(response, query, sizeof(uint16_t));
+    size_t len = 0;
+    if (query_len == 0 ||
+        !_dns_forward_bench_send(upstream, response, sample->len, &from) ||
+        (len = _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from)) == 0 ||
+        _dns_forward_bench_answers_text(response, len, upstream_text, sizeof(upstream_text)) == 0)
+    {
+        fprintf(stderr, "CNAME chain wasn't forwarded\n");
+        return false;
+    }
+
+    query_len = dns_encode_query(2, "WWW.example.ORG", DNS_TYPE_A, 0, query, sizeof(query));
+    if (!_dns_forward_bench_send(client, query, query_len, forwarder) ||
+        (len = _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from)) == 0 ||
+        _dns_forward_bench_answers_text(response, len, cached_text, sizeof(cached_text)) == 0 ||
+        strcasecmp(upstream_text, cached_text) != 0 ||
+        memcmp(response + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, dns_question_length(query, query_len)) != 0)
+    {
+        fprintf(stderr,
+                "CNAME chain didn't come back from the cache - upstream:\n%scached:\n%s",
+                upstream_text,
+                cached_text);
+        return false;
+    }
+
+    return true;
+}
+
+static bool _dns_forward_bench_give_up(int client, int upstream, const struct sockaddr_in* forwarder)
+{
+    uint8_t query[DNS_MAX_EDNS_UDP_SIZE];
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    struct sockaddr_in from;
+    const size_t query_len = dns_encode_query(3, "silent.example.test", DNS_TYPE_A, 0, query, sizeof(query));
+    if (!_dns_forward_bench_send(client, query, query_len, forwarder))
+    {
+        return false;
+    }
+
+    struct dns_header header;
+    const size_t len = _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from);
+    int sent = 0;
+    while (_dns_forward_bench_receive(upstream, query, 0, &from) > 0)
+    {
+        ++sent;
+    }
+
+    if (len == 0 || !dns_read_header(response, len, &header) ||
+        (header.flags & DNS_RCODE_MASK) != DNS_RCODE_SERVFAIL || sent != DNS_FORWARD_BENCH_GIVE_UP_ATTEMPTS)
+    {
+        fprintf(stderr,
+                "Expected SERVFAIL after %d attempts - sent: %d rcode: %s\n",
+                DNS_FORWARD_BENCH_GIVE_UP_ATTEMPTS,
+                sent,
+                len > 0 ? dns_rcode_name(header.flags & DNS_RCODE_MASK) : "none");
+        return false;
+    }
+
+    return true;
+}
+
+// A name past DNS_MAX_NAME_LENGTH, every label the longest allowed, gets
+// FORMERR rather than being copied anywhere or sent upstream
+static bool _dns_forward_bench_oversized(int client, int upstream, const struct sockaddr_in* forwarder)
+{
+    uint8_t query[DNS_MAX_EDNS_UDP_SIZE];
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    struct sockaddr_in from;
+    memset(query, 0, DNS_HEADER_SIZE);
+    query[1] = 7;
+    query[5] = 1;
+    size_t query_len = DNS_HEADER_SIZE;
+    for (int label = 0; label < DNS_FORWARD_BENCH_OVERSIZED_LABELS; ++label)
+    {
+        query[query_len++] = DNS_MAX_LABEL_LENGTH;
+        memset(query + query_len, 'a', DNS_MAX_LABEL_LENGTH);
+        query_len += DNS_MAX_LABEL_LENGTH;
+    }
+    query[query_len++] = 0;
+    const uint8_t type_and_class[] = { 0, DNS_TYPE_A, 0, DNS_CLASS_IN };
+    memcpy(query + query_len, type_and_class, sizeof(type_and_class));
+    query_len += sizeof(type_and_class);
+    if (!_dns_forward_bench_send(client, query, query_len, forwarder))
+    {
+        return false;
+    }
+
+    struct dns_header header;
+    const size_t len = _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from);
+    int sent = 0;
+    while (_dns_forward_bench_receive(upstream, query, 0, &from) > 0)
+    {
+        ++sent;
+    }
+
+    if (len == 0 || !dns_read_header(response, len, &header) ||
+        (header.flags & DNS_RCODE_MASK) != DNS_RCODE_FORMERR || header.id != 7 || sent != 0)
+    {
+        fprintf(stderr,
+                "Expected FORMERR for a %zu byte query - sent: %d rcode: %s\n",
+                query_len,
+                sent,
+                len > 0 ? dns_rcode_name(header.flags & DNS_RCODE_MASK) : "none");
+        return false;
+    }
+
+    return true;
+}
+
+static bool _dns_forward_bench_behaviour()
+{
+    struct sockaddr_in upstream_address;
+    struct sockaddr_in client_address;
+    const int upstream = _dns_forward_bench_socket(&upstream_address);
+    const int client = _dns_forward_bench_socket(&client_address);
+    struct dns_forward_config config;
+    dns_forward_config_default(&config, &upstream_address);
+    config.address = _dns_forward_bench_loopback(0);
+    config.timeout_ms = DNS_FORWARD_BENCH_GIVE_UP_TIMEOUT_MS;
+    config.attempts = DNS_FORWARD_BENCH_GIVE_UP_ATTEMPTS;
+
+    // The give up check wants a short timeout, the rest want one long enough
+    // that nothing's resent while the bench answers by hand
+    struct dns_forwarder forwarder;
+    struct dns_forwarder impatient;
+    memset(&forwarder, 0, sizeof(forwarder));
+    memset(&impatient, 0, sizeof(impatient));
+    bool valid = upstream >= 0 && client >= 0 && dns_forward_open(&impatient, &config);
+    config.address = _dns_forward_bench_loopback(0);
+    config.timeout_ms = DNS_FORWARD_DEFAULT_TIMEOUT_MS * 10;
+    valid = valid && dns_forward_open(&forwarder, &config);
+    valid = valid && dns_forward_start(&forwarder) && dns_forward_start(&impatient);
+    valid = valid &&
+            _dns_forward_bench_burst(client, upstream, &forwarder.config.address) &&
+            _dns_forward_bench_chain(client, upstream, &forwarder.config.address) &&
+            _dns_forward_bench_give_up(client, upstream, &impatient.config.address) &&
+            _dns_forward_bench_oversized(client, upstream, &forwarder.config.address);
+
+    if (forwarder.workers)
+    {
+        dns_forward_stop(&forwarder);
+        dns_forward_close(&forwarder);
+    }
+    if (impatient.workers)
+    {
+        dns_forward_stop(&impatient);
+        dns_forward_close(&impatient);
+    }
+
+    if (upstream >= 0)
+    {
+        close(upstream);
+    }
+    if (client >= 0)
+    {
+        close(client);
+    }
+
+    if (valid)
+    {
+        fprintf(stdout,
+                "%d clients coalesced into one upstream query, CNAME chain cached, SERVFAIL after %d attempts, "
+                "FORMERR for an oversized name\n",
+                DNS_FORWARD_BENCH_BURST,
+                DNS_FORWARD_BENCH_GIVE_UP_ATTEMPTS);
+    }
+    return valid;
+}
+
+struct dns_forward_bench_client {
+    struct dns_batch_config config;
+    struct dns_batch_query* queries;
+    size_t count;
+    size_t wrong;
+    struct dns_batch_stats stats;
+    bool valid;
+    pthread_t thread;
+};
+
+static void _dns_forward_bench_on_answer(
+    struct dns_batch_query* query,
+    const uint8_t* response,
+    size_t len,
+    void* context)
+{
+    struct dns_forward_bench_client* client = (struct dns_forward_bench_client*)context;
+    if (strncmp(query->name, "nx", 2) == 0)
+    {
+        client->wrong += query->rcode != DNS_RCODE_NXDOMAIN || query->ancount != 0;
+        return;
+    }
+
+    uint8_t packet[DNS_MAX_UDP_SIZE];
+    const size_t packet_len = dns_encode_query(0, query->name, query->qtype, 0, packet, sizeof(packet));
+    client->wrong += !_dns_forward_bench_check_stub_answer(packet, packet_len, response, len);
+}
+
+static void* _dns_forward_bench_client_thread(void* context)
+{
+    struct dns_forward_bench_client* client = (struct dns_forward_bench_client*)context;
+    client->valid = dns_batch_resolve(
+        &client->config, client->queries, client->count, _dns_forward_bench_on_answer, client, &client->stats);
+    return NULL;
+}
+
+static int _dns_forward_bench_compare_latency(const void* a, const void* b)
+{
+    const uint64_t lhs = ((const struct dns_batch_query*)a)->latency_ns;
+    const uint64_t rhs = ((const struct dns_batch_query*)b)->latency_ns;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static double _dns_forward_bench_percentile_ms(const struct dns_batch_query* sorted, size_t count, double percentile)
+{
+    const size_t index = (size_t)(percentile * (count - 1));
+    return (double)sorted[index].latency_ns / DNS_NS_PER_MS;
+}
+
+// Splits the queries across a client thread each, checks every answer and
+// prints a line for them
+static bool _dns_forward_bench_run(
+    const char* label,
+    const struct sockaddr_in* forwarder,
+    int threads,
+    int window,
+    struct dns_batch_query* queries,
+    size_t count)
+{
+    struct dns_forward_bench_client clients[DNS_FORWARD_MAX_THREADS];
+    const uint64_t start_ns = dns_now_ns();
+    int started = 0;
+    for (; started < threads; ++started)
+    {
+        struct dns_forward_bench_client* client = &clients[started];
+        memset(client, 0, sizeof(*client));
+        dns_batch_config_default(&client->config, forwarder);
+        client->config.window = window;
+        client->queries = queries + count * started / threads;
+        client->count = count * (started + 1) / threads - count * started / threads;
+        if (pthread_create(&client->thread, NULL, _dns_forward_bench_client_thread, client) != 0)
+        {
+            fprintf(stderr, "Failed to start client thread\n");
+            break;
+        }
+    }
+
+    size_t answered = 0;
+    size_t wrong = 0;
+    size_t retries = 0;
+    bool valid = started == threads;
+    for (int c = 0; c < started; ++c)
+    {
+        pthread_join(clients[c].thread, NULL);
+        valid &= clients[c].valid;
+        answered += clients[c].stats.answered;
+        wrong += clients[c].wrong + clients[c].stats.mismatched;
+        retries += clients[c].stats.retries;
+    }
+
+    const uint64_t elapsed_ns = dns_now_ns() - start_ns;
+    qsort(queries, count, sizeof(struct dns_batch_query), _dns_forward_bench_compare_latency);
+    fprintf(stdout,
+            "%-9s window %4d: %6zu queries %9.0f queries/sec  p50 %6.3f ms  p99 %6.3f ms  p99.9 %6.3f ms"
+            "  %zu retries\n",
+            label,
+            window,
+            count,
+            (double)answered * DNS_NS_PER_SEC / elapsed_ns,
+            _dns_forward_bench_percentile_ms(queries, count, 0.5),
+            _dns_forward_bench_percentile_ms(queries, count, 0.99),
+            _dns_forward_bench_percentile_ms(queries, count, 0.999),
+            retries);
+
+    if (!valid || answered != count || wrong != 0)
+    {
+        fprintf(stderr, "Batch went wrong - answered: %zu/%zu wrong: %zu\n", answered, count, wrong);
+        return false;
+    }
+
+    return true;
+}
+
+// The forwarder fetches the whole answer over TCP either way, it's only the
+// client's UDP size that decides whether it gets it
+static bool _dns_forward_bench_truncated(const struct sockaddr_in* forwarder)
+{
+    struct sockaddr_in client_address;
+    struct sockaddr_in from;
+    const int client = _dns_forward_bench_socket(&client_address);
+    const uint16_t udp_sizes[] = { DNS_MAX_EDNS_UDP_SIZE, 0 };
+    bool valid = client >= 0;
+    for (size_t u = 0; u < sizeof(udp_sizes) / sizeof(udp_sizes[0]) && valid; ++u)
+    {
+        uint8_t query[DNS_MAX_UDP_SIZE];
+        uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+        const size_t query_len =
+            dns_encode_query(5, "big.Forward.Example.Test", DNS_TYPE_A, udp_sizes[u], query, sizeof(query));
+        struct dns_header header;
+        const size_t len = _dns_forward_bench_send(client, query, query_len, forwarder)
+                               ? _dns_forward_bench_receive(client, response, DNS_FORWARD_BENCH_WAIT_MS, &from)
+                               : 0;
+        const bool truncated = udp_sizes[u] == 0;
+        valid = len > 0 && dns_read_header(response, len, &header) &&
+                ((header.flags & DNS_FLAG_TC) != 0) == truncated &&
+                header.ancount == (truncated ? 0 : DNS_STUB_BIG_RECORDS);
+        if (!valid)
+        {
+            fprintf(stderr,
+                    "Big answer went wrong - udp_size: %d len: %zu ancount: %d\n",
+                    udp_sizes[u],
+                    len,
+                    len > 0 ? header.ancount : -1);
+        }
+    }
+
+    if (client >= 0)
+    {
+        close(client);
+    }
+    return valid;
+}
+
+static bool _dns_forward_bench_load(int threads, struct dns_batch_query* queries, size_t count)
+{
+    struct dns_stub stub;
+    const struct dns_stub_config stub_config = { .port = 0, .drop_percent = 0 };
+    if (!dns_stub_open(&stub, &stub_config) || !dns_stub_start(&stub))
+    {
+        return false;
+    }
+
+    const struct sockaddr_in upstream = _dns_forward_bench_loopback(stub.config.port);
+    struct dns_forward_config config;
+    dns_forward_config_default(&config, &upstream);
+    config.address = _dns_forward_bench_loopback(0);
+    config.threads = threads;
+    config.cache_capacity = count < DNS_CACHE_MAX_CAPACITY ? count : DNS_CACHE_MAX_CAPACITY;
+
+    struct dns_forwarder forwarder;
+    bool valid = dns_forward_open(&forwarder, &config) && dns_forward_start(&forwarder);
+    const struct sockaddr_in* address = &forwarder.config.address;
+    const int window = DNS_BATCH_DEFAULT_WINDOW;
+    const size_t serial_count = count / DNS_FORWARD_BENCH_SERIAL_DIVISOR;
+    valid = valid &&
+            _dns_forward_bench_run("upstream", address, threads, window, queries, count) &&
+            _dns_forward_bench_run("cached", address, threads, window, queries, count) &&
+            _dns_forward_bench_run("cached", address, threads, 1, queries, serial_count) &&
+            _dns_forward_bench_truncated(address);
+
+    struct dns_forward_stats stats = {0};
+    if (forwarder.workers)
+    {
+        dns_forward_stop(&forwarder);
+        dns_forward_get_stats(&forwarder, &stats);
+        dns_forward_print_stats(&stats, stdout);
+        dns_forward_close(&forwarder);
+    }
+
+    dns_stub_stop(&stub);
+    dns_stub_close(&stub);
+    // Plus the two big answers, too many records to cache, forwarded and
+    // fetched over TCP each time
+    const size_t big = 2;
+    if (valid && threads == 1 &&
+        (stats.forwarded != count + big || stats.cache_hits != count + serial_count || stats.tcp != big))
+    {
+        fprintf(stderr,
+                "Expected every name forwarded once then cached - forwarded: %lu/%zu hits: %lu/%zu tcp: %lu/%zu\n",
+                stats.forwarded,
+                count + big,
+                stats.cache_hits,
+                count + serial_count,
+                stats.tcp,
+                big);
+        valid = false;
+    }
+
+    return valid;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = DNS_FORWARD_BENCH_DEFAULT_COUNT;
+    int threads = 1;
+    for (int a = 1; a < argc; a += 2)
+    {
+        const int value = a + 1 < argc ? atoi(argv[a + 1]) : 0;
+        if (strcmp(argv[a], "--count") == 0 && value >= DNS_FORWARD_BENCH_SERIAL_DIVISOR)
+        {
+            count = (size_t)value;
+        }
+        else if (strcmp(argv[a], "--threads") == 0 && value >= 1 && value <= DNS_FORWARD_MAX_THREADS)
+        {
+            threads = value;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--count n] [--threads n]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    char (*names)[DNS_FORWARD_BENCH_NAME_LENGTH] = malloc(count * DNS_FORWARD_BENCH_NAME_LENGTH);
+    struct dns_batch_query* queries = calloc(count, sizeof(struct dns_batch_query));
+    if (!names || !queries)
+    {
+        fprintf(stderr, "Out of memory for %zu names\n", count);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        snprintf(names[i],
+                 DNS_FORWARD_BENCH_NAME_LENGTH,
+                 "%s-%zu.Forward.Example.Test",
+                 i % DNS_FORWARD_BENCH_NX_EVERY == 0 ? "nx" : "host",
+                 i);
+        queries[i].name = names[i];
+        queries[i].qtype = DNS_TYPE_A;
+    }
+
+    const bool valid = _dns_forward_bench_behaviour() && _dns_forward_bench_load(threads, queries, count);
+    free(queries);
+    free(names);
+    return valid ? 0 : -1;
+}
@@ -0,0 +1,130 @@
+// Caching forwarder daemon, runs until interrupted and prints its stats.
+//
+// Usage: dns-forwarder --upstream ip[:port] [--listen ip[:port]] [--threads n] [--cache entries]
+//                      [--timeout ms] [--attempts n] [--tcp n]
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "dns.h"
+#include "forward.h"
+#include "tcp.h"
+
+static struct dns_forwarder s_forwarder;
+
+static void _forward_on_signal(int signal)
+{
+    atomic_store(&s_forwarder.running, false);
+}
+
+static void _forward_usage(const char* program)
+{
+    fprintf(stderr,
+            "Usage: %s --upstream ip[:port] [--listen ip[:port]] [--threads n] [--cache entries]\n"
+            "       [--timeout ms] [--attempts n] [--tcp n]\n\n",
+            program);
+    fprintf(stderr, "  --listen   127.0.0.1:%d by default\n", DNS_FORWARD_DEFAULT_PORT);
+    fprintf(stderr, "  --threads  Workers sharing the port with SO_REUSEPORT, each with its own cache\n");
+    fprintf(stderr,
+            "  --tcp      Upstream connections per worker for truncated answers, 0 for none, %d by default\n",
+            DNS_TCP_DEFAULT_CONNECTIONS);
+}
+
+int main(int argc, char** argv)
+{
+    struct sockaddr_in upstream;
+    memset(&upstream, 0, sizeof(upstream));
+    struct dns_forward_config config;
+    dns_forward_config_default(&config, &upstream);
+
+    bool has_upstream = false;
+    for (int a = 1; a < argc; a += 2)
+    {
+        const char* arg = argv[a];
+        const char* value = a + 1 < argc ? argv[a + 1] : NULL;
+        if (value == NULL)
+        {
+            _forward_usage(argv[0]);
+            return -1;
+        }
+
+        bool valid = true;
+        if (strcmp(arg, "--upstream") == 0)
+        {
+            valid = has_upstream = dns_parse_address(value, DNS_PORT, &config.upstream);
+        }
+        else if (strcmp(arg, "--listen") == 0)
+        {
+            valid = dns_parse_address(value, DNS_FORWARD_DEFAULT_PORT, &config.address);
+        }
+        else if (strcmp(arg, "--threads") == 0)
+        {
+            config.threads = atoi(value);
+        }
+        else if (strcmp(arg, "--cache") == 0)
+        {
+            config.cache_capacity = (size_t)atol(value);
+        }
+        else if (strcmp(arg, "--timeout") == 0)
+        {
+            config.timeout_ms = atoi(value);
+        }
+        else if (strcmp(arg, "--attempts") == 0)
+        {
+            config.attempts = atoi(value);
+        }
+        else if (strcmp(arg, "--tcp") == 0)
+        {
+            config.tcp_connections = atoi(value);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            _forward_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!has_upstream)
+    {
+        _forward_usage(argv[0]);
+        return -1;
+    }
+
+    if (!dns_forward_open(&s_forwarder, &config))
+    {
+        return -1;
+    }
+
+    char listen_text[INET_ADDRSTRLEN];
+    char upstream_text[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &s_forwarder.config.address.sin_addr, listen_text, sizeof(listen_text));
+    inet_ntop(AF_INET, &config.upstream.sin_addr, upstream_text, sizeof(upstream_text));
+    fprintf(stdout,
+            "Forwarding %s:%d to %s:%d with %d thread%s\n",
+            listen_text,
+            ntohs(s_forwarder.config.address.sin_port),
+            upstream_text,
+            ntohs(config.upstream.sin_port),
+            config.threads,
+            config.threads == 1 ? "" : "s");
+    fflush(stdout);
+
+    signal(SIGINT, _forward_on_signal);
+    signal(SIGTERM, _forward_on_signal);
+    const bool valid = dns_forward_run(&s_forwarder);
+
+    struct dns_forward_stats stats;
+    dns_forward_get_stats(&s_forwarder, &stats);
+    dns_forward_print_stats(&stats, stdout);
+    dns_forward_close(&s_forwarder);
+    return valid ? 0 : -1;
+}
@@ -0,0 +1,252 @@
+// Fuzz target for the response parser. Built with clang and
+// -fsanitize=fuzzer,address -DDNS_FUZZ_LIBFUZZER it's a plain libFuzzer
+// target. Otherwise it brings its own main, which replays the corpus and then
+// mutates it for a while, so gcc with -fsanitize=address still gets a look.
+//
+// Every input is copied into a buffer of exactly its size, so reading a
+// byte past the end is caught by the sanitizer rather than landing in slack.
+// Anything the parser accepts has to hold up too: names have to expand to
+// text and wire form, and each name has to equal itself. Every input also
+// goes through the resolver cache, which parses the same untrusted bytes.
+//
+// Usage: dns-fuzz [--runs n] [--seed n] <corpus files...>
+//
+// fuzz/corpus holds the samples.c responses plus hand-made bad ones:
+// pointer loops, pointers forward or into the header, names over 255 once
+// expanded, rdata running off the end and so on, plus anything the fuzzer
+// has tripped over before.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cache.h"
+#include "../dns.h"
+#include "../parse.h"
+
+#define DNS_FUZZ_DEFAULT_RUNS 200000
+#define DNS_FUZZ_MAX_INPUT 4096
+#define DNS_FUZZ_MAX_CORPUS 256
+
+// Small, so eviction and flushing get a go too
+#define DNS_FUZZ_CACHE_CAPACITY 256
+
+static void _dns_fuzz_check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "Fuzz invariant broken: %s\n", what);
+        abort();
+    }
+}
+
+static void _dns_fuzz_name(const struct dns_name* name)
+{
+    char text[DNS_MAX_NAME_TEXT];
+    uint8_t wire[DNS_MAX_NAME_LENGTH];
+    _dns_fuzz_check(name->length >= 1 && name->length <= DNS_MAX_NAME_LENGTH, "name length");
+    _dns_fuzz_check(dns_name_to_text(name, text, sizeof(text)) == strlen(text), "name to text");
+    _dns_fuzz_check(dns_name_to_wire(name, wire, sizeof(wire)) == name->length, "name to wire");
+    _dns_fuzz_check(dns_name_equals(name, name), "name equals itself");
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    struct dns_parser parser;
+    if (!dns_parser_init(&parser, data, size))
+    {
+        return 0;
+    }
+
+    struct dns_question question;
+    while (dns_parser_next_question(&parser, &question))
+    {
+        _dns_fuzz_name(&question.qname);
+    }
+
+    char text[DNS_FUZZ_MAX_INPUT * 4 + DNS_MAX_NAME_TEXT];
+    struct dns_answer answer;
+    int num_records = 0;
+    while (dns_parser_next_record(&parser, &answer))
+    {
+        _dns_fuzz_check(answer.rdata + answer.rdlength <= data + size, "rdata in bounds");
+        _dns_fuzz_name(&answer.name);
+        if (answer.type == DNS_TYPE_CNAME || answer.type == DNS_TYPE_NS)
+        {
+            _dns_fuzz_name(&answer.data.target);
+        }
+        else if (answer.type == DNS_TYPE_MX)
+        {
+            _dns_fuzz_name(&answer.data.mx.exchange);
+        }
+        else if (answer.type == DNS_TYPE_SOA)
+        {
+            _dns_fuzz_name(&answer.data.soa.mname);
+            _dns_fuzz_name(&answer.data.soa.rname);
+        }
+
+        dns_answer_to_text(&answer, text, sizeof(text));
+        ++num_records;
+    }
+
+    _dns_fuzz_check(
+        parser.failed || num_records == parser.header.ancount + parser.header.nscount + parser.header.arcount,
+        "record count");
+
+    // Whatever the cache takes from it has to come back out in one piece.
+    // The clock runs a minute per input, so entries expire as it goes.
+    static struct dns_cache s_cache;
+    static uint64_t s_now_ns;
+    s_now_ns += 60 * DNS_NS_PER_SEC;
+    if (s_cache.capacity == 0 && !dns_cache_init(&s_cache, DNS_FUZZ_CACHE_CAPACITY))
+    {
+        abort();
+    }
+
+    uint8_t qname[DNS_MAX_NAME_LENGTH];
+    struct dns_cache_result result;
+    dns_cache_store(&s_cache, data, size, s_now_ns);
+    dns_parser_init(&parser, data, size);
+    if (dns_parser_next_question(&parser, &question) &&
+        dns_cache_lookup(
+            &s_cache, qname, dns_name_to_wire(&question.qname, qname, sizeof(qname)), question.qtype, s_now_ns, &result))
+    {
+        const struct dns_cache_rrset* last = &result.chain[result.chain_length - 1];
+        _dns_fuzz_check(result.chain_length >= 1 && result.chain_length <= DNS_CACHE_MAX_CHAIN + 1, "chain length");
+        _dns_fuzz_check(last->name_length >= 1 && last->records_len >= sizeof(uint16_t), "cached rrset");
+    }
+    return 0;
+}
+
+#ifndef DNS_FUZZ_LIBFUZZER
+
+struct dns_fuzz_input {
+    uint8_t data[DNS_FUZZ_MAX_INPUT];
+    size_t len;
+};
+
+static uint32_t s_rng = 0x12345678u;
+
+static uint32_t _dns_fuzz_random()
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+// A few things likely to get past the header and into the interesting parts:
+// flipped bits, pointers, lengths and counts nudged, chunks cut or repeated
+static void _dns_fuzz_mutate(struct dns_fuzz_input* input)
+{
+    const int num_mutations = 1 + _dns_fuzz_random() % 4;
+    for (int m = 0; m < num_mutations && input->len > 0; ++m)
+    {
+        const size_t at = _dns_fuzz_random() % input->len;
+        switch (_dns_fuzz_random() % 7)
+        {
+            case 0:
+                input->data[at] ^= (uint8_t)(1 << (_dns_fuzz_random() % 8));
+                break;
+
+            case 1:
+                input->data[at] = (uint8_t)_dns_fuzz_random();
+                break;
+
+            case 2:
+                if (at + 1 < input->len)
+                {
+                    input->data[at] = DNS_POINTER_MASK | (_dns_fuzz_random() % 2);
+                    input->data[at + 1] = (uint8_t)_dns_fuzz_random();
+                }
+                break;
+
+            case 3:
+                input->data[at] += (uint8_t)(_dns_fuzz_random() % 5) - 2;
+                break;
+
+            case 4:
+                if (input->len > DNS_HEADER_SIZE)
+                {
+                    const size_t count = 4 + 2 * (_dns_fuzz_random() % 4);
+                    input->data[count + 1] += 1;
+                }
+                break;
+
+            case 5:
+                input->len = at;
+                break;
+
+            case 6:
+            {
+                const size_t chunk = 1 + _dns_fuzz_random() % 16;
+                if (at + chunk <= input->len && input->len + chunk <= DNS_FUZZ_MAX_INPUT)
+                {
+                    memmove(input->data + at + chunk, input->data + at, input->len - at);
+                    input->len += chunk;
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void _dns_fuzz_run(const uint8_t* data, size_t len)
+{
+    uint8_t* exact = malloc(len > 0 ? len : 1);
+    memcpy(exact, data, len);
+    LLVMFuzzerTestOneInput(exact, len);
+    free(exact);
+}
+
+int main(int argc, char** argv)
+{
+    long runs = DNS_FUZZ_DEFAULT_RUNS;
+    static struct dns_fuzz_input s_corpus[DNS_FUZZ_MAX_CORPUS];
+    size_t corpus_size = 0;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--runs") == 0 && a + 1 < argc)
+        {
+            runs = atol(argv[++a]);
+            continue;
+        }
+
+        if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc)
+        {
+            s_rng = (uint32_t)strtoul(argv[++a], NULL, 0) | 1;
+            continue;
+        }
+
+        FILE* file = fopen(argv[a], "rb");
+        if (!file || corpus_size == DNS_FUZZ_MAX_CORPUS)
+        {
+            fprintf(stderr, "Can't use corpus file - path: %s\n", argv[a]);
+            return -1;
+        }
+
+        struct dns_fuzz_input* input = &s_corpus[corpus_size++];
+        input->len = fread(input->data, 1, sizeof(input->data), file);
+        fclose(file);
+        _dns_fuzz_run(input->data, input->len);
+    }
+
+    if (corpus_size == 0)
+    {
+        fprintf(stderr, "Usage: %s [--runs n] [--seed n] <corpus files...>\n", argv[0]);
+        return -1;
+    }
+
+    for (long r = 0; r < runs; ++r)
+    {
+        struct dns_fuzz_input input = s_corpus[_dns_fuzz_random() % corpus_size];
+        _dns_fuzz_mutate(&input);
+        _dns_fuzz_run(input.data, input.len);
+    }
+
+    fprintf(stdout, "%zu corpus files, %ld mutated runs, no invariants broken\n", corpus_size, runs);
+    return 0;
+}
+
+#endif // DNS_FUZZ_LIBFUZZER
@@ -1,4 +1,4 @@
-#include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -7,203 +7,344 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
-#define DNS_ID 0x2020
-
-//                                     1  1  1  1  1  1
-//       0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//     |                      ID                       |
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//     |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//     |                    QDCOUNT                    |
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//     |                    ANCOUNT                    |
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//     |                    NSCOUNT                    |
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//     |                    ARCOUNT                    |
-//     +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-
-struct dns_header {
-    uint16_t  id;
-    uint16_t  flags;
-    uint16_t  qdcount; // Number of entries in question section
-    uint16_t  ancount; // Number of resource records in answer section
-    uint16_t  nscount; // Number of name server resources in auth records section
-    uint16_t  arcount; // Number of resource records in additional records section
-};
+#include "batch.h"
+#include "dns.h"
+#include "parse.h"
+#include "tcp.h"
+
+#define DNS_DEFAULT_SERVER 0xd043dede
 
-//                                     1  1  1  1  1  1
-//      0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                                               |
-//    /                     QNAME                     /
-//    /                                               /
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                     QTYPE                     |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                     QCLASS                    |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-
-struct dns_question {
-    char* qname;
+struct dns_options {
+    struct dns_batch_config batch;
+    const char* batch_path;
+    const char* hostname;
     uint16_t qtype;
-    uint16_t qclass;
+    bool quiet;
 };
 
-//                                    1  1  1  1  1  1
-//      0  1  2  3  4  5  6  7  8  9  0  1  2  3  4  5
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                                               |
-//    /                                               /
-//    /                      NAME                     /
-//    |                                               |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                      TYPE                     |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                     CLASS                     |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                      TTL                      |
-//    |                                               |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-//    |                   RDLENGTH                    |
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--|
-//    /                     RDATA                     /
-//    /                                               /
-//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+ 
-
-struct dns_answer {
-    uint16_t compression;
-    uint16_t type;
-    uint16_t class;
-    uint32_t ttl;
-    uint16_t rdlength;
-    char* rdata;
-};
+static void _dns_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [--server ip[:port]]... [--race] [--type t] [--edns size] <hostname>\n", program);
+    fprintf(stderr,
+            "       %s [--server ip[:port]]... [--race] [--type t] [--edns size] [--window n] [--timeout ms]\n"
+            "           [--attempts n] [--tcp n] [--quiet] --batch <file|->\n\n",
+            program);
+    fprintf(stderr,
+            "  --server Up to %d, the nameservers in %s if none are given\n",
+            DNS_BATCH_MAX_SERVERS,
+            DNS_RESOLV_CONF_PATH);
+    fprintf(stderr, "  --race   Every query to the two fastest servers at once, the first answer wins\n");
+    fprintf(stderr, "  --type   A, AAAA, CNAME, NS, SOA, MX, TXT or ANY, A by default\n");
+    fprintf(stderr, "  --edns   UDP size to advertise with EDNS0, 0 for none, %d by default\n", DNS_EDNS_DEFAULT_UDP_SIZE);
+    fprintf(stderr,
+            "  --tcp    Connections to ask again on when an answer's truncated, 0 for none, %d by default\n",
+            DNS_TCP_DEFAULT_CONNECTIONS);
+    fprintf(stderr, "  --batch  One name per line, optionally followed by a type\n");
+}
 
-char* dns_build_qname(char* hostname)
+static bool _dns_parse_args(int argc, char** argv, struct dns_options* options)
 {
-    const size_t hostnamelen = strlen(hostname);
-    char* qname = (char*)calloc(hostnamelen + 2, sizeof(uint8_t));
-    if (hostname == NULL || hostnamelen == 0)
-    {
-        return NULL;
-    }
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(DNS_DEFAULT_SERVER);
+    server.sin_port = htons(DNS_PORT);
 
-    // Reencode each segment as <seg-len><segment>
-    char currentlen = 0;
-    char* write = qname + 1;
-    char* read = hostname;
-    do
+    memset(options, 0, sizeof(*options));
+    dns_batch_config_default(&options->batch, &server);
+    options->batch.num_servers = 0;
+    options->qtype = DNS_TYPE_A;
+    for (int a = 1; a < argc; ++a)
     {
-        ++currentlen;
-        if (*read != '.')
+        const char* arg = argv[a];
+        const char* value = a + 1 < argc ? argv[a + 1] : NULL;
+        if (strcmp(arg, "--quiet") == 0)
+        {
+            options->quiet = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--race") == 0)
+        {
+            options->batch.race = true;
+            continue;
+        }
+
+        if (strncmp(arg, "--", 2) != 0)
+        {
+            options->hostname = arg;
+            continue;
+        }
+
+        if (value == NULL)
+        {
+            return false;
+        }
+
+        ++a;
+        if (strcmp(arg, "--server") == 0)
+        {
+            if (!dns_parse_address(value, DNS_PORT, &server) || !dns_batch_add_server(&options->batch, &server))
+            {
+                fprintf(stderr, "Bad server or too many - server: '%s' max: %d\n", value, DNS_BATCH_MAX_SERVERS);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--batch") == 0)
+        {
+            options->batch_path = value;
+        }
+        else if (strcmp(arg, "--type") == 0)
         {
-            *write = *read;
+            options->qtype = dns_type_from_name(value);
+            if (options->qtype == 0)
+            {
+                fprintf(stderr, "Unknown type - type: '%s'\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--edns") == 0)
+        {
+            const int edns_udp_size = atoi(value);
+            if (edns_udp_size < 0 || edns_udp_size > DNS_MAX_EDNS_UDP_SIZE)
+            {
+                fprintf(stderr, "Bad EDNS size - size: '%s' expected: [0, %d]\n", value, DNS_MAX_EDNS_UDP_SIZE);
+                return false;
+            }
+            options->batch.edns_udp_size = (uint16_t)edns_udp_size;
+        }
+        else if (strcmp(arg, "--window") == 0)
+        {
+            options->batch.window = atoi(value);
+        }
+        else if (strcmp(arg, "--timeout") == 0)
+        {
+            options->batch.timeout_ms = atoi(value);
+        }
+        else if (strcmp(arg, "--attempts") == 0)
+        {
+            options->batch.attempts = atoi(value);
+        }
+        else if (strcmp(arg, "--tcp") == 0)
+        {
+            options->batch.tcp_connections = atoi(value);
         }
         else
         {
-            *(write - currentlen) = currentlen;
-            currentlen = 0;
+            return false;
         }
+    }
 
-        ++read;
-        ++write;
-    } while (*read != '\0');
+    // resolv.conf if there are no servers given, and the old default if
+    // there's nothing in that either
+    if (options->batch.num_servers == 0)
+    {
+        options->batch.num_servers =
+            dns_read_resolv_conf(DNS_RESOLV_CONF_PATH, options->batch.servers, DNS_BATCH_MAX_SERVERS);
+    }
+    if (options->batch.num_servers == 0)
+    {
+        server.sin_addr.s_addr = htonl(DNS_DEFAULT_SERVER);
+        server.sin_port = htons(DNS_PORT);
+        dns_batch_add_server(&options->batch, &server);
+    }
 
-    return qname;
+    return (options->hostname != NULL) != (options->batch_path != NULL);
 }
 
-uint8_t* dns_build_request(char* hostname, size_t* packetlen)
+// Whole file in one allocation, split into names in place. One name per
+// line with an optional type after it, blank lines and # comments are
+// skipped.
+static char* _dns_read_names(
+    const char* path,
+    uint16_t default_qtype,
+    struct dns_batch_query** queries_out,
+    size_t* count_out)
 {
-    uint8_t* data = NULL;
-    struct dns_header header = {
-        .id = htons(DNS_ID),
-        .flags = htons (0x0100), /* Q=0, RD=1 */
-        .qdcount = 1,
-        .ancount = 0,
-        .nscount = 0,
-        .arcount = 0
-    };
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open names - path: %s errno: %d\n", path, errno);
+        return NULL;
+    }
 
-    struct dns_question question = {
-        .qtype = 1,  // A
-        .qclass = 1, // IN
-        .qname = dns_build_qname(hostname)
-    };
+    size_t len = 0;
+    size_t cap = 64 * 1024;
+    char* text = malloc(cap + 1);
+    size_t read;
+    while (text && (read = fread(text + len, 1, cap - len, file)) > 0)
+    {
+        len += read;
+        if (len == cap)
+        {
+            cap *= 2;
+            char* grown = realloc(text, cap + 1);
+            if (!grown)
+            {
+                free(text);
+            }
+            text = grown;
+        }
+    }
 
-    const size_t headlen = sizeof(header);
-    const size_t qnamelen = strlen(hostname) + 2;
-    const size_t questionlen = sizeof(uint16_t) * 2 + qnamelen;
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+
+    if (!text)
+    {
+        fprintf(stderr, "Out of memory reading names\n");
+        return NULL;
+    }
+    text[len] = '\0';
+
+    size_t count = 0;
+    size_t queries_cap = 1024;
+    struct dns_batch_query* queries = malloc(queries_cap * sizeof(struct dns_batch_query));
+    char* save = NULL;
+    for (char* line = strtok_r(text, "\r\n", &save); line && queries; line = strtok_r(NULL, "\r\n", &save))
+    {
+        char* comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char* name_save = NULL;
+        char* name = strtok_r(line, " \t", &name_save);
+        if (!name)
+        {
+            continue;
+        }
+
+        if (count == queries_cap)
+        {
+            queries_cap *= 2;
+            struct dns_batch_query* grown = realloc(queries, queries_cap * sizeof(struct dns_batch_query));
+            if (!grown)
+            {
+                free(queries);
+            }
+            queries = grown;
+            if (!queries)
+            {
+                break;
+            }
+        }
+
+        const char* type = strtok_r(NULL, " \t", &name_save);
+        memset(&queries[count], 0, sizeof(queries[count]));
+        queries[count].name = name;
+        queries[count].qtype = type ? dns_type_from_name(type) : default_qtype;
+        if (queries[count].qtype == 0)
+        {
+            fprintf(stderr, "Unknown type, asking for A - name: %s type: %s\n", name, type);
+            queries[count].qtype = DNS_TYPE_A;
+        }
+        ++count;
+    }
 
-    data = (uint8_t*)malloc(headlen + questionlen + qnamelen);
-    memcpy(data, &header, headlen);
-    memcpy(data + headlen, &question, questionlen);
-    memcpy(data + headlen + questionlen, question.qname, qnamelen);
+    if (!queries)
+    {
+        fprintf(stderr, "Out of memory reading names\n");
+        free(text);
+        return NULL;
+    }
 
-    *packetlen = headlen + questionlen + qnamelen;
-    return data;
+    *queries_out = queries;
+    *count_out = count;
+    return text;
 }
 
-void dns_print_response(uint8_t* response, size_t length)
+static void _dns_on_batch_answer(struct dns_batch_query* query, const uint8_t* response, size_t len, void* context)
 {
-    struct dns_header* header = (struct dns_header*)response;
-    if (!header->flags)
+    const struct dns_options* options = (const struct dns_options*)context;
+    if (!options->quiet)
     {
-        fprintf(stderr, "Invalid answer from host\n");
-        return;
+        fprintf(stdout,
+                "%s\t%s\t%d answers\t%.2f ms%s%s\n",
+                query->name,
+                dns_rcode_name(query->rcode),
+                query->ancount,
+                (double)query->latency_ns / DNS_NS_PER_MS,
+                query->tcp ? "\ttcp" : "",
+                query->truncated ? "\ttruncated" : "");
     }
+}
 
-    const uint16_t flags = htons(header->flags);
-    const uint16_t ancount = htons(header->ancount);
-    const uint16_t qdcount = htons(header->qdcount);
-    const uint16_t nscount = htons(header->nscount);
-    const uint16_t arcount = htons(header->arcount);
-    fprintf(stdout, "Flags: 0x%04X\n", flags);
-    fprintf(stdout, "ANCount: %d\n", ancount);
-    fprintf(stdout, "QDCount: %d\n", qdcount);
-    fprintf(stdout, "NSCount: %d\n", nscount);
-    fprintf(stdout, "ARCount: %d\n", arcount);
-    for (size_t i = 0; i < length; ++i)
+static void _dns_on_single_answer(struct dns_batch_query* query, const uint8_t* response, size_t len, void* context)
+{
+    fprintf(stdout, "received: %d bytes\n", (int)len);
+    dns_print_response(response, len);
+}
+
+static int _dns_run_batch(const struct dns_options* options)
+{
+    struct dns_batch_query* queries = NULL;
+    size_t count = 0;
+    char* text = _dns_read_names(options->batch_path, options->qtype, &queries, &count);
+    if (!text)
+    {
+        return -1;
+    }
+
+    struct dns_batch_stats stats;
+    const bool valid =
+        dns_batch_resolve(&options->batch, queries, count, _dns_on_batch_answer, (void*)options, &stats);
+    if (valid)
     {
-        const uint8_t byte = response[i];
-        fprintf(stdout, "0x%02X ", byte);
+        for (size_t q = 0; q < count && !options->quiet; ++q)
+        {
+            if (queries[q].status == DNS_BATCH_TIMED_OUT || queries[q].status == DNS_BATCH_INVALID)
+            {
+                fprintf(stdout,
+                        "%s\t%s\n",
+                        queries[q].name,
+                        queries[q].status == DNS_BATCH_TIMED_OUT ? "TIMEOUT" : "INVALID");
+            }
+        }
+        dns_batch_print_stats(&options->batch, &stats, stderr);
     }
-    fprintf(stdout, "\n");
+
+    free(queries);
+    free(text);
+    return valid && stats.answered == count ? 0 : 1;
 }
 
 int main(int argc, char** argv)
 {
-    if (argc < 2)
+    struct dns_options options;
+    if (!_dns_parse_args(argc, argv, &options))
     {
-        fprintf(stderr, "Usage: %s <hostname>\n", argv[0]);
+        _dns_usage(argv[0]);
         return -1;
     }
 
-    char* hostname = argv[1];
-
-    size_t packetlen = 0;
-    uint8_t* packet = dns_build_request(hostname, &packetlen);
-
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(0xd043dede);
-    address.sin_port = htons(53);
-    sendto(
-        sockfd, packet, packetlen, 0,
-        (struct sockaddr*)&address, (socklen_t)sizeof(address));
+    if (options.batch_path)
+    {
+        return _dns_run_batch(&options);
+    }
 
-    socklen_t len = 0;
-    uint8_t response[512];
-    memset(response, 0, sizeof(response));
-    ssize_t bytes = 
-        recvfrom(sockfd, response, 512, 0, (struct sockaddr*)&address, &len);
-    fprintf(stdout, "received: %d bytes\n", (int)bytes);
+    // A batch of one gets the same IDs, retries and timeouts
+    struct dns_batch_query query = {
+        .name = options.hostname,
+        .qtype = options.qtype
+    };
+    struct dns_batch_stats stats;
+    if (!dns_batch_resolve(&options.batch, &query, 1, _dns_on_single_answer, NULL, &stats))
+    {
+        return -1;
+    }
 
-    dns_print_response(response, bytes);
+    if (query.status != DNS_BATCH_ANSWERED)
+    {
+        fprintf(stderr,
+                "No answer for %s - %s\n",
+                options.hostname,
+                query.status == DNS_BATCH_INVALID ? "invalid name" : "timed out");
+        return -1;
+    }
 
     return 0;
 }
-
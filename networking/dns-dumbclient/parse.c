@@ -0,0 +1,621 @@
+#include "parse.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+// Type, class, TTL and RDLENGTH after a record's name
+#define DNS_RECORD_FIXED_SIZE 10
+
+// Type and class after a question's name
+#define DNS_QUESTION_FIXED_SIZE 4
+
+// Five 32 bit numbers after an SOA's two names
+#define DNS_SOA_FIXED_SIZE 20
+
+static uint16_t _dns_parse_u16(const uint8_t* buffer)
+{
+    return (uint16_t)((buffer[0] << 8) | buffer[1]);
+}
+
+static uint32_t _dns_parse_u32(const uint8_t* buffer)
+{
+    return ((uint32_t)_dns_parse_u16(buffer) << 16) | _dns_parse_u16(buffer + 2);
+}
+
+size_t dns_name_read(const uint8_t* packet, size_t len, size_t offset, struct dns_name* name_out)
+{
+    size_t cursor = offset;
+    size_t consumed = 0;
+    size_t limit = offset;
+    size_t length = 0;
+    for (;;)
+    {
+        if (cursor >= len)
+        {
+            return 0;
+        }
+
+        const uint8_t label_len = packet[cursor];
+        if ((label_len & DNS_POINTER_MASK) == DNS_POINTER_MASK)
+        {
+            if (cursor + 1 >= len)
+            {
+                return 0;
+            }
+
+            // Has to land in an earlier name than the last jump did, which
+            // is what stops loops
+            const size_t target = ((label_len << 8) | packet[cursor + 1]) & DNS_POINTER_OFFSET_MASK;
+            if (target >= limit || target < DNS_HEADER_SIZE)
+            {
+                return 0;
+            }
+
+            if (consumed == 0)
+            {
+                consumed = cursor + 2 - offset;
+            }
+            limit = target;
+            cursor = target;
+            continue;
+        }
+
+        // 0x40 and 0x80 were never more than proposals
+        if (label_len & DNS_POINTER_MASK)
+        {
+            return 0;
+        }
+
+        length += 1 + label_len;
+        if (length > DNS_MAX_NAME_LENGTH)
+        {
+            return 0;
+        }
+
+        if (label_len == 0)
+        {
+            if (consumed == 0)
+            {
+                consumed = cursor + 1 - offset;
+            }
+            break;
+        }
+        cursor += 1 + label_len;
+    }
+
+    name_out->packet = packet;
+    name_out->packet_len = len;
+    name_out->offset = (uint16_t)offset;
+    name_out->length = (uint8_t)length;
+    return consumed;
+}
+
+// Next label of a name that's already been through dns_name_read, so no
+// checks. cursor starts at the name's offset, 0 length is the root.
+static uint8_t _dns_name_next_label(const struct dns_name* name, size_t* cursor, const uint8_t** label_out)
+{
+    uint8_t label_len = name->packet[*cursor];
+    while ((label_len & DNS_POINTER_MASK) == DNS_POINTER_MASK)
+    {
+        *cursor = ((label_len << 8) | name->packet[*cursor + 1]) & DNS_POINTER_OFFSET_MASK;
+        label_len = name->packet[*cursor];
+    }
+
+    *label_out = name->packet + *cursor + 1;
+    *cursor += 1 + label_len;
+    return label_len;
+}
+
+size_t dns_name_to_text(const struct dns_name* name, char* buffer, size_t cap)
+{
+    size_t cursor = name->offset;
+    size_t written = 0;
+    const uint8_t* label;
+    uint8_t label_len;
+    while ((label_len = _dns_name_next_label(name, &cursor, &label)) != 0)
+    {
+        if (written > 0)
+        {
+            if (written + 1 >= cap)
+            {
+                return 0;
+            }
+            buffer[written++] = '.';
+        }
+
+        for (uint8_t i = 0; i < label_len; ++i)
+        {
+            const uint8_t c = label[i];
+            const bool printable = c > ' ' && c < 0x7F;
+            const bool special = c == '.' || c == '\\';
+            const size_t needed = !printable ? 4 : special ? 2 : 1;
+            if (written + needed >= cap)
+            {
+                return 0;
+            }
+
+            if (!printable)
+            {
+                written += (size_t)snprintf(buffer + written, cap - written, "\\%03u", c);
+            }
+            else
+            {
+                if (special)
+                {
+                    buffer[written++] = '\\';
+                }
+                buffer[written++] = (char)c;
+            }
+        }
+    }
+
+    if (written == 0)
+    {
+        if (cap < 2)
+        {
+            return 0;
+        }
+        buffer[written++] = '.';
+    }
+
+    buffer[written] = '\0';
+    return written;
+}
+
+size_t dns_name_to_wire(const struct dns_name* name, uint8_t* buffer, size_t cap)
+{
+    if (cap < name->length)
+    {
+        return 0;
+    }
+
+    size_t cursor = name->offset;
+    size_t written = 0;
+    const uint8_t* label;
+    uint8_t label_len;
+    do
+    {
+        label_len = _dns_name_next_label(name, &cursor, &label);
+        buffer[written] = label_len;
+        memcpy(buffer + written + 1, label, label_len);
+        written += 1 + label_len;
+    } while (label_len != 0);
+
+    return written;
+}
+
+// Labels can hold any byte, NULs included, so no strncasecmp
+static bool _dns_label_equals(const uint8_t* lhs, const uint8_t* rhs, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; ++i)
+    {
+        if (tolower(lhs[i]) != tolower(rhs[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool dns_name_equals(const struct dns_name* lhs, const struct dns_name* rhs)
+{
+    if (lhs->length != rhs->length)
+    {
+        return false;
+    }
+
+    size_t lhs_cursor = lhs->offset;
+    size_t rhs_cursor = rhs->offset;
+    const uint8_t* lhs_label;
+    const uint8_t* rhs_label;
+    uint8_t label_len;
+    do
+    {
+        label_len = _dns_name_next_label(lhs, &lhs_cursor, &lhs_label);
+        if (_dns_name_next_label(rhs, &rhs_cursor, &rhs_label) != label_len ||
+            !_dns_label_equals(lhs_label, rhs_label, label_len))
+        {
+            return false;
+        }
+    } while (label_len != 0);
+
+    return true;
+}
+
+bool dns_name_equals_text(const struct dns_name* name, const char* text)
+{
+    size_t cursor = name->offset;
+    const uint8_t* label;
+    uint8_t label_len;
+    while ((label_len = _dns_name_next_label(name, &cursor, &label)) != 0)
+    {
+        if (strcspn(text, ".") != label_len || !_dns_label_equals(label, (const uint8_t*)text, label_len))
+        {
+            return false;
+        }
+
+        text += label_len;
+        if (*text == '.')
+        {
+            ++text;
+        }
+    }
+
+    return *text == '\0' || strcmp(text, ".") == 0;
+}
+
+bool dns_txt_next(const struct dns_answer* answer, size_t* cursor, const uint8_t** text_out, uint8_t* len_out)
+{
+    if (answer->type != DNS_TYPE_TXT || *cursor >= answer->rdlength)
+    {
+        return false;
+    }
+
+    // Lengths were checked to add up to rdlength when it was parsed
+    *len_out = answer->rdata[*cursor];
+    *text_out = answer->rdata + *cursor + 1;
+    *cursor += 1 + *len_out;
+    return true;
+}
+
+// Checks the rdata of the types we know about is the shape it should be, and
+// breaks it out into answer->data
+static bool _dns_parse_rdata(struct dns_parser* parser, struct dns_answer* answer)
+{
+    const size_t rdata_offset = (size_t)(answer->rdata - parser->packet);
+    switch (answer->type)
+    {
+        case DNS_TYPE_A:
+            return answer->rdlength == 4;
+
+        case DNS_TYPE_AAAA:
+            return answer->rdlength == 16;
+
+        // A failed read is 0, so an empty rdata mustn't pass for a name
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_NS:
+            return answer->rdlength > 0 &&
+                   dns_name_read(parser->packet, parser->len, rdata_offset, &answer->data.target) ==
+                       answer->rdlength;
+
+        case DNS_TYPE_MX:
+            if (answer->rdlength < sizeof(uint16_t) + 1)
+            {
+                return false;
+            }
+            answer->data.mx.preference = _dns_parse_u16(answer->rdata);
+            return dns_name_read(
+                       parser->packet,
+                       parser->len,
+                       rdata_offset + sizeof(uint16_t),
+                       &answer->data.mx.exchange) == answer->rdlength - sizeof(uint16_t);
+
+        // Two names, then serial, refresh, retry, expire and minimum
+        case DNS_TYPE_SOA:
+        {
+            const size_t mname_len =
+                dns_name_read(parser->packet, parser->len, rdata_offset, &answer->data.soa.mname);
+            const size_t rname_len =
+                mname_len == 0 ? 0 :
+                dns_name_read(parser->packet, parser->len, rdata_offset + mname_len, &answer->data.soa.rname);
+            if (rname_len == 0 || mname_len + rname_len + DNS_SOA_FIXED_SIZE != answer->rdlength)
+            {
+                return false;
+            }
+
+            const uint8_t* fixed = answer->rdata + mname_len + rname_len;
+            answer->data.soa.serial = _dns_parse_u32(fixed);
+            answer->data.soa.refresh = _dns_parse_u32(fixed + 4);
+            answer->data.soa.retry = _dns_parse_u32(fixed + 8);
+            answer->data.soa.expire = _dns_parse_u32(fixed + 12);
+            answer->data.soa.minimum = _dns_parse_u32(fixed + 16);
+            return true;
+        }
+
+        case DNS_TYPE_TXT:
+        {
+            size_t cursor = 0;
+            while (cursor < answer->rdlength)
+            {
+                cursor += 1 + answer->rdata[cursor];
+            }
+            return answer->rdlength > 0 && cursor == answer->rdlength;
+        }
+
+        default:
+            return true;
+    }
+}
+
+bool dns_parser_init(struct dns_parser* parser, const uint8_t* packet, size_t len)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->packet = packet;
+    parser->len = len;
+    parser->offset = DNS_HEADER_SIZE;
+    if (!dns_read_header(packet, len, &parser->header))
+    {
+        parser->failed = true;
+        return false;
+    }
+
+    parser->questions_left = parser->header.qdcount;
+    parser->section = DNS_SECTION_ANSWER;
+    parser->records_left = parser->header.ancount;
+    return true;
+}
+
+static bool _dns_parser_fail(struct dns_parser* parser)
+{
+    parser->failed = true;
+    parser->questions_left = 0;
+    parser->records_left = 0;
+    parser->section = DNS_SECTION_ADDITIONAL;
+    return false;
+}
+
+bool dns_parser_next_question(struct dns_parser* parser, struct dns_question* question_out)
+{
+    if (parser->failed || parser->questions_left == 0)
+    {
+        return false;
+    }
+
+    const size_t consumed = dns_name_read(parser->packet, parser->len, parser->offset, &question_out->qname);
+    const size_t fixed_offset = parser->offset + consumed;
+    if (consumed == 0 || fixed_offset + DNS_QUESTION_FIXED_SIZE > parser->len)
+    {
+        return _dns_parser_fail(parser);
+    }
+
+    question_out->qtype = _dns_parse_u16(parser->packet + fixed_offset);
+    question_out->qclass = _dns_parse_u16(parser->packet + fixed_offset + 2);
+    parser->offset = fixed_offset + DNS_QUESTION_FIXED_SIZE;
+    --parser->questions_left;
+    return true;
+}
+
+bool dns_parser_next_record(struct dns_parser* parser, struct dns_answer* answer_out)
+{
+    struct dns_question skipped;
+    while (parser->questions_left > 0)
+    {
+        if (!dns_parser_next_question(parser, &skipped))
+        {
+            return false;
+        }
+    }
+
+    while (parser->records_left == 0)
+    {
+        if (parser->failed || parser->section == DNS_SECTION_ADDITIONAL)
+        {
+            return false;
+        }
+
+        ++parser->section;
+        parser->records_left =
+            parser->section == DNS_SECTION_AUTHORITY ? parser->header.nscount : parser->header.arcount;
+    }
+
+    memset(answer_out, 0, sizeof(*answer_out));
+    const size_t consumed = dns_name_read(parser->packet, parser->len, parser->offset, &answer_out->name);
+    const size_t fixed_offset = parser->offset + consumed;
+    if (consumed == 0 || fixed_offset + DNS_RECORD_FIXED_SIZE > parser->len)
+    {
+        return _dns_parser_fail(parser);
+    }
+
+    const uint8_t* fixed = parser->packet + fixed_offset;
+    answer_out->type = _dns_parse_u16(fixed);
+    answer_out->class = _dns_parse_u16(fixed + 2);
+    answer_out->ttl = _dns_parse_u32(fixed + 4);
+    answer_out->rdlength = _dns_parse_u16(fixed + 8);
+    answer_out->rdata = fixed + DNS_RECORD_FIXED_SIZE;
+    answer_out->section = parser->section;
+
+    // RFC 2181, a TTL with the top bit set is read as zero
+    if (answer_out->ttl & 0x80000000u)
+    {
+        answer_out->ttl = 0;
+    }
+
+    const size_t end = fixed_offset + DNS_RECORD_FIXED_SIZE + answer_out->rdlength;
+    if (end > parser->len || !_dns_parse_rdata(parser, answer_out))
+    {
+        return _dns_parser_fail(parser);
+    }
+
+    parser->offset = end;
+    --parser->records_left;
+    return true;
+}
+
+// snprintf onto the end of buffer, false once it no longer fits
+static bool _dns_append(char* buffer, size_t cap, size_t* len, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    const int written = vsnprintf(buffer + *len, cap - *len, format, args);
+    va_end(args);
+    if (written < 0 || *len + (size_t)written >= cap)
+    {
+        return false;
+    }
+
+    *len += (size_t)written;
+    return true;
+}
+
+static bool _dns_append_txt(const struct dns_answer* answer, char* buffer, size_t cap, size_t* len)
+{
+    size_t cursor = 0;
+    const uint8_t* text;
+    uint8_t text_len;
+    while (dns_txt_next(answer, &cursor, &text, &text_len))
+    {
+        if (!_dns_append(buffer, cap, len, cursor > 1u + text_len ? " \"" : "\""))
+        {
+            return false;
+        }
+
+        for (uint8_t i = 0; i < text_len; ++i)
+        {
+            const uint8_t c = text[i];
+            const bool appended = c < ' ' || c >= 0x7F ? _dns_append(buffer, cap, len, "\\%03u", c) :
+                                  c == '"' || c == '\\'  ? _dns_append(buffer, cap, len, "\\%c", c) :
+                                                            _dns_append(buffer, cap, len, "%c", c);
+            if (!appended)
+            {
+                return false;
+            }
+        }
+
+        if (!_dns_append(buffer, cap, len, "\""))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t dns_answer_to_text(const struct dns_answer* answer, char* buffer, size_t cap)
+{
+    char name[DNS_MAX_NAME_TEXT];
+    char type_text[16];
+    const char* type = dns_type_name(answer->type);
+    if (!type)
+    {
+        snprintf(type_text, sizeof(type_text), "TYPE%u", answer->type);
+        type = type_text;
+    }
+
+    // OPT puts the sender's UDP size where the class goes, which comes out
+    // as CLASS<size> the same as any other class we don't know
+    char class_text[16];
+    snprintf(class_text, sizeof(class_text), "CLASS%u", answer->class);
+
+    size_t len = 0;
+    dns_name_to_text(&answer->name, name, sizeof(name));
+    if (!_dns_append(
+            buffer,
+            cap,
+            &len,
+            "%s\t%u\t%s\t%s\t",
+            name,
+            answer->ttl,
+            answer->class == DNS_CLASS_IN ? "IN" : class_text,
+            type))
+    {
+        return 0;
+    }
+
+    bool appended;
+    switch (answer->type)
+    {
+        case DNS_TYPE_A:
+        case DNS_TYPE_AAAA:
+        {
+            char address[INET6_ADDRSTRLEN];
+            inet_ntop(answer->type == DNS_TYPE_A ? AF_INET : AF_INET6, answer->rdata, address, sizeof(address));
+            appended = _dns_append(buffer, cap, &len, "%s", address);
+            break;
+        }
+
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_NS:
+            dns_name_to_text(&answer->data.target, name, sizeof(name));
+            appended = _dns_append(buffer, cap, &len, "%s", name);
+            break;
+
+        case DNS_TYPE_MX:
+            dns_name_to_text(&answer->data.mx.exchange, name, sizeof(name));
+            appended = _dns_append(buffer, cap, &len, "%u %s", answer->data.mx.preference, name);
+            break;
+
+        case DNS_TYPE_SOA:
+        {
+            char rname[DNS_MAX_NAME_TEXT];
+            dns_name_to_text(&answer->data.soa.mname, name, sizeof(name));
+            dns_name_to_text(&answer->data.soa.rname, rname, sizeof(rname));
+            appended = _dns_append(
+                buffer,
+                cap,
+                &len,
+                "%s %s %u %u %u %u %u",
+                name,
+                rname,
+                answer->data.soa.serial,
+                answer->data.soa.refresh,
+                answer->data.soa.retry,
+                answer->data.soa.expire,
+                answer->data.soa.minimum);
+            break;
+        }
+
+        case DNS_TYPE_TXT:
+            appended = _dns_append_txt(answer, buffer, cap, &len);
+            break;
+
+        default:
+            appended = _dns_append(buffer, cap, &len, "\\# %u", answer->rdlength);
+            break;
+    }
+
+    return appended ? len : 0;
+}
+
+void dns_print_response(const uint8_t* response, size_t length)
+{
+    static const char* s_section_names[] = { "ANSWER", "AUTHORITY", "ADDITIONAL" };
+
+    struct dns_parser parser;
+    if (!dns_parser_init(&parser, response, length) || !(parser.header.flags & DNS_FLAG_QR))
+    {
+        fprintf(stderr, "Invalid answer from host\n");
+        return;
+    }
+
+    const struct dns_header* header = &parser.header;
+    fprintf(stdout, "Flags: 0x%04X (%s)\n", header->flags, dns_rcode_name(header->flags & DNS_RCODE_MASK));
+    fprintf(stdout, "ANCount: %d\n", header->ancount);
+    fprintf(stdout, "QDCount: %d\n", header->qdcount);
+    fprintf(stdout, "NSCount: %d\n", header->nscount);
+    fprintf(stdout, "ARCount: %d\n", header->arcount);
+
+    char text[DNS_MAX_NAME_TEXT + 64];
+    struct dns_question question;
+    while (dns_parser_next_question(&parser, &question))
+    {
+        dns_name_to_text(&question.qname, text, sizeof(text));
+        const char* type = dns_type_name(question.qtype);
+        fprintf(stdout, "QUESTION\t%s\t%s\n", text, type ? type : "?");
+    }
+
+    // Big TXT records can take a whole packet
+    char record[DNS_MAX_UDP_SIZE * 4 + DNS_MAX_NAME_TEXT];
+    struct dns_answer answer;
+    while (dns_parser_next_record(&parser, &answer))
+    {
+        if (dns_answer_to_text(&answer, record, sizeof(record)) > 0)
+        {
+            fprintf(stdout, "%s\t%s\n", s_section_names[answer.section], record);
+        }
+    }
+
+    if (parser.failed)
+    {
+        fprintf(stderr, "Malformed response at offset %zu:\n", parser.offset);
+        for (size_t i = 0; i < length; ++i)
+        {
+            fprintf(stdout, "0x%02X ", response[i]);
+        }
+        fprintf(stdout, "\n");
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef __PARSE_H__
+#define __PARSE_H__
+
+// Zero-copy response parser. Walks the packet where it is: names, rdata and
+// TXT strings all point back into it, so the buffer has to outlive anything
+// parsed out of it. Every count, length and offset is checked against the
+// packet before it's followed. Compression pointers have to land before the
+// name they're in, and before wherever the last pointer landed, so a packet
+// can't send the parser round in circles.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dns.h"
+
+// Longest dns_name_to_text can get, every byte escaped as \DDD
+#define DNS_MAX_NAME_TEXT (DNS_MAX_NAME_LENGTH * 4 + 1)
+
+struct dns_parser {
+    const uint8_t* packet;
+    size_t len;
+    size_t offset;
+    struct dns_header header;
+    uint16_t questions_left;
+    enum dns_section section;
+    uint16_t records_left; // In the current section
+    bool failed;
+};
+
+// False if there isn't even a header
+bool dns_parser_init(struct dns_parser* parser, const uint8_t* packet, size_t len);
+
+// Both return false once there's nothing left, or on anything malformed, in
+// which case failed is set and everything after it is given up on.
+// next_record skips over any questions that weren't read.
+bool dns_parser_next_question(struct dns_parser* parser, struct dns_question* question_out);
+bool dns_parser_next_record(struct dns_parser* parser, struct dns_answer* answer_out);
+
+// Reads the name at offset. Returns how many bytes it takes up there, a
+// pointer counting as two, or 0 if it's malformed.
+size_t dns_name_read(const uint8_t* packet, size_t len, size_t offset, struct dns_name* name_out);
+
+// Dotted, without the trailing dot, or "." for the root. Dots, backslashes
+// and anything unprintable inside a label are escaped. Returns the length,
+// or 0 if it doesn't fit in cap with the terminator.
+size_t dns_name_to_text(const struct dns_name* name, char* buffer, size_t cap);
+
+// Expanded wire form, returns name->length or 0 if it doesn't fit
+size_t dns_name_to_wire(const struct dns_name* name, uint8_t* buffer, size_t cap);
+
+// Case-insensitive, as names are. A trailing dot on text is optional.
+bool dns_name_equals(const struct dns_name* lhs, const struct dns_name* rhs);
+bool dns_name_equals_text(const struct dns_name* name, const char* text);
+
+// Walks the strings of a TXT record, cursor starting at 0
+bool dns_txt_next(const struct dns_answer* answer, size_t* cursor, const uint8_t** text_out, uint8_t* len_out);
+
+// One record, zone file style. Same return as dns_name_to_text.
+size_t dns_answer_to_text(const struct dns_answer* answer, char* buffer, size_t cap);
+
+// Header, then every record, or a hex dump if it doesn't parse
+void dns_print_response(const uint8_t* response, size_t length);
+
+#endif // __PARSE_H__
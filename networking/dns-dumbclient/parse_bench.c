@@ -0,0 +1,197 @@
+// Parse throughput over the canned responses in samples.c. Checks each one
+// parses the way it should first, then times two passes over them: walking
+// every record, and walking every record while also expanding its names to
+// text, which is what anything printing or caching them ends up paying.
+//
+// Usage: dns-parse-bench [--ms n]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns.h"
+#include "parse.h"
+#include "samples.h"
+
+#define DNS_PARSE_BENCH_DEFAULT_MS 500
+
+// Samples are walked this many times between clock reads
+#define DNS_PARSE_BENCH_BATCH 1024
+
+struct dns_parse_bench_result {
+    uint64_t messages;
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+
+    // Summed so the work can't be optimized away
+    uint64_t checksum;
+};
+
+typedef uint64_t (*dns_parse_bench_fn)(const struct dns_sample* sample, uint64_t* records);
+
+static uint64_t _dns_parse_bench_walk(const struct dns_sample* sample, uint64_t* records)
+{
+    struct dns_parser parser;
+    struct dns_answer answer;
+    uint64_t checksum = 0;
+    dns_parser_init(&parser, sample->packet, sample->len);
+    while (dns_parser_next_record(&parser, &answer))
+    {
+        checksum += answer.type + answer.rdlength + answer.name.length;
+        ++*records;
+    }
+
+    return checksum;
+}
+
+static uint64_t _dns_parse_bench_decode(const struct dns_sample* sample, uint64_t* records)
+{
+    struct dns_parser parser;
+    struct dns_answer answer;
+    char text[DNS_MAX_NAME_TEXT];
+    uint64_t checksum = 0;
+    dns_parser_init(&parser, sample->packet, sample->len);
+    while (dns_parser_next_record(&parser, &answer))
+    {
+        checksum += dns_name_to_text(&answer.name, text, sizeof(text));
+        if (answer.type == DNS_TYPE_CNAME || answer.type == DNS_TYPE_NS)
+        {
+            checksum += dns_name_to_text(&answer.data.target, text, sizeof(text));
+        }
+        else if (answer.type == DNS_TYPE_MX)
+        {
+            checksum += dns_name_to_text(&answer.data.mx.exchange, text, sizeof(text));
+        }
+        ++*records;
+    }
+
+    return checksum;
+}
+
+static void _dns_parse_bench_run(
+    const char* label,
+    dns_parse_bench_fn parse,
+    const struct dns_sample* samples,
+    size_t num_samples,
+    uint64_t duration_ns)
+{
+    struct dns_parse_bench_result result;
+    memset(&result, 0, sizeof(result));
+    const uint64_t start_ns = dns_now_ns();
+    do
+    {
+        for (int b = 0; b < DNS_PARSE_BENCH_BATCH; ++b)
+        {
+            for (size_t s = 0; s < num_samples; ++s)
+            {
+                result.checksum += parse(&samples[s], &result.records);
+                result.bytes += samples[s].len;
+            }
+        }
+        result.messages += DNS_PARSE_BENCH_BATCH * num_samples;
+        result.elapsed_ns = dns_now_ns() - start_ns;
+    } while (result.elapsed_ns < duration_ns);
+
+    const double seconds = (double)result.elapsed_ns / DNS_NS_PER_SEC;
+    fprintf(stdout,
+            "%-8s %7.1f ns/message %11.0f messages/sec %11.0f records/sec %7.1f MB/s  (%lu)\n",
+            label,
+            (double)result.elapsed_ns / result.messages,
+            result.messages / seconds,
+            result.records / seconds,
+            result.bytes / seconds / (1024.0 * 1024.0),
+            result.checksum & 0xFFFF);
+}
+
+// What each sample should come out as, one line per record
+static bool _dns_parse_bench_check(const struct dns_sample* sample)
+{
+    struct dns_parser parser;
+    struct dns_question question;
+    struct dns_answer answer;
+    char text[DNS_MAX_UDP_SIZE * 4];
+    int num_records = 0;
+    bool valid = dns_parser_init(&parser, sample->packet, sample->len) &&
+                 dns_parser_next_question(&parser, &question);
+    while (valid && dns_parser_next_record(&parser, &answer))
+    {
+        valid = dns_answer_to_text(&answer, text, sizeof(text)) > 0;
+        ++num_records;
+    }
+
+    if (!valid || parser.failed || num_records != sample->num_records)
+    {
+        fprintf(stderr,
+                "Sample didn't parse - name: %s records: %d/%d offset: %zu\n",
+                sample->name,
+                num_records,
+                sample->num_records,
+                parser.offset);
+        return false;
+    }
+
+    return true;
+}
+
+// Spot checks that decoding came out right, not just that it didn't fail
+static bool _dns_parse_bench_expect(const struct dns_sample* samples, size_t index, int record, const char* expected)
+{
+    struct dns_parser parser;
+    struct dns_answer answer;
+    char text[DNS_MAX_UDP_SIZE * 4];
+    dns_parser_init(&parser, samples[index].packet, samples[index].len);
+    for (int r = 0; r <= record; ++r)
+    {
+        dns_parser_next_record(&parser, &answer);
+    }
+
+    dns_answer_to_text(&answer, text, sizeof(text));
+    if (strcmp(text, expected) != 0)
+    {
+        fprintf(stderr, "Wrong decode - sample: %s\n  got:      %s\n  expected: %s\n", samples[index].name, text, expected);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int duration_ms = DNS_PARSE_BENCH_DEFAULT_MS;
+    if (argc == 3 && strcmp(argv[1], "--ms") == 0 && atoi(argv[2]) > 0)
+    {
+        duration_ms = atoi(argv[2]);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: %s [--ms n]\n", argv[0]);
+        return -1;
+    }
+
+    size_t num_samples;
+    const struct dns_sample* samples = dns_samples(&num_samples);
+    bool valid = true;
+    for (size_t s = 0; s < num_samples; ++s)
+    {
+        valid &= _dns_parse_bench_check(&samples[s]);
+    }
+
+    valid &= _dns_parse_bench_expect(samples, 0, 1, "www.example.com\t300\tIN\tA\t93.184.216.35");
+    valid &= _dns_parse_bench_expect(samples, 1, 1, "edge.cdn.example.net\t60\tIN\tCNAME\te1.edge.cdn.example.net");
+    valid &= _dns_parse_bench_expect(samples, 1, 7, "ns2.cdn.example.net\t86400\tIN\tAAAA\t2001:db8::53");
+    valid &= _dns_parse_bench_expect(samples, 2, 1, "example.com\t3600\tIN\tMX\t20 mail2.example.com");
+    valid &= _dns_parse_bench_expect(
+        samples, 3, 1, "example.com\t300\tIN\tTXT\t\"google-site-verification=abc123\" \"\\\"quoted\\\" \\\\ \\001\"");
+    valid &= _dns_parse_bench_expect(
+        samples, 5, 0, "example.com\t3600\tIN\tSOA\tns.icann.org noc.dns.icann.org 2024010101 7200 3600 1209600 3600");
+    if (!valid)
+    {
+        return -1;
+    }
+
+    const uint64_t duration_ns = (uint64_t)duration_ms * DNS_NS_PER_MS;
+    _dns_parse_bench_run("walk", _dns_parse_bench_walk, samples, num_samples, duration_ns);
+    _dns_parse_bench_run("decode", _dns_parse_bench_decode, samples, num_samples, duration_ns);
+    return 0;
+}
@@ -1,3 +1,5 @@
 #!/usr/bin/bash
 
-gcc main.c -o /tmp/dns-dumbclient && /tmp/dns-dumbclient $1
+SCRIPT_DIR=$(dirname ${BASH_SOURCE[0]})
+
+"$SCRIPT_DIR/build.sh" && "$SCRIPT_DIR/build/dns-dumbclient" "$@"
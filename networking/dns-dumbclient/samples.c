@@ -0,0 +1,100 @@
+#include "samples.h"
+
+// www.example.com A, two addresses, the usual 0xC00C pointers
+static const uint8_t s_a[] = {
+    0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x03, 0x77, 0x77, 0x77, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65,
+    0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00,
+    0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 0x5d, 0xb8, 0xd8,
+    0x22, 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00,
+    0x04, 0x5d, 0xb8, 0xd8, 0x23,
+};
+
+// www.example.org A through two CNAMEs, NS in authority and glue in additional
+static const uint8_t s_cname[] = {
+    0x23, 0x45, 0x81, 0x80, 0x00, 0x01, 0x00, 0x04, 0x00, 0x02, 0x00, 0x02,
+    0x03, 0x77, 0x77, 0x77, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65,
+    0x03, 0x6f, 0x72, 0x67, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x0c, 0x00,
+    0x05, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x16, 0x04, 0x65, 0x64,
+    0x67, 0x65, 0x03, 0x63, 0x64, 0x6e, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70,
+    0x6c, 0x65, 0x03, 0x6e, 0x65, 0x74, 0x00, 0xc0, 0x2d, 0x00, 0x05, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x05, 0x02, 0x65, 0x31, 0xc0, 0x2d,
+    0xc0, 0x4f, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x14, 0x00, 0x04,
+    0xcb, 0x00, 0x71, 0x0a, 0xc0, 0x4f, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x14, 0x00, 0x04, 0xcb, 0x00, 0x71, 0x0b, 0xc0, 0x32, 0x00, 0x02,
+    0x00, 0x01, 0x00, 0x01, 0x51, 0x80, 0x00, 0x06, 0x03, 0x6e, 0x73, 0x31,
+    0xc0, 0x32, 0xc0, 0x32, 0x00, 0x02, 0x00, 0x01, 0x00, 0x01, 0x51, 0x80,
+    0x00, 0x06, 0x03, 0x6e, 0x73, 0x32, 0xc0, 0x32, 0xc0, 0x80, 0x00, 0x01,
+    0x00, 0x01, 0x00, 0x01, 0x51, 0x80, 0x00, 0x04, 0xc6, 0x33, 0x64, 0x01,
+    0xc0, 0x92, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x01, 0x51, 0x80, 0x00, 0x10,
+    0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x53,
+};
+
+// example.com MX, two exchanges pointing back into the question, addresses for both
+static const uint8_t s_mx[] = {
+    0x34, 0x56, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x02,
+    0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+    0x00, 0x00, 0x0f, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00,
+    0x00, 0x0e, 0x10, 0x00, 0x09, 0x00, 0x0a, 0x04, 0x6d, 0x61, 0x69, 0x6c,
+    0xc0, 0x0c, 0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10,
+    0x00, 0x0a, 0x00, 0x14, 0x05, 0x6d, 0x61, 0x69, 0x6c, 0x32, 0xc0, 0x0c,
+    0xc0, 0x2b, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+    0xc0, 0x00, 0x02, 0x19, 0xc0, 0x40, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+    0x0e, 0x10, 0x00, 0x04, 0xc0, 0x00, 0x02, 0x1a,
+};
+
+// example.com TXT, one record with two strings, escapes needed to print it
+static const uint8_t s_txt[] = {
+    0x45, 0x67, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+    0x00, 0x00, 0x10, 0x00, 0x01, 0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00,
+    0x00, 0x01, 0x2c, 0x00, 0x25, 0x24, 0x76, 0x3d, 0x73, 0x70, 0x66, 0x31,
+    0x20, 0x69, 0x6e, 0x63, 0x6c, 0x75, 0x64, 0x65, 0x3a, 0x5f, 0x73, 0x70,
+    0x66, 0x2e, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x2e, 0x63, 0x6f,
+    0x6d, 0x20, 0x2d, 0x61, 0x6c, 0x6c, 0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01,
+    0x00, 0x00, 0x01, 0x2c, 0x00, 0x2d, 0x1f, 0x67, 0x6f, 0x6f, 0x67, 0x6c,
+    0x65, 0x2d, 0x73, 0x69, 0x74, 0x65, 0x2d, 0x76, 0x65, 0x72, 0x69, 0x66,
+    0x69, 0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 0x3d, 0x61, 0x62, 0x63, 0x31,
+    0x32, 0x33, 0x0c, 0x22, 0x71, 0x75, 0x6f, 0x74, 0x65, 0x64, 0x22, 0x20,
+    0x5c, 0x20, 0x01,
+};
+
+// ipv6.Example.COM AAAA, question case left as asked
+static const uint8_t s_aaaa[] = {
+    0x56, 0x78, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x04, 0x69, 0x70, 0x76, 0x36, 0x07, 0x45, 0x78, 0x61, 0x6d, 0x70, 0x6c,
+    0x65, 0x03, 0x43, 0x4f, 0x4d, 0x00, 0x00, 0x1c, 0x00, 0x01, 0xc0, 0x0c,
+    0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x02, 0x58, 0x00, 0x10, 0x20, 0x01,
+    0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0xc0, 0x0c, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x02, 0x58,
+    0x00, 0x10, 0x20, 0x01, 0x0d, 0xb8, 0x85, 0xa3, 0x00, 0x00, 0x00, 0x00,
+    0x8a, 0x2e, 0x03, 0x70, 0x73, 0x34,
+};
+
+// nope.example.com NXDOMAIN, SOA in authority
+static const uint8_t s_nxdomain[] = {
+    0x67, 0x89, 0x81, 0x83, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x04, 0x6e, 0x6f, 0x70, 0x65, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c,
+    0x65, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0xc0, 0x11,
+    0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x2c, 0x02, 0x6e,
+    0x73, 0x05, 0x69, 0x63, 0x61, 0x6e, 0x6e, 0x03, 0x6f, 0x72, 0x67, 0x00,
+    0x03, 0x6e, 0x6f, 0x63, 0x03, 0x64, 0x6e, 0x73, 0xc0, 0x31, 0x78, 0xa3,
+    0xf1, 0x75, 0x00, 0x00, 0x1c, 0x20, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x12,
+    0x75, 0x00, 0x00, 0x00, 0x0e, 0x10,
+};
+
+static const struct dns_sample s_samples[] = {
+    { "a", s_a, sizeof(s_a), 2 },
+    { "cname", s_cname, sizeof(s_cname), 8 },
+    { "mx", s_mx, sizeof(s_mx), 4 },
+    { "txt", s_txt, sizeof(s_txt), 2 },
+    { "aaaa", s_aaaa, sizeof(s_aaaa), 2 },
+    { "nxdomain", s_nxdomain, sizeof(s_nxdomain), 1 },
+};
+
+const struct dns_sample* dns_samples(size_t* count_out)
+{
+    *count_out = sizeof(s_samples) / sizeof(s_samples[0]);
+    return s_samples;
+}
@@ -0,0 +1,19 @@
+#ifndef __SAMPLES_H__
+#define __SAMPLES_H__
+
+// Canned responses shaped like real ones, for the parse bench. The same
+// packets seed the fuzz corpus.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct dns_sample {
+    const char* name;
+    const uint8_t* packet;
+    size_t len;
+    int num_records; // All sections
+};
+
+const struct dns_sample* dns_samples(size_t* count_out);
+
+#endif // __SAMPLES_H__
@@ -0,0 +1,603 @@
+#include "stub.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+#include "parse.h"
+
+#define DNS_STUB_POLL_MS 50
+
+struct dns_stub_delayed {
+    uint64_t due_ns;
+    struct sockaddr_in to;
+    size_t len;
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+};
+
+// Answer record: pointer to the question's name, type, class, ttl, rdlength
+#define DNS_STUB_ANSWER_SIZE (2 + 2 + 2 + 4 + 2)
+#define DNS_STUB_QUESTION_POINTER 0xC00C
+
+// Root SOA: root owner, then type, class, ttl and rdlength, then a root mname
+// and rname and the five numbers
+#define DNS_STUB_SOA_RDLENGTH (1 + 1 + 5 * 4)
+#define DNS_STUB_SOA_SIZE (1 + 2 + 2 + 4 + 2 + DNS_STUB_SOA_RDLENGTH)
+
+static void _dns_stub_write_u16(uint8_t* buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+}
+
+static void _dns_stub_write_u32(uint8_t* buffer, uint32_t value)
+{
+    _dns_stub_write_u16(buffer, (uint16_t)(value >> 16));
+    _dns_stub_write_u16(buffer + 2, (uint16_t)value);
+}
+
+// Negative answers need an SOA to say how long they can be cached for. Ours
+// is for the root, which is as true as anything else the stub says. Sets TC
+// if it doesn't fit.
+static size_t _dns_stub_write_soa(uint8_t* response, size_t offset, size_t cap, uint16_t* flags)
+{
+    if (offset + DNS_STUB_SOA_SIZE > cap)
+    {
+        *flags |= DNS_FLAG_TC;
+        return offset;
+    }
+
+    uint8_t* soa = response + offset;
+    memset(soa, 0, DNS_STUB_SOA_SIZE);
+    _dns_stub_write_u16(soa + 1, DNS_TYPE_SOA);
+    _dns_stub_write_u16(soa + 3, DNS_CLASS_IN);
+    _dns_stub_write_u32(soa + 5, DNS_STUB_NEGATIVE_TTL);
+    _dns_stub_write_u16(soa + 9, DNS_STUB_SOA_RDLENGTH);
+
+    // Serial, refresh, retry, expire and minimum after the two root names
+    uint8_t* numbers = soa + 13;
+    _dns_stub_write_u32(numbers, 1);
+    _dns_stub_write_u32(numbers + 4, 3600);
+    _dns_stub_write_u32(numbers + 8, 600);
+    _dns_stub_write_u32(numbers + 12, 86400);
+    _dns_stub_write_u32(numbers + 16, DNS_STUB_NEGATIVE_TTL);
+    _dns_stub_write_u16(response + 8, 1);
+    return offset + DNS_STUB_SOA_SIZE;
+}
+
+// Case-insensitive, prefix is lower case
+static bool _dns_stub_label_starts(const uint8_t* qname, const char* prefix)
+{
+    const size_t len = strlen(prefix);
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (qname[0] < len || tolower(qname[1 + i]) != prefix[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t dns_stub_address(const uint8_t* qname, size_t qname_len)
+{
+    // FNV-1a, squeezed into 10/8
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < qname_len; ++i)
+    {
+        hash ^= (uint8_t)tolower(qname[i]);
+        hash *= 16777619u;
+    }
+
+    return (10u << 24) | (hash & 0x00FFFFFF);
+}
+
+// EDNS0 size asked for, RFC 6891 6.2.5, or 0 without an OPT
+static uint16_t _dns_stub_edns_size(const uint8_t* query, size_t len)
+{
+    struct dns_parser parser;
+    struct dns_answer record;
+    dns_parser_init(&parser, query, len);
+    while (parser.header.arcount > 0 && dns_parser_next_record(&parser, &record))
+    {
+        if (record.type == DNS_TYPE_OPT && record.section == DNS_SECTION_ADDITIONAL)
+        {
+            return record.class < DNS_MAX_UDP_SIZE ? DNS_MAX_UDP_SIZE : record.class;
+        }
+    }
+
+    return 0;
+}
+
+size_t dns_stub_answer(const uint8_t* query, size_t len, bool tcp, uint8_t* response, size_t cap)
+{
+    struct dns_header header;
+    if (!dns_read_header(query, len, &header) || (header.flags & DNS_FLAG_QR) || cap < DNS_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    memset(response, 0, DNS_HEADER_SIZE);
+    _dns_stub_write_u16(response, header.id);
+    uint16_t flags = DNS_FLAG_QR | DNS_FLAG_AA | DNS_FLAG_RA | (header.flags & (DNS_FLAG_RD | DNS_OPCODE_MASK));
+
+    const size_t question_len = dns_question_length(query, len);
+    if (header.qdcount != 1 || question_len == 0 || DNS_HEADER_SIZE + question_len > cap)
+    {
+        _dns_stub_write_u16(response + 2, flags | DNS_RCODE_FORMERR);
+        return DNS_HEADER_SIZE;
+    }
+
+    // Over UDP, whatever doesn't fit the size the client can take leaves the
+    // answer empty with TC set. Room for our OPT is kept back if it gets one.
+    const uint16_t edns_size = _dns_stub_edns_size(query, len);
+    size_t limit = tcp ? cap : edns_size > 0 ? edns_size : DNS_MAX_UDP_SIZE;
+    limit = limit < cap ? limit : cap;
+    const size_t room = limit - (edns_size > 0 && limit >= DNS_OPT_RECORD_SIZE ? DNS_OPT_RECORD_SIZE : 0);
+
+    // Question goes back exactly as it came, case and all
+    memcpy(response + DNS_HEADER_SIZE, query + DNS_HEADER_SIZE, question_len);
+    _dns_stub_write_u16(response + 4, 1);
+    size_t offset = DNS_HEADER_SIZE + question_len;
+
+    const uint8_t* qname = query + DNS_HEADER_SIZE;
+    const size_t qname_len = question_len - 2 * sizeof(uint16_t);
+    const uint16_t qtype = (uint16_t)((qname[qname_len] << 8) | qname[qname_len + 1]);
+    const uint16_t qclass = (uint16_t)((qname[qname_len + 2] << 8) | qname[qname_len + 3]);
+    const size_t num_addresses = _dns_stub_label_starts(qname, "big") ? DNS_STUB_BIG_RECORDS : 1;
+    if ((header.flags & DNS_OPCODE_MASK) != 0)
+    {
+        flags |= DNS_RCODE_NOTIMP;
+    }
+    else if (_dns_stub_label_starts(qname, "nx"))
+    {
+        flags |= DNS_RCODE_NXDOMAIN;
+        offset = _dns_stub_write_soa(response, offset, room, &flags);
+    }
+    else if (qtype == DNS_TYPE_A && qclass == DNS_CLASS_IN &&
+             offset + num_addresses * (DNS_STUB_ANSWER_SIZE + 4) > room)
+    {
+        flags |= DNS_FLAG_TC;
+    }
+    else if (qtype == DNS_TYPE_A && qclass == DNS_CLASS_IN)
+    {
+        const uint32_t address = dns_stub_address(qname, qname_len);
+        for (size_t a = 0; a < num_addresses; ++a)
+        {
+            uint8_t* answer = response + offset;
+            _dns_stub_write_u16(answer, DNS_STUB_QUESTION_POINTER);
+            _dns_stub_write_u16(answer + 2, DNS_TYPE_A);
+            _dns_stub_write_u16(answer + 4, DNS_CLASS_IN);
+            _dns_stub_write_u32(answer + 6, DNS_STUB_TTL);
+            _dns_stub_write_u16(answer + 10, 4);
+            _dns_stub_write_u32(answer + 12, address ^ (uint32_t)a);
+            offset += DNS_STUB_ANSWER_SIZE + 4;
+        }
+        _dns_stub_write_u16(response + 6, (uint16_t)num_addresses);
+    }
+    else
+    {
+        offset = _dns_stub_write_soa(response, offset, room, &flags);
+    }
+
+    // EDNS0 gets an OPT back with our own size, RFC 6891 6.1.1
+    if (edns_size > 0 && offset + DNS_OPT_RECORD_SIZE <= limit)
+    {
+        uint8_t* opt = response + offset;
+        memset(opt, 0, DNS_OPT_RECORD_SIZE);
+        _dns_stub_write_u16(opt + 1, DNS_TYPE_OPT);
+        _dns_stub_write_u16(opt + 3, DNS_MAX_EDNS_UDP_SIZE);
+        _dns_stub_write_u16(response + 10, 1);
+        offset += DNS_OPT_RECORD_SIZE;
+    }
+
+    _dns_stub_write_u16(response + 2, flags);
+    return offset;
+}
+
+static bool _dns_stub_set_nonblocking(int socket)
+{
+    const int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+bool dns_stub_open(struct dns_stub* stub, const struct dns_stub_config* config)
+{
+    memset(stub, 0, sizeof(*stub));
+    stub->config = *config;
+    stub->rng = 0x2545F491u;
+    stub->tcp_socket = -1;
+    for (int c = 0; c < DNS_STUB_MAX_TCP; ++c)
+    {
+        stub->tcp[c].socket = -1;
+    }
+
+    if (config->delay_percent > 0 && config->delay_ms > 0)
+    {
+        stub->delayed = malloc(DNS_STUB_MAX_DELAYED * sizeof(struct dns_stub_delayed));
+        if (!stub->delayed)
+        {
+            fprintf(stderr, "Out of memory for delayed answers\n");
+            return false;
+        }
+    }
+
+    stub->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (stub->socket < 0)
+    {
+        fprintf(stderr, "Failed to create stub socket - errno: %d\n", errno);
+        dns_stub_close(stub);
+        return false;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)config->port);
+    socklen_t address_len = sizeof(address);
+    const int rcvbuf = DNS_STUB_RCVBUF;
+    if (bind(stub->socket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        getsockname(stub->socket, (struct sockaddr*)&address, &address_len) < 0 ||
+        setsockopt(stub->socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0 ||
+        !_dns_stub_set_nonblocking(stub->socket))
+    {
+        fprintf(stderr, "Failed to bind stub - port: %d errno: %d\n", config->port, errno);
+        dns_stub_close(stub);
+        return false;
+    }
+
+    // TCP on the same port number, for answers too big for UDP
+    const int reuse = 1;
+    stub->tcp_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (stub->tcp_socket < 0 ||
+        setsockopt(stub->tcp_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        bind(stub->tcp_socket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(stub->tcp_socket, DNS_STUB_MAX_TCP) < 0 ||
+        !_dns_stub_set_nonblocking(stub->tcp_socket))
+    {
+        fprintf(stderr, "Failed to listen on stub TCP - port: %d errno: %d\n", ntohs(address.sin_port), errno);
+        dns_stub_close(stub);
+        return false;
+    }
+
+    stub->config.port = ntohs(address.sin_port);
+    return true;
+}
+
+static void _dns_stub_tcp_disconnect(struct dns_stub_tcp* connection)
+{
+    close(connection->socket);
+    connection->socket = -1;
+    connection->in_len = 0;
+    connection->out_len = 0;
+}
+
+void dns_stub_close(struct dns_stub* stub)
+{
+    for (int c = 0; c < DNS_STUB_MAX_TCP; ++c)
+    {
+        if (stub->tcp[c].socket >= 0)
+        {
+            _dns_stub_tcp_disconnect(&stub->tcp[c]);
+        }
+        free(stub->tcp[c].in);
+        free(stub->tcp[c].out);
+        stub->tcp[c].in = NULL;
+        stub->tcp[c].out = NULL;
+    }
+
+    if (stub->tcp_socket >= 0)
+    {
+        close(stub->tcp_socket);
+        stub->tcp_socket = -1;
+    }
+
+    if (stub->socket >= 0)
+    {
+        close(stub->socket);
+        stub->socket = -1;
+    }
+
+    free(stub->delayed);
+    stub->delayed = NULL;
+}
+
+static bool _dns_stub_chance(struct dns_stub* stub, int percent)
+{
+    if (percent <= 0)
+    {
+        return false;
+    }
+
+    stub->rng ^= stub->rng << 13;
+    stub->rng ^= stub->rng >> 17;
+    stub->rng ^= stub->rng << 5;
+    return (int)(stub->rng % 100) < percent;
+}
+
+// Every answer is held for the same time, so they're due in the order they
+// went in. False if there's no room, and it should go now.
+static bool _dns_stub_delay(
+    struct dns_stub* stub,
+    const uint8_t* response,
+    size_t len,
+    const struct sockaddr_in* to,
+    uint64_t now_ns)
+{
+    if (!stub->delayed || stub->num_delayed == DNS_STUB_MAX_DELAYED ||
+        !_dns_stub_chance(stub, stub->config.delay_percent))
+    {
+        return false;
+    }
+
+    const int index = (stub->first_delayed + stub->num_delayed++) % DNS_STUB_MAX_DELAYED;
+    struct dns_stub_delayed* delayed = &stub->delayed[index];
+    delayed->due_ns = now_ns + (uint64_t)stub->config.delay_ms * DNS_NS_PER_MS;
+    delayed->to = *to;
+    delayed->len = len;
+    memcpy(delayed->response, response, len);
+    ++stub->stats.delayed;
+    return true;
+}
+
+// Sends whatever's due, returns ms until the next one is, or timeout_ms if
+// that's sooner
+static int _dns_stub_send_delayed(struct dns_stub* stub, int timeout_ms)
+{
+    const uint64_t now_ns = dns_now_ns();
+    while (stub->num_delayed > 0)
+    {
+        const struct dns_stub_delayed* delayed = &stub->delayed[stub->first_delayed];
+        if (delayed->due_ns > now_ns)
+        {
+            const uint64_t wait_ms = (delayed->due_ns - now_ns + DNS_NS_PER_MS - 1) / DNS_NS_PER_MS;
+            return wait_ms < (uint64_t)timeout_ms ? (int)wait_ms : timeout_ms;
+        }
+
+        const struct sockaddr* to = (const struct sockaddr*)&delayed->to;
+        if (sendto(stub->socket, delayed->response, delayed->len, 0, to, sizeof(delayed->to)) >= 0)
+        {
+            ++stub->stats.answered;
+        }
+        stub->first_delayed = (stub->first_delayed + 1) % DNS_STUB_MAX_DELAYED;
+        --stub->num_delayed;
+    }
+
+    return timeout_ms;
+}
+
+static void _dns_stub_serve_udp(struct dns_stub* stub)
+{
+    uint8_t query[DNS_MAX_EDNS_UDP_SIZE];
+    uint8_t response[DNS_MAX_EDNS_UDP_SIZE];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t received;
+    const uint64_t now_ns = stub->delayed ? dns_now_ns() : 0;
+    while ((received = recvfrom(stub->socket, query, sizeof(query), 0, (struct sockaddr*)&from, &from_len)) >= 0)
+    {
+        ++stub->stats.queries;
+        const size_t response_len = dns_stub_answer(query, (size_t)received, false, response, sizeof(response));
+        if (response_len == 0)
+        {
+            ++stub->stats.malformed;
+        }
+        else if (_dns_stub_chance(stub, stub->config.drop_percent))
+        {
+            ++stub->stats.dropped;
+        }
+        else if (!_dns_stub_delay(stub, response, response_len, &from, now_ns) &&
+                 sendto(stub->socket, response, response_len, 0, (struct sockaddr*)&from, from_len) >= 0)
+        {
+            ++stub->stats.answered;
+        }
+        from_len = sizeof(from);
+    }
+}
+
+static void _dns_stub_accept(struct dns_stub* stub)
+{
+    int socket;
+    while ((socket = accept(stub->tcp_socket, NULL, NULL)) >= 0)
+    {
+        // No Nagle, an answer shouldn't wait on the one before it being acked
+        const int no_delay = 1;
+        if (!_dns_stub_set_nonblocking(socket) ||
+            setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)) < 0)
+        {
+            close(socket);
+            continue;
+        }
+
+        struct dns_stub_tcp* connection = NULL;
+        for (int c = 0; c < DNS_STUB_MAX_TCP && !connection; ++c)
+        {
+            connection = stub->tcp[c].socket < 0 ? &stub->tcp[c] : NULL;
+        }
+
+        if (connection && !connection->in)
+        {
+            connection->in = malloc(DNS_STUB_TCP_BUFFER);
+            connection->out = malloc(DNS_STUB_TCP_BUFFER);
+        }
+
+        if (!connection || !connection->in || !connection->out)
+        {
+            close(socket);
+            continue;
+        }
+
+        connection->socket = socket;
+        ++stub->stats.tcp_connections;
+    }
+}
+
+// Answers every whole query that's come in, as long as there's room to queue
+// the answers, then sends as much as the socket takes
+static void _dns_stub_serve_tcp(struct dns_stub* stub, struct dns_stub_tcp* connection, short revents)
+{
+    if (revents & POLLIN)
+    {
+        const ssize_t received =
+            recv(connection->socket, connection->in + connection->in_len, DNS_STUB_TCP_BUFFER - connection->in_len, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            _dns_stub_tcp_disconnect(connection);
+            return;
+        }
+        connection->in_len += received > 0 ? (size_t)received : 0;
+    }
+
+    // Whenever the socket takes every answer queued, there may be more
+    // queries waiting that there wasn't room to answer before
+    size_t answered = 1;
+    while (answered > 0 && connection->out_len == 0)
+    {
+        answered = 0;
+        size_t offset = 0;
+        while (connection->in_len - offset >= 2 &&
+               connection->out_len + 2 + DNS_STUB_TCP_MAX_ANSWER <= DNS_STUB_TCP_BUFFER)
+        {
+            const uint8_t* framed = connection->in + offset;
+            const size_t len = (size_t)((framed[0] << 8) | framed[1]);
+            if (connection->in_len - offset < 2 + len)
+            {
+                break;
+            }
+
+            ++stub->stats.queries;
+            ++stub->stats.tcp_queries;
+            uint8_t* answer = connection->out + connection->out_len;
+            const size_t answer_len = dns_stub_answer(framed + 2, len, true, answer + 2, DNS_STUB_TCP_MAX_ANSWER);
+            if (answer_len == 0)
+            {
+                ++stub->stats.malformed;
+            }
+            else
+            {
+                _dns_stub_write_u16(answer, (uint16_t)answer_len);
+                connection->out_len += 2 + answer_len;
+                ++stub->stats.answered;
+            }
+            offset += 2 + len;
+            ++answered;
+        }
+
+        connection->in_len -= offset;
+        memmove(connection->in, connection->in + offset, connection->in_len);
+
+        size_t sent = 0;
+        while (sent < connection->out_len)
+        {
+            const ssize_t written =
+                send(connection->socket, connection->out + sent, connection->out_len - sent, MSG_NOSIGNAL);
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (written < 0 && errno != EINTR)
+            {
+                _dns_stub_tcp_disconnect(connection);
+                return;
+            }
+            sent += written > 0 ? (size_t)written : 0;
+        }
+
+        connection->out_len -= sent;
+        memmove(connection->out, connection->out + sent, connection->out_len);
+    }
+}
+
+bool dns_stub_poll(struct dns_stub* stub, int timeout_ms)
+{
+    struct pollfd poll_fds[2 + DNS_STUB_MAX_TCP];
+    struct dns_stub_tcp* connections[DNS_STUB_MAX_TCP];
+    poll_fds[0] = (struct pollfd){ .fd = stub->socket, .events = POLLIN };
+    poll_fds[1] = (struct pollfd){ .fd = stub->tcp_socket, .events = POLLIN };
+    nfds_t num_fds = 2;
+    for (int c = 0; c < DNS_STUB_MAX_TCP; ++c)
+    {
+        struct dns_stub_tcp* connection = &stub->tcp[c];
+        if (connection->socket >= 0)
+        {
+            connections[num_fds - 2] = connection;
+            poll_fds[num_fds++] = (struct pollfd){
+                .fd = connection->socket,
+                .events = (connection->in_len < DNS_STUB_TCP_BUFFER ? POLLIN : 0) |
+                          (connection->out_len > 0 ? POLLOUT : 0)
+            };
+        }
+    }
+
+    const int wait_ms = _dns_stub_send_delayed(stub, timeout_ms);
+    if (poll(poll_fds, num_fds, wait_ms) < 0 && errno != EINTR)
+    {
+        fprintf(stderr, "Stub failed to poll - errno: %d\n", errno);
+        return false;
+    }
+
+    _dns_stub_serve_udp(stub);
+    _dns_stub_send_delayed(stub, 0);
+    for (nfds_t f = 2; f < num_fds; ++f)
+    {
+        if (poll_fds[f].revents)
+        {
+            _dns_stub_serve_tcp(stub, connections[f - 2], poll_fds[f].revents);
+        }
+    }
+
+    if (poll_fds[1].revents & POLLIN)
+    {
+        _dns_stub_accept(stub);
+    }
+
+    return true;
+}
+
+static void* _dns_stub_thread(void* context)
+{
+    struct dns_stub* stub = (struct dns_stub*)context;
+    while (atomic_load(&stub->running))
+    {
+        if (!dns_stub_poll(stub, DNS_STUB_POLL_MS))
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+bool dns_stub_start(struct dns_stub* stub)
+{
+    atomic_store(&stub->running, true);
+    if (pthread_create(&stub->thread, NULL, _dns_stub_thread, stub) != 0)
+    {
+        fprintf(stderr, "Failed to start stub thread\n");
+        atomic_store(&stub->running, false);
+        return false;
+    }
+
+    return true;
+}
+
+void dns_stub_stop(struct dns_stub* stub)
+{
+    if (atomic_exchange(&stub->running, false))
+    {
+        pthread_join(stub->thread, NULL);
+    }
+}
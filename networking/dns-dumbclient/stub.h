@@ -0,0 +1,111 @@
+#ifndef __STUB_H__
+#define __STUB_H__
+
+// Local DNS responder for tests and benches, no zone file needed. Every A
+// query gets one address worked out from the name (see dns_stub_address), so
+// callers can check what came back. Names whose first label starts with "nx"
+// get NXDOMAIN, other types get an empty NOERROR. Both come with an SOA in
+// authority, so they can be cached for DNS_STUB_NEGATIVE_TTL.
+//
+// Names starting "big" get DNS_STUB_BIG_RECORDS addresses instead, the first
+// from dns_stub_address and the rest that xor their index. That's too many
+// for UDP, so over UDP they come back empty with TC set. The same port takes
+// TCP, with any number of queries pipelined on a connection.
+//
+// For testing retries and server selection it can drop some UDP answers, or
+// hold some back for a while, a server with a slow tail.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNS_STUB_DEFAULT_PORT 5300
+#define DNS_STUB_TTL 300
+#define DNS_STUB_NEGATIVE_TTL 60
+
+#define DNS_STUB_BIG_RECORDS 128
+
+// TCP clients at once
+#define DNS_STUB_MAX_TCP 32
+
+// Queries read and answers waiting to be sent, per TCP client. Reading stops
+// while there isn't room for another answer.
+#define DNS_STUB_TCP_BUFFER (128 * 1024)
+#define DNS_STUB_TCP_MAX_ANSWER 4096
+
+// Answers held back at once, past this the rest go straight away
+#define DNS_STUB_MAX_DELAYED 1024
+
+// Enough for a full batch window of queries to queue up while the stub isn't
+// scheduled
+#define DNS_STUB_RCVBUF (4 * 1024 * 1024)
+
+struct dns_stub_config {
+    int port; // 0 for any free port, filled in once open
+    int drop_percent;
+    int delay_percent; // Held back for delay_ms, 100 for every answer
+    int delay_ms;
+};
+
+struct dns_stub_stats {
+    uint64_t queries;
+    uint64_t answered;
+    uint64_t dropped;
+    uint64_t delayed;
+    uint64_t malformed;
+    uint64_t tcp_queries; // Included in queries
+    uint64_t tcp_connections;
+};
+
+struct dns_stub_tcp {
+    int socket; // -1 for a free slot
+    uint8_t* in;
+    size_t in_len;
+    uint8_t* out;
+    size_t out_len;
+};
+
+struct dns_stub_delayed;
+
+struct dns_stub {
+    struct dns_stub_config config;
+    int socket;
+    int tcp_socket;
+    struct dns_stub_tcp tcp[DNS_STUB_MAX_TCP];
+
+    // Ring in the order they're due, only allocated with a delay
+    struct dns_stub_delayed* delayed;
+    int first_delayed;
+    int num_delayed;
+
+    uint32_t rng;
+    struct dns_stub_stats stats;
+
+    pthread_t thread;
+    atomic_bool running;
+};
+
+// Binds to 127.0.0.1, UDP and TCP
+bool dns_stub_open(struct dns_stub* stub, const struct dns_stub_config* config);
+void dns_stub_close(struct dns_stub* stub);
+
+// Answers everything that's arrived, waiting up to timeout_ms for the first
+bool dns_stub_poll(struct dns_stub* stub, int timeout_ms);
+
+// Runs dns_stub_poll on its own thread until stopped, for tests that want
+// the stub in process. Stats are only safe to read after stopping.
+bool dns_stub_start(struct dns_stub* stub);
+void dns_stub_stop(struct dns_stub* stub);
+
+// Writes the stub's response to query into response. Over UDP it's kept to
+// what the query said it can take. Returns the length, 0 if it's not worth
+// answering at all.
+size_t dns_stub_answer(const uint8_t* query, size_t len, bool tcp, uint8_t* response, size_t cap);
+
+// Address every A query for qname is answered with, host order. qname is in
+// wire format, and case doesn't matter.
+uint32_t dns_stub_address(const uint8_t* qname, size_t qname_len);
+
+#endif // __STUB_H__
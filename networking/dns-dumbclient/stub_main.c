@@ -0,0 +1,92 @@
+// Runs the stub responder on its own until interrupted, for pointing
+// dns-dumbclient at by hand.
+//
+// Usage: dns-stub [--port n] [--drop percent] [--delay ms] [--delay-percent percent]
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stub.h"
+
+static volatile sig_atomic_t s_running = 1;
+
+static void _stub_on_signal(int signal)
+{
+    s_running = 0;
+}
+
+static void _stub_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [--port n] [--drop percent] [--delay ms] [--delay-percent percent]\n\n", program);
+    fprintf(stderr, "  --delay          Holds UDP answers back this long, a slow server\n");
+    fprintf(stderr, "  --delay-percent  Only this many of them, 100 by default\n");
+}
+
+int main(int argc, char** argv)
+{
+    struct dns_stub_config config = {
+        .port = DNS_STUB_DEFAULT_PORT,
+        .drop_percent = 0,
+        .delay_percent = 100,
+        .delay_ms = 0
+    };
+
+    for (int a = 1; a < argc; a += 2)
+    {
+        if (a + 1 >= argc)
+        {
+            _stub_usage(argv[0]);
+            return -1;
+        }
+
+        if (strcmp(argv[a], "--port") == 0)
+        {
+            config.port = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--drop") == 0)
+        {
+            config.drop_percent = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--delay") == 0)
+        {
+            config.delay_ms = atoi(argv[a + 1]);
+        }
+        else if (strcmp(argv[a], "--delay-percent") == 0)
+        {
+            config.delay_percent = atoi(argv[a + 1]);
+        }
+        else
+        {
+            _stub_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    struct dns_stub stub;
+    if (!dns_stub_open(&stub, &config))
+    {
+        return -1;
+    }
+
+    signal(SIGINT, _stub_on_signal);
+    signal(SIGTERM, _stub_on_signal);
+    fprintf(stdout, "Stub listening on 127.0.0.1:%d\n", stub.config.port);
+    fflush(stdout);
+    while (s_running && dns_stub_poll(&stub, 100))
+    {
+    }
+
+    fprintf(stdout,
+            "%lu queries, %lu answered, %lu dropped, %lu delayed, %lu malformed, %lu over %lu TCP connections\n",
+            stub.stats.queries,
+            stub.stats.answered,
+            stub.stats.dropped,
+            stub.stats.delayed,
+            stub.stats.malformed,
+            stub.stats.tcp_queries,
+            stub.stats.tcp_connections);
+    dns_stub_close(&stub);
+    return 0;
+}
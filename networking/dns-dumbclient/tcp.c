@@ -0,0 +1,315 @@
+#include "tcp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define DNS_TCP_LENGTH_SIZE 2
+
+static bool _dns_tcp_watch(struct dns_tcp_pool* pool, struct dns_tcp_connection* connection, bool want_write, int op)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+        .data.ptr = connection
+    };
+    if (epoll_ctl(pool->epoll, op, connection->socket, &event) < 0)
+    {
+        fprintf(stderr, "Failed to watch TCP connection - errno: %d\n", errno);
+        return false;
+    }
+
+    connection->want_write = want_write;
+    return true;
+}
+
+static void _dns_tcp_disconnect(struct dns_tcp_pool* pool, struct dns_tcp_connection* connection)
+{
+    if (connection->socket < 0)
+    {
+        return;
+    }
+
+    if (connection->in_flight > 0 || connection->connecting)
+    {
+        ++pool->stats.failed;
+        pool->stats.lost += connection->in_flight;
+    }
+
+    // Closing drops it from the epoll set
+    close(connection->socket);
+    connection->socket = -1;
+    connection->connecting = false;
+    connection->in_flight = 0;
+    connection->send_len = 0;
+    connection->receive_len = 0;
+}
+
+static bool _dns_tcp_connect(struct dns_tcp_pool* pool, struct dns_tcp_connection* connection)
+{
+    // No Nagle, a pipelined query shouldn't wait for the one before it to be
+    // acknowledged
+    const int no_delay = 1;
+    connection->socket = socket(AF_INET, SOCK_STREAM, 0);
+    const int flags = connection->socket >= 0 ? fcntl(connection->socket, F_GETFL, 0) : -1;
+    if (flags < 0 || fcntl(connection->socket, F_SETFL, flags | O_NONBLOCK) < 0 ||
+        setsockopt(connection->socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)) < 0)
+    {
+        fprintf(stderr, "Failed to create TCP socket - errno: %d\n", errno);
+        if (connection->socket >= 0)
+        {
+            close(connection->socket);
+            connection->socket = -1;
+        }
+        return false;
+    }
+
+    // Finishes later, unless it's over loopback and it's refused outright
+    ++pool->stats.connects;
+    connection->connecting = true;
+    if (connect(connection->socket, (const struct sockaddr*)&pool->server, sizeof(pool->server)) < 0 &&
+        errno != EINPROGRESS)
+    {
+        _dns_tcp_disconnect(pool, connection);
+        return false;
+    }
+
+    if (!_dns_tcp_watch(pool, connection, true, EPOLL_CTL_ADD))
+    {
+        _dns_tcp_disconnect(pool, connection);
+        return false;
+    }
+
+    return true;
+}
+
+// Sends as much of what's queued as the socket takes, and watches for room
+// for the rest
+static bool _dns_tcp_flush(struct dns_tcp_pool* pool, struct dns_tcp_connection* connection)
+{
+    size_t sent = 0;
+    while (sent < connection->send_len)
+    {
+        const ssize_t written =
+            send(connection->socket, connection->send_buffer + sent, connection->send_len - sent, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            _dns_tcp_disconnect(pool, connection);
+            return false;
+        }
+        sent += (size_t)written;
+    }
+
+    connection->send_len -= sent;
+    memmove(connection->send_buffer, connection->send_buffer + sent, connection->send_len);
+    const bool want_write = connection->send_len > 0;
+    if (want_write != connection->want_write && !_dns_tcp_watch(pool, connection, want_write, EPOLL_CTL_MOD))
+    {
+        _dns_tcp_disconnect(pool, connection);
+        return false;
+    }
+
+    return true;
+}
+
+bool dns_tcp_pool_open(struct dns_tcp_pool* pool, const struct sockaddr_in* server, int connections)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->server = *server;
+    pool->num_connections = connections;
+    for (int c = 0; c < DNS_TCP_MAX_CONNECTIONS; ++c)
+    {
+        pool->connections[c].socket = -1;
+    }
+
+    if (connections < 1 || connections > DNS_TCP_MAX_CONNECTIONS)
+    {
+        fprintf(stderr, "Invalid TCP connections - connections: %d max: %d\n", connections, DNS_TCP_MAX_CONNECTIONS);
+        pool->epoll = -1;
+        return false;
+    }
+
+    pool->epoll = epoll_create1(0);
+    if (pool->epoll < 0)
+    {
+        fprintf(stderr, "Failed to create TCP epoll - errno: %d\n", errno);
+        return false;
+    }
+
+    return true;
+}
+
+void dns_tcp_pool_close(struct dns_tcp_pool* pool)
+{
+    for (int c = 0; c < pool->num_connections && c < DNS_TCP_MAX_CONNECTIONS; ++c)
+    {
+        struct dns_tcp_connection* connection = &pool->connections[c];
+        _dns_tcp_disconnect(pool, connection);
+        free(connection->send_buffer);
+        free(connection->receive_buffer);
+        connection->send_buffer = NULL;
+        connection->receive_buffer = NULL;
+    }
+
+    if (pool->epoll >= 0)
+    {
+        close(pool->epoll);
+        pool->epoll = -1;
+    }
+}
+
+bool dns_tcp_pool_send(struct dns_tcp_pool* pool, const uint8_t* query, size_t len)
+{
+    struct dns_tcp_connection* connection = &pool->connections[0];
+    for (int c = 1; c < pool->num_connections; ++c)
+    {
+        if (pool->connections[c].in_flight < connection->in_flight)
+        {
+            connection = &pool->connections[c];
+        }
+    }
+
+    // Buffers too, only once a connection's first wanted
+    if (!connection->send_buffer)
+    {
+        connection->send_buffer = malloc(DNS_TCP_SEND_BUFFER);
+        connection->receive_buffer = malloc(DNS_TCP_RECEIVE_BUFFER);
+        if (!connection->send_buffer || !connection->receive_buffer)
+        {
+            fprintf(stderr, "Out of memory for TCP connection\n");
+            free(connection->send_buffer);
+            free(connection->receive_buffer);
+            connection->send_buffer = NULL;
+            connection->receive_buffer = NULL;
+            return false;
+        }
+    }
+
+    if (len > DNS_TCP_MAX_MESSAGE || connection->send_len + DNS_TCP_LENGTH_SIZE + len > DNS_TCP_SEND_BUFFER ||
+        (connection->socket < 0 && !_dns_tcp_connect(pool, connection)))
+    {
+        return false;
+    }
+
+    uint8_t* framed = connection->send_buffer + connection->send_len;
+    framed[0] = (uint8_t)(len >> 8);
+    framed[1] = (uint8_t)len;
+    memcpy(framed + DNS_TCP_LENGTH_SIZE, query, len);
+    connection->send_len += DNS_TCP_LENGTH_SIZE + len;
+    ++connection->in_flight;
+    ++pool->stats.sent;
+
+    // Still connecting, it all goes once that's done
+    return connection->connecting || _dns_tcp_flush(pool, connection);
+}
+
+// Reads whatever's arrived and hands on every whole response in it. False if
+// the connection's gone.
+static bool _dns_tcp_receive(
+    struct dns_tcp_pool* pool,
+    struct dns_tcp_connection* connection,
+    dns_tcp_answer_fn answer_callback,
+    void* context)
+{
+    for (;;)
+    {
+        const ssize_t received = recv(connection->socket,
+                                      connection->receive_buffer + connection->receive_len,
+                                      DNS_TCP_RECEIVE_BUFFER - connection->receive_len,
+                                      0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            _dns_tcp_disconnect(pool, connection);
+            return false;
+        }
+
+        if (received < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return true;
+        }
+
+        connection->receive_len += (size_t)received;
+        size_t offset = 0;
+        while (connection->receive_len - offset >= DNS_TCP_LENGTH_SIZE)
+        {
+            const uint8_t* framed = connection->receive_buffer + offset;
+            const size_t len = (size_t)((framed[0] << 8) | framed[1]);
+            if (connection->receive_len - offset < DNS_TCP_LENGTH_SIZE + len)
+            {
+                break;
+            }
+
+            ++pool->stats.received;
+            if (connection->in_flight > 0)
+            {
+                --connection->in_flight;
+            }
+            answer_callback(framed + DNS_TCP_LENGTH_SIZE, len, context);
+            offset += DNS_TCP_LENGTH_SIZE + len;
+        }
+
+        connection->receive_len -= offset;
+        memmove(connection->receive_buffer, connection->receive_buffer + offset, connection->receive_len);
+    }
+}
+
+void dns_tcp_pool_service(struct dns_tcp_pool* pool, dns_tcp_answer_fn answer_callback, void* context)
+{
+    struct epoll_event events[DNS_TCP_MAX_CONNECTIONS];
+    const int ready = epoll_wait(pool->epoll, events, DNS_TCP_MAX_CONNECTIONS, 0);
+    for (int e = 0; e < ready; ++e)
+    {
+        struct dns_tcp_connection* connection = (struct dns_tcp_connection*)events[e].data.ptr;
+        if (connection->socket < 0)
+        {
+            continue;
+        }
+
+        if (connection->connecting && (events[e].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        {
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            if (getsockopt(connection->socket, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0)
+            {
+                _dns_tcp_disconnect(pool, connection);
+                continue;
+            }
+            connection->connecting = false;
+        }
+
+        if ((events[e].events & EPOLLIN) && !_dns_tcp_receive(pool, connection, answer_callback, context))
+        {
+            continue;
+        }
+
+        if ((events[e].events & (EPOLLERR | EPOLLHUP)) && !(events[e].events & EPOLLIN))
+        {
+            _dns_tcp_disconnect(pool, connection);
+            continue;
+        }
+
+        if (!connection->connecting)
+        {
+            _dns_tcp_flush(pool, connection);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __TCP_H__
+#define __TCP_H__
+
+// DNS over TCP to one server, RFC 7766. Every message has its length in two
+// bytes in front of it. Queries are pipelined, with any number in flight on
+// a connection at once, and answers can come back in any order, so callers
+// match them up by ID as they do over UDP. Connections are opened when
+// they're first needed and kept for the queries after. One the server closes
+// is opened again the next time there's something to send on it.
+//
+// Nothing is retried here. A connection that fails loses whatever was in
+// flight on it, and the caller's timeouts send those again.
+//
+// Every connection sits behind one epoll fd. That fd can go in the caller's
+// own poll or epoll set, and reads ready whenever a connection has something
+// to do.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#define DNS_TCP_DEFAULT_CONNECTIONS 2
+#define DNS_TCP_MAX_CONNECTIONS 16
+
+// Biggest message there is, not counting its length
+#define DNS_TCP_MAX_MESSAGE 65535
+
+// Framed queries waiting for the socket to take them
+#define DNS_TCP_SEND_BUFFER (64 * 1024)
+
+// Room for a whole message of the biggest size, and a few smaller ones to
+// come in with each read
+#define DNS_TCP_RECEIVE_BUFFER (2 * (DNS_TCP_MAX_MESSAGE + 2))
+
+struct dns_tcp_connection {
+    int socket;       // -1 when closed
+    bool connecting;
+    bool want_write;  // Registered for EPOLLOUT
+    int in_flight;
+    uint8_t* send_buffer;
+    size_t send_len;
+    uint8_t* receive_buffer;
+    size_t receive_len;
+};
+
+struct dns_tcp_stats {
+    uint64_t connects;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t failed; // Connections refused, reset or closed with queries in flight
+    uint64_t lost;   // Queries in flight when they went
+};
+
+struct dns_tcp_pool {
+    struct sockaddr_in server;
+    int epoll;
+    int num_connections;
+    struct dns_tcp_connection connections[DNS_TCP_MAX_CONNECTIONS];
+    struct dns_tcp_stats stats;
+};
+
+// Called once per whole response, which is only good until it returns
+typedef void (*dns_tcp_answer_fn)(const uint8_t* response, size_t len, void* context);
+
+// Opens nothing yet but the epoll fd
+bool dns_tcp_pool_open(struct dns_tcp_pool* pool, const struct sockaddr_in* server, int connections);
+void dns_tcp_pool_close(struct dns_tcp_pool* pool);
+
+// Queues a query on whichever connection has the fewest in flight, opening
+// it if it has to, and sends as much as the socket takes now. False if it
+// can't be queued, the caller's retry can try again later.
+bool dns_tcp_pool_send(struct dns_tcp_pool* pool, const uint8_t* query, size_t len);
+
+// Does whatever's ready without waiting: finishes connecting, sends what's
+// queued and hands every whole response that's arrived to answer_callback
+void dns_tcp_pool_service(struct dns_tcp_pool* pool, dns_tcp_answer_fn answer_callback, void* context);
+
+#endif // __TCP_H__
@@ -1,13 +1,48 @@
 #!/usr/bin/bash
+#
+# Usage: build.sh [mode]
+#
+#   release  -O2, the default
+#   native   release with -march=native
+#   lto      release with link time optimization
+#   debug    -O0 -g
+#   asan     AddressSanitizer + UndefinedBehaviorSanitizer
+#   ubsan    UndefinedBehaviorSanitizer only
+#   tsan     ThreadSanitizer
+#   bench    release build, then runs the microbenchmarks
+#   test     release build, then runs the benches' own checks through ctest
+#
+# Binaries end up in ./build either way.
 
-rm -rf ./build
-mkdir build
+set -e
 
 SCRIPT_DIR=$(dirname ${BASH_SOURCE[0]})
 BUILD_DIR="$SCRIPT_DIR/build"
-SRC_DIR="$SCRIPT_DIR/src"
-SERVER_SOURCE_DIR="$SRC_DIR/server"
-CLIENT_SOURCE_DIR="$SRC_DIR/client"
+MODE=${1:-release}
 
-gcc -I$SRC_DIR -o "$BUILD_DIR/server" "$SERVER_SOURCE_DIR/main.c"
-gcc -I$SRC_DIR -o "$BUILD_DIR/client" "$CLIENT_SOURCE_DIR/main.c"
+case $MODE in
+    release|bench|test) ARGS="-DCMAKE_BUILD_TYPE=Release" ;;
+    native)        ARGS="-DCMAKE_BUILD_TYPE=Release -DNET_THING_MARCH=native" ;;
+    lto)           ARGS="-DCMAKE_BUILD_TYPE=Release -DNET_THING_LTO=ON" ;;
+    debug)         ARGS="-DCMAKE_BUILD_TYPE=Debug" ;;
+    asan)          ARGS="-DCMAKE_BUILD_TYPE=Debug -DNET_THING_SANITIZE=address,undefined" ;;
+    ubsan)         ARGS="-DCMAKE_BUILD_TYPE=Debug -DNET_THING_SANITIZE=undefined" ;;
+    tsan)          ARGS="-DCMAKE_BUILD_TYPE=Debug -DNET_THING_SANITIZE=thread" ;;
+    *)
+        echo "Unknown build mode: $MODE"
+        exit 1
+        ;;
+esac
+
+# Modes don't mix, always start clean
+rm -rf "$BUILD_DIR"
+cmake -S "$SCRIPT_DIR" -B "$BUILD_DIR" $ARGS > /dev/null
+cmake --build "$BUILD_DIR" -j"$(nproc)"
+
+if [ "$MODE" = "bench" ]; then
+    cmake --build "$BUILD_DIR" --target bench
+fi
+
+if [ "$MODE" = "test" ]; then
+    ctest --test-dir "$BUILD_DIR" --output-on-failure
+fi
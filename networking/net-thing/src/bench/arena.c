@@ -0,0 +1,206 @@
+// Arena snapshot costs at 1, 16 and 64MB of state: full save/restore (one
+// memcpy) against the dirty page versions with about 1% of pages written per
+// frame, which is roughly what a mostly idle world looks like.
+//
+// Usage: arena [--json path] [--filter text] [--reps n] [--samples n] [--check]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <system/arena.h>
+#include <bench/harness.h>
+
+#include <util/util.h>
+
+#define ARENA_BENCH_MB (1024 * 1024)
+
+// Percent of pages written between snapshots in the dirty cases
+#define ARENA_BENCH_DIRTY_PCT 1
+
+struct arena_bench_state
+{
+    struct arena arena;
+    struct arena_snapshot snapshot;
+    arena_handle world;
+    size_t world_size;
+    uint64_t rng;
+};
+
+static uint64_t _arena_bench_rand(struct arena_bench_state* state)
+{
+    state->rng ^= state->rng << 13;
+    state->rng ^= state->rng >> 7;
+    state->rng ^= state->rng << 17;
+    return state->rng;
+}
+
+static bool _arena_bench_init(struct arena_bench_state* state, size_t size)
+{
+    if (!arena_init(&state->arena, size))
+    {
+        return false;
+    }
+
+    if (!arena_snapshot_init(&state->snapshot, &state->arena))
+    {
+        arena_free(&state->arena);
+        return false;
+    }
+
+    // One allocation filling the arena, then fault every page in so the first
+    // repetition isn't paying for it
+    state->world_size = state->arena.capacity - ARENA_ALIGNMENT;
+    state->world = arena_alloc(&state->arena, state->world_size);
+    memset(arena_get(&state->arena, state->world), 0xA5, state->world_size);
+    arena_save(&state->arena, &state->snapshot);
+    state->rng = 0x2545F4914F6CDD1Dull;
+    return true;
+}
+
+static void _arena_bench_free(struct arena_bench_state* state)
+{
+    arena_snapshot_free(&state->snapshot);
+    arena_free(&state->arena);
+}
+
+// Writes a word to ARENA_BENCH_DIRTY_PCT of the pages, at random
+static void _arena_bench_touch(struct arena_bench_state* state)
+{
+    const size_t pages = state->arena.num_pages * ARENA_BENCH_DIRTY_PCT / 100 + 1;
+    for (size_t p = 0; p < pages; ++p)
+    {
+        const size_t offset =
+            _arena_bench_rand(state) % (state->world_size / sizeof(uint64_t)) * sizeof(uint64_t);
+        uint64_t* word = arena_write(&state->arena, state->world + offset, sizeof(uint64_t));
+        *word += 1;
+    }
+}
+
+static void _arena_bench_save(uint64_t iterations, void* context)
+{
+    struct arena_bench_state* state = context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        arena_save(&state->arena, &state->snapshot);
+    }
+    bench_do_not_optimize(state->snapshot.data);
+}
+
+static void _arena_bench_restore(uint64_t iterations, void* context)
+{
+    struct arena_bench_state* state = context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        arena_restore(&state->arena, &state->snapshot);
+    }
+    bench_do_not_optimize(state->arena.base);
+}
+
+static void _arena_bench_save_dirty(uint64_t iterations, void* context)
+{
+    struct arena_bench_state* state = context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        _arena_bench_touch(state);
+        arena_save_dirty(&state->arena, &state->snapshot);
+    }
+    bench_do_not_optimize(state->snapshot.data);
+}
+
+static void _arena_bench_restore_dirty(uint64_t iterations, void* context)
+{
+    struct arena_bench_state* state = context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        _arena_bench_touch(state);
+        arena_restore_dirty(&state->arena, &state->snapshot);
+    }
+    bench_do_not_optimize(state->arena.base);
+}
+
+// The dirty cases have to start tracking the snapshot they copy to
+static void _arena_bench_sync(uint64_t iterations, void* context)
+{
+    struct arena_bench_state* state = context;
+    arena_save(&state->arena, &state->snapshot);
+}
+
+// Dirty saves and restores have to leave the arena and snapshot identical
+static bool _arena_bench_verify(struct arena_bench_state* state)
+{
+    arena_save(&state->arena, &state->snapshot);
+    for (int frame = 0; frame < 100; ++frame)
+    {
+        _arena_bench_touch(state);
+        arena_restore_dirty(&state->arena, &state->snapshot);
+    }
+
+    if (memcmp(state->arena.base, state->snapshot.data, state->arena.used) != 0)
+    {
+        return false;
+    }
+
+    for (int frame = 0; frame < 100; ++frame)
+    {
+        _arena_bench_touch(state);
+        arena_save_dirty(&state->arena, &state->snapshot);
+    }
+
+    return memcmp(state->arena.base, state->snapshot.data, state->arena.used) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_suite suite;
+    if (!bench_suite_init(&suite, "arena", argc, argv))
+    {
+        return -1;
+    }
+
+    static const size_t sizes_mb[] = { 1, 16, 64 };
+    static char names[ARRAY_SIZE(sizes_mb)][4][64];
+    bool verified = true;
+    for (size_t s = 0; s < ARRAY_SIZE(sizes_mb); ++s)
+    {
+        struct arena_bench_state state;
+        if (!_arena_bench_init(&state, sizes_mb[s] * ARENA_BENCH_MB))
+        {
+            return -1;
+        }
+
+        snprintf(names[s][0], sizeof(names[s][0]), "save/%zuMB", sizes_mb[s]);
+        snprintf(names[s][1], sizeof(names[s][1]), "restore/%zuMB", sizes_mb[s]);
+        snprintf(names[s][2], sizeof(names[s][2]), "save_dirty_%dpct/%zuMB", ARENA_BENCH_DIRTY_PCT, sizes_mb[s]);
+        snprintf(names[s][3], sizeof(names[s][3]), "restore_dirty_%dpct/%zuMB", ARENA_BENCH_DIRTY_PCT, sizes_mb[s]);
+
+        const size_t bytes = state.arena.used;
+        const struct bench_case cases[] = {
+            { names[s][0], _arena_bench_save, NULL, &state, 0, bytes },
+            { names[s][1], _arena_bench_restore, NULL, &state, 0, bytes },
+            { names[s][2], _arena_bench_save_dirty, _arena_bench_sync, &state, 0, 0 },
+            { names[s][3], _arena_bench_restore_dirty, _arena_bench_sync, &state, 0, 0 },
+        };
+        for (size_t c = 0; c < ARRAY_SIZE(cases); ++c)
+        {
+            bench_run(&suite, &cases[c]);
+        }
+
+        if (!_arena_bench_verify(&state))
+        {
+            fprintf(stderr, "Dirty restore doesn't match the snapshot - size: %zuMB\n", sizes_mb[s]);
+            verified = false;
+        }
+
+        _arena_bench_free(&state);
+    }
+
+    if (!bench_suite_finish(&suite) || !verified)
+    {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Connection churn benchmark: hammers a running server with connect/goodbye
+// cycles from a handful of concurrent clients and reports how many the server
+// sustains per second.
+//
+// Usage: churn [cycles] [concurrency]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/socket.h>
+#include <system/time.h>
+#include <net/crypto.h>
+#include <net/rudp.h>
+
+#include <util/util.h>
+
+#define CHURN_DEFAULT_CYCLES 1000
+#define CHURN_DEFAULT_CONCURRENCY 2
+#define CHURN_MAX_CONCURRENCY 64
+
+// Give up on a bench run that isn't making progress, e.g. no server running
+#define CHURN_STALL_TIMEOUT_NS (2 * BILLION)
+
+struct churn_client
+{
+    int socket_handle;
+    uint64_t connect_start_ns;
+    struct rudp_conn connection;
+};
+
+bool _churn_client_init(struct churn_client* client)
+{
+    client->socket_handle = socket_create_udp();
+    if (client->socket_handle <= 0)
+    {
+        fprintf(stderr, "Failed to create churn socket\n");
+        return false;
+    }
+
+    // Ephemeral port, the server tells clients apart by port
+    if (!socket_bind(client->socket_handle, 0) ||
+        !socket_set_nonblocking(client->socket_handle))
+    {
+        fprintf(stderr, "Failed to configure churn socket\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool _churn_client_connect(struct churn_client* client)
+{
+    rudp_conn_init(
+        client->socket_handle,
+        CREATE_ADDR(127, 0, 0, 1),
+        SERVER_PORT,
+        NULL,
+        NULL,
+        client,
+        NULL,
+        &client->connection);
+    client->connect_start_ns = system_time_ns();
+    return rudp_conn_connect(&client->connection);
+}
+
+int main(int argc, char** argv)
+{
+    const int cycles = argc > 1 ? atoi(argv[1]) : CHURN_DEFAULT_CYCLES;
+    int concurrency = argc > 2 ? atoi(argv[2]) : CHURN_DEFAULT_CONCURRENCY;
+    if (concurrency < 1 || concurrency > CHURN_MAX_CONCURRENCY)
+    {
+        fprintf(stderr, "Concurrency must be in [1, %d]\n", CHURN_MAX_CONCURRENCY);
+        return -1;
+    }
+
+    struct churn_client clients[CHURN_MAX_CONCURRENCY];
+    for (int c = 0; c < concurrency; ++c)
+    {
+        if (!_churn_client_init(&clients[c]) || !_churn_client_connect(&clients[c]))
+        {
+            return -1;
+        }
+    }
+
+    int completed = 0;
+    uint64_t total_connect_ns = 0;
+    uint64_t max_connect_ns = 0;
+    const uint64_t start_ns = system_time_ns();
+    uint64_t last_progress_ns = start_ns;
+    while (completed < cycles)
+    {
+        const uint64_t now_ns = system_time_ns();
+        if (now_ns - last_progress_ns > CHURN_STALL_TIMEOUT_NS)
+        {
+            fprintf(stderr, "Stalled after %d cycles, is the server running?\n", completed);
+            return -1;
+        }
+
+        for (int c = 0; c < concurrency && completed < cycles; ++c)
+        {
+            struct churn_client* client = &clients[c];
+            rudp_tick(&client->connection);
+            if (client->connection.state != RUDP_STATUS_CONNECTED)
+            {
+                continue;
+            }
+
+            const uint64_t connect_ns = system_time_ns() - client->connect_start_ns;
+            total_connect_ns += connect_ns;
+            if (connect_ns > max_connect_ns)
+            {
+                max_connect_ns = connect_ns;
+            }
+
+            // Hang up immediately, the slot should be reclaimed right away
+            rudp_conn_close(&client->connection);
+            _churn_client_connect(client);
+            last_progress_ns = system_time_ns();
+            ++completed;
+        }
+    }
+
+    const uint64_t elapsed_ns = system_time_ns() - start_ns;
+    for (int c = 0; c < concurrency; ++c)
+    {
+        rudp_conn_close(&clients[c].connection);
+        socket_close(clients[c].socket_handle);
+    }
+
+    fprintf(stdout, "cycles:            %d\n", completed);
+    fprintf(stdout, "concurrency:       %d\n", concurrency);
+    fprintf(stdout, "elapsed:           %.3f s\n", (double)elapsed_ns / BILLION);
+    fprintf(stdout, "connects/sec:      %.1f\n", completed * (double)BILLION / elapsed_ns);
+    fprintf(stdout, "mean connect time: %.3f ms\n", (double)total_connect_ns / completed / MILLION);
+    fprintf(stdout, "max connect time:  %.3f ms\n", (double)max_connect_ns / MILLION);
+
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Clock sync simulation: runs the client and server halves of clock.c against
+// a virtual network with latency, jitter, loss and a drifting server clock,
+// and reports how far the client's estimated server time is off.
+//
+// Usage: clock_sync [latency-ms jitter-ms drift-ppm loss-pct]
+//
+// Latency is one way. Jitter is exponentially distributed and drawn separately
+// for each direction, so the path is rarely symmetric.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <system/time.h>
+#include <net/clock.h>
+
+#include <util/util.h>
+
+#define CLOCK_BENCH_CLIENT_TICK_NS (BILLION / 60)
+#define CLOCK_BENCH_SERVER_TICK_NS (BILLION / 120)
+#define CLOCK_BENCH_DURATION_NS (60 * BILLION)
+
+// Skip the initial step while the sample window fills
+#define CLOCK_BENCH_WARMUP_NS (5 * BILLION)
+#define CLOCK_BENCH_MAX_IN_FLIGHT 256
+#define CLOCK_BENCH_MAX_MEASUREMENTS \
+    (CLOCK_BENCH_DURATION_NS / CLOCK_BENCH_CLIENT_TICK_NS + 1)
+
+// Where the server's clock is relative to the client's at time zero
+#define CLOCK_BENCH_SERVER_OFFSET_NS (1234 * BILLION + 567890123)
+
+struct clock_bench_scenario
+{
+    double latency_ms;
+    double jitter_ms;
+    double drift_ppm;
+    double loss_pct;
+};
+
+struct clock_bench_packet
+{
+    bool in_use;
+    bool to_server;
+    uint64_t arrival_ns;
+    struct clock_sync_message message;
+};
+
+struct clock_bench_network
+{
+    uint64_t rng;
+    struct clock_bench_scenario scenario;
+    struct clock_bench_packet packets[CLOCK_BENCH_MAX_IN_FLIGHT];
+};
+
+double _clock_bench_random(struct clock_bench_network* network)
+{
+    // xorshift64*, deterministic so runs are comparable
+    network->rng ^= network->rng >> 12;
+    network->rng ^= network->rng << 25;
+    network->rng ^= network->rng >> 27;
+    return ((network->rng * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Everything below runs on the "true" timeline, which is also the client's
+// local clock. The server's clock runs fast or slow by drift_ppm.
+uint64_t _clock_bench_server_time_ns(const struct clock_bench_scenario* scenario, uint64_t true_ns)
+{
+    return CLOCK_BENCH_SERVER_OFFSET_NS + true_ns + (uint64_t)(true_ns * scenario->drift_ppm / 1e6);
+}
+
+uint64_t _clock_bench_server_tick_ns(const struct clock_bench_scenario* scenario)
+{
+    return (uint64_t)(CLOCK_BENCH_SERVER_TICK_NS / (1.0 + scenario->drift_ppm / 1e6));
+}
+
+void _clock_bench_send(
+    struct clock_bench_network* network,
+    const struct clock_sync_message* message,
+    bool to_server,
+    uint64_t now_ns)
+{
+    if (_clock_bench_random(network) * 100.0 < network->scenario.loss_pct)
+    {
+        return;
+    }
+
+    const double jitter_ms = -network->scenario.jitter_ms * log(1.0 - _clock_bench_random(network));
+    const double delay_ms = network->scenario.latency_ms + jitter_ms;
+    for (int p = 0; p < CLOCK_BENCH_MAX_IN_FLIGHT; ++p)
+    {
+        struct clock_bench_packet* packet = &network->packets[p];
+        if (!packet->in_use)
+        {
+            packet->in_use = true;
+            packet->to_server = to_server;
+            packet->arrival_ns = now_ns + (uint64_t)(delay_ms * MILLION);
+            packet->message = *message;
+            return;
+        }
+    }
+}
+
+int _clock_bench_compare(const void* a, const void* b)
+{
+    const double lhs = *(const double*)a;
+    const double rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+void _clock_bench_run(const struct clock_bench_scenario* scenario)
+{
+    static double errors_ms[CLOCK_BENCH_MAX_MEASUREMENTS];
+    int num_errors = 0;
+    double error_sum_ms = 0.0;
+    int tick_mismatches = 0;
+
+    struct clock_bench_network network;
+    memset(&network, 0, sizeof(network));
+    network.rng = 0x9E3779B97F4A7C15ull;
+    network.scenario = *scenario;
+
+    struct clock_sync sync;
+    clock_sync_init(&sync);
+
+    // Tick 0 starts at time 0 on both ends
+    const uint64_t server_tick_ns = _clock_bench_server_tick_ns(scenario);
+    uint64_t next_client_tick_ns = 0;
+    uint64_t next_server_tick_ns = 0;
+    uint32_t server_tick = 0;
+    while (next_client_tick_ns < CLOCK_BENCH_DURATION_NS)
+    {
+        if (next_server_tick_ns <= next_client_tick_ns)
+        {
+            // Server tick: answer whatever has arrived since the last one,
+            // stamped with the kernel arrival time like the real server
+            const uint64_t now_ns = next_server_tick_ns;
+            const uint64_t server_now_ns = _clock_bench_server_time_ns(scenario, now_ns);
+            for (int p = 0; p < CLOCK_BENCH_MAX_IN_FLIGHT; ++p)
+            {
+                struct clock_bench_packet* packet = &network.packets[p];
+                if (!packet->in_use || !packet->to_server || packet->arrival_ns > now_ns)
+                {
+                    continue;
+                }
+
+                packet->in_use = false;
+                struct clock_sync_message reply = packet->message;
+                clock_sync_make_reply(
+                    &reply,
+                    _clock_bench_server_time_ns(scenario, packet->arrival_ns),
+                    server_now_ns,
+                    server_tick,
+                    server_now_ns,
+                    CLOCK_BENCH_SERVER_TICK_NS);
+                _clock_bench_send(&network, &reply, false, now_ns);
+            }
+
+            ++server_tick;
+            next_server_tick_ns += server_tick_ns;
+            continue;
+        }
+
+        const uint64_t now_ns = next_client_tick_ns;
+        for (int p = 0; p < CLOCK_BENCH_MAX_IN_FLIGHT; ++p)
+        {
+            struct clock_bench_packet* packet = &network.packets[p];
+            if (!packet->in_use || packet->to_server || packet->arrival_ns > now_ns)
+            {
+                continue;
+            }
+
+            packet->in_use = false;
+            clock_sync_process_reply(&sync, &packet->message, packet->arrival_ns);
+        }
+
+        struct clock_sync_message request;
+        if (clock_sync_make_request(&sync, now_ns, &request))
+        {
+            _clock_bench_send(&network, &request, true, now_ns);
+        }
+        clock_sync_update(&sync, now_ns);
+
+        if (now_ns >= CLOCK_BENCH_WARMUP_NS && sync.synced)
+        {
+            const int64_t error_ns =
+                (int64_t)(clock_sync_estimated_server_time_ns(&sync, now_ns) -
+                          _clock_bench_server_time_ns(scenario, now_ns));
+            const double error_ms = (double)error_ns / MILLION;
+            error_sum_ms += error_ms;
+            errors_ms[num_errors++] = fabs(error_ms);
+
+            // Which tick the server is on right now, by its own clock
+            const uint64_t server_elapsed_ns =
+                _clock_bench_server_time_ns(scenario, now_ns) - CLOCK_BENCH_SERVER_OFFSET_NS;
+            const uint32_t true_tick = (uint32_t)(server_elapsed_ns / CLOCK_BENCH_SERVER_TICK_NS);
+            if (clock_sync_estimated_server_tick(&sync, now_ns) != true_tick)
+            {
+                ++tick_mismatches;
+            }
+        }
+
+        next_client_tick_ns += CLOCK_BENCH_CLIENT_TICK_NS;
+    }
+
+    if (num_errors == 0)
+    {
+        fprintf(stdout, "%6.1f %6.1f %6.1f %5.1f | never synced\n",
+                scenario->latency_ms, scenario->jitter_ms, scenario->drift_ppm, scenario->loss_pct);
+        return;
+    }
+
+    qsort(errors_ms, num_errors, sizeof(errors_ms[0]), _clock_bench_compare);
+    fprintf(stdout,
+            "%6.1f %6.1f %6.1f %5.1f | %+8.3f %8.3f %8.3f %8.3f | %5.1f%% | %lu/%lu\n",
+            scenario->latency_ms,
+            scenario->jitter_ms,
+            scenario->drift_ppm,
+            scenario->loss_pct,
+            error_sum_ms / num_errors,
+            errors_ms[num_errors / 2],
+            errors_ms[(int)(num_errors * 0.99)],
+            errors_ms[num_errors - 1],
+            100.0 * tick_mismatches / num_errors,
+            sync.replies_received,
+            sync.requests_sent);
+}
+
+int main(int argc, char** argv)
+{
+    static const struct clock_bench_scenario defaults[] = {
+        {   5.0,  0.0,  50.0,  0.0 },
+        {  25.0,  2.0,  50.0,  0.0 },
+        {  50.0, 10.0,  50.0,  0.0 },
+        { 100.0, 30.0,  50.0,  0.0 },
+        { 100.0, 30.0, 200.0, 10.0 },
+    };
+
+    fprintf(stdout, "   lat    jit  drift  loss |     mean      p50      p99      max | tick   | replies\n");
+    fprintf(stdout, "    ms     ms    ppm     %% |       ms       ms       ms       ms | miss   |\n");
+    if (argc > 4)
+    {
+        const struct clock_bench_scenario scenario = {
+            atof(argv[1]),
+            atof(argv[2]),
+            atof(argv[3]),
+            atof(argv[4])
+        };
+        _clock_bench_run(&scenario);
+        return 0;
+    }
+
+    for (size_t s = 0; s < ARRAY_SIZE(defaults); ++s)
+    {
+        _clock_bench_run(&defaults[s]);
+    }
+
+    return 0;
+}
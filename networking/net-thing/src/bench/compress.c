@@ -0,0 +1,217 @@
+// Compression benchmark: ratio and per-packet cost of the built-in LZ codec,
+// with and without a trained dictionary.
+//
+// Usage: compress [capture]
+//
+// Without a capture, synthetic snapshot and map-chunk packets are generated.
+// The first half of the samples trains the dictionary, the second half is
+// what gets measured.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/socket.h>
+#include <system/time.h>
+#include <net/crypto.h>
+#include <net/rudp.h>
+#include <net/lz.h>
+
+#define COMPRESS_MAX_SAMPLES 4096
+#define COMPRESS_ITERATIONS 20
+
+struct compress_samples
+{
+    uint8_t data[COMPRESS_MAX_SAMPLES * COMMON_MTU];
+    size_t lens[COMPRESS_MAX_SAMPLES];
+    size_t num_samples;
+};
+
+uint32_t _compress_rand(uint32_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Roughly what a snapshot looks like: a small header followed by quantized
+// entity state that mostly drifts a little between ticks
+size_t _compress_make_snapshot(uint8_t* packet, uint32_t tick, uint32_t* rng)
+{
+    size_t len = 0;
+    memcpy(packet + len, "SNAP", 4);
+    len += 4;
+    memcpy(packet + len, &tick, sizeof(tick));
+    len += sizeof(tick);
+
+    const uint16_t num_entities = 24;
+    memcpy(packet + len, &num_entities, sizeof(num_entities));
+    len += sizeof(num_entities);
+    for (uint16_t e = 0; e < num_entities; ++e)
+    {
+        const uint16_t id = e * 3;
+        const int16_t x = (int16_t)(e * 100 + (tick & 0xFF));
+        const int16_t y = (int16_t)(e * 50);
+        const int16_t z = 0;
+        const uint8_t health = 100;
+        const uint8_t flags = (_compress_rand(rng) & 0x7) == 0 ? 0x3 : 0x1;
+        memcpy(packet + len, &id, 2); len += 2;
+        memcpy(packet + len, &x, 2); len += 2;
+        memcpy(packet + len, &y, 2); len += 2;
+        memcpy(packet + len, &z, 2); len += 2;
+        packet[len++] = health;
+        packet[len++] = flags;
+    }
+
+    return len;
+}
+
+// Map chunks are tile ids, long runs of the same few tiles
+size_t _compress_make_chunk(uint8_t* packet, uint32_t* rng)
+{
+    size_t len = 0;
+    memcpy(packet + len, "CHNK", 4);
+    len += 4;
+    while (len < COMMON_MTU - 64)
+    {
+        const uint8_t tile = _compress_rand(rng) % 6;
+        const size_t run = 1 + _compress_rand(rng) % 12;
+        for (size_t r = 0; r < run; ++r)
+        {
+            packet[len++] = tile;
+        }
+    }
+
+    return len;
+}
+
+void _compress_generate(struct compress_samples* samples)
+{
+    uint32_t rng = 0x12345678;
+    size_t offset = 0;
+    for (size_t s = 0; s < COMPRESS_MAX_SAMPLES; ++s)
+    {
+        uint8_t* packet = samples->data + offset;
+        const size_t len = (s % 8 == 7) ?
+            _compress_make_chunk(packet, &rng) :
+            _compress_make_snapshot(packet, s, &rng);
+        samples->lens[s] = len;
+        offset += len;
+    }
+    samples->num_samples = COMPRESS_MAX_SAMPLES;
+}
+
+bool _compress_run(const char* label, struct rudp_codec* codec, struct compress_samples* samples, size_t first)
+{
+    uint64_t bytes_before = 0;
+    uint64_t bytes_after = 0;
+    uint64_t compress_ns = 0;
+    uint64_t decompress_ns = 0;
+    uint64_t packets = 0;
+
+    size_t offset = 0;
+    for (size_t s = 0; s < first; ++s)
+    {
+        offset += samples->lens[s];
+    }
+
+    for (int i = 0; i < COMPRESS_ITERATIONS; ++i)
+    {
+        size_t sample_offset = offset;
+        for (size_t s = first; s < samples->num_samples; ++s)
+        {
+            const uint8_t* packet = samples->data + sample_offset;
+            const size_t len = samples->lens[s];
+            sample_offset += len;
+
+            uint8_t compressed[COMMON_MTU * 2];
+            uint8_t decompressed[COMMON_MTU];
+
+            const uint64_t start_ns = system_time_ns();
+            const size_t compressed_len =
+                codec->compress(packet, len, compressed, sizeof(compressed), codec->state);
+            const uint64_t mid_ns = system_time_ns();
+            const size_t decompressed_len =
+                codec->decompress(compressed, compressed_len, decompressed, sizeof(decompressed), codec->state);
+            const uint64_t end_ns = system_time_ns();
+
+            if (compressed_len == 0 ||
+                decompressed_len != len ||
+                memcmp(decompressed, packet, len) != 0)
+            {
+                fprintf(stderr, "%s: round trip failed on sample %zu\n", label, s);
+                return false;
+            }
+
+            bytes_before += len;
+            bytes_after += compressed_len;
+            compress_ns += mid_ns - start_ns;
+            decompress_ns += end_ns - mid_ns;
+            ++packets;
+        }
+    }
+
+    fprintf(stdout,
+            "%-8s ratio: %.3f (%.1f -> %.1f B/packet)  compress: %.3f us/packet  decompress: %.3f us/packet\n",
+            label,
+            (double)bytes_before / bytes_after,
+            (double)bytes_before / packets,
+            (double)bytes_after / packets,
+            (double)compress_ns / packets / 1000.0,
+            (double)decompress_ns / packets / 1000.0);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    static struct compress_samples samples;
+    if (argc > 1)
+    {
+        samples.num_samples =
+            lz_capture_read(
+                argv[1],
+                samples.data,
+                sizeof(samples.data),
+                samples.lens,
+                COMPRESS_MAX_SAMPLES);
+        if (samples.num_samples < 2)
+        {
+            fprintf(stderr, "Not enough samples in %s\n", argv[1]);
+            return -1;
+        }
+    }
+    else
+    {
+        _compress_generate(&samples);
+    }
+
+    const size_t num_training = samples.num_samples / 2;
+    static struct lz_dictionary dictionary;
+    const uint64_t train_start_ns = system_time_ns();
+    if (!lz_dictionary_train(samples.data, samples.lens, num_training, LZ_MAX_DICTIONARY_SIZE, &dictionary))
+    {
+        fprintf(stderr, "Failed to train dictionary\n");
+        return -1;
+    }
+    fprintf(stdout,
+            "trained %zu byte dictionary from %zu samples in %.1f ms\n",
+            dictionary.len,
+            num_training,
+            (double)(system_time_ns() - train_start_ns) / MILLION);
+
+    struct rudp_codec plain_codec;
+    struct rudp_codec dictionary_codec;
+    lz_codec_init(&plain_codec, NULL);
+    lz_codec_init(&dictionary_codec, &dictionary);
+
+    if (!_compress_run(plain_codec.name, &plain_codec, &samples, num_training) ||
+        !_compress_run(dictionary_codec.name, &dictionary_codec, &samples, num_training))
+    {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Entity update throughput at 10k and 100k entities for each compiled in
+// kernel, reported as entity updates per millisecond. Also checks the SIMD
+// paths land where the scalar one does.
+//
+// Usage: entities [--json path] [--filter text] [--reps n] [--samples n] [--check]
+//
+// The AVX2 kernel only exists in builds with AVX2 enabled, e.g. build.sh
+// native.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <server/entity.h>
+#include <bench/harness.h>
+
+#include <util/util.h>
+
+#define ENTITIES_WORLD_SIZE 1024.f
+#define ENTITIES_MAX_SPEED 64.f
+#define ENTITIES_DT (1.f / 120.f)
+
+// Steps compared between kernels, and how far apart they may end up. Not
+// zero, the compiler is free to fuse the scalar multiply-add.
+#define ENTITIES_CHECK_STEPS 100
+#define ENTITIES_CHECK_TOLERANCE 1e-2f
+
+struct entities_bench
+{
+    struct entity_store store;
+    enum entity_simd simd;
+};
+
+static uint32_t _entities_rand(uint32_t* rng)
+{
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    return *rng;
+}
+
+static float _entities_randf(uint32_t* rng)
+{
+    return (float)_entities_rand(rng) / (float)UINT32_MAX;
+}
+
+// Every sixteenth one frozen, so the mask isn't a formality
+static bool _entities_init(struct entity_store* store, uint32_t count)
+{
+    if (!entity_store_init(store, count, ENTITIES_WORLD_SIZE))
+    {
+        return false;
+    }
+
+    uint32_t rng = 0x2545F491u;
+    for (uint32_t e = 0; e < count; ++e)
+    {
+        const float x = _entities_randf(&rng) * ENTITIES_WORLD_SIZE;
+        const float y = _entities_randf(&rng) * ENTITIES_WORLD_SIZE;
+        const float vx = (_entities_randf(&rng) * 2.f - 1.f) * ENTITIES_MAX_SPEED;
+        const float vy = (_entities_randf(&rng) * 2.f - 1.f) * ENTITIES_MAX_SPEED;
+        entity_spawn(store, x, y, vx, vy, e % 16 == 0 ? ENTITY_FLAG_FROZEN : 0);
+    }
+
+    return true;
+}
+
+static void _entities_update(uint64_t iterations, void* context)
+{
+    struct entities_bench* bench = context;
+    entity_set_simd(bench->simd);
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        entity_store_update(&bench->store, ENTITIES_DT);
+    }
+    bench_do_not_optimize(bench->store.x);
+}
+
+static bool _entities_check(enum entity_simd simd, uint32_t count)
+{
+    struct entity_store reference;
+    struct entity_store store;
+    if (!_entities_init(&reference, count) || !_entities_init(&store, count))
+    {
+        return false;
+    }
+
+    for (int step = 0; step < ENTITIES_CHECK_STEPS; ++step)
+    {
+        entity_set_simd(ENTITY_SIMD_SCALAR);
+        entity_store_update(&reference, ENTITIES_DT);
+        entity_set_simd(simd);
+        entity_store_update(&store, ENTITIES_DT);
+    }
+
+    uint32_t mismatches = 0;
+    for (uint32_t e = 0; e < count; ++e)
+    {
+        if (fabsf(store.x[e] - reference.x[e]) > ENTITIES_CHECK_TOLERANCE ||
+            fabsf(store.y[e] - reference.y[e]) > ENTITIES_CHECK_TOLERANCE ||
+            fabsf(store.vx[e] - reference.vx[e]) > ENTITIES_CHECK_TOLERANCE ||
+            fabsf(store.vy[e] - reference.vy[e]) > ENTITIES_CHECK_TOLERANCE ||
+            store.flags[e] != reference.flags[e])
+        {
+            ++mismatches;
+        }
+    }
+
+    if (mismatches > 0)
+    {
+        fprintf(stderr, "%s doesn't match scalar - mismatches: %u/%u\n", entity_simd_name(simd), mismatches, count);
+    }
+
+    entity_store_free(&reference);
+    entity_store_free(&store);
+    return mismatches == 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_suite suite;
+    if (!bench_suite_init(&suite, "entities", argc, argv))
+    {
+        return -1;
+    }
+
+    static const uint32_t counts[] = { 10000, 100000 };
+    static char names[ARRAY_SIZE(counts)][ENTITY_SIMD_AVX2 + 1][64];
+    bool matches = true;
+    for (size_t c = 0; c < ARRAY_SIZE(counts); ++c)
+    {
+        for (int simd = ENTITY_SIMD_SCALAR; simd <= (int)entity_best_simd(); ++simd)
+        {
+            if (simd != ENTITY_SIMD_SCALAR)
+            {
+                matches &= _entities_check(simd, counts[c]);
+            }
+
+            struct entities_bench bench;
+            bench.simd = simd;
+            if (!_entities_init(&bench.store, counts[c]))
+            {
+                return -1;
+            }
+
+            snprintf(names[c][simd], sizeof(names[c][simd]), "update_%s/%uk", entity_simd_name(simd), counts[c] / 1000);
+            const struct bench_case update = { names[c][simd], _entities_update, NULL, &bench, 0, 0 };
+
+            const int num_results = suite.num_results;
+            bench_run(&suite, &update);
+            if (suite.num_results > num_results)
+            {
+                const struct bench_result* result = &suite.results[suite.num_results - 1];
+                fprintf(stdout, "%-36s %10.0f entity updates/ms at p50\n", "", counts[c] * MILLION / result->p50_ns);
+            }
+
+            entity_store_free(&bench.store);
+        }
+    }
+
+    entity_set_simd(entity_best_simd());
+    if (!bench_suite_finish(&suite) || !matches)
+    {
+        return -1;
+    }
+
+    return 0;
+}
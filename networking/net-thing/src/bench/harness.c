@@ -0,0 +1,311 @@
+#include <bench/harness.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t bench_now_ns()
+{
+    // Monotonic, wall clock adjustments mid-run would show up as outliers
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+
+    return BILLION * spec.tv_sec + spec.tv_nsec;
+}
+
+void bench_do_not_optimize(const void* p)
+{
+    __asm__ volatile("" : : "g"(p) : "memory");
+}
+
+bool bench_suite_init(struct bench_suite* suite, const char* name, int argc, char** argv)
+{
+    memset(suite, 0, sizeof(*suite));
+    suite->name = name;
+    suite->repetitions = BENCH_DEFAULT_REPETITIONS;
+    suite->latency_samples = BENCH_DEFAULT_LATENCY_SAMPLES;
+
+    for (int a = 1; a < argc; ++a)
+    {
+        const bool has_value = a + 1 < argc;
+        if (strcmp(argv[a], "--json") == 0 && has_value)
+        {
+            suite->json_path = argv[++a];
+        }
+        else if (strcmp(argv[a], "--filter") == 0 && has_value)
+        {
+            suite->filter = argv[++a];
+        }
+        else if (strcmp(argv[a], "--reps") == 0 && has_value)
+        {
+            suite->repetitions = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--samples") == 0 && has_value)
+        {
+            suite->latency_samples = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--check") == 0)
+        {
+            suite->check_only = true;
+        }
+        else
+        {
+            fprintf(stderr,
+                    "Usage: %s [--json path] [--filter text] [--reps n] [--samples n] [--check]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+
+    if (suite->repetitions < 1 || suite->latency_samples < 1)
+    {
+        fprintf(stderr, "Repetitions and samples must be positive\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool _bench_selected(const struct bench_suite* suite, const struct bench_case* bench)
+{
+    return !suite->filter || strstr(bench->name, suite->filter);
+}
+
+// Check mode still runs the op, anything verified afterwards depends on it
+static bool _bench_check_only(const struct bench_suite* suite, const struct bench_case* bench)
+{
+    if (!suite->check_only)
+    {
+        return false;
+    }
+
+    if (bench->setup)
+    {
+        bench->setup(1, bench->context);
+    }
+    bench->run(1, bench->context);
+    return true;
+}
+
+static struct bench_result* _bench_next_result(struct bench_suite* suite, const struct bench_case* bench)
+{
+    if (suite->num_results >= BENCH_MAX_RESULTS)
+    {
+        fprintf(stderr, "Too many bench cases, skipping %s\n", bench->name);
+        return NULL;
+    }
+
+    struct bench_result* result = &suite->results[suite->num_results++];
+    memset(result, 0, sizeof(*result));
+    result->name = bench->name;
+    result->bytes_per_op = bench->bytes_per_op;
+    return result;
+}
+
+static uint64_t _bench_time_batch(const struct bench_case* bench, uint64_t iterations)
+{
+    if (bench->setup)
+    {
+        bench->setup(iterations, bench->context);
+    }
+
+    const uint64_t start_ns = bench_now_ns();
+    bench->run(iterations, bench->context);
+    return bench_now_ns() - start_ns;
+}
+
+static int _bench_compare(const void* a, const void* b)
+{
+    const double lhs = *(const double*)a;
+    const double rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Nearest rank on a sorted array
+static double _bench_percentile(const double* sorted, int count, double percentile)
+{
+    int rank = (int)(percentile / 100.0 * count + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    if (rank > count)
+    {
+        rank = count;
+    }
+
+    return sorted[rank - 1];
+}
+
+static void _bench_summarize(struct bench_result* result, double* samples, int count)
+{
+    qsort(samples, count, sizeof(samples[0]), _bench_compare);
+
+    double sum = 0.0;
+    for (int s = 0; s < count; ++s)
+    {
+        sum += samples[s];
+    }
+
+    result->samples = count;
+    result->mean_ns = sum / count;
+    result->min_ns = samples[0];
+    result->p50_ns = _bench_percentile(samples, count, 50.0);
+    result->p90_ns = _bench_percentile(samples, count, 90.0);
+    result->p99_ns = _bench_percentile(samples, count, 99.0);
+    result->max_ns = samples[count - 1];
+}
+
+void bench_run(struct bench_suite* suite, const struct bench_case* bench)
+{
+    if (!_bench_selected(suite, bench) || _bench_check_only(suite, bench))
+    {
+        return;
+    }
+
+    struct bench_result* result = _bench_next_result(suite, bench);
+    if (!result)
+    {
+        return;
+    }
+
+    // Warm up caches, branch predictors and clocks while doubling the batch
+    // until one takes long enough to time reliably
+    uint64_t iterations = 1;
+    const uint64_t warmup_start_ns = bench_now_ns();
+    while (true)
+    {
+        const uint64_t elapsed_ns = _bench_time_batch(bench, iterations);
+        const bool batch_long_enough =
+            elapsed_ns >= BENCH_TARGET_REPETITION_NS ||
+            (bench->max_batch && iterations >= bench->max_batch);
+        if (batch_long_enough && bench_now_ns() - warmup_start_ns >= BENCH_WARMUP_NS)
+        {
+            break;
+        }
+
+        if (!batch_long_enough)
+        {
+            iterations *= 2;
+            if (bench->max_batch && iterations > bench->max_batch)
+            {
+                iterations = bench->max_batch;
+            }
+        }
+    }
+
+    double* samples = malloc(suite->repetitions * sizeof(double));
+    for (int r = 0; r < suite->repetitions; ++r)
+    {
+        samples[r] = (double)_bench_time_batch(bench, iterations) / iterations;
+    }
+
+    result->iterations = iterations * suite->repetitions;
+    _bench_summarize(result, samples, suite->repetitions);
+    free(samples);
+
+    fprintf(stdout,
+            "%-36s %10.1f ns/op  (p50 %.1f  p99 %.1f)\n",
+            result->name,
+            result->mean_ns,
+            result->p50_ns,
+            result->p99_ns);
+}
+
+void bench_run_latency(struct bench_suite* suite, const struct bench_case* bench)
+{
+    if (!_bench_selected(suite, bench) || _bench_check_only(suite, bench))
+    {
+        return;
+    }
+
+    struct bench_result* result = _bench_next_result(suite, bench);
+    if (!result)
+    {
+        return;
+    }
+
+    result->latency = true;
+    const uint64_t warmup_start_ns = bench_now_ns();
+    while (bench_now_ns() - warmup_start_ns < BENCH_WARMUP_NS)
+    {
+        _bench_time_batch(bench, 1);
+    }
+
+    const int count = suite->latency_samples;
+    double* samples = malloc(count * sizeof(double));
+    for (int s = 0; s < count; ++s)
+    {
+        samples[s] = (double)_bench_time_batch(bench, 1);
+    }
+
+    result->iterations = count;
+    _bench_summarize(result, samples, count);
+    free(samples);
+
+    fprintf(stdout,
+            "%-36s %10.1f ns     (p50 %.1f  p99 %.1f  max %.1f)\n",
+            result->name,
+            result->mean_ns,
+            result->p50_ns,
+            result->p99_ns,
+            result->max_ns);
+}
+
+static bool _bench_write_json(const struct bench_suite* suite)
+{
+    FILE* file = fopen(suite->json_path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open %s\n", suite->json_path);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"suite\": \"%s\",\n  \"results\": [\n", suite->name);
+    for (int r = 0; r < suite->num_results; ++r)
+    {
+        const struct bench_result* result = &suite->results[r];
+        fprintf(file,
+                "    {\"name\": \"%s\", \"mode\": \"%s\", \"iterations\": %lu, \"samples\": %d, "
+                "\"bytes_per_op\": %zu, \"mean_ns\": %.2f, \"min_ns\": %.2f, \"p50_ns\": %.2f, "
+                "\"p90_ns\": %.2f, \"p99_ns\": %.2f, \"max_ns\": %.2f}%s\n",
+                result->name,
+                result->latency ? "latency" : "throughput",
+                result->iterations,
+                result->samples,
+                result->bytes_per_op,
+                result->mean_ns,
+                result->min_ns,
+                result->p50_ns,
+                result->p90_ns,
+                result->p99_ns,
+                result->max_ns,
+                r + 1 < suite->num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    const bool ok = fclose(file) == 0;
+    if (ok)
+    {
+        fprintf(stdout, "Wrote %s\n", suite->json_path);
+    }
+
+    return ok;
+}
+
+bool bench_suite_finish(struct bench_suite* suite)
+{
+    for (int r = 0; r < suite->num_results; ++r)
+    {
+        const struct bench_result* result = &suite->results[r];
+        if (result->bytes_per_op && result->p50_ns > 0.0)
+        {
+            fprintf(stdout,
+                    "%-36s %10.1f MB/s at p50\n",
+                    result->name,
+                    result->bytes_per_op * 1000.0 / result->p50_ns);
+        }
+    }
+
+    return !suite->json_path || _bench_write_json(suite);
+}
@@ -0,0 +1,95 @@
+#ifndef __HARNESS_H__
+#define __HARNESS_H__
+
+// Small microbenchmark harness. Each case is warmed up, calibrated so one
+// repetition runs for about BENCH_TARGET_REPETITION_NS, then repeated and
+// reported as percentiles of ns/op across repetitions. Latency cases time
+// every op on its own instead, for things like round trips where the spread
+// matters more than the mean.
+//
+// Benches take the same flags:
+//
+//   --json <path>    also write results as JSON, one case per line so runs
+//                    from two commits diff cleanly
+//   --filter <text>  only run cases whose name contains text
+//   --reps <n>       repetitions per case
+//   --samples <n>    samples per latency case
+//   --check          run every case once, untimed, for the bench's own
+//                    correctness checks. ctest runs benches this way.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <system/time.h>
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_DEFAULT_REPETITIONS 50
+#define BENCH_DEFAULT_LATENCY_SAMPLES 10000
+#define BENCH_WARMUP_NS (100 * MILLION)
+#define BENCH_TARGET_REPETITION_NS (5 * MILLION)
+
+// Runs the op under test iterations times
+typedef void(*bench_fn)(uint64_t iterations, void* context);
+
+struct bench_case
+{
+    const char* name;
+    bench_fn run;
+
+    // Optional, called untimed before every repetition with the number of
+    // iterations about to run, e.g. to drain or refill a socket
+    bench_fn setup;
+    void* context;
+
+    // Caps iterations per repetition, 0 for no cap. Handy when setup has to
+    // stage one input per iteration.
+    uint64_t max_batch;
+
+    // Optional, for MB/s in the report
+    size_t bytes_per_op;
+};
+
+struct bench_result
+{
+    const char* name;
+    bool latency;
+    uint64_t iterations;
+    int samples;
+    size_t bytes_per_op;
+    double mean_ns;
+    double min_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double max_ns;
+};
+
+struct bench_suite
+{
+    const char* name;
+    const char* json_path;
+    const char* filter;
+    int repetitions;
+    int latency_samples;
+    bool check_only;
+
+    struct bench_result results[BENCH_MAX_RESULTS];
+    int num_results;
+};
+
+bool bench_suite_init(struct bench_suite* suite, const char* name, int argc, char** argv);
+
+void bench_run(struct bench_suite* suite, const struct bench_case* bench);
+void bench_run_latency(struct bench_suite* suite, const struct bench_case* bench);
+
+// Prints the summary and writes JSON if asked, false if that fails
+bool bench_suite_finish(struct bench_suite* suite);
+
+uint64_t bench_now_ns();
+
+// Keeps the optimizer from throwing away a result
+void bench_do_not_optimize(const void* p);
+
+#endif // __HARNESS_H__
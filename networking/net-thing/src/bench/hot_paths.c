@@ -0,0 +1,463 @@
+// Per-packet costs of the socket and rudp hot paths: header encode/decode,
+// the send queue, tick send/recv, server connection lookup and loopback round
+// trips. Everything runs over 127.0.0.1, no server needed.
+//
+// Usage: hot_paths [--json path] [--filter text] [--reps n] [--samples n] [--check]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/socket.h>
+#include <system/time.h>
+#include <net/crypto.h>
+#include <net/rudp.h>
+#include <server/server.h>
+#include <bench/harness.h>
+
+#include <util/util.h>
+
+#define HOT_PATHS_PORT_BASE 30200
+#define HOT_PATHS_SMALL_PAYLOAD 64
+#define HOT_PATHS_LARGE_PAYLOAD 400
+
+// Keep staged packets well inside the default socket receive buffer
+#define HOT_PATHS_SOCKET_BATCH 64
+
+struct hot_paths_peer
+{
+    int socket_handle;
+    int port;
+    uint64_t packets_received;
+    struct rudp_conn connection;
+};
+
+// A connected client/server rudp pair on two loopback sockets
+struct hot_paths_pair
+{
+    struct hot_paths_peer client;
+    struct hot_paths_peer server;
+    size_t payload_len;
+    uint8_t payload[RUDP_MAX_PAYLOAD_SIZE];
+    uint8_t packet[COMMON_MAX_MTU];
+    size_t packet_len;
+};
+
+struct hot_paths_socket_context
+{
+    int sender;
+    int sink;
+    int sink_port;
+    uint8_t payload[HOT_PATHS_LARGE_PAYLOAD];
+};
+
+static void _hot_paths_on_read(int address, int port, uint8_t* data, size_t len, void* context)
+{
+    struct hot_paths_peer* peer = (struct hot_paths_peer*)context;
+    peer->packets_received++;
+}
+
+static int _hot_paths_open_socket(int port)
+{
+    const int socket_handle = socket_create_udp();
+    if (socket_handle <= 0 ||
+        !socket_bind(socket_handle, port) ||
+        !socket_set_nonblocking(socket_handle))
+    {
+        fprintf(stderr, "Failed to set up loopback socket on port %d\n", port);
+        return -1;
+    }
+
+    return socket_handle;
+}
+
+static bool _hot_paths_peer_init(struct hot_paths_peer* peer, int local_port, int remote_port, const uint8_t* key)
+{
+    memset(peer, 0, sizeof(*peer));
+    peer->port = local_port;
+    peer->socket_handle = _hot_paths_open_socket(local_port);
+    if (peer->socket_handle < 0)
+    {
+        return false;
+    }
+
+    // No MTU probes, they'd land in the middle of the measurements
+    struct rudp_config config;
+    rudp_config_default(&config);
+    config.max_mtu = config.mtu;
+
+    rudp_conn_init(
+        peer->socket_handle,
+        CREATE_ADDR(127, 0, 0, 1),
+        remote_port,
+        _hot_paths_on_read,
+        NULL,
+        peer,
+        &config,
+        &peer->connection);
+
+    // Some cases go a long while without hearing back, don't let that count
+    // as a timeout
+    peer->connection.timeout_ns = UINT64_MAX;
+    if (key)
+    {
+        rudp_conn_set_key(&peer->connection, key);
+    }
+
+    return true;
+}
+
+static bool _hot_paths_pair_init(struct hot_paths_pair* pair, int port_base, const uint8_t* key, size_t payload_len)
+{
+    memset(pair, 0, sizeof(*pair));
+    pair->payload_len = payload_len;
+    for (size_t i = 0; i < payload_len; ++i)
+    {
+        pair->payload[i] = (uint8_t)i;
+    }
+
+    if (!_hot_paths_peer_init(&pair->client, port_base, port_base + 1, key) ||
+        !_hot_paths_peer_init(&pair->server, port_base + 1, port_base, key))
+    {
+        return false;
+    }
+
+    // Handshake by hand, there's no demux in front of the server end
+    rudp_conn_connect(&pair->client.connection);
+    uint8_t hello[COMMON_MAX_MTU];
+    int address, port, received;
+    const uint64_t start_ns = system_time_ns();
+    while ((received = socket_recv(pair->server.socket_handle, hello, sizeof(hello), &address, &port)) <= 0)
+    {
+        if (system_time_ns() - start_ns > BILLION)
+        {
+            fprintf(stderr, "Loopback handshake never arrived\n");
+            return false;
+        }
+    }
+
+    rudp_conn_accept(&pair->server.connection, hello, received);
+    while (pair->client.connection.state != RUDP_STATUS_CONNECTED)
+    {
+        rudp_tick(&pair->client.connection);
+        if (system_time_ns() - start_ns > BILLION)
+        {
+            fprintf(stderr, "Loopback handshake never completed\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void _hot_paths_drain(int socket_handle)
+{
+    uint8_t buffer[COMMON_MAX_MTU];
+    int address, port;
+    while (socket_recv(socket_handle, buffer, sizeof(buffer), &address, &port) > 0)
+    {
+    }
+}
+
+//
+// Header encode/decode
+//
+
+static void _hot_paths_encode(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        pair->packet_len =
+            rudp_conn_encode(&pair->client.connection, NULL, pair->payload, pair->payload_len, pair->packet);
+        bench_do_not_optimize(pair->packet);
+    }
+}
+
+static void _hot_paths_decode(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        rudp_conn_process(&pair->server.connection, pair->packet, pair->packet_len);
+    }
+}
+
+// Sealed packets can't be replayed, so encode a fresh one every time
+static void _hot_paths_seal_open(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        pair->packet_len =
+            rudp_conn_encode(&pair->client.connection, NULL, pair->payload, pair->payload_len, pair->packet);
+        rudp_conn_process(&pair->server.connection, pair->packet, pair->packet_len);
+    }
+}
+
+//
+// Send queue and tick
+//
+
+static void _hot_paths_send_queue(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    struct rudp_conn* connection = &pair->client.connection;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        if (connection->packets_to_send == connection->packet_pool_size)
+        {
+            connection->packets_to_send = 0;
+        }
+        rudp_send(connection, pair->payload, pair->payload_len);
+    }
+}
+
+static void _hot_paths_fill_pool(struct hot_paths_pair* pair)
+{
+    while (rudp_send(&pair->client.connection, pair->payload, pair->payload_len))
+    {
+    }
+}
+
+static void _hot_paths_tick_send_setup(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    _hot_paths_drain(pair->server.socket_handle);
+    _hot_paths_fill_pool(pair);
+}
+
+static void _hot_paths_tick_send(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    rudp_conn_update(&pair->client.connection);
+}
+
+static void _hot_paths_tick_recv_setup(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    _hot_paths_fill_pool(pair);
+    rudp_conn_update(&pair->client.connection);
+}
+
+static void _hot_paths_tick_recv(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    rudp_tick(&pair->server.connection);
+}
+
+//
+// Raw sockets
+//
+
+static void _hot_paths_socket_send_setup(uint64_t iterations, void* context)
+{
+    struct hot_paths_socket_context* sockets = (struct hot_paths_socket_context*)context;
+    _hot_paths_drain(sockets->sink);
+}
+
+static void _hot_paths_socket_send(uint64_t iterations, void* context)
+{
+    struct hot_paths_socket_context* sockets = (struct hot_paths_socket_context*)context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        socket_send(
+            sockets->sender,
+            sockets->payload,
+            sizeof(sockets->payload),
+            CREATE_ADDR(127, 0, 0, 1),
+            sockets->sink_port);
+    }
+}
+
+static void _hot_paths_socket_recv_setup(uint64_t iterations, void* context)
+{
+    struct hot_paths_socket_context* sockets = (struct hot_paths_socket_context*)context;
+    _hot_paths_drain(sockets->sink);
+    _hot_paths_socket_send(iterations, context);
+}
+
+static void _hot_paths_socket_recv(uint64_t iterations, void* context)
+{
+    struct hot_paths_socket_context* sockets = (struct hot_paths_socket_context*)context;
+    uint8_t buffer[COMMON_MAX_MTU];
+    int address, port;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        socket_recv(sockets->sink, buffer, sizeof(buffer), &address, &port);
+    }
+}
+
+//
+// Server connection lookup
+//
+
+static struct server_context s_server;
+static struct client_connection s_connections[SERVER_DEFAULT_MAX_CONNECTIONS];
+
+static void _hot_paths_server_init()
+{
+    memset(&s_server, 0, sizeof(s_server));
+    server_config_default(&s_server.config);
+    s_server.connections = s_connections;
+    for (int c = 0; c < SERVER_DEFAULT_MAX_CONNECTIONS; ++c)
+    {
+        struct client_connection* connection = &s_server.connections[c];
+        connection->client_id = c;
+        connection->address = CREATE_ADDR(127, 0, 0, 1);
+        connection->port = HOT_PATHS_PORT_BASE + 100 + c;
+    }
+    s_server.num_connections = SERVER_DEFAULT_MAX_CONNECTIONS;
+}
+
+static void _hot_paths_find_hit(uint64_t iterations, void* context)
+{
+    // Worst case hit, the last slot
+    const int port = HOT_PATHS_PORT_BASE + 100 + SERVER_DEFAULT_MAX_CONNECTIONS - 1;
+    int found = 0;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        found += server_find_connection(&s_server, CREATE_ADDR(127, 0, 0, 1), port);
+        bench_do_not_optimize(&found);
+    }
+}
+
+static void _hot_paths_find_miss(uint64_t iterations, void* context)
+{
+    int found = 0;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        found += server_find_connection(&s_server, CREATE_ADDR(10, 0, 0, 1), HOT_PATHS_PORT_BASE);
+        bench_do_not_optimize(&found);
+    }
+}
+
+//
+// Round trips
+//
+
+static void _hot_paths_round_trip(uint64_t iterations, void* context)
+{
+    struct hot_paths_pair* pair = (struct hot_paths_pair*)context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        const uint64_t server_received = pair->server.packets_received + 1;
+        rudp_send(&pair->client.connection, pair->payload, pair->payload_len);
+        rudp_conn_update(&pair->client.connection);
+        while (pair->server.packets_received < server_received)
+        {
+            rudp_tick(&pair->server.connection);
+        }
+
+        const uint64_t client_received = pair->client.packets_received + 1;
+        rudp_send(&pair->server.connection, pair->payload, pair->payload_len);
+        rudp_conn_update(&pair->server.connection);
+        while (pair->client.packets_received < client_received)
+        {
+            rudp_tick(&pair->client.connection);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_suite suite;
+    if (!bench_suite_init(&suite, "hot_paths", argc, argv))
+    {
+        return -1;
+    }
+
+    uint8_t key[CRYPTO_KEY_SIZE];
+    crypto_random(key, sizeof(key));
+
+    static struct hot_paths_pair small;
+    static struct hot_paths_pair large;
+    static struct hot_paths_pair sealed;
+    static struct hot_paths_socket_context sockets;
+    if (!_hot_paths_pair_init(&small, HOT_PATHS_PORT_BASE, NULL, HOT_PATHS_SMALL_PAYLOAD) ||
+        !_hot_paths_pair_init(&large, HOT_PATHS_PORT_BASE + 2, NULL, HOT_PATHS_LARGE_PAYLOAD) ||
+        !_hot_paths_pair_init(&sealed, HOT_PATHS_PORT_BASE + 4, key, HOT_PATHS_LARGE_PAYLOAD))
+    {
+        return -1;
+    }
+
+    sockets.sink_port = HOT_PATHS_PORT_BASE + 6;
+    sockets.sender = _hot_paths_open_socket(HOT_PATHS_PORT_BASE + 7);
+    sockets.sink = _hot_paths_open_socket(sockets.sink_port);
+    if (sockets.sender < 0 || sockets.sink < 0)
+    {
+        return -1;
+    }
+
+    _hot_paths_server_init();
+
+    // Decode needs something to decode
+    _hot_paths_encode(1, &small);
+    _hot_paths_encode(1, &large);
+
+    const struct bench_case throughput_cases[] = {
+        { "rudp_encode/64B", _hot_paths_encode, NULL, &small, 0, HOT_PATHS_SMALL_PAYLOAD },
+        { "rudp_encode/400B", _hot_paths_encode, NULL, &large, 0, HOT_PATHS_LARGE_PAYLOAD },
+        { "rudp_decode/64B", _hot_paths_decode, NULL, &small, 0, HOT_PATHS_SMALL_PAYLOAD },
+        { "rudp_decode/400B", _hot_paths_decode, NULL, &large, 0, HOT_PATHS_LARGE_PAYLOAD },
+        { "rudp_seal_open/400B", _hot_paths_seal_open, NULL, &sealed, 0, HOT_PATHS_LARGE_PAYLOAD },
+        { "rudp_send_queue/400B", _hot_paths_send_queue, NULL, &large, 0, HOT_PATHS_LARGE_PAYLOAD },
+        {
+            "rudp_tick_send/16x400B",
+            _hot_paths_tick_send,
+            _hot_paths_tick_send_setup,
+            &large,
+            1,
+            RUDP_DEFAULT_PACKET_POOL_SIZE * HOT_PATHS_LARGE_PAYLOAD
+        },
+        {
+            "rudp_tick_recv/16x400B",
+            _hot_paths_tick_recv,
+            _hot_paths_tick_recv_setup,
+            &large,
+            1,
+            RUDP_DEFAULT_PACKET_POOL_SIZE * HOT_PATHS_LARGE_PAYLOAD
+        },
+        {
+            "socket_send/400B",
+            _hot_paths_socket_send,
+            _hot_paths_socket_send_setup,
+            &sockets,
+            HOT_PATHS_SOCKET_BATCH,
+            HOT_PATHS_LARGE_PAYLOAD
+        },
+        {
+            "socket_recv/400B",
+            _hot_paths_socket_recv,
+            _hot_paths_socket_recv_setup,
+            &sockets,
+            HOT_PATHS_SOCKET_BATCH,
+            HOT_PATHS_LARGE_PAYLOAD
+        },
+        { "server_find_connection/hit", _hot_paths_find_hit, NULL, NULL, 0, 0 },
+        { "server_find_connection/miss", _hot_paths_find_miss, NULL, NULL, 0, 0 },
+    };
+    for (size_t c = 0; c < ARRAY_SIZE(throughput_cases); ++c)
+    {
+        bench_run(&suite, &throughput_cases[c]);
+    }
+
+    // The tick cases leave packets lying around, start the round trips clean
+    _hot_paths_drain(small.client.socket_handle);
+    _hot_paths_drain(small.server.socket_handle);
+    _hot_paths_drain(sealed.client.socket_handle);
+    _hot_paths_drain(sealed.server.socket_handle);
+
+    const struct bench_case latency_cases[] = {
+        { "loopback_round_trip/64B", _hot_paths_round_trip, NULL, &small, 0, 0 },
+        { "loopback_round_trip_sealed/400B", _hot_paths_round_trip, NULL, &sealed, 0, 0 },
+    };
+    for (size_t c = 0; c < ARRAY_SIZE(latency_cases); ++c)
+    {
+        bench_run_latency(&suite, &latency_cases[c]);
+    }
+
+    return bench_suite_finish(&suite) ? 0 : -1;
+}
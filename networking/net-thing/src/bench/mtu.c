@@ -0,0 +1,270 @@
+// Path MTU probing over loopback, and what it buys for bulk transfers: the
+// same 64KB pushed through rudp at the default MTU and at whatever probing
+// finds. Also checks probing settles where it should.
+//
+// Usage: mtu [--json path] [--filter text] [--reps n] [--samples n] [--check]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/socket.h>
+#include <system/time.h>
+#include <net/rudp.h>
+#include <bench/harness.h>
+
+#include <util/util.h>
+
+#define MTU_PORT_BASE 30300
+#define MTU_BULK_BYTES (64 * 1024)
+
+// Probe ceiling for the check that probing stops at max_mtu rather than at
+// whatever the path takes
+#define MTU_CAPPED 1000
+
+// Loopback answers straight away, so this is only hit if probing is broken
+#define MTU_SETTLE_TIMEOUT_NS (5 * BILLION)
+
+struct mtu_peer
+{
+    int socket_handle;
+    uint64_t bytes_received;
+    struct rudp_conn connection;
+};
+
+struct mtu_pair
+{
+    struct mtu_peer client;
+    struct mtu_peer server;
+    uint8_t payload[RUDP_MAX_PAYLOAD_SIZE];
+};
+
+static void _mtu_on_read(int address, int port, uint8_t* data, size_t len, void* context)
+{
+    struct mtu_peer* peer = (struct mtu_peer*)context;
+    peer->bytes_received += len;
+}
+
+static bool _mtu_peer_init(struct mtu_peer* peer, int local_port, int remote_port, size_t max_mtu)
+{
+    memset(peer, 0, sizeof(*peer));
+    peer->socket_handle = socket_create_udp();
+    if (peer->socket_handle <= 0 ||
+        !socket_bind(peer->socket_handle, local_port) ||
+        !socket_set_nonblocking(peer->socket_handle) ||
+        !socket_set_dont_fragment(peer->socket_handle))
+    {
+        fprintf(stderr, "Failed to set up loopback socket on port %d\n", local_port);
+        return false;
+    }
+
+    struct rudp_config config;
+    rudp_config_default(&config);
+    config.max_mtu = max_mtu;
+    config.timeout_ns = UINT64_MAX;
+    return rudp_conn_init(
+        peer->socket_handle,
+        CREATE_ADDR(127, 0, 0, 1),
+        remote_port,
+        _mtu_on_read,
+        NULL,
+        peer,
+        &config,
+        &peer->connection);
+}
+
+static void _mtu_pair_free(struct mtu_pair* pair)
+{
+    rudp_conn_close(&pair->client.connection);
+    rudp_conn_close(&pair->server.connection);
+    socket_close(pair->client.socket_handle);
+    socket_close(pair->server.socket_handle);
+}
+
+// Connects, then ticks both ends until the client's probing is done. Returns
+// how long that took, 0 on failure.
+static uint64_t _mtu_pair_init(struct mtu_pair* pair, int port_base, size_t max_mtu)
+{
+    memset(pair, 0, sizeof(*pair));
+    for (size_t i = 0; i < sizeof(pair->payload); ++i)
+    {
+        pair->payload[i] = (uint8_t)(i * 31);
+    }
+
+    if (!_mtu_peer_init(&pair->client, port_base, port_base + 1, max_mtu) ||
+        !_mtu_peer_init(&pair->server, port_base + 1, port_base, max_mtu))
+    {
+        return 0;
+    }
+
+    // Handshake by hand, there's no demux in front of the server end
+    rudp_conn_connect(&pair->client.connection);
+    uint8_t hello[COMMON_MAX_MTU];
+    int address, port, received;
+    const uint64_t start_ns = system_time_ns();
+    while ((received = socket_recv(pair->server.socket_handle, hello, sizeof(hello), &address, &port)) <= 0)
+    {
+        if (system_time_ns() - start_ns > BILLION)
+        {
+            fprintf(stderr, "Loopback handshake never arrived\n");
+            return 0;
+        }
+    }
+
+    rudp_conn_accept(&pair->server.connection, hello, received);
+    while (pair->client.connection.state != RUDP_STATUS_CONNECTED ||
+           !rudp_conn_mtu_settled(&pair->client.connection))
+    {
+        rudp_tick(&pair->client.connection);
+        rudp_tick(&pair->server.connection);
+        if (system_time_ns() - start_ns > MTU_SETTLE_TIMEOUT_NS)
+        {
+            fprintf(stderr,
+                    "Probing never settled - mtu: %zu high: %zu\n",
+                    pair->client.connection.mtu,
+                    pair->client.connection.probe_high);
+            return 0;
+        }
+    }
+
+    return system_time_ns() - start_ns;
+}
+
+// Flushes the client's queue and reads it all on the server end
+static void _mtu_flush(struct mtu_pair* pair)
+{
+    rudp_conn_update(&pair->client.connection);
+    rudp_tick(&pair->server.connection);
+}
+
+// One op is MTU_BULK_BYTES split into as few packets as the MTU allows
+static void _mtu_bulk(uint64_t iterations, void* context)
+{
+    struct mtu_pair* pair = (struct mtu_pair*)context;
+    struct rudp_conn* connection = &pair->client.connection;
+    const size_t max_payload = rudp_conn_max_payload(connection);
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        size_t remaining = MTU_BULK_BYTES;
+        while (remaining > 0)
+        {
+            const size_t len = remaining < max_payload ? remaining : max_payload;
+            if (!rudp_send(connection, pair->payload, len))
+            {
+                _mtu_flush(pair);
+                continue;
+            }
+            remaining -= len;
+        }
+        _mtu_flush(pair);
+    }
+}
+
+static bool _mtu_check_transfer(struct mtu_pair* pair)
+{
+    pair->server.bytes_received = 0;
+    _mtu_bulk(1, pair);
+    if (pair->server.bytes_received != MTU_BULK_BYTES)
+    {
+        fprintf(stderr,
+                "Bulk transfer lost data at mtu %zu - received: %lu/%d\n",
+                pair->client.connection.mtu,
+                pair->server.bytes_received,
+                MTU_BULK_BYTES);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_suite suite;
+    if (!bench_suite_init(&suite, "mtu", argc, argv))
+    {
+        return -1;
+    }
+
+    static struct mtu_pair fixed;
+    static struct mtu_pair capped;
+    static struct mtu_pair probed;
+    const uint64_t fixed_ns = _mtu_pair_init(&fixed, MTU_PORT_BASE, COMMON_MTU);
+    const uint64_t capped_ns = _mtu_pair_init(&capped, MTU_PORT_BASE + 2, MTU_CAPPED);
+    const uint64_t probed_ns = _mtu_pair_init(&probed, MTU_PORT_BASE + 4, COMMON_MAX_MTU);
+    if (fixed_ns == 0 || capped_ns == 0 || probed_ns == 0)
+    {
+        return -1;
+    }
+
+    // Loopback takes anything, so probing should go right up to the ceiling
+    bool valid = true;
+    const struct mtu_pair* pairs[] = { &fixed, &capped, &probed };
+    const uint64_t settle_ns[] = { fixed_ns, capped_ns, probed_ns };
+    for (size_t p = 0; p < ARRAY_SIZE(pairs); ++p)
+    {
+        const struct rudp_conn* connection = &pairs[p]->client.connection;
+        fprintf(stdout,
+                "max-mtu %4zu: settled at %4zu in %.1f ms, %lu packets\n",
+                connection->max_mtu,
+                connection->mtu,
+                (double)settle_ns[p] / MILLION,
+                connection->traffic_stats.packets_sent);
+        if (connection->mtu != connection->max_mtu)
+        {
+            fprintf(stderr, "Probing stopped short of %zu\n", connection->max_mtu);
+            valid = false;
+        }
+    }
+    fprintf(stdout, "\n");
+
+    valid &= _mtu_check_transfer(&fixed);
+    valid &= _mtu_check_transfer(&probed);
+
+    static char names[2][64];
+    snprintf(names[0], sizeof(names[0]), "bulk_64KB/mtu%zu", fixed.client.connection.mtu);
+    snprintf(names[1], sizeof(names[1]), "bulk_64KB/mtu%zu", probed.client.connection.mtu);
+    const struct bench_case cases[] = {
+        { names[0], _mtu_bulk, NULL, &fixed, 0, MTU_BULK_BYTES },
+        { names[1], _mtu_bulk, NULL, &probed, 0, MTU_BULK_BYTES },
+    };
+
+    double p50_ns[ARRAY_SIZE(cases)] = {0};
+    for (size_t c = 0; c < ARRAY_SIZE(cases); ++c)
+    {
+        const int num_results = suite.num_results;
+        bench_run(&suite, &cases[c]);
+        if (suite.num_results > num_results)
+        {
+            p50_ns[c] = suite.results[suite.num_results - 1].p50_ns;
+        }
+    }
+
+    if (p50_ns[0] > 0.0 && p50_ns[1] > 0.0)
+    {
+        const size_t fixed_packets =
+            (MTU_BULK_BYTES + rudp_conn_max_payload(&fixed.client.connection) - 1) /
+            rudp_conn_max_payload(&fixed.client.connection);
+        const size_t probed_packets =
+            (MTU_BULK_BYTES + rudp_conn_max_payload(&probed.client.connection) - 1) /
+            rudp_conn_max_payload(&probed.client.connection);
+        fprintf(stdout,
+                "\n64KB in %zu packets at mtu %zu vs %zu at mtu %zu, %.2fx the throughput\n",
+                fixed_packets,
+                fixed.client.connection.mtu,
+                probed_packets,
+                probed.client.connection.mtu,
+                p50_ns[0] / p50_ns[1]);
+    }
+
+    _mtu_pair_free(&fixed);
+    _mtu_pair_free(&capped);
+    _mtu_pair_free(&probed);
+    if (!bench_suite_finish(&suite) || !valid)
+    {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,522 @@
+// Rollback: runs two peers of rollback.c against a virtual network with
+// latency, jitter and loss and checks they end up bit for bit identical to a
+// straight simulation of the same inputs, then times the worst case per frame
+// cost of a rollback at a few state sizes.
+//
+// Usage: rollback [--json path] [--filter text] [--reps n] [--samples n] [--check]
+//
+// The determinism check always runs, exits non-zero if it fails. The last
+// scenario perturbs one peer on purpose and passes if the checksums catch it.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <system/time.h>
+#include <net/rollback.h>
+#include <bench/harness.h>
+
+#include <util/util.h>
+
+#define ROLLBACK_BENCH_FRAME_MS 16
+#define ROLLBACK_BENCH_FRAMES 3600
+#define ROLLBACK_BENCH_CHECK_STATE_SIZE (64 * 1024)
+#define ROLLBACK_BENCH_MAX_IN_FLIGHT 256
+
+// Inputs change every this many frames, often enough that predictions miss
+#define ROLLBACK_BENCH_INPUT_HOLD 6
+
+// A 1MB rollback is around a millisecond, the harness default would take
+// minutes. Still overridable with --samples.
+#define ROLLBACK_BENCH_LATENCY_SAMPLES 1000
+
+struct rollback_bench_input
+{
+    int8_t dx;
+    int8_t dy;
+    uint8_t buttons;
+    uint8_t pad;
+};
+
+struct rollback_bench_entity
+{
+    int32_t x;
+    int32_t y;
+    int32_t vx;
+    int32_t vy;
+};
+
+// The whole simulation, fills however many bytes the state is
+struct rollback_bench_world
+{
+    uint32_t frame;
+    int32_t player_x[ROLLBACK_NUM_PLAYERS];
+    int32_t player_y[ROLLBACK_NUM_PLAYERS];
+    uint32_t num_entities;
+    struct rollback_bench_entity entities[];
+};
+
+struct rollback_bench_sim
+{
+    // Deliberately break determinism on this frame, 0 for never
+    uint32_t desync_frame;
+};
+
+struct rollback_bench_scenario
+{
+    int latency_ms;
+    int jitter_ms;
+    int loss_pct;
+    int input_delay;
+    uint32_t desync_frame;
+};
+
+struct rollback_bench_packet
+{
+    bool in_use;
+    int to_player;
+    uint64_t arrival_ms;
+    size_t len;
+    uint8_t data[RUDP_MAX_PAYLOAD_SIZE];
+};
+
+struct rollback_bench_network
+{
+    uint64_t rng;
+    const struct rollback_bench_scenario* scenario;
+    struct rollback_bench_packet packets[ROLLBACK_BENCH_MAX_IN_FLIGHT];
+};
+
+struct rollback_bench_peer
+{
+    struct rollback_session session;
+    struct rollback_bench_sim sim;
+    struct rollback_bench_world* world;
+};
+
+uint64_t _rollback_bench_random(uint64_t* rng)
+{
+    // xorshift64*, deterministic so runs are comparable
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return *rng * 2685821657736338717ull;
+}
+
+// Fixed point only, floats would be fine on one machine but not across them
+void _rollback_bench_advance(void* state, const uint8_t* const* inputs, void* context)
+{
+    struct rollback_bench_world* world = state;
+    const struct rollback_bench_sim* sim = context;
+
+    bool kick[ROLLBACK_NUM_PLAYERS];
+    for (int p = 0; p < ROLLBACK_NUM_PLAYERS; ++p)
+    {
+        struct rollback_bench_input input;
+        memcpy(&input, inputs[p], sizeof(input));
+        world->player_x[p] += input.dx * 256;
+        world->player_y[p] += input.dy * 256;
+        kick[p] = input.buttons & 1;
+    }
+
+    // Every entity chases one of the players
+    for (uint32_t e = 0; e < world->num_entities; ++e)
+    {
+        struct rollback_bench_entity* entity = &world->entities[e];
+        const int p = e & 1;
+        entity->vx += (world->player_x[p] - entity->x) >> 8;
+        entity->vy += (world->player_y[p] - entity->y) >> 8;
+        if (kick[p])
+        {
+            entity->vx = -entity->vx;
+            entity->vy = -entity->vy;
+        }
+
+        entity->vx -= entity->vx >> 4;
+        entity->vy -= entity->vy >> 4;
+        entity->x += entity->vx;
+        entity->y += entity->vy;
+    }
+
+    world->frame++;
+    if (sim && sim->desync_frame != 0 && world->frame == sim->desync_frame)
+    {
+        world->player_x[0] += 1;
+    }
+}
+
+void _rollback_bench_world_init(struct rollback_bench_world* world, size_t state_size)
+{
+    memset(world, 0, state_size);
+    world->num_entities =
+        (state_size - sizeof(*world)) / sizeof(struct rollback_bench_entity);
+
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (uint32_t e = 0; e < world->num_entities; ++e)
+    {
+        world->entities[e].x = (int32_t)(_rollback_bench_random(&rng) >> 40);
+        world->entities[e].y = (int32_t)(_rollback_bench_random(&rng) >> 40);
+    }
+}
+
+// What player is doing on frame, the same for every peer asking
+struct rollback_bench_input _rollback_bench_input(int player, uint32_t frame, int input_delay)
+{
+    struct rollback_bench_input input;
+    memset(&input, 0, sizeof(input));
+    if (frame < (uint32_t)input_delay)
+    {
+        return input;
+    }
+
+    uint64_t rng = 0x2545F4914F6CDD1Dull ^
+        ((uint64_t)player << 32 | frame / ROLLBACK_BENCH_INPUT_HOLD);
+    const uint64_t bits = _rollback_bench_random(&rng);
+    input.dx = (int8_t)(bits % 3) - 1;
+    input.dy = (int8_t)((bits >> 8) % 3) - 1;
+    input.buttons = (bits >> 16) % 16 == 0;
+    return input;
+}
+
+void _rollback_bench_send(
+    struct rollback_bench_network* network,
+    int to_player,
+    const uint8_t* data,
+    size_t len,
+    uint64_t now_ms)
+{
+    const struct rollback_bench_scenario* scenario = network->scenario;
+    if ((int)(_rollback_bench_random(&network->rng) % 100) < scenario->loss_pct)
+    {
+        return;
+    }
+
+    uint64_t delay_ms = scenario->latency_ms;
+    if (scenario->jitter_ms > 0)
+    {
+        delay_ms += _rollback_bench_random(&network->rng) % (scenario->jitter_ms + 1);
+    }
+
+    for (int p = 0; p < ROLLBACK_BENCH_MAX_IN_FLIGHT; ++p)
+    {
+        struct rollback_bench_packet* packet = &network->packets[p];
+        if (!packet->in_use)
+        {
+            packet->in_use = true;
+            packet->to_player = to_player;
+            packet->arrival_ms = now_ms + delay_ms;
+            packet->len = len;
+            memcpy(packet->data, data, len);
+            return;
+        }
+    }
+}
+
+bool _rollback_bench_peer_init(
+    struct rollback_bench_peer* peer,
+    int player,
+    const struct rollback_bench_scenario* scenario)
+{
+    peer->world = malloc(ROLLBACK_BENCH_CHECK_STATE_SIZE);
+    if (!peer->world)
+    {
+        return false;
+    }
+
+    // Only the second peer goes wrong, the first is the reference
+    peer->sim.desync_frame = player == 1 ? scenario->desync_frame : 0;
+    _rollback_bench_world_init(peer->world, ROLLBACK_BENCH_CHECK_STATE_SIZE);
+    return rollback_session_init(
+        &peer->session,
+        player,
+        sizeof(struct rollback_bench_input),
+        scenario->input_delay,
+        peer->world,
+        ROLLBACK_BENCH_CHECK_STATE_SIZE,
+        _rollback_bench_advance,
+        &peer->sim);
+}
+
+bool _rollback_bench_peer_done(const struct rollback_bench_peer* peer)
+{
+    return peer->session.frame == ROLLBACK_BENCH_FRAMES &&
+        peer->session.next_remote_frame >= ROLLBACK_BENCH_FRAMES &&
+        peer->session.rollback_frame == UINT32_MAX;
+}
+
+void _rollback_bench_peer_tick(
+    struct rollback_bench_peer* peer,
+    struct rollback_bench_network* network,
+    uint64_t now_ms)
+{
+    struct rollback_session* session = &peer->session;
+    for (int p = 0; p < ROLLBACK_BENCH_MAX_IN_FLIGHT; ++p)
+    {
+        struct rollback_bench_packet* packet = &network->packets[p];
+        if (packet->in_use && packet->to_player == session->local_player && packet->arrival_ms <= now_ms)
+        {
+            packet->in_use = false;
+            rollback_read_message(session, packet->data, packet->len);
+        }
+    }
+
+    if (session->next_local_frame < ROLLBACK_BENCH_FRAMES)
+    {
+        const struct rollback_bench_input input =
+            _rollback_bench_input(session->local_player, session->next_local_frame, session->input_delay);
+        rollback_add_local_input(session, &input);
+    }
+
+    if (session->frame < ROLLBACK_BENCH_FRAMES || session->rollback_frame != UINT32_MAX)
+    {
+        rollback_advance_frame(session);
+    }
+
+    uint8_t buffer[RUDP_MAX_PAYLOAD_SIZE];
+    const size_t len = rollback_write_message(session, buffer, sizeof(buffer));
+    _rollback_bench_send(network, 1 - session->local_player, buffer, len, now_ms);
+}
+
+// True if the outcome is the expected one
+bool _rollback_bench_check(const struct rollback_bench_scenario* scenario)
+{
+    static struct rollback_bench_network network;
+    memset(&network, 0, sizeof(network));
+    network.rng = 0x9E3779B97F4A7C15ull;
+    network.scenario = scenario;
+
+    struct rollback_bench_peer peers[ROLLBACK_NUM_PLAYERS];
+    for (int p = 0; p < ROLLBACK_NUM_PLAYERS; ++p)
+    {
+        if (!_rollback_bench_peer_init(&peers[p], p, scenario))
+        {
+            return false;
+        }
+    }
+
+    // Give up if it hasn't converged in a generous amount of time
+    const uint64_t max_ticks = ROLLBACK_BENCH_FRAMES * 4;
+    uint64_t tick = 0;
+    for (; tick < max_ticks; ++tick)
+    {
+        if (_rollback_bench_peer_done(&peers[0]) && _rollback_bench_peer_done(&peers[1]))
+        {
+            break;
+        }
+
+        const uint64_t now_ms = tick * ROLLBACK_BENCH_FRAME_MS;
+        _rollback_bench_peer_tick(&peers[0], &network, now_ms);
+        _rollback_bench_peer_tick(&peers[1], &network, now_ms);
+    }
+
+    // Checksums still in flight at the end never get compared, one more round
+    // trip settles them
+    for (int p = 0; p < ROLLBACK_NUM_PLAYERS; ++p)
+    {
+        uint8_t buffer[RUDP_MAX_PAYLOAD_SIZE];
+        const size_t len = rollback_write_message(&peers[p].session, buffer, sizeof(buffer));
+        rollback_read_message(&peers[1 - p].session, buffer, len);
+        rollback_advance_frame(&peers[1 - p].session);
+    }
+
+    // The same inputs, no network, no rollback
+    struct rollback_bench_world* reference = malloc(ROLLBACK_BENCH_CHECK_STATE_SIZE);
+    _rollback_bench_world_init(reference, ROLLBACK_BENCH_CHECK_STATE_SIZE);
+    for (uint32_t frame = 0; frame < ROLLBACK_BENCH_FRAMES; ++frame)
+    {
+        struct rollback_bench_input inputs[ROLLBACK_NUM_PLAYERS];
+        const uint8_t* input_pointers[ROLLBACK_NUM_PLAYERS];
+        for (int p = 0; p < ROLLBACK_NUM_PLAYERS; ++p)
+        {
+            inputs[p] = _rollback_bench_input(p, frame, scenario->input_delay);
+            input_pointers[p] = (const uint8_t*)&inputs[p];
+        }
+        _rollback_bench_advance(reference, input_pointers, NULL);
+    }
+
+    const uint32_t reference_checksum = rollback_checksum(reference, ROLLBACK_BENCH_CHECK_STATE_SIZE);
+    const bool converged = tick < max_ticks;
+    bool matches = converged;
+    uint64_t desyncs = 0;
+    for (int p = 0; p < ROLLBACK_NUM_PLAYERS; ++p)
+    {
+        matches &= rollback_checksum(peers[p].world, ROLLBACK_BENCH_CHECK_STATE_SIZE) == reference_checksum;
+        desyncs += peers[p].session.stats.desyncs;
+    }
+
+    const bool expect_desync = scenario->desync_frame != 0;
+    const bool passed = converged && (expect_desync ? desyncs > 0 && !matches : desyncs == 0 && matches);
+
+    const struct rollback_stats* stats = &peers[0].session.stats;
+    fprintf(stdout,
+            "%4d %4d %4d %5d | %6lu %6lu %7lu %4u %6lu | %6lu %4lu | %s%s\n",
+            scenario->latency_ms,
+            scenario->jitter_ms,
+            scenario->loss_pct,
+            scenario->input_delay,
+            stats->rollbacks,
+            stats->mispredictions,
+            stats->frames_resimulated,
+            stats->max_rollback_frames,
+            stats->stalls,
+            stats->checksums_compared,
+            desyncs,
+            passed ? "PASS" : "FAIL",
+            converged ? "" : " (stuck)");
+
+    for (int p = 0; p < ROLLBACK_NUM_PLAYERS; ++p)
+    {
+        rollback_session_free(&peers[p].session);
+        free(peers[p].world);
+    }
+    free(reference);
+    return passed;
+}
+
+// A session stuck the full ROLLBACK_MAX_PREDICTION frames ahead of the remote
+// player, who then turns out to have changed input on the oldest of them
+struct rollback_bench_worst_case
+{
+    size_t state_size;
+    struct rollback_bench_world* world;
+    struct rollback_session session;
+    int8_t remote_dx;
+};
+
+bool _rollback_bench_worst_case_init(struct rollback_bench_worst_case* bench, size_t state_size)
+{
+    bench->state_size = state_size;
+    bench->remote_dx = 0;
+    bench->world = malloc(state_size);
+    if (!bench->world)
+    {
+        return false;
+    }
+
+    _rollback_bench_world_init(bench->world, state_size);
+    return rollback_session_init(
+        &bench->session,
+        0,
+        sizeof(struct rollback_bench_input),
+        0,
+        bench->world,
+        state_size,
+        _rollback_bench_advance,
+        NULL);
+}
+
+void _rollback_bench_worst_case_free(struct rollback_bench_worst_case* bench)
+{
+    rollback_session_free(&bench->session);
+    free(bench->world);
+}
+
+// Predicts until it can't any more, then delivers remote inputs that all
+// differ from the prediction
+void _rollback_bench_worst_case_setup(uint64_t iterations, void* context)
+{
+    struct rollback_bench_worst_case* bench = context;
+    struct rollback_session* session = &bench->session;
+
+    const struct rollback_bench_input input = _rollback_bench_input(0, session->frame, 0);
+    while (rollback_add_local_input(session, &input) && rollback_advance_frame(session))
+    {
+    }
+
+    bench->remote_dx = bench->remote_dx == 1 ? -1 : 1;
+    struct rollback_bench_input remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.dx = bench->remote_dx;
+
+    uint8_t buffer[RUDP_MAX_PAYLOAD_SIZE];
+    struct rollback_message message;
+    memset(&message, 0, sizeof(message));
+    message.id = ROLLBACK_MESSAGE_ID;
+    message.input_size = sizeof(remote);
+    message.count = session->frame - session->next_remote_frame;
+    message.start_frame = session->next_remote_frame;
+    message.ack_frame = session->next_local_frame;
+    memcpy(buffer, &message, sizeof(message));
+    for (int i = 0; i < message.count; ++i)
+    {
+        memcpy(buffer + sizeof(message) + i * sizeof(remote), &remote, sizeof(remote));
+    }
+
+    rollback_read_message(session, buffer, sizeof(message) + message.count * sizeof(remote));
+}
+
+void _rollback_bench_worst_case_run(uint64_t iterations, void* context)
+{
+    struct rollback_bench_worst_case* bench = context;
+    const struct rollback_bench_input input = _rollback_bench_input(0, bench->session.frame, 0);
+    rollback_add_local_input(&bench->session, &input);
+    rollback_advance_frame(&bench->session);
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_suite suite;
+    if (!bench_suite_init(&suite, "rollback", argc, argv))
+    {
+        return -1;
+    }
+
+    if (suite.latency_samples == BENCH_DEFAULT_LATENCY_SAMPLES)
+    {
+        suite.latency_samples = ROLLBACK_BENCH_LATENCY_SAMPLES;
+    }
+
+    static const struct rollback_bench_scenario scenarios[] = {
+        {   0,  0,  0, 0, 0 },
+        {  20,  5,  0, 2, 0 },
+        {  50, 10,  5, 2, 0 },
+        { 100, 30, 10, 3, 0 },
+        {  60,  0, 30, 1, 0 },
+        {  50, 10,  5, 2, 1000 },
+    };
+
+    fprintf(stdout, "Determinism, %d frames, %d KB state\n", ROLLBACK_BENCH_FRAMES, ROLLBACK_BENCH_CHECK_STATE_SIZE / 1024);
+    fprintf(stdout, " lat  jit loss delay | rollbk mispre   resim  max  stall | chksum desy |\n");
+    fprintf(stdout, "  ms   ms    %%   frm |                               |             |\n");
+    bool passed = true;
+    for (size_t s = 0; s < ARRAY_SIZE(scenarios); ++s)
+    {
+        passed &= _rollback_bench_check(&scenarios[s]);
+    }
+    fprintf(stdout, "\n");
+
+    static const size_t state_sizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024 };
+    static const char* names[] = {
+        "worst_case_rollback/64KB",
+        "worst_case_rollback/256KB",
+        "worst_case_rollback/1MB",
+    };
+    for (size_t s = 0; s < ARRAY_SIZE(state_sizes); ++s)
+    {
+        struct rollback_bench_worst_case worst_case;
+        if (!_rollback_bench_worst_case_init(&worst_case, state_sizes[s]))
+        {
+            return -1;
+        }
+
+        const struct bench_case bench = {
+            names[s],
+            _rollback_bench_worst_case_run,
+            _rollback_bench_worst_case_setup,
+            &worst_case,
+            1,
+            0
+        };
+        bench_run_latency(&suite, &bench);
+        _rollback_bench_worst_case_free(&worst_case);
+    }
+
+    if (!bench_suite_finish(&suite) || !passed)
+    {
+        return -1;
+    }
+
+    return 0;
+}
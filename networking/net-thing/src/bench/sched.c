@@ -0,0 +1,180 @@
+// Scheduler tick cost with a full queue of small messages, and a check that
+// a write which fails (rudp's packet pool being full, say) leaves its
+// messages queued and uncharged rather than losing them.
+//
+// Usage: sched [--json path] [--filter text] [--reps n] [--samples n] [--check]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/sched.h>
+#include <bench/harness.h>
+
+#include <util/util.h>
+
+#define SCHED_BENCH_MESSAGE_SIZE 64
+
+// Plenty for everything queued to go out every tick
+#define SCHED_BENCH_KBPS (100 * 1000)
+#define SCHED_BENCH_TICK_NS (16 * MILLION)
+
+struct sched_bench_state
+{
+    struct sched_conn conn;
+    uint64_t now_ns;
+    uint8_t message[SCHED_BENCH_MESSAGE_SIZE];
+
+    // Writes the callback lets through before failing, -1 for all of them
+    int writes_allowed;
+    uint64_t packets_written;
+    uint64_t messages_written;
+};
+
+static bool _sched_bench_write(uint8_t* data, size_t len, void* context)
+{
+    struct sched_bench_state* state = (struct sched_bench_state*)context;
+    if (state->writes_allowed == 0)
+    {
+        return false;
+    }
+
+    if (state->writes_allowed > 0)
+    {
+        --state->writes_allowed;
+    }
+
+    size_t offset = 0;
+    while (offset + SCHED_MESSAGE_PREFIX_SIZE <= len)
+    {
+        uint16_t message_len;
+        memcpy(&message_len, data + offset, sizeof(message_len));
+        offset += SCHED_MESSAGE_PREFIX_SIZE + message_len;
+        state->messages_written++;
+    }
+    state->packets_written++;
+    return true;
+}
+
+static void _sched_bench_init(struct sched_bench_state* state)
+{
+    memset(state, 0, sizeof(*state));
+    sched_conn_init(&state->conn, SCHED_BENCH_KBPS);
+    state->now_ns = SCHED_BENCH_TICK_NS;
+    state->writes_allowed = -1;
+    for (size_t i = 0; i < sizeof(state->message); ++i)
+    {
+        state->message[i] = (uint8_t)i;
+    }
+
+    // The first tick only starts the budget clock
+    sched_tick(&state->conn, state->now_ns, _sched_bench_write, state);
+}
+
+static void _sched_bench_fill(struct sched_bench_state* state)
+{
+    for (int m = state->conn.num_messages; m < SCHED_MAX_MESSAGES; ++m)
+    {
+        sched_enqueue(&state->conn, state->message, sizeof(state->message), 1.f + (m % 4));
+    }
+}
+
+static bool _sched_bench_tick(struct sched_bench_state* state)
+{
+    state->now_ns += SCHED_BENCH_TICK_NS;
+    return sched_tick(&state->conn, state->now_ns, _sched_bench_write, state);
+}
+
+// One op is refilling the queue and ticking it all out
+static void _sched_bench_full_tick(uint64_t iterations, void* context)
+{
+    struct sched_bench_state* state = (struct sched_bench_state*)context;
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        _sched_bench_fill(state);
+        _sched_bench_tick(state);
+    }
+}
+
+static bool _sched_bench_check_failed_write()
+{
+    static struct sched_bench_state state;
+    _sched_bench_init(&state);
+    _sched_bench_fill(&state);
+
+    // First packet goes, the second fails, so the tick stops there
+    state.writes_allowed = 1;
+    const bool all_written = _sched_bench_tick(&state);
+    struct sched_stats stats;
+    sched_get_stats(&state.conn, &stats);
+    const uint64_t first_messages = state.messages_written;
+    bool valid = !all_written &&
+                 state.packets_written == 1 &&
+                 stats.packets_sent == 1 &&
+                 stats.messages_sent == first_messages &&
+                 stats.messages_dropped == 0 &&
+                 state.conn.num_messages == SCHED_MAX_MESSAGES - (int)first_messages;
+    if (!valid)
+    {
+        fprintf(stderr,
+                "Failed write wasn't left queued - written: %lu/%lu sent: %lu/%lu queued: %d dropped: %lu\n",
+                state.packets_written,
+                state.messages_written,
+                stats.packets_sent,
+                stats.messages_sent,
+                state.conn.num_messages,
+                stats.messages_dropped);
+        return false;
+    }
+
+    // Nothing at all gets out, nothing is charged
+    state.writes_allowed = 0;
+    _sched_bench_tick(&state);
+    sched_get_stats(&state.conn, &stats);
+    valid = stats.packets_sent == 1 && state.conn.num_messages == SCHED_MAX_MESSAGES - (int)first_messages;
+
+    // Then everything that was held back goes once writes work again
+    state.writes_allowed = -1;
+    valid &= _sched_bench_tick(&state);
+    sched_get_stats(&state.conn, &stats);
+    valid &= state.messages_written == SCHED_MAX_MESSAGES &&
+             stats.messages_sent == SCHED_MAX_MESSAGES &&
+             stats.bytes_sent == state.packets_written * RUDP_PACKET_OVERHEAD +
+                                 SCHED_MAX_MESSAGES * (SCHED_MESSAGE_PREFIX_SIZE + SCHED_BENCH_MESSAGE_SIZE) &&
+             state.conn.num_messages == 0;
+    fprintf(valid ? stdout : stderr,
+            "Failed writes %s: %lu messages in %lu packets, %lu sent\n",
+            valid ? "kept queued" : "lost messages",
+            state.messages_written,
+            state.packets_written,
+            stats.messages_sent);
+    return valid;
+}
+
+int main(int argc, char** argv)
+{
+    struct bench_suite suite;
+    if (!bench_suite_init(&suite, "sched", argc, argv))
+    {
+        return -1;
+    }
+
+    const bool valid = _sched_bench_check_failed_write();
+    fprintf(stdout, "\n");
+
+    static struct sched_bench_state state;
+    _sched_bench_init(&state);
+    const struct bench_case full_tick = {
+        "tick/64x64B", _sched_bench_full_tick, NULL, &state, 0, SCHED_MAX_MESSAGES * SCHED_BENCH_MESSAGE_SIZE
+    };
+    bench_run(&suite, &full_tick);
+
+    if (!bench_suite_finish(&suite) || !valid)
+    {
+        return -1;
+    }
+
+    return 0;
+}
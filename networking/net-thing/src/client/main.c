@@ -3,21 +3,68 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
 
 #include <util/util.h>
 
-#include <net/socket.c>
-#include <system/time.c>
+#include <net/socket.h>
+#include <system/time.h>
+#include <net/crypto.h>
+#include <net/rudp.h>
+#include <net/lz.h>
+#include <net/clock.h>
 
 #define CLIENT_TICK_FREQ 60
 #define CLIENT_HEARTBEAT_FREQ 1
 
+// Same key as the server's, encryption is off if it isn't there
+#define CLIENT_KEY_PATH "net-thing.key"
+
+static volatile sig_atomic_t g_keep_running = 1;
+
 struct client_context
 {
     int socket_handle;
     uint64_t last_heartbeat_ns;
+    uint64_t bytes_received;
+    struct rudp_codec codec;
+    struct lz_dictionary dictionary;
+    struct rudp_conn connection;
+    struct clock_sync clock;
 };
 
+void _client_on_interrupt(int signal)
+{
+    g_keep_running = 0;
+}
+
+void _client_on_read(int address, int port, uint8_t* data, size_t len, void* context)
+{
+    struct client_context* client = (struct client_context*)context;
+    client->bytes_received += len;
+    if (clock_sync_is_message(data, len))
+    {
+        struct clock_sync_message reply;
+        memcpy(&reply, data, sizeof(reply));
+        clock_sync_process_reply(&client->clock, &reply, client->connection.prev_recv_ns);
+    }
+}
+
+uint64_t estimated_server_time_ns(const struct client_context* context)
+{
+    return clock_sync_estimated_server_time_ns(&context->clock, system_time_ns());
+}
+
+uint32_t estimated_server_tick(const struct client_context* context)
+{
+    return clock_sync_estimated_server_tick(&context->clock, system_time_ns());
+}
+
+void _client_on_status(enum rudp_status status, void* context)
+{
+    fprintf(stdout, "Connection status: %s\n", rudp_status_name(status));
+}
+
 bool _client_init(struct client_context* context, int port)
 {
     if (!context)
@@ -28,6 +75,7 @@ bool _client_init(struct client_context* context, int port)
     context->socket_handle = -1;
     context->socket_handle = socket_create_udp();
     context->last_heartbeat_ns = 0;
+    context->bytes_received = 0;
     if (context->socket_handle <= 0)
     {
         fprintf(stderr, "Failed to create client socket\n");
@@ -46,48 +94,111 @@ bool _client_init(struct client_context* context, int port)
         return false;
     }
 
+    if (!socket_set_dont_fragment(context->socket_handle))
+    {
+        fprintf(stderr, "Failed to disable fragmentation, MTU probing will overshoot\n");
+    }
+
+    if (!socket_set_timestamping(context->socket_handle))
+    {
+        fprintf(stderr, "Failed to enable receive timestamps, clock sync will be coarse\n");
+    }
+
     return true;
 }
 
-void _client_connect(struct client_context* context, int address, int port)
+// dictionary_path has to name the same file as the server's --dictionary,
+// NULL if the server doesn't use one
+bool _client_connect(struct client_context* context, int address, int port, const char* dictionary_path)
 {
-    uint8_t buffer[] = "hello";
-    if (socket_send(context->socket_handle,
-                    buffer,
-                    sizeof(buffer),
-                    address,
-                    port) < 0)
+    rudp_conn_init(
+        context->socket_handle,
+        address,
+        port,
+        _client_on_read,
+        _client_on_status,
+        context,
+        NULL,
+        &context->connection);
+    clock_sync_init(&context->clock);
+    if (dictionary_path)
+    {
+        if (!lz_dictionary_load(dictionary_path, &context->dictionary))
+        {
+            return false;
+        }
+        lz_codec_init(&context->codec, &context->dictionary);
+    }
+    else
+    {
+        lz_codec_init(&context->codec, NULL);
+    }
+    fprintf(stdout, "Compression %s\n", context->codec.name);
+    rudp_conn_set_codec(&context->connection, &context->codec, RUDP_DEFAULT_COMPRESS_THRESHOLD);
+
+    uint8_t key[CRYPTO_KEY_SIZE];
+    if (crypto_load_key(CLIENT_KEY_PATH, key))
+    {
+        rudp_conn_set_key(&context->connection, key);
+        fprintf(stdout, "Encryption enabled\n");
+    }
+    if (!rudp_conn_connect(&context->connection))
     {
         fprintf(stderr, "Failed to say hello to server\n");
     }
+
+    return true;
 }
 
-void _client_heartbeat(struct client_context* context, int address, int port)
+void _client_heartbeat(struct client_context* context)
 {
     uint8_t buffer[] = "alive";
-    if (socket_send(context->socket_handle,
-                    buffer,
-                    sizeof(buffer),
-                    address,
-                    port) < 0)
+    if (!rudp_send(&context->connection, buffer, sizeof(buffer)))
     {
-        fprintf(stderr, "Failed to say hello to server\n");
+        fprintf(stderr, "Failed to queue heartbeat\n");
     }
+
+    if (context->clock.synced)
+    {
+        fprintf(stdout,
+                "server tick ~%u (offset %.3f ms, rtt %.3f ms)\n",
+                estimated_server_tick(context),
+                (double)context->clock.offset_ns / MILLION,
+                (double)context->clock.rtt_ns / MILLION);
+    }
+}
+
+void _client_sync_clock(struct client_context* context, uint64_t now_ns)
+{
+    struct clock_sync_message request;
+    if (clock_sync_make_request(&context->clock, now_ns, &request) &&
+        !rudp_send(&context->connection, &request, sizeof(request)))
+    {
+        fprintf(stderr, "Failed to queue clock sync request\n");
+    }
+
+    clock_sync_update(&context->clock, now_ns);
 }
 
-bool _client_tick(struct client_context* context, int address, int port)
+bool _client_tick(struct client_context* context)
 {
     const uint64_t now_ns = system_time_ns();
     const uint64_t diff_ns = now_ns - context->last_heartbeat_ns;
     const uint64_t heartbeat_threshold_ns = BILLION / CLIENT_HEARTBEAT_FREQ;
-    if (diff_ns >= heartbeat_threshold_ns)
+    if (context->connection.state == RUDP_STATUS_CONNECTED &&
+        diff_ns >= heartbeat_threshold_ns)
     {
-        _client_heartbeat(context, address, port);
+        _client_heartbeat(context);
         context->last_heartbeat_ns = now_ns;
     }
 
-    // Tick forever r/n
-    return true;
+    if (context->connection.state == RUDP_STATUS_CONNECTED)
+    {
+        _client_sync_clock(context, now_ns);
+    }
+
+    // Tick until the server goes away or we're told to stop
+    return rudp_tick(&context->connection) && g_keep_running;
 }
 
 int main(int argc, char** argv)
@@ -97,6 +208,20 @@ int main(int argc, char** argv)
     {
         port = atoi(argv[1]);
     }
+
+    // For servers started with --port
+    int server_port = SERVER_PORT;
+    if (argc > 2)
+    {
+        server_port = atoi(argv[2]);
+    }
+
+    // For servers started with --dictionary
+    const char* dictionary_path = NULL;
+    if (argc > 3)
+    {
+        dictionary_path = argv[3];
+    }
     fprintf(stdout, "client using port %d\n", port);
 
     struct client_context context;
@@ -105,9 +230,15 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    signal(SIGINT, _client_on_interrupt);
+    signal(SIGTERM, _client_on_interrupt);
+
     const int server_address = CREATE_ADDR(127, 0, 0, 1);
-    const int server_port = SERVER_PORT;
-    _client_connect(&context, server_address, server_port);
+    if (!_client_connect(&context, server_address, server_port, dictionary_path))
+    {
+        socket_close(context.socket_handle);
+        return -1;
+    }
 
     // 60hz client tick
     const uint64_t TICK_FREQ_NS = BILLION / CLIENT_TICK_FREQ;
@@ -115,7 +246,7 @@ int main(int argc, char** argv)
     do
     {
         const uint64_t start_ns = system_time_ns();
-        keep_ticking = _client_tick(&context, server_address, server_port);
+        keep_ticking = _client_tick(&context);
         const uint64_t end_ns = system_time_ns();
 
         const uint64_t diff = end_ns - start_ns;
@@ -126,5 +257,9 @@ int main(int argc, char** argv)
         }
     } while(keep_ticking);
 
+    // Let the server know so it can free our slot right away
+    rudp_conn_close(&context.connection);
+    socket_close(context.socket_handle);
+
     return 0;
 }
@@ -0,0 +1,166 @@
+#include <net/clock.h>
+
+#include <string.h>
+
+void clock_sync_init(struct clock_sync* sync)
+{
+    memset(sync, 0, sizeof(*sync));
+}
+
+bool clock_sync_is_message(const uint8_t* data, size_t len)
+{
+    if (len != sizeof(struct clock_sync_message))
+    {
+        return false;
+    }
+
+    uint32_t id;
+    memcpy(&id, data, sizeof(id));
+    return id == CLOCK_SYNC_ID;
+}
+
+bool clock_sync_make_request(struct clock_sync* sync, uint64_t now_ns, struct clock_sync_message* request_out)
+{
+    const uint64_t interval_ns = sync->num_samples < CLOCK_SYNC_SAMPLES ?
+        CLOCK_SYNC_FAST_INTERVAL_NS : CLOCK_SYNC_INTERVAL_NS;
+    if (sync->prev_request_ns != 0 && now_ns - sync->prev_request_ns < interval_ns)
+    {
+        return false;
+    }
+
+    memset(request_out, 0, sizeof(*request_out));
+    request_out->id = CLOCK_SYNC_ID;
+    request_out->client_send_ns = now_ns;
+    request_out->client_rtt_ns = sync->synced ? sync->rtt_ns : 0;
+
+    sync->prev_request_ns = now_ns;
+    sync->requests_sent++;
+    return true;
+}
+
+void clock_sync_make_reply(
+    struct clock_sync_message* message,
+    uint64_t recv_ns,
+    uint64_t send_ns,
+    uint32_t tick,
+    uint64_t tick_start_ns,
+    uint64_t tick_period_ns)
+{
+    message->server_recv_ns = recv_ns;
+    message->server_send_ns = send_ns;
+    message->server_tick = tick;
+    message->server_tick_start_ns = tick_start_ns;
+    message->server_tick_period_ns = tick_period_ns;
+}
+
+// Old samples are charged for how far the clocks may have drifted since, like
+// NTP's dispersion, so a marginally faster round trip doesn't win forever
+static uint64_t _clock_sync_sample_cost(const struct clock_sync_sample* sample, uint64_t now_ns)
+{
+    return sample->rtt_ns + (now_ns - sample->local_ns) / CLOCK_SYNC_AGE_PENALTY_DIVISOR;
+}
+
+static void _clock_sync_pick_target(struct clock_sync* sync, uint64_t now_ns)
+{
+    const struct clock_sync_sample* best = &sync->samples[0];
+    for (int s = 1; s < sync->num_samples; ++s)
+    {
+        if (_clock_sync_sample_cost(&sync->samples[s], now_ns) < _clock_sync_sample_cost(best, now_ns))
+        {
+            best = &sync->samples[s];
+        }
+    }
+
+    sync->target_offset_ns = best->offset_ns;
+    sync->rtt_ns = best->rtt_ns;
+}
+
+bool clock_sync_process_reply(struct clock_sync* sync, const struct clock_sync_message* reply, uint64_t now_ns)
+{
+    const int64_t t0 = (int64_t)reply->client_send_ns;
+    const int64_t t1 = (int64_t)reply->server_recv_ns;
+    const int64_t t2 = (int64_t)reply->server_send_ns;
+    const int64_t t3 = (int64_t)now_ns;
+    if (t3 < t0 || t2 < t1 || (t3 - t0) < (t2 - t1))
+    {
+        return false;
+    }
+
+    struct clock_sync_sample* sample = &sync->samples[sync->next_sample];
+    sample->local_ns = now_ns;
+    sample->rtt_ns = (t3 - t0) - (t2 - t1);
+    sample->offset_ns = ((t1 - t0) + (t2 - t3)) / 2;
+    sync->next_sample = (sync->next_sample + 1) % CLOCK_SYNC_SAMPLES;
+    if (sync->num_samples < CLOCK_SYNC_SAMPLES)
+    {
+        sync->num_samples++;
+    }
+
+    // Replies can arrive out of order, only move the tick anchor forward
+    if (reply->server_tick >= sync->server_tick)
+    {
+        sync->server_tick = reply->server_tick;
+        sync->server_tick_start_ns = reply->server_tick_start_ns;
+        sync->server_tick_period_ns = reply->server_tick_period_ns;
+    }
+
+    _clock_sync_pick_target(sync, now_ns);
+    sync->replies_received++;
+    return true;
+}
+
+void clock_sync_update(struct clock_sync* sync, uint64_t now_ns)
+{
+    const uint64_t elapsed_ns = sync->prev_update_ns ? now_ns - sync->prev_update_ns : 0;
+    sync->prev_update_ns = now_ns;
+    if (sync->num_samples == 0)
+    {
+        return;
+    }
+
+    const int64_t error_ns = sync->target_offset_ns - sync->offset_ns;
+    const int64_t abs_error_ns = error_ns < 0 ? -error_ns : error_ns;
+    if (!sync->synced || abs_error_ns > CLOCK_SYNC_STEP_THRESHOLD_NS)
+    {
+        sync->offset_ns = sync->target_offset_ns;
+        sync->synced = true;
+        return;
+    }
+
+    const int64_t max_step_ns = (int64_t)(elapsed_ns / CLOCK_SYNC_SLEW_DIVISOR);
+    if (abs_error_ns <= max_step_ns)
+    {
+        sync->offset_ns = sync->target_offset_ns;
+    }
+    else
+    {
+        sync->offset_ns += error_ns < 0 ? -max_step_ns : max_step_ns;
+    }
+}
+
+uint64_t clock_sync_estimated_server_time_ns(const struct clock_sync* sync, uint64_t now_ns)
+{
+    return (uint64_t)((int64_t)now_ns + sync->offset_ns);
+}
+
+uint32_t clock_sync_estimated_server_tick(const struct clock_sync* sync, uint64_t now_ns)
+{
+    if (!sync->synced || sync->server_tick_period_ns == 0)
+    {
+        return 0;
+    }
+
+    const int64_t since_anchor_ns =
+        (int64_t)clock_sync_estimated_server_time_ns(sync, now_ns) - (int64_t)sync->server_tick_start_ns;
+    const int64_t period_ns = (int64_t)sync->server_tick_period_ns;
+
+    // Round towards negative infinity so a slightly early estimate lands on
+    // the previous tick rather than the anchor
+    int64_t ticks = since_anchor_ns / period_ns;
+    if (since_anchor_ns < 0 && since_anchor_ns % period_ns != 0)
+    {
+        --ticks;
+    }
+
+    return (uint32_t)((int64_t)sync->server_tick + ticks);
+}
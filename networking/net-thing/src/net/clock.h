@@ -0,0 +1,117 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+// NTP-style clock sync. The client stamps a request on the way out, the server
+// stamps it on arrival and on the way back, and the client stamps the reply:
+//
+//   t0 client send, t1 server recv, t2 server send, t3 client recv
+//   rtt    = (t3 - t0) - (t2 - t1)
+//   offset = ((t1 - t0) + (t2 - t3)) / 2
+//
+// Queueing only ever adds delay, so of the last few samples the one with the
+// smallest round trip has the least asymmetry and its offset is trusted. The
+// applied offset slews towards that target instead of jumping, so the
+// estimated server time never runs backwards once it's settled.
+//
+// Nothing in here reads a clock, callers pass their local time in. That keeps
+// it usable from the simulation bench.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <system/time.h>
+
+#define CLOCK_SYNC_ID 0xC10C5EC5
+
+// Window for the min-RTT filter, 8 seconds' worth once settled
+#define CLOCK_SYNC_SAMPLES 32
+
+// Fire off requests quickly until the window is full, then settle down
+#define CLOCK_SYNC_FAST_INTERVAL_NS (BILLION / 10)
+#define CLOCK_SYNC_INTERVAL_NS (BILLION / 4)
+
+// Round trip penalty per unit of sample age, 1/10000 is 100 ppm of drift
+#define CLOCK_SYNC_AGE_PENALTY_DIVISOR 10000
+
+// Errors bigger than this are stepped instead of slewed
+#define CLOCK_SYNC_STEP_THRESHOLD_NS (250 * MILLION)
+
+// Slew at most 1/20th of elapsed time, i.e. the estimated server clock runs
+// somewhere between 0.95x and 1.05x
+#define CLOCK_SYNC_SLEW_DIVISOR 20
+
+struct clock_sync_message
+{
+    uint32_t id;
+    uint32_t server_tick;
+    uint64_t client_send_ns;
+    uint64_t server_recv_ns;
+    uint64_t server_send_ns;
+
+    // Server time the tick above started at, and how long ticks are
+    uint64_t server_tick_start_ns;
+    uint64_t server_tick_period_ns;
+
+    // The client's current round trip estimate, 0 until synced. Saves the
+    // server measuring its own.
+    uint64_t client_rtt_ns;
+};
+
+struct clock_sync_sample
+{
+    uint64_t local_ns;
+    uint64_t rtt_ns;
+    int64_t offset_ns;
+};
+
+struct clock_sync
+{
+    uint64_t prev_request_ns;
+    uint64_t prev_update_ns;
+
+    struct clock_sync_sample samples[CLOCK_SYNC_SAMPLES];
+    int num_samples;
+    int next_sample;
+
+    // Server time = local time + offset
+    int64_t target_offset_ns;
+    int64_t offset_ns;
+    uint64_t rtt_ns;
+    bool synced;
+
+    // Latest tick anchor from the server
+    uint32_t server_tick;
+    uint64_t server_tick_start_ns;
+    uint64_t server_tick_period_ns;
+
+    uint64_t requests_sent;
+    uint64_t replies_received;
+};
+
+void clock_sync_init(struct clock_sync* sync);
+bool clock_sync_is_message(const uint8_t* data, size_t len);
+
+// Returns true and fills in a request if one is due
+bool clock_sync_make_request(struct clock_sync* sync, uint64_t now_ns, struct clock_sync_message* request_out);
+
+// Server side, turns a request around in place
+void clock_sync_make_reply(
+    struct clock_sync_message* message,
+    uint64_t recv_ns,
+    uint64_t send_ns,
+    uint32_t tick,
+    uint64_t tick_start_ns,
+    uint64_t tick_period_ns);
+
+bool clock_sync_process_reply(struct clock_sync* sync, const struct clock_sync_message* reply, uint64_t now_ns);
+
+// Call once per tick to slew the applied offset
+void clock_sync_update(struct clock_sync* sync, uint64_t now_ns);
+
+uint64_t clock_sync_estimated_server_time_ns(const struct clock_sync* sync, uint64_t now_ns);
+
+// Extrapolates from the last tick anchor the server sent
+uint32_t clock_sync_estimated_server_tick(const struct clock_sync* sync, uint64_t now_ns);
+
+#endif // __CLOCK_H__
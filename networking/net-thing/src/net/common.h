@@ -20,6 +20,10 @@
 #define SERVER_PORT 30000
 #define CLIENT_PORT 30001
 
+// Default datagram size, header and tag included. Connections can be
+// configured anywhere up to COMMON_MAX_MTU, which is what fits in an
+// unfragmented UDP datagram on ethernet and bounds every packet buffer.
 #define COMMON_MTU 512
+#define COMMON_MAX_MTU 1472
 
 #endif // __COMMON_H__
@@ -0,0 +1,522 @@
+// ChaCha20-Poly1305 AEAD (RFC 8439), in-tree so there's nothing to vendor.
+//
+// ChaCha20 has a scalar path and an SSE2 path which runs four blocks side by
+// side, one block per 32-bit lane. Poly1305 uses 44/44/42-bit limbs and
+// 128-bit products, same approach as poly1305-donna-64.
+
+#include <net/crypto.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/random.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+static bool s_crypto_use_simd = true;
+
+void crypto_set_simd(bool enabled)
+{
+    s_crypto_use_simd = enabled;
+}
+
+bool crypto_has_simd()
+{
+#ifdef __SSE2__
+    return true;
+#else
+    return false;
+#endif
+}
+
+static uint32_t _crypto_load32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t _crypto_load64(const uint8_t* p)
+{
+    return (uint64_t)_crypto_load32(p) | ((uint64_t)_crypto_load32(p + 4) << 32);
+}
+
+static void _crypto_store32(uint8_t* p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void _crypto_store64(uint8_t* p, uint64_t v)
+{
+    _crypto_store32(p, (uint32_t)v);
+    _crypto_store32(p + 4, (uint32_t)(v >> 32));
+}
+
+bool crypto_random(uint8_t* data, size_t len)
+{
+    return getrandom(data, len, 0) == (ssize_t)len;
+}
+
+bool crypto_load_key(const char* path, uint8_t key_out[CRYPTO_KEY_SIZE])
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    const size_t read = fread(key_out, 1, CRYPTO_KEY_SIZE, file);
+    fclose(file);
+
+    if (read != CRYPTO_KEY_SIZE)
+    {
+        fprintf(stderr, "Key file %s should be %d bytes\n", path, CRYPTO_KEY_SIZE);
+        return false;
+    }
+
+    return true;
+}
+
+//
+// ChaCha20
+//
+
+#define _CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define _CHACHA_QUARTER_ROUND(x, a, b, c, d) \
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = _CHACHA_ROTL(x[d], 16); \
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = _CHACHA_ROTL(x[b], 12); \
+    x[a] += x[b]; x[d] ^= x[a]; x[d] = _CHACHA_ROTL(x[d], 8);  \
+    x[c] += x[d]; x[b] ^= x[c]; x[b] = _CHACHA_ROTL(x[b], 7);
+
+static void _chacha20_init_state(
+    uint32_t state[16],
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    uint32_t counter,
+    const uint8_t nonce[CRYPTO_NONCE_SIZE])
+{
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i)
+    {
+        state[4 + i] = _crypto_load32(key + 4 * i);
+    }
+    state[12] = counter;
+    state[13] = _crypto_load32(nonce);
+    state[14] = _crypto_load32(nonce + 4);
+    state[15] = _crypto_load32(nonce + 8);
+}
+
+static void _chacha20_rounds(uint32_t x[16])
+{
+    for (int round = 0; round < 10; ++round)
+    {
+        _CHACHA_QUARTER_ROUND(x, 0, 4,  8, 12)
+        _CHACHA_QUARTER_ROUND(x, 1, 5,  9, 13)
+        _CHACHA_QUARTER_ROUND(x, 2, 6, 10, 14)
+        _CHACHA_QUARTER_ROUND(x, 3, 7, 11, 15)
+        _CHACHA_QUARTER_ROUND(x, 0, 5, 10, 15)
+        _CHACHA_QUARTER_ROUND(x, 1, 6, 11, 12)
+        _CHACHA_QUARTER_ROUND(x, 2, 7,  8, 13)
+        _CHACHA_QUARTER_ROUND(x, 3, 4,  9, 14)
+    }
+}
+
+static void _chacha20_block(const uint32_t state[16], uint8_t out[CRYPTO_CHACHA_BLOCK_SIZE])
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    _chacha20_rounds(x);
+    for (int i = 0; i < 16; ++i)
+    {
+        _crypto_store32(out + 4 * i, x[i] + state[i]);
+    }
+}
+
+static void _chacha20_xor_scalar(uint32_t state[16], uint8_t* data, size_t len)
+{
+    uint8_t keystream[CRYPTO_CHACHA_BLOCK_SIZE];
+    while (len > 0)
+    {
+        _chacha20_block(state, keystream);
+        state[12]++;
+
+        const size_t block_len = len < sizeof(keystream) ? len : sizeof(keystream);
+        for (size_t i = 0; i < block_len; ++i)
+        {
+            data[i] ^= keystream[i];
+        }
+
+        data += block_len;
+        len -= block_len;
+    }
+}
+
+#ifdef __SSE2__
+
+#define _CHACHA_ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define _CHACHA_QUARTER_ROUND_SSE2(x, a, b, c, d) \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = _mm_xor_si128(x[d], x[a]); x[d] = _CHACHA_ROTL_SSE2(x[d], 16); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = _mm_xor_si128(x[b], x[c]); x[b] = _CHACHA_ROTL_SSE2(x[b], 12); \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = _mm_xor_si128(x[d], x[a]); x[d] = _CHACHA_ROTL_SSE2(x[d], 8);  \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = _mm_xor_si128(x[b], x[c]); x[b] = _CHACHA_ROTL_SSE2(x[b], 7);
+
+// Four blocks at a time, lane n of every vector belongs to block n. The
+// remainder falls back to the scalar path.
+static void _chacha20_xor_sse2(uint32_t state[16], uint8_t* data, size_t len)
+{
+    const size_t stride = 4 * CRYPTO_CHACHA_BLOCK_SIZE;
+    while (len >= stride)
+    {
+        __m128i x[16];
+        __m128i original[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            x[i] = _mm_set1_epi32(state[i]);
+        }
+        x[12] = _mm_add_epi32(x[12], _mm_set_epi32(3, 2, 1, 0));
+        memcpy(original, x, sizeof(x));
+
+        for (int round = 0; round < 10; ++round)
+        {
+            _CHACHA_QUARTER_ROUND_SSE2(x, 0, 4,  8, 12)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 1, 5,  9, 13)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 2, 6, 10, 14)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 3, 7, 11, 15)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 0, 5, 10, 15)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 1, 6, 11, 12)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 2, 7,  8, 13)
+            _CHACHA_QUARTER_ROUND_SSE2(x, 3, 4,  9, 14)
+        }
+
+        // Transpose four words at a time back into per-block order
+        for (int i = 0; i < 16; i += 4)
+        {
+            const __m128i a = _mm_add_epi32(x[i + 0], original[i + 0]);
+            const __m128i b = _mm_add_epi32(x[i + 1], original[i + 1]);
+            const __m128i c = _mm_add_epi32(x[i + 2], original[i + 2]);
+            const __m128i d = _mm_add_epi32(x[i + 3], original[i + 3]);
+
+            const __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+            const __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+            const __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+            const __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+
+            const __m128i blocks[4] = {
+                _mm_unpacklo_epi64(ab_lo, cd_lo),
+                _mm_unpackhi_epi64(ab_lo, cd_lo),
+                _mm_unpacklo_epi64(ab_hi, cd_hi),
+                _mm_unpackhi_epi64(ab_hi, cd_hi)
+            };
+
+            for (int block = 0; block < 4; ++block)
+            {
+                __m128i* p = (__m128i*)(data + block * CRYPTO_CHACHA_BLOCK_SIZE + i * 4);
+                _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), blocks[block]));
+            }
+        }
+
+        state[12] += 4;
+        data += stride;
+        len -= stride;
+    }
+
+    _chacha20_xor_scalar(state, data, len);
+}
+
+#endif // __SSE2__
+
+void chacha20_xor(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    uint32_t counter,
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    uint8_t* data,
+    size_t len)
+{
+    uint32_t state[16];
+    _chacha20_init_state(state, key, counter, nonce);
+
+#ifdef __SSE2__
+    if (s_crypto_use_simd)
+    {
+        _chacha20_xor_sse2(state, data, len);
+        return;
+    }
+#endif
+
+    _chacha20_xor_scalar(state, data, len);
+}
+
+void hchacha20(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t input[16],
+    uint8_t key_out[CRYPTO_KEY_SIZE])
+{
+    uint32_t x[16];
+    _chacha20_init_state(x, key, _crypto_load32(input), input + 4);
+    _chacha20_rounds(x);
+    for (int i = 0; i < 4; ++i)
+    {
+        _crypto_store32(key_out + 4 * i, x[i]);
+        _crypto_store32(key_out + 16 + 4 * i, x[12 + i]);
+    }
+}
+
+//
+// Poly1305
+//
+
+#define _POLY1305_MASK44 0xfffffffffffULL
+#define _POLY1305_MASK42 0x3ffffffffffULL
+
+struct poly1305_state
+{
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+    uint8_t buffer[16];
+    size_t leftover;
+};
+
+static void _poly1305_init(struct poly1305_state* poly, const uint8_t key[32])
+{
+    const uint64_t t0 = _crypto_load64(key);
+    const uint64_t t1 = _crypto_load64(key + 8);
+
+    // Clamp r
+    poly->r[0] = t0 & 0xffc0fffffffULL;
+    poly->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    poly->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+
+    poly->h[0] = 0;
+    poly->h[1] = 0;
+    poly->h[2] = 0;
+
+    poly->pad[0] = _crypto_load64(key + 16);
+    poly->pad[1] = _crypto_load64(key + 24);
+    poly->leftover = 0;
+}
+
+static void _poly1305_blocks(struct poly1305_state* poly, const uint8_t* m, size_t len, uint64_t hibit)
+{
+    const uint64_t r0 = poly->r[0];
+    const uint64_t r1 = poly->r[1];
+    const uint64_t r2 = poly->r[2];
+    const uint64_t s1 = r1 * (5 << 2);
+    const uint64_t s2 = r2 * (5 << 2);
+    uint64_t h0 = poly->h[0];
+    uint64_t h1 = poly->h[1];
+    uint64_t h2 = poly->h[2];
+
+    while (len >= 16)
+    {
+        const uint64_t t0 = _crypto_load64(m);
+        const uint64_t t1 = _crypto_load64(m + 8);
+        h0 += t0 & _POLY1305_MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & _POLY1305_MASK44;
+        h2 += ((t1 >> 24) & _POLY1305_MASK42) | hibit;
+
+        unsigned __int128 d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+        unsigned __int128 d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+        unsigned __int128 d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+        uint64_t c = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & _POLY1305_MASK44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & _POLY1305_MASK44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & _POLY1305_MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= _POLY1305_MASK44;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+    }
+
+    poly->h[0] = h0;
+    poly->h[1] = h1;
+    poly->h[2] = h2;
+}
+
+static void _poly1305_update(struct poly1305_state* poly, const uint8_t* m, size_t len)
+{
+    const uint64_t hibit = 1ULL << 40;
+    if (poly->leftover)
+    {
+        size_t want = 16 - poly->leftover;
+        if (want > len)
+        {
+            want = len;
+        }
+        memcpy(poly->buffer + poly->leftover, m, want);
+        poly->leftover += want;
+        m += want;
+        len -= want;
+        if (poly->leftover < 16)
+        {
+            return;
+        }
+        _poly1305_blocks(poly, poly->buffer, 16, hibit);
+        poly->leftover = 0;
+    }
+
+    const size_t full = len & ~(size_t)15;
+    _poly1305_blocks(poly, m, full, hibit);
+    m += full;
+    len -= full;
+
+    memcpy(poly->buffer, m, len);
+    poly->leftover = len;
+}
+
+// The AEAD construction pads every section to 16 bytes with zeros
+static void _poly1305_pad16(struct poly1305_state* poly, size_t len)
+{
+    static const uint8_t zeros[16] = {0};
+    if (len % 16)
+    {
+        _poly1305_update(poly, zeros, 16 - len % 16);
+    }
+}
+
+static void _poly1305_finish(struct poly1305_state* poly, uint8_t tag[CRYPTO_TAG_SIZE])
+{
+    if (poly->leftover)
+    {
+        poly->buffer[poly->leftover] = 1;
+        memset(poly->buffer + poly->leftover + 1, 0, 16 - poly->leftover - 1);
+        _poly1305_blocks(poly, poly->buffer, 16, 0);
+    }
+
+    uint64_t h0 = poly->h[0];
+    uint64_t h1 = poly->h[1];
+    uint64_t h2 = poly->h[2];
+
+    // Fully carry h
+    uint64_t c = h1 >> 44; h1 &= _POLY1305_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= _POLY1305_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= _POLY1305_MASK44;
+    h1 += c; c = h1 >> 44; h1 &= _POLY1305_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= _POLY1305_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= _POLY1305_MASK44;
+    h1 += c;
+
+    // g = h + -p, pick h or g without branching
+    uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= _POLY1305_MASK44;
+    uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= _POLY1305_MASK44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+
+    c = (g2 >> 63) - 1;
+    g0 &= c;
+    g1 &= c;
+    g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    // h = (h + pad) mod 2^128
+    const uint64_t t0 = poly->pad[0];
+    const uint64_t t1 = poly->pad[1];
+    h0 += t0 & _POLY1305_MASK44; c = h0 >> 44; h0 &= _POLY1305_MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & _POLY1305_MASK44) + c; c = h1 >> 44; h1 &= _POLY1305_MASK44;
+    h2 += ((t1 >> 24) & _POLY1305_MASK42) + c; h2 &= _POLY1305_MASK42;
+
+    _crypto_store64(tag, h0 | (h1 << 44));
+    _crypto_store64(tag + 8, (h1 >> 20) | (h2 << 24));
+
+    memset(poly, 0, sizeof(*poly));
+}
+
+void poly1305(const uint8_t key[32], const uint8_t* m, size_t len, uint8_t tag[CRYPTO_TAG_SIZE])
+{
+    struct poly1305_state poly;
+    _poly1305_init(&poly, key);
+    _poly1305_update(&poly, m, len);
+    _poly1305_finish(&poly, tag);
+}
+
+//
+// AEAD
+//
+
+static void _aead_tag(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    const uint8_t* aad,
+    size_t aad_len,
+    const uint8_t* ciphertext,
+    size_t len,
+    uint8_t tag[CRYPTO_TAG_SIZE])
+{
+    // One-time Poly1305 key is the first half of keystream block zero
+    uint8_t poly_key[CRYPTO_CHACHA_BLOCK_SIZE] = {0};
+    uint32_t state[16];
+    _chacha20_init_state(state, key, 0, nonce);
+    _chacha20_block(state, poly_key);
+
+    struct poly1305_state poly;
+    _poly1305_init(&poly, poly_key);
+    _poly1305_update(&poly, aad, aad_len);
+    _poly1305_pad16(&poly, aad_len);
+    _poly1305_update(&poly, ciphertext, len);
+    _poly1305_pad16(&poly, len);
+
+    uint8_t lengths[16];
+    _crypto_store64(lengths, aad_len);
+    _crypto_store64(lengths + 8, len);
+    _poly1305_update(&poly, lengths, sizeof(lengths));
+    _poly1305_finish(&poly, tag);
+
+    memset(poly_key, 0, sizeof(poly_key));
+}
+
+void aead_seal(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    const uint8_t* aad,
+    size_t aad_len,
+    uint8_t* data,
+    size_t len,
+    uint8_t tag_out[CRYPTO_TAG_SIZE])
+{
+    chacha20_xor(key, 1, nonce, data, len);
+    _aead_tag(key, nonce, aad, aad_len, data, len, tag_out);
+}
+
+bool aead_open(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    const uint8_t* aad,
+    size_t aad_len,
+    uint8_t* data,
+    size_t len,
+    const uint8_t tag[CRYPTO_TAG_SIZE])
+{
+    uint8_t expected[CRYPTO_TAG_SIZE];
+    _aead_tag(key, nonce, aad, aad_len, data, len, expected);
+
+    // Constant time compare
+    uint8_t diff = 0;
+    for (int i = 0; i < CRYPTO_TAG_SIZE; ++i)
+    {
+        diff |= expected[i] ^ tag[i];
+    }
+
+    if (diff != 0)
+    {
+        return false;
+    }
+
+    chacha20_xor(key, 1, nonce, data, len);
+    return true;
+}
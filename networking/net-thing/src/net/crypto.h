@@ -0,0 +1,58 @@
+#ifndef __CRYPTO_H__
+#define __CRYPTO_H__
+
+// ChaCha20-Poly1305 AEAD (RFC 8439), in-tree so there's nothing to vendor.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRYPTO_KEY_SIZE 32
+#define CRYPTO_NONCE_SIZE 12
+#define CRYPTO_TAG_SIZE 16
+#define CRYPTO_CHACHA_BLOCK_SIZE 64
+
+// Lets benchmarks compare the kernels, SIMD is used whenever it's compiled in
+void crypto_set_simd(bool enabled);
+bool crypto_has_simd();
+
+bool crypto_random(uint8_t* data, size_t len);
+bool crypto_load_key(const char* path, uint8_t key_out[CRYPTO_KEY_SIZE]);
+
+void chacha20_xor(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    uint32_t counter,
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    uint8_t* data,
+    size_t len);
+
+// HChaCha20 (draft-irtf-cfrg-xchacha): a keyed hash of a 16 byte input, used
+// to derive session keys
+void hchacha20(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t input[16],
+    uint8_t key_out[CRYPTO_KEY_SIZE]);
+
+void poly1305(const uint8_t key[32], const uint8_t* m, size_t len, uint8_t tag[CRYPTO_TAG_SIZE]);
+
+// Encrypts data in place and writes the tag
+void aead_seal(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    const uint8_t* aad,
+    size_t aad_len,
+    uint8_t* data,
+    size_t len,
+    uint8_t tag_out[CRYPTO_TAG_SIZE]);
+
+// Verifies the tag and decrypts data in place, data is untouched on failure
+bool aead_open(
+    const uint8_t key[CRYPTO_KEY_SIZE],
+    const uint8_t nonce[CRYPTO_NONCE_SIZE],
+    const uint8_t* aad,
+    size_t aad_len,
+    uint8_t* data,
+    size_t len,
+    const uint8_t tag[CRYPTO_TAG_SIZE]);
+
+#endif // __CRYPTO_H__
@@ -0,0 +1,442 @@
+#include <net/lz.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t _lz_read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t _lz_hash(const uint8_t* p)
+{
+    return (_lz_read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint32_t _lz_gram_hash(const uint8_t* p)
+{
+    uint16_t tail;
+    memcpy(&tail, p + 4, sizeof(tail));
+    const uint32_t mixed = _lz_read32(p) ^ (tail * 2246822519u);
+    return (mixed * 2654435761u) >> (32 - LZ_TRAIN_COUNT_BITS);
+}
+
+bool lz_dictionary_init(struct lz_dictionary* dictionary, const uint8_t* data, size_t len)
+{
+    memset(dictionary, 0, sizeof(*dictionary));
+    if (len > LZ_MAX_DICTIONARY_SIZE)
+    {
+        fprintf(stderr, "Dictionary too large - len: %zu\n", len);
+        return false;
+    }
+
+    memcpy(dictionary->data, data, len);
+    dictionary->len = len;
+
+    // Table entries are position + 1 so that zero means empty
+    for (size_t p = 0; p + LZ_MIN_MATCH <= len; ++p)
+    {
+        dictionary->table[_lz_hash(dictionary->data + p)] = p + 1;
+    }
+
+    return true;
+}
+
+bool lz_dictionary_load(const char* path, struct lz_dictionary* dictionary)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open dictionary %s\n", path);
+        return false;
+    }
+
+    uint8_t data[LZ_MAX_DICTIONARY_SIZE];
+    const size_t len = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    return lz_dictionary_init(dictionary, data, len);
+}
+
+bool lz_dictionary_save(const char* path, const struct lz_dictionary* dictionary)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open dictionary %s for writing\n", path);
+        return false;
+    }
+
+    const size_t written = fwrite(dictionary->data, 1, dictionary->len, file);
+    fclose(file);
+
+    return written == dictionary->len;
+}
+
+bool lz_dictionary_train(
+    const uint8_t* sample_data,
+    const size_t* sample_lens,
+    size_t num_samples,
+    size_t dictionary_size,
+    struct lz_dictionary* dictionary_out)
+{
+    if (dictionary_size > LZ_MAX_DICTIONARY_SIZE)
+    {
+        dictionary_size = LZ_MAX_DICTIONARY_SIZE;
+    }
+
+    const size_t num_counts = 1 << LZ_TRAIN_COUNT_BITS;
+    uint32_t* counts = (uint32_t*)calloc(num_counts, sizeof(uint32_t));
+    if (!counts)
+    {
+        return false;
+    }
+
+    size_t offset = 0;
+    for (size_t s = 0; s < num_samples; ++s)
+    {
+        const uint8_t* sample = sample_data + offset;
+        for (size_t p = 0; p + LZ_TRAIN_GRAM_SIZE <= sample_lens[s]; ++p)
+        {
+            counts[_lz_gram_hash(sample + p)]++;
+        }
+        offset += sample_lens[s];
+    }
+
+    uint8_t data[LZ_MAX_DICTIONARY_SIZE];
+    size_t len = 0;
+    const size_t grams_per_segment = LZ_TRAIN_SEGMENT_SIZE - LZ_TRAIN_GRAM_SIZE + 1;
+    while (len + LZ_TRAIN_SEGMENT_SIZE <= dictionary_size)
+    {
+        uint64_t best_score = 0;
+        const uint8_t* best_segment = NULL;
+
+        offset = 0;
+        for (size_t s = 0; s < num_samples; ++s)
+        {
+            const uint8_t* sample = sample_data + offset;
+            const size_t sample_len = sample_lens[s];
+            offset += sample_len;
+            if (sample_len < LZ_TRAIN_SEGMENT_SIZE)
+            {
+                continue;
+            }
+
+            // Sliding window sum over the grams in each segment
+            uint64_t score = 0;
+            for (size_t g = 0; g < grams_per_segment; ++g)
+            {
+                score += counts[_lz_gram_hash(sample + g)];
+            }
+
+            for (size_t start = 0; ; ++start)
+            {
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best_segment = sample + start;
+                }
+
+                if (start + LZ_TRAIN_SEGMENT_SIZE >= sample_len)
+                {
+                    break;
+                }
+
+                score -= counts[_lz_gram_hash(sample + start)];
+                score += counts[_lz_gram_hash(sample + start + grams_per_segment)];
+            }
+        }
+
+        if (!best_segment)
+        {
+            break;
+        }
+
+        memcpy(data + len, best_segment, LZ_TRAIN_SEGMENT_SIZE);
+        len += LZ_TRAIN_SEGMENT_SIZE;
+        for (size_t g = 0; g < grams_per_segment; ++g)
+        {
+            counts[_lz_gram_hash(best_segment + g)] = 0;
+        }
+    }
+
+    free(counts);
+    return lz_dictionary_init(dictionary_out, data, len);
+}
+
+// Writes a length with the nibble-then-255s scheme, false if out of space
+static bool _lz_write_length(uint8_t** op, const uint8_t* op_end, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (*op >= op_end)
+        {
+            return false;
+        }
+        *(*op)++ = 255;
+    }
+
+    if (*op >= op_end)
+    {
+        return false;
+    }
+    *(*op)++ = (uint8_t)len;
+    return true;
+}
+
+static bool _lz_write_sequence(
+    uint8_t** op,
+    const uint8_t* op_end,
+    const uint8_t* literals,
+    size_t literal_len,
+    size_t offset,
+    size_t match_len)
+{
+    if (*op >= op_end)
+    {
+        return false;
+    }
+
+    const size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    uint8_t* token = (*op)++;
+    *token = (literal_len < 15 ? literal_len : 15) << 4;
+    *token |= match_code < 15 ? match_code : 15;
+
+    if (literal_len >= 15 && !_lz_write_length(op, op_end, literal_len - 15))
+    {
+        return false;
+    }
+
+    if (op_end - *op < (ptrdiff_t)literal_len)
+    {
+        return false;
+    }
+    memcpy(*op, literals, literal_len);
+    *op += literal_len;
+
+    // Last sequence, literals only
+    if (match_len == 0)
+    {
+        return true;
+    }
+
+    if (op_end - *op < 2)
+    {
+        return false;
+    }
+    *(*op)++ = offset & 0xFF;
+    *(*op)++ = offset >> 8;
+
+    if (match_code >= 15 && !_lz_write_length(op, op_end, match_code - 15))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+size_t lz_compress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap, void* state)
+{
+    const struct lz_dictionary* dictionary = (const struct lz_dictionary*)state;
+    const size_t dictionary_len = dictionary ? dictionary->len : 0;
+    if (src_len > COMMON_MAX_MTU)
+    {
+        return 0;
+    }
+
+    // Dictionary and packet back to back so matches can span both
+    uint8_t window[LZ_MAX_DICTIONARY_SIZE + COMMON_MAX_MTU];
+    uint16_t table[LZ_HASH_SIZE];
+    if (dictionary)
+    {
+        memcpy(window, dictionary->data, dictionary_len);
+        memcpy(table, dictionary->table, sizeof(table));
+    }
+    else
+    {
+        memset(table, 0, sizeof(table));
+    }
+    memcpy(window + dictionary_len, src, src_len);
+
+    uint8_t* op = dst;
+    const uint8_t* op_end = dst + dst_cap;
+    const size_t end = dictionary_len + src_len;
+    size_t ip = dictionary_len;
+    size_t anchor = ip;
+    while (ip + LZ_MIN_MATCH <= end)
+    {
+        const uint32_t hash = _lz_hash(window + ip);
+        const size_t candidate = table[hash];
+        table[hash] = ip + 1;
+        if (candidate == 0 ||
+            ip - (candidate - 1) > LZ_MAX_OFFSET ||
+            _lz_read32(window + candidate - 1) != _lz_read32(window + ip))
+        {
+            ++ip;
+            continue;
+        }
+
+        const size_t ref = candidate - 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < end && window[ref + match_len] == window[ip + match_len])
+        {
+            ++match_len;
+        }
+
+        if (!_lz_write_sequence(&op, op_end, window + anchor, ip - anchor, ip - ref, match_len))
+        {
+            return 0;
+        }
+
+        // Packets are small, so index everything the match covered
+        for (size_t p = ip + 1; p < ip + match_len && p + LZ_MIN_MATCH <= end; ++p)
+        {
+            table[_lz_hash(window + p)] = p + 1;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    if (!_lz_write_sequence(&op, op_end, window + anchor, end - anchor, 0, 0))
+    {
+        return 0;
+    }
+
+    return op - dst;
+}
+
+static bool _lz_read_length(const uint8_t* src, size_t src_len, size_t* ip, size_t* len)
+{
+    uint8_t byte;
+    do
+    {
+        if (*ip >= src_len)
+        {
+            return false;
+        }
+        byte = src[(*ip)++];
+        *len += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+size_t lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap, void* state)
+{
+    const struct lz_dictionary* dictionary = (const struct lz_dictionary*)state;
+    const size_t dictionary_len = dictionary ? dictionary->len : 0;
+    if (dst_cap > COMMON_MAX_MTU)
+    {
+        dst_cap = COMMON_MAX_MTU;
+    }
+
+    uint8_t window[LZ_MAX_DICTIONARY_SIZE + COMMON_MAX_MTU];
+    if (dictionary)
+    {
+        memcpy(window, dictionary->data, dictionary_len);
+    }
+
+    const size_t op_end = dictionary_len + dst_cap;
+    size_t op = dictionary_len;
+    size_t ip = 0;
+    while (ip < src_len)
+    {
+        const uint8_t token = src[ip++];
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !_lz_read_length(src, src_len, &ip, &literal_len))
+        {
+            return 0;
+        }
+
+        if (ip + literal_len > src_len || op + literal_len > op_end)
+        {
+            return 0;
+        }
+        memcpy(window + op, src + ip, literal_len);
+        op += literal_len;
+        ip += literal_len;
+
+        // Last sequence, literals only
+        if (ip >= src_len)
+        {
+            break;
+        }
+
+        if (ip + 2 > src_len)
+        {
+            return 0;
+        }
+        const size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+
+        size_t match_len = token & 0xF;
+        if (match_len == 15 && !_lz_read_length(src, src_len, &ip, &match_len))
+        {
+            return 0;
+        }
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || op + match_len > op_end)
+        {
+            return 0;
+        }
+
+        // Byte at a time, matches may overlap what they're writing
+        const size_t ref = op - offset;
+        for (size_t m = 0; m < match_len; ++m)
+        {
+            window[op + m] = window[ref + m];
+        }
+        op += match_len;
+    }
+
+    memcpy(dst, window + dictionary_len, op - dictionary_len);
+    return op - dictionary_len;
+}
+
+void lz_codec_init(struct rudp_codec* codec, struct lz_dictionary* dictionary)
+{
+    codec->name = dictionary ? "lz+dict" : "lz";
+    codec->compress = lz_compress;
+    codec->decompress = lz_decompress;
+    codec->state = dictionary;
+}
+
+size_t lz_capture_read(const char* path, uint8_t* data, size_t max_data, size_t* lens, size_t max_samples)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open capture %s\n", path);
+        return 0;
+    }
+
+    size_t num_samples = 0;
+    size_t offset = 0;
+    uint16_t len;
+    while (num_samples < max_samples && fread(&len, sizeof(len), 1, file) == 1)
+    {
+        if (offset + len > max_data || fread(data + offset, 1, len, file) != len)
+        {
+            break;
+        }
+
+        lens[num_samples++] = len;
+        offset += len;
+    }
+
+    fclose(file);
+    return num_samples;
+}
+
+bool lz_capture_write(FILE* file, const uint8_t* data, size_t len)
+{
+    const uint16_t record_len = len;
+    return fwrite(&record_len, sizeof(record_len), 1, file) == 1 &&
+           fwrite(data, 1, len, file) == len;
+}
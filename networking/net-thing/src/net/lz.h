@@ -0,0 +1,70 @@
+#ifndef __LZ_H__
+#define __LZ_H__
+
+// Small LZ77 codec for rudp payloads. The block format follows LZ4:
+//
+//   [token][literal-len ext...][literals...][offset lo][offset hi][match-len ext...]
+//
+// The token's high nibble is the literal count and the low nibble is the match
+// length minus LZ_MIN_MATCH. A nibble of 15 means extra length bytes follow,
+// each adding up to 255 and stopping on a byte < 255. The last sequence is
+// literals only.
+//
+// An optional static dictionary acts as history in front of every packet, so
+// even small packets can reference bytes seen in training captures.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <net/rudp.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_MAX_DICTIONARY_SIZE 4096
+
+// Training parameters, see lz_dictionary_train
+#define LZ_TRAIN_GRAM_SIZE 6
+#define LZ_TRAIN_SEGMENT_SIZE 32
+#define LZ_TRAIN_COUNT_BITS 18
+
+struct lz_dictionary
+{
+    uint8_t data[LZ_MAX_DICTIONARY_SIZE];
+    size_t len;
+
+    // Match table primed with every dictionary position, copied per packet
+    uint16_t table[LZ_HASH_SIZE];
+};
+
+bool lz_dictionary_init(struct lz_dictionary* dictionary, const uint8_t* data, size_t len);
+bool lz_dictionary_load(const char* path, struct lz_dictionary* dictionary);
+bool lz_dictionary_save(const char* path, const struct lz_dictionary* dictionary);
+
+// Greedy segment selection, roughly zstd's COVER: count how often every
+// LZ_TRAIN_GRAM_SIZE-gram occurs across the samples, repeatedly take the
+// LZ_TRAIN_SEGMENT_SIZE window with the highest total count, then zero the
+// counts of the grams it covers so the next pick favours something new.
+//
+// Samples are concatenated in sample_data, sample_lens gives each length.
+bool lz_dictionary_train(
+    const uint8_t* sample_data,
+    const size_t* sample_lens,
+    size_t num_samples,
+    size_t dictionary_size,
+    struct lz_dictionary* dictionary_out);
+
+// rudp_codec_fn compatible, state is an optional struct lz_dictionary
+size_t lz_compress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap, void* state);
+size_t lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap, void* state);
+
+void lz_codec_init(struct rudp_codec* codec, struct lz_dictionary* dictionary);
+
+// Replay captures are just a series of [u16 length][payload] records
+size_t lz_capture_read(const char* path, uint8_t* data, size_t max_data, size_t* lens, size_t max_samples);
+bool lz_capture_write(FILE* file, const uint8_t* data, size_t len);
+
+#endif // __LZ_H__
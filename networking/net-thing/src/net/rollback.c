@@ -0,0 +1,358 @@
+#include <net/rollback.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROLLBACK_NO_FRAME UINT32_MAX
+
+bool rollback_session_init(
+    struct rollback_session* session,
+    int local_player,
+    size_t input_size,
+    int input_delay,
+    void* state,
+    size_t state_size,
+    rollback_advance_fn advance,
+    void* context)
+{
+    if (local_player < 0 || local_player >= ROLLBACK_NUM_PLAYERS)
+    {
+        fprintf(stderr, "Invalid rollback player - player: %d\n", local_player);
+        return false;
+    }
+
+    if (input_size == 0 || input_size > ROLLBACK_MAX_INPUT_SIZE)
+    {
+        fprintf(stderr, "Invalid rollback input size - size: %zu\n", input_size);
+        return false;
+    }
+
+    if (input_delay < 0 || input_delay > ROLLBACK_MAX_INPUT_DELAY)
+    {
+        fprintf(stderr, "Invalid rollback input delay - delay: %d\n", input_delay);
+        return false;
+    }
+
+    memset(session, 0, sizeof(*session));
+    session->saved_states = malloc(state_size * ROLLBACK_STATE_SLOTS);
+    if (!session->saved_states)
+    {
+        fprintf(stderr, "Failed to allocate rollback states - size: %zu\n", state_size);
+        return false;
+    }
+
+    session->local_player = local_player;
+    session->input_size = input_size;
+    session->input_delay = input_delay;
+    session->state = state;
+    session->state_size = state_size;
+    session->advance = advance;
+    session->context = context;
+
+    // The first input_delay frames have no input, both ends agree they're zero
+    session->next_local_frame = input_delay;
+    session->rollback_frame = ROLLBACK_NO_FRAME;
+    session->next_checksum_frame = ROLLBACK_CHECKSUM_INTERVAL;
+    return true;
+}
+
+void rollback_session_free(struct rollback_session* session)
+{
+    free(session->saved_states);
+    session->saved_states = NULL;
+}
+
+bool rollback_add_local_input(struct rollback_session* session, const void* input)
+{
+    // Already have one for the next frame, the last advance must have stalled
+    if (session->next_local_frame > session->frame + session->input_delay)
+    {
+        return false;
+    }
+
+    // Would overwrite an input the peer hasn't acked
+    if (session->next_local_frame - session->remote_ack >= ROLLBACK_INPUT_FRAMES)
+    {
+        return false;
+    }
+
+    memcpy(
+        session->local_inputs[session->next_local_frame % ROLLBACK_INPUT_FRAMES],
+        input,
+        session->input_size);
+    session->next_local_frame++;
+    return true;
+}
+
+int64_t rollback_confirmed_frame(const struct rollback_session* session)
+{
+    uint32_t confirmed = session->next_remote_frame;
+    if (session->next_local_frame < confirmed)
+    {
+        confirmed = session->next_local_frame;
+    }
+
+    return (int64_t)confirmed - 1;
+}
+
+uint32_t rollback_checksum(const void* data, size_t len)
+{
+    const uint8_t* bytes = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static uint8_t* _rollback_saved_state(struct rollback_session* session, uint32_t frame)
+{
+    return session->saved_states + (frame % ROLLBACK_STATE_SLOTS) * session->state_size;
+}
+
+static void _rollback_compare_checksums(struct rollback_session* session)
+{
+    const uint32_t frame = session->remote_checksum.frame;
+    if (frame <= session->compared_checksum_frame)
+    {
+        return;
+    }
+
+    const struct rollback_checksum* local =
+        &session->local_checksums[(frame / ROLLBACK_CHECKSUM_INTERVAL) % ROLLBACK_CHECKSUM_HISTORY];
+    if (local->frame != frame)
+    {
+        return;
+    }
+
+    session->stats.checksums_compared++;
+    // Only the first one is interesting, once out of sync it stays that way
+    if (local->checksum != session->remote_checksum.checksum && session->stats.desyncs++ == 0)
+    {
+        fprintf(
+            stderr,
+            "Rollback desync - frame: %u, local: %08x, remote: %08x\n",
+            frame,
+            local->checksum,
+            session->remote_checksum.checksum);
+    }
+
+    session->compared_checksum_frame = frame;
+}
+
+// Checksums the state at the start of each checksum frame once every input
+// before it is confirmed. Those are never rolled back again, so it's final.
+static void _rollback_update_checksums(struct rollback_session* session)
+{
+    const uint32_t confirmed = (uint32_t)(rollback_confirmed_frame(session) + 1);
+    while (session->next_checksum_frame <= confirmed && session->next_checksum_frame <= session->frame)
+    {
+        const uint32_t frame = session->next_checksum_frame;
+        const void* state = frame == session->frame ?
+            session->state : _rollback_saved_state(session, frame);
+
+        struct rollback_checksum* local =
+            &session->local_checksums[(frame / ROLLBACK_CHECKSUM_INTERVAL) % ROLLBACK_CHECKSUM_HISTORY];
+        local->frame = frame;
+        local->checksum = rollback_checksum(state, session->state_size);
+
+        session->next_checksum_frame += ROLLBACK_CHECKSUM_INTERVAL;
+    }
+
+    _rollback_compare_checksums(session);
+}
+
+static void _rollback_simulate(struct rollback_session* session, uint32_t frame)
+{
+    memcpy(_rollback_saved_state(session, frame), session->state, session->state_size);
+
+    const uint32_t index = frame % ROLLBACK_INPUT_FRAMES;
+    uint8_t* remote = session->remote_used[index];
+    if (frame < session->next_remote_frame)
+    {
+        memcpy(remote, session->remote_inputs[index], session->input_size);
+    }
+    else if (session->next_remote_frame > 0)
+    {
+        // Predict the remote player keeps doing whatever they did last
+        const uint32_t last = (session->next_remote_frame - 1) % ROLLBACK_INPUT_FRAMES;
+        memcpy(remote, session->remote_inputs[last], session->input_size);
+    }
+    else
+    {
+        memset(remote, 0, session->input_size);
+    }
+
+    const uint8_t* inputs[ROLLBACK_NUM_PLAYERS];
+    inputs[session->local_player] = session->local_inputs[index];
+    inputs[1 - session->local_player] = remote;
+    session->advance(session->state, inputs, session->context);
+}
+
+bool rollback_advance_frame(struct rollback_session* session)
+{
+    if (session->rollback_frame != ROLLBACK_NO_FRAME)
+    {
+        const uint32_t from = session->rollback_frame;
+        memcpy(session->state, _rollback_saved_state(session, from), session->state_size);
+        for (uint32_t frame = from; frame < session->frame; frame++)
+        {
+            _rollback_simulate(session, frame);
+        }
+
+        const uint32_t frames = session->frame - from;
+        session->stats.rollbacks++;
+        session->stats.frames_resimulated += frames;
+        if (frames > session->stats.max_rollback_frames)
+        {
+            session->stats.max_rollback_frames = frames;
+        }
+
+        session->rollback_frame = ROLLBACK_NO_FRAME;
+    }
+
+    const bool have_local = session->frame < session->next_local_frame;
+    const bool can_predict = session->frame < session->next_remote_frame + ROLLBACK_MAX_PREDICTION;
+    if (!have_local || !can_predict)
+    {
+        session->stats.stalls++;
+        _rollback_update_checksums(session);
+        return false;
+    }
+
+    _rollback_simulate(session, session->frame);
+    session->frame++;
+    session->stats.frames_advanced++;
+
+    _rollback_update_checksums(session);
+    return true;
+}
+
+size_t rollback_write_message(struct rollback_session* session, uint8_t* buffer, size_t max_len)
+{
+    if (max_len < sizeof(struct rollback_message))
+    {
+        return 0;
+    }
+
+    // Everything the peer hasn't acked yet, a lost message is covered by the
+    // next one
+    uint32_t count = session->next_local_frame - session->remote_ack;
+    const size_t max_count = (max_len - sizeof(struct rollback_message)) / session->input_size;
+    if (count > max_count)
+    {
+        count = max_count;
+    }
+    if (count > UINT8_MAX)
+    {
+        count = UINT8_MAX;
+    }
+
+    struct rollback_message message;
+    message.id = ROLLBACK_MESSAGE_ID;
+    message.input_size = session->input_size;
+    message.count = count;
+    message.start_frame = session->remote_ack;
+    message.ack_frame = session->next_remote_frame;
+
+    const struct rollback_checksum* latest = &session->local_checksums[
+        ((session->next_checksum_frame / ROLLBACK_CHECKSUM_INTERVAL) + ROLLBACK_CHECKSUM_HISTORY - 1) %
+        ROLLBACK_CHECKSUM_HISTORY];
+    message.checksum_frame = latest->frame;
+    message.checksum = latest->checksum;
+    memcpy(buffer, &message, sizeof(message));
+
+    uint8_t* inputs = buffer + sizeof(message);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t frame = session->remote_ack + i;
+        memcpy(
+            inputs + i * session->input_size,
+            session->local_inputs[frame % ROLLBACK_INPUT_FRAMES],
+            session->input_size);
+    }
+
+    return sizeof(message) + count * session->input_size;
+}
+
+bool rollback_read_message(struct rollback_session* session, const uint8_t* data, size_t len)
+{
+    struct rollback_message message;
+    if (len < sizeof(message))
+    {
+        return false;
+    }
+
+    memcpy(&message, data, sizeof(message));
+    if (message.id != ROLLBACK_MESSAGE_ID ||
+        message.input_size != session->input_size ||
+        len != sizeof(message) + message.count * session->input_size)
+    {
+        return false;
+    }
+
+    // Acks can arrive out of order, only ever move forward
+    if (message.ack_frame > session->remote_ack && message.ack_frame <= session->next_local_frame)
+    {
+        session->remote_ack = message.ack_frame;
+    }
+
+    const uint8_t* inputs = data + sizeof(message);
+    for (uint32_t i = 0; i < message.count; i++)
+    {
+        const uint32_t frame = message.start_frame + i;
+        if (frame < session->next_remote_frame)
+        {
+            continue;
+        }
+
+        // A gap means a later message got here first, or the frame is so far
+        // ahead it would overwrite inputs a rollback may still need. Either
+        // way it'll be sent again.
+        if (frame > session->next_remote_frame ||
+            frame >= session->frame + ROLLBACK_INPUT_FRAMES - ROLLBACK_MAX_PREDICTION)
+        {
+            break;
+        }
+
+        const uint32_t index = frame % ROLLBACK_INPUT_FRAMES;
+        const uint8_t* input = inputs + i * session->input_size;
+        memcpy(session->remote_inputs[index], input, session->input_size);
+        session->next_remote_frame++;
+
+        // Already simulated on a prediction, redo it if that was wrong
+        if (frame < session->frame &&
+            memcmp(session->remote_used[index], input, session->input_size) != 0)
+        {
+            session->stats.mispredictions++;
+            if (frame < session->rollback_frame)
+            {
+                session->rollback_frame = frame;
+            }
+        }
+    }
+
+    if (message.checksum_frame > session->remote_checksum.frame)
+    {
+        session->remote_checksum.frame = message.checksum_frame;
+        session->remote_checksum.checksum = message.checksum;
+    }
+
+    return true;
+}
+
+bool rollback_send(struct rollback_session* session, struct rudp_conn* connection)
+{
+    uint8_t buffer[RUDP_MAX_PAYLOAD_SIZE];
+    const size_t len = rollback_write_message(session, buffer, rudp_conn_max_payload(connection));
+    if (len == 0)
+    {
+        return false;
+    }
+
+    return rudp_send(connection, buffer, len);
+}
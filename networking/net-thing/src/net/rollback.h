@@ -0,0 +1,162 @@
+#ifndef __ROLLBACK_H__
+#define __ROLLBACK_H__
+
+// Peer to peer rollback for deterministic simulations. Both peers run the
+// same simulation on the same inputs; nobody is authoritative.
+//
+// Local inputs are scheduled input_delay frames ahead and sent every frame
+// along with every input the peer hasn't acked yet, so a lost packet is
+// covered by the next one. Frames the remote input hasn't arrived for yet are
+// simulated with a prediction (its last known input). When the real input
+// turns up and differs, the state saved at the start of that frame is copied
+// back and everything since is resimulated.
+//
+// The simulation state has to be one flat block of memory with no pointers
+// into itself, saving a frame is a memcpy. Periodic checksums of confirmed
+// frames are exchanged so a desync shows up right away rather than as a
+// slowly diverging game.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <net/rudp.h>
+
+#define ROLLBACK_MESSAGE_ID 0xB4C7
+
+// Two peers per session, local and remote
+#define ROLLBACK_NUM_PLAYERS 2
+
+#define ROLLBACK_MAX_INPUT_SIZE 16
+#define ROLLBACK_MAX_INPUT_DELAY 16
+
+// How far ahead of the last confirmed remote input we're allowed to predict
+// before stalling, and so the most frames a single rollback resimulates
+#define ROLLBACK_MAX_PREDICTION 8
+
+// Saved states, enough for the full prediction window plus the frame being
+// simulated
+#define ROLLBACK_STATE_SLOTS (ROLLBACK_MAX_PREDICTION + 2)
+
+// Input history, has to cover whatever the peer hasn't acked yet
+#define ROLLBACK_INPUT_FRAMES 64
+
+// Confirmed frames are checksummed and compared every this many frames
+#define ROLLBACK_CHECKSUM_INTERVAL 8
+#define ROLLBACK_CHECKSUM_HISTORY 16
+
+// Followed by count inputs of input_size bytes, for frames start_frame on
+struct rollback_message
+{
+    uint16_t id;
+    uint8_t input_size;
+    uint8_t count;
+    uint32_t start_frame;
+
+    // The sender has every input before this frame from us
+    uint32_t ack_frame;
+
+    // Sender's latest confirmed checksum, frame 0 if none yet
+    uint32_t checksum_frame;
+    uint32_t checksum;
+};
+
+// Simulates one frame in place. inputs[p] is player p's input for the frame.
+typedef void(*rollback_advance_fn)(void* state, const uint8_t* const* inputs, void* context);
+
+struct rollback_stats
+{
+    uint64_t frames_advanced;
+    uint64_t frames_resimulated;
+    uint64_t rollbacks;
+    uint64_t stalls;
+    uint64_t mispredictions;
+    uint64_t checksums_compared;
+    uint64_t desyncs;
+    uint32_t max_rollback_frames;
+};
+
+struct rollback_checksum
+{
+    uint32_t frame;
+    uint32_t checksum;
+};
+
+struct rollback_session
+{
+    int local_player;
+    size_t input_size;
+    int input_delay;
+
+    // Live simulation state, owned by the caller
+    void* state;
+    size_t state_size;
+    rollback_advance_fn advance;
+    void* context;
+
+    // Next frame to simulate
+    uint32_t frame;
+
+    // Local inputs by frame, next_local_frame is the next one to schedule
+    uint8_t local_inputs[ROLLBACK_INPUT_FRAMES][ROLLBACK_MAX_INPUT_SIZE];
+    uint32_t next_local_frame;
+
+    // Remote inputs by frame, next_remote_frame is the first one missing.
+    // Anything simulated at or past it used remote_used, the prediction.
+    uint8_t remote_inputs[ROLLBACK_INPUT_FRAMES][ROLLBACK_MAX_INPUT_SIZE];
+    uint8_t remote_used[ROLLBACK_INPUT_FRAMES][ROLLBACK_MAX_INPUT_SIZE];
+    uint32_t next_remote_frame;
+
+    // Highest local frame + 1 the peer says it has
+    uint32_t remote_ack;
+
+    // Earliest frame that needs resimulating, or UINT32_MAX
+    uint32_t rollback_frame;
+
+    // State at the start of frame f lives in slot f % ROLLBACK_STATE_SLOTS.
+    // One allocation, state_size bytes per slot.
+    uint8_t* saved_states;
+
+    struct rollback_checksum local_checksums[ROLLBACK_CHECKSUM_HISTORY];
+    struct rollback_checksum remote_checksum;
+    uint32_t compared_checksum_frame;
+    uint32_t next_checksum_frame;
+
+    struct rollback_stats stats;
+};
+
+bool rollback_session_init(
+    struct rollback_session* session,
+    int local_player,
+    size_t input_size,
+    int input_delay,
+    void* state,
+    size_t state_size,
+    rollback_advance_fn advance,
+    void* context);
+
+void rollback_session_free(struct rollback_session* session);
+
+// Schedules the local input for the next frame, frame + input_delay. False if
+// the peer has fallen so far behind that it can't be buffered.
+bool rollback_add_local_input(struct rollback_session* session, const void* input);
+
+// Rolls back if a misprediction came in, then simulates one frame. False
+// (and nothing simulated) if that would predict too far ahead of the peer or
+// the local input for the frame hasn't been added.
+bool rollback_advance_frame(struct rollback_session* session);
+
+// The input message to send this frame, returns its length or 0 on failure
+size_t rollback_write_message(struct rollback_session* session, uint8_t* buffer, size_t max_len);
+bool rollback_read_message(struct rollback_session* session, const uint8_t* data, size_t len);
+
+// rollback_write_message straight into rudp_send
+bool rollback_send(struct rollback_session* session, struct rudp_conn* connection);
+
+// Last frame whose inputs are known for both players, or -1
+int64_t rollback_confirmed_frame(const struct rollback_session* session);
+
+// FNV-1a, also handy for comparing states outside of a session
+uint32_t rollback_checksum(const void* data, size_t len);
+
+#endif // __ROLLBACK_H__
@@ -1,162 +1,826 @@
-// Depends on socket.c, time.c
+#include <net/rudp.h>
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-// I dunno I'm hungry
-#define RUDP_PROTOCOL_ID 0xFEED
-#define RUDP_PACKET_POOL_SIZE 16
+#include <net/socket.h>
+#include <system/time.h>
 
-enum rudp_status
+void rudp_config_default(struct rudp_config* config)
 {
-    // A sentinel for uninitialized state
-    RUDP_STATUS_INVALID = 0,
-
-    // Connection is established
-    RUDP_STATUS_CONNECTED,
-
-    // Connection has timed out
-    RUDP_STATUS_TIMEOUT,
-
-    // Connection has gracefully disconnected
-    RUDP_STATUS_DISCONNECTED
-};
-
-struct rudp_queued_packet
-{
-    uint8_t data[COMMON_MTU];
-    size_t len;
-};
-
-typedef void(*rudp_read_fn)(int address, int port, uint8_t* data, size_t len, void* context);
-typedef void(*rudp_status_fn)(enum rudp_status status, void* context);
-
-struct rudp_conn
-{
-    int socket_handle;
-    int remote_address;
-    int remote_port;
-    uint16_t ack;
-    uint16_t remote_ack;
-    uint64_t prev_recv_ns;
-    rudp_read_fn read_callback;
-    rudp_status_fn status_callback;
-    void* context;
-    struct rudp_queued_packet packet_pool[RUDP_PACKET_POOL_SIZE];
-    int packets_to_send;
-};
-
-struct rudp_header
-{
-    uint16_t protocol_id;
-    uint32_t ack_bits;
-    bool     has_status;
-};
+    config->mtu = COMMON_MTU;
+    config->max_mtu = COMMON_MAX_MTU;
+    config->packet_pool_size = RUDP_DEFAULT_PACKET_POOL_SIZE;
+    config->timeout_ns = RUDP_DEFAULT_TIMEOUT_NS;
+}
 
-bool
-rudp_conn_init(
+bool rudp_conn_init(
     int socket_handle,
     int remote_address,
     int remote_port,
     rudp_read_fn read_callback,
     rudp_status_fn status_callback,
     void* context,
+    const struct rudp_config* config,
     struct rudp_conn* connection_out)
 {
+    struct rudp_config defaults;
+    if (!config)
+    {
+        rudp_config_default(&defaults);
+        config = &defaults;
+    }
+
     memset(connection_out, 0, sizeof(*connection_out));
+    if (config->mtu <= RUDP_PACKET_OVERHEAD + sizeof(struct rudp_status_payload) ||
+        config->max_mtu < config->mtu ||
+        config->max_mtu > COMMON_MAX_MTU ||
+        config->packet_pool_size <= 0)
+    {
+        fprintf(stderr,
+                "Invalid connection config - mtu: %zu max-mtu: %zu packet-pool-size: %d\n",
+                config->mtu,
+                config->max_mtu,
+                config->packet_pool_size);
+        return false;
+    }
+
+    // One block, the pool entries up front and their payloads after. Sized
+    // for the biggest MTU probing could find, so it never has to move.
+    const size_t max_payload = config->max_mtu - RUDP_PACKET_OVERHEAD;
+    const size_t pool_size = config->packet_pool_size * sizeof(struct rudp_queued_packet);
+    uint8_t* pool = malloc(pool_size + config->packet_pool_size * max_payload);
+    if (!pool)
+    {
+        fprintf(stderr, "Failed to allocate packet pool - size: %d\n", config->packet_pool_size);
+        return false;
+    }
+
+    connection_out->packet_pool = (struct rudp_queued_packet*)pool;
+    for (int p = 0; p < config->packet_pool_size; ++p)
+    {
+        connection_out->packet_pool[p].data = pool + pool_size + p * max_payload;
+        connection_out->packet_pool[p].len = 0;
+    }
+
+    connection_out->packet_pool_size = config->packet_pool_size;
+    connection_out->mtu = config->mtu;
+    connection_out->base_mtu = config->mtu;
+    connection_out->max_mtu = config->max_mtu;
+    connection_out->probe_high = config->max_mtu;
     connection_out->socket_handle = socket_handle;
     connection_out->remote_address = remote_address;
     connection_out->remote_port = remote_port;
     connection_out->read_callback = read_callback;
     connection_out->status_callback = status_callback;
     connection_out->context = context;
+    connection_out->timeout_ns = config->timeout_ns;
+    connection_out->state = RUDP_STATUS_INVALID;
+    connection_out->compress_threshold = RUDP_DEFAULT_COMPRESS_THRESHOLD;
 
     return true;
 }
 
+size_t rudp_conn_max_payload(const struct rudp_conn* connection)
+{
+    return connection->mtu - RUDP_PACKET_OVERHEAD;
+}
+
+bool rudp_conn_mtu_settled(const struct rudp_conn* connection)
+{
+    return connection->mtu >= connection->probe_high;
+}
+
+void rudp_conn_set_codec(struct rudp_conn* connection, struct rudp_codec* codec, size_t threshold)
+{
+    connection->codec = codec;
+    connection->compress_threshold = threshold;
+}
+
+void rudp_conn_set_key(struct rudp_conn* connection, const uint8_t key[CRYPTO_KEY_SIZE])
+{
+    memcpy(connection->psk, key, CRYPTO_KEY_SIZE);
+    connection->has_key = true;
+}
+
+static void _rudp_derive_key(
+    struct rudp_conn* connection,
+    const uint8_t client_nonce[RUDP_HANDSHAKE_NONCE_SIZE],
+    const uint8_t server_nonce[RUDP_HANDSHAKE_NONCE_SIZE])
+{
+    uint8_t intermediate[CRYPTO_KEY_SIZE];
+    hchacha20(connection->psk, client_nonce, intermediate);
+    hchacha20(intermediate, server_nonce, connection->session_key);
+    memset(intermediate, 0, sizeof(intermediate));
+    connection->keyed = true;
+}
+
+// Each direction gets its own nonce space so the sequence numbers never
+// collide under the shared session key
+static void _rudp_packet_nonce(bool from_server, uint32_t sequence, uint8_t nonce_out[CRYPTO_NONCE_SIZE])
+{
+    memset(nonce_out, 0, CRYPTO_NONCE_SIZE);
+    nonce_out[0] = from_server ? 'S' : 'C';
+    memcpy(nonce_out + 4, &sequence, sizeof(sequence));
+}
+
+static bool _rudp_replay_check(const struct rudp_conn* connection, uint32_t sequence)
+{
+    if (connection->recv_window == 0 || sequence > connection->recv_sequence)
+    {
+        return true;
+    }
+
+    const uint32_t age = connection->recv_sequence - sequence;
+    if (age >= RUDP_REPLAY_WINDOW)
+    {
+        return false;
+    }
+
+    return !(connection->recv_window & (1ULL << age));
+}
+
+// Only call once the packet has been authenticated
+static void _rudp_replay_mark(struct rudp_conn* connection, uint32_t sequence)
+{
+    if (connection->recv_window == 0 || sequence > connection->recv_sequence)
+    {
+        const uint32_t shift = sequence - connection->recv_sequence;
+        connection->recv_window =
+            (connection->recv_window == 0 || shift >= RUDP_REPLAY_WINDOW) ?
+                0 : connection->recv_window << shift;
+        connection->recv_window |= 1;
+        connection->recv_sequence = sequence;
+        return;
+    }
+
+    connection->recv_window |= 1ULL << (connection->recv_sequence - sequence);
+}
+
+const char* rudp_status_name(enum rudp_status status)
+{
+    switch (status)
+    {
+        case RUDP_STATUS_CONNECTING:    return "connecting";
+        case RUDP_STATUS_CONNECTED:     return "connected";
+        case RUDP_STATUS_DISCONNECTING: return "disconnecting";
+        case RUDP_STATUS_TIMEOUT:       return "timeout";
+        case RUDP_STATUS_DISCONNECTED:  return "disconnected";
+        default:                        return "invalid";
+    }
+}
+
+static void _rudp_set_state(struct rudp_conn* connection, enum rudp_status state)
+{
+    if (connection->state == state)
+    {
+        return;
+    }
+
+    connection->state = state;
+    if (connection->status_callback)
+    {
+        connection->status_callback(state, connection->context);
+    }
+}
+
+// Returns the compressed length, or 0 if the packet should go out as-is
+static size_t _rudp_compress(struct rudp_conn* connection, const uint8_t* data, size_t len, uint8_t* dst, size_t dst_cap)
+{
+    struct rudp_compress_stats* stats = &connection->compress_stats;
+    if (!connection->codec ||
+        len == 0 ||
+        len < connection->compress_threshold)
+    {
+        stats->packets_uncompressed++;
+        return 0;
+    }
+
+    // Anything that doesn't shrink isn't worth the decompression on the other end
+    const uint64_t start_ns = system_time_ns();
+    const size_t compressed_len =
+        connection->codec->compress(
+            data,
+            len,
+            dst,
+            len < dst_cap ? len - 1 : dst_cap,
+            connection->codec->state);
+    stats->compress_ns += system_time_ns() - start_ns;
+    if (compressed_len == 0)
+    {
+        stats->packets_uncompressed++;
+        return 0;
+    }
+
+    stats->packets_compressed++;
+    stats->bytes_before += len;
+    stats->bytes_after += compressed_len;
+    return compressed_len;
+}
+
+// [header][status][probe][data], with data left zeroed if it's NULL. That's
+// the padding on a probe, which is never compressed or it wouldn't be much of
+// a probe.
+static size_t _rudp_encode(
+    struct rudp_conn* connection,
+    const struct rudp_status_payload* status,
+    const struct rudp_probe_payload* probe,
+    const uint8_t* data,
+    size_t len,
+    size_t max_payload,
+    uint8_t buffer[COMMON_MAX_MTU])
+{
+    memset(buffer, 0, sizeof(struct rudp_header));
+    struct rudp_header* header = (struct rudp_header*)(buffer);
+    header->protocol_id = RUDP_PROTOCOL_ID;
+    header->ack_bits = 0; // TODO
+    header->sequence = connection->send_sequence++;
+    header->has_status = status != NULL;
+    header->has_probe = probe != NULL;
+
+    uint8_t body[RUDP_MAX_PAYLOAD_SIZE];
+    size_t body_len = 0;
+    const size_t status_len = status ? sizeof(*status) : 0;
+    const size_t probe_len = probe ? sizeof(*probe) : 0;
+    if (status_len + probe_len + len > max_payload)
+    {
+        fprintf(stderr, "Send packet too large - len: %zu\n", len);
+        return 0;
+    }
+
+    if (status)
+    {
+        memcpy(body, status, status_len);
+    }
+    if (probe)
+    {
+        memcpy(body + status_len, probe, probe_len);
+    }
+    if (data)
+    {
+        memcpy(body + status_len + probe_len, data, len);
+    }
+    else
+    {
+        memset(body + status_len + probe_len, 0, len);
+    }
+    body_len = status_len + probe_len + len;
+
+    uint8_t* payload = buffer + sizeof(*header);
+    size_t payload_len = probe ? 0 : _rudp_compress(connection, body, body_len, payload, max_payload);
+    header->compressed = payload_len > 0;
+    if (!header->compressed)
+    {
+        memcpy(payload, body, body_len);
+        payload_len = body_len;
+    }
+
+    // The handshake has to go out in the clear, the other end can't derive
+    // the key until it has seen it
+    const bool handshake =
+        status &&
+        (status->status == RUDP_STATUS_CONNECTING ||
+         status->status == RUDP_STATUS_CONNECTED);
+    if (connection->keyed && !handshake)
+    {
+        header->encrypted = true;
+
+        uint8_t nonce[CRYPTO_NONCE_SIZE];
+        _rudp_packet_nonce(connection->is_server, header->sequence, nonce);
+
+        const uint64_t start_ns = system_time_ns();
+        aead_seal(
+            connection->session_key,
+            nonce,
+            buffer,
+            sizeof(*header),
+            payload,
+            payload_len,
+            payload + payload_len);
+        connection->crypto_stats.seal_ns += system_time_ns() - start_ns;
+        connection->crypto_stats.packets_sealed++;
+        payload_len += CRYPTO_TAG_SIZE;
+    }
+
+    return sizeof(*header) + payload_len;
+}
+
+size_t rudp_conn_encode(
+    struct rudp_conn* connection,
+    const struct rudp_status_payload* status,
+    const uint8_t* data,
+    size_t len,
+    uint8_t buffer[COMMON_MAX_MTU])
+{
+    return _rudp_encode(connection, status, NULL, data, len, rudp_conn_max_payload(connection), buffer);
+}
+
+// Leaves errno alone on failure. EMSGSIZE means the kernel already knows the
+// path won't take it, which callers deal with themselves.
+static bool _rudp_send_datagram(struct rudp_conn* connection, uint8_t* buffer, size_t total_size)
+{
+    const int sent =
+        socket_send(
+            connection->socket_handle,
+            buffer,
+            total_size,
+            connection->remote_address,
+            connection->remote_port);
+    if (sent != total_size)
+    {
+        const int error = errno;
+        if (error != EMSGSIZE)
+        {
+            fprintf(stderr, "Send failed - total-size: %zu sent: %d\n", total_size, sent);
+        }
+        errno = error;
+        return false;
+    }
+
+    connection->traffic_stats.packets_sent++;
+    connection->traffic_stats.bytes_sent += total_size;
+    return true;
+}
+
+// The route changed under us. Start again from the base MTU and probe back up
+// to whatever it takes now.
+static void _rudp_mtu_shrunk(struct rudp_conn* connection)
+{
+    fprintf(stderr,
+            "Path MTU dropped below %zu, falling back to %zu\n",
+            connection->mtu,
+            connection->base_mtu);
+    connection->probe_high = connection->mtu - 1;
+    connection->mtu = connection->base_mtu;
+    connection->probe_size = 0;
+}
+
+static bool _rudp_send_packet(
+    struct rudp_conn* connection,
+    const struct rudp_status_payload* status,
+    const uint8_t* data,
+    size_t len)
+{
+    uint8_t buffer[COMMON_MAX_MTU];
+    const size_t total_size = rudp_conn_encode(connection, status, data, len, buffer);
+    if (total_size == 0)
+    {
+        return false;
+    }
+
+    if (!_rudp_send_datagram(connection, buffer, total_size))
+    {
+        if (errno == EMSGSIZE && connection->mtu > connection->base_mtu)
+        {
+            _rudp_mtu_shrunk(connection);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+static bool _rudp_send_probe(struct rudp_conn* connection, enum rudp_probe_kind kind, size_t mtu)
+{
+    struct rudp_probe_payload probe = {0};
+    probe.kind = kind;
+    probe.mtu = mtu;
+
+    // Padded so the datagram is exactly as big as a full packet at that MTU
+    // would be
+    const size_t max_payload = mtu - RUDP_PACKET_OVERHEAD;
+    const size_t padding = kind == RUDP_PROBE_REQUEST ? max_payload - sizeof(probe) : 0;
+
+    uint8_t buffer[COMMON_MAX_MTU];
+    const size_t total_size = _rudp_encode(connection, NULL, &probe, NULL, padding, max_payload, buffer);
+    if (total_size == 0)
+    {
+        return false;
+    }
+
+    return _rudp_send_datagram(connection, buffer, total_size);
+}
+
+static void _rudp_update_probe(struct rudp_conn* connection, uint64_t now_ns)
+{
+    if (connection->probe_size != 0)
+    {
+        if (now_ns - connection->probe_sent_ns < RUDP_PROBE_RETRY_NS)
+        {
+            return;
+        }
+
+        // Nothing back, either it's too big for the path or we were unlucky
+        // RUDP_PROBE_ATTEMPTS times in a row
+        if (connection->probe_attempts >= RUDP_PROBE_ATTEMPTS)
+        {
+            connection->probe_high = connection->probe_size - 1;
+            connection->probe_size = 0;
+        }
+    }
+
+    if (connection->probe_size == 0)
+    {
+        if (rudp_conn_mtu_settled(connection))
+        {
+            return;
+        }
+
+        connection->probe_size = connection->mtu + (connection->probe_high - connection->mtu + 1) / 2;
+        connection->probe_attempts = 0;
+    }
+
+    connection->probe_attempts++;
+    connection->probe_sent_ns = now_ns;
+    if (!_rudp_send_probe(connection, RUDP_PROBE_REQUEST, connection->probe_size) && errno == EMSGSIZE)
+    {
+        // The kernel already knows it won't fit, no need to wait it out
+        connection->probe_high = connection->probe_size - 1;
+        connection->probe_size = 0;
+    }
+}
+
+static void _rudp_process_probe(struct rudp_conn* connection, const struct rudp_probe_payload* probe, size_t received)
+{
+    switch (probe->kind)
+    {
+        case RUDP_PROBE_REQUEST:
+            // Only vouch for what actually arrived
+            if (received >= probe->mtu - CRYPTO_TAG_SIZE)
+            {
+                _rudp_send_probe(connection, RUDP_PROBE_ACK, probe->mtu);
+            }
+            break;
+        case RUDP_PROBE_ACK:
+            if (probe->mtu > connection->mtu && probe->mtu <= connection->max_mtu)
+            {
+                connection->mtu = probe->mtu;
+            }
+            if (probe->mtu >= connection->probe_size)
+            {
+                connection->probe_size = 0;
+            }
+            break;
+        default:
+            fprintf(stderr, "Unexpected probe payload: %d\n", probe->kind);
+            break;
+    }
+}
+
+static bool _rudp_send_status(struct rudp_conn* connection, enum rudp_status status)
+{
+    struct rudp_status_payload payload = {0};
+    payload.status = status;
+    memcpy(payload.nonce, connection->local_nonce, sizeof(payload.nonce));
+    return _rudp_send_packet(connection, &payload, NULL, 0);
+}
+
+bool rudp_conn_connect(struct rudp_conn* connection)
+{
+    if (connection->has_key && !crypto_random(connection->local_nonce, sizeof(connection->local_nonce)))
+    {
+        fprintf(stderr, "Failed to generate handshake nonce\n");
+        return false;
+    }
+
+    const uint64_t now_ns = system_time_ns();
+    connection->prev_recv_ns = now_ns;
+    connection->prev_status_ns = now_ns;
+    _rudp_set_state(connection, RUDP_STATUS_CONNECTING);
+    return _rudp_send_status(connection, RUDP_STATUS_CONNECTING);
+}
+
+bool rudp_peek_status(uint8_t* data, size_t len, struct rudp_status_payload* payload_out)
+{
+    if (len < sizeof(struct rudp_header) + sizeof(struct rudp_status_payload))
+    {
+        return false;
+    }
+
+    // Only plain status packets, which covers the handshake
+    struct rudp_header* header = (struct rudp_header*)(data);
+    if (header->protocol_id != RUDP_PROTOCOL_ID ||
+        !header->has_status ||
+        header->compressed ||
+        header->encrypted)
+    {
+        return false;
+    }
+
+    memcpy(payload_out, data + sizeof(*header), sizeof(*payload_out));
+    return true;
+}
+
+static void _rudp_track_received(struct rudp_conn* connection, uint32_t sequence, size_t len)
+{
+    struct rudp_traffic_stats* stats = &connection->traffic_stats;
+    if (stats->packets_received == 0)
+    {
+        connection->recv_highest_sequence = sequence;
+    }
+    else if (sequence > connection->recv_highest_sequence)
+    {
+        stats->packets_lost += sequence - connection->recv_highest_sequence - 1;
+        connection->recv_highest_sequence = sequence;
+    }
+
+    stats->packets_received++;
+    stats->bytes_received += len;
+}
+
+bool rudp_conn_accept(struct rudp_conn* connection, uint8_t* hello, size_t len)
+{
+    struct rudp_status_payload payload;
+    if (!rudp_peek_status(hello, len, &payload) || payload.status != RUDP_STATUS_CONNECTING)
+    {
+        return false;
+    }
+
+    const struct rudp_header* header = (const struct rudp_header*)hello;
+    _rudp_track_received(connection, header->sequence, len);
+
+    connection->is_server = true;
+    if (connection->has_key)
+    {
+        if (!crypto_random(connection->local_nonce, sizeof(connection->local_nonce)))
+        {
+            fprintf(stderr, "Failed to generate handshake nonce\n");
+            return false;
+        }
+
+        _rudp_derive_key(connection, payload.nonce, connection->local_nonce);
+    }
+
+    connection->prev_recv_ns = system_time_ns();
+    _rudp_set_state(connection, RUDP_STATUS_CONNECTED);
+    return _rudp_send_status(connection, RUDP_STATUS_CONNECTED);
+}
+
+bool rudp_conn_is_active(const struct rudp_conn* connection)
+{
+    return connection->state == RUDP_STATUS_CONNECTING ||
+           connection->state == RUDP_STATUS_CONNECTED;
+}
+
 bool rudp_conn_close(struct rudp_conn* connection)
 {
-    // TODO: send goodbye
+    bool all_sends_succeeded = true;
+    if (rudp_conn_is_active(connection))
+    {
+        _rudp_set_state(connection, RUDP_STATUS_DISCONNECTING);
+        for (int g = 0; g < RUDP_GOODBYE_REDUNDANCY; ++g)
+        {
+            if (!_rudp_send_status(connection, RUDP_STATUS_DISCONNECTED))
+            {
+                all_sends_succeeded = false;
+            }
+        }
+        _rudp_set_state(connection, RUDP_STATUS_DISCONNECTED);
+    }
+
     // Caller closes the actual handle
+    free(connection->packet_pool);
     memset(connection, 0, sizeof(*connection));
-    return true;
+    return all_sends_succeeded;
 }
 
-bool _rudp_tick_recv(struct rudp_conn* connection)
+static void _rudp_process_status(struct rudp_conn* connection, const struct rudp_status_payload* payload)
 {
-    uint8_t buffer[COMMON_MTU] = {0};
-    const size_t max_packet_size = sizeof(buffer);
-    int address, port;
-    const int received =
-        socket_recv(connection->socket_handle,
-                    buffer,
-                    max_packet_size,
-                    &address,
-                    &port);
+    switch (payload->status)
+    {
+        case RUDP_STATUS_CONNECTING:
+            // Our accept was lost, say it again
+            if (connection->state == RUDP_STATUS_CONNECTED)
+            {
+                _rudp_send_status(connection, RUDP_STATUS_CONNECTED);
+            }
+            break;
+        case RUDP_STATUS_CONNECTED:
+            if (connection->state == RUDP_STATUS_CONNECTING)
+            {
+                if (connection->has_key)
+                {
+                    _rudp_derive_key(connection, connection->local_nonce, payload->nonce);
+                }
+                _rudp_set_state(connection, RUDP_STATUS_CONNECTED);
+            }
+            break;
+        case RUDP_STATUS_DISCONNECTED:
+            // Redundant goodbyes land here too once we're already disconnected
+            if (rudp_conn_is_active(connection))
+            {
+                _rudp_set_state(connection, RUDP_STATUS_DISCONNECTED);
+            }
+            break;
+        default:
+            fprintf(stderr, "Unexpected status payload: %d\n", payload->status);
+            break;
+    }
+}
+
+bool rudp_conn_process_at(struct rudp_conn* connection, uint8_t* buffer, size_t received, uint64_t recv_ns)
+{
+    if (received < sizeof(struct rudp_header))
+    {
+        return false;
+    }
 
-    if (address != connection->remote_address ||
-        port != connection->remote_port)
+    struct rudp_header* header = (struct rudp_header*)(buffer);
+    if (header->protocol_id != RUDP_PROTOCOL_ID)
     {
+        fprintf(stderr, "Unexpected protocol ID, dropping packet\n");
         return false;
     }
 
-    if (received >= sizeof(struct rudp_header))
+    // TODO: Process ACK bits
+
+    uint8_t* data = buffer + sizeof(*header);
+    size_t len = received - sizeof(*header);
+    if (header->encrypted)
+    {
+        if (!connection->keyed || len < CRYPTO_TAG_SIZE)
+        {
+            return false;
+        }
+
+        struct rudp_crypto_stats* stats = &connection->crypto_stats;
+        if (!_rudp_replay_check(connection, header->sequence))
+        {
+            stats->replays_rejected++;
+            return false;
+        }
+
+        uint8_t nonce[CRYPTO_NONCE_SIZE];
+        _rudp_packet_nonce(!connection->is_server, header->sequence, nonce);
+
+        len -= CRYPTO_TAG_SIZE;
+        const uint64_t start_ns = system_time_ns();
+        const bool authentic =
+            aead_open(
+                connection->session_key,
+                nonce,
+                buffer,
+                sizeof(*header),
+                data,
+                len,
+                data + len);
+        stats->open_ns += system_time_ns() - start_ns;
+        if (!authentic)
+        {
+            stats->auth_failures++;
+            return false;
+        }
+
+        stats->packets_opened++;
+        _rudp_replay_mark(connection, header->sequence);
+    }
+    else if (connection->has_key)
+    {
+        // Only the handshake is allowed in the clear, and only its status.
+        // Nothing else in the packet can be trusted, so anything after the
+        // status is dropped and the packet doesn't count towards sequence
+        // tracking, probing or the receive timeout.
+        struct rudp_status_payload payload;
+        if (!rudp_peek_status(buffer, received, &payload) ||
+            (payload.status != RUDP_STATUS_CONNECTING &&
+             payload.status != RUDP_STATUS_CONNECTED))
+        {
+            return false;
+        }
+
+        _rudp_process_status(connection, &payload);
+        return true;
+    }
+
+    _rudp_track_received(connection, header->sequence, received);
+
+    uint8_t decompressed[COMMON_MAX_MTU];
+    if (header->compressed)
     {
-        struct rudp_header* header = (struct rudp_header*)(buffer);
-        if (header->protocol_id != RUDP_PROTOCOL_ID)
+        if (!connection->codec)
         {
-            fprintf(stderr, "Unexpected protocol ID, dropping packet\n");
+            fprintf(stderr, "Compressed packet but no codec, dropping packet\n");
             return false;
         }
 
-        // TODO: Process ACK bits
+        const uint64_t start_ns = system_time_ns();
+        len = connection->codec->decompress(
+            data,
+            len,
+            decompressed,
+            sizeof(decompressed),
+            connection->codec->state);
+        connection->compress_stats.decompress_ns += system_time_ns() - start_ns;
+        connection->compress_stats.packets_decompressed++;
+        if (len == 0)
+        {
+            fprintf(stderr, "Failed to decompress packet, dropping packet\n");
+            return false;
+        }
 
-        if (header->has_status)
+        data = decompressed;
+    }
+    if (header->has_status)
+    {
+        if (len < sizeof(struct rudp_status_payload))
         {
-            // TODO: support for status payload
+            fprintf(stderr, "Truncated status payload, dropping packet\n");
+            return false;
         }
 
-        uint8_t* data = buffer + sizeof(*header);
-        size_t len = received - sizeof(*header);
-        connection->read_callback(address, port, data, len, connection->context);
+        struct rudp_status_payload payload;
+        memcpy(&payload, data, sizeof(payload));
+        data += sizeof(payload);
+        len -= sizeof(payload);
+        _rudp_process_status(connection, &payload);
+    }
+
+    if (!rudp_conn_is_active(connection))
+    {
+        return true;
+    }
+
+    connection->prev_recv_ns = recv_ns;
+    if (header->has_probe)
+    {
+        if (len < sizeof(struct rudp_probe_payload))
+        {
+            fprintf(stderr, "Truncated probe payload, dropping packet\n");
+            return false;
+        }
+
+        // The rest is padding
+        struct rudp_probe_payload probe;
+        memcpy(&probe, data, sizeof(probe));
+        _rudp_process_probe(connection, &probe, received);
+        return true;
+    }
+
+    if (len > 0 && connection->read_callback)
+    {
+        connection->read_callback(
+            connection->remote_address,
+            connection->remote_port,
+            data,
+            len,
+            connection->context);
     }
 
     return true;
 }
 
-bool _rudp_tick_send(struct rudp_conn* connection)
+bool rudp_conn_process(struct rudp_conn* connection, uint8_t* buffer, size_t received)
 {
-    uint8_t buffer[COMMON_MTU] = {0};
-    struct rudp_header* header = (struct rudp_header*)(buffer);
-    header->protocol_id = RUDP_PROTOCOL_ID;
-    header->has_status = false; // TODO
-    header->ack_bits = 0; // TODO
+    return rudp_conn_process_at(connection, buffer, received, system_time_ns());
+}
 
-    const size_t header_size = sizeof(struct rudp_header);
-    bool all_sends_succeeded = true;
-    for (int p = 0; p < connection->packets_to_send; ++p)
+static bool _rudp_tick_recv(struct rudp_conn* connection)
+{
+    uint8_t buffer[COMMON_MAX_MTU] = {0};
+    const size_t max_packet_size = sizeof(buffer);
+    bool all_packets_valid = true;
+    while (true)
     {
-        struct rudp_queued_packet* packet = &connection->packet_pool[p];
-        const size_t max_len = sizeof(buffer) - header_size;
-        if (packet->len >= max_len)
+        int address, port;
+        uint64_t recv_ns;
+        const int received =
+            socket_recv_timestamped(connection->socket_handle,
+                                    buffer,
+                                    max_packet_size,
+                                    &address,
+                                    &port,
+                                    &recv_ns);
+        if (received <= 0)
         {
-            fprintf(stderr, "Send packet too large - len: %d\n", packet->len);
-            all_sends_succeeded = false;
+            break;
+        }
+
+        if (address != connection->remote_address ||
+            port != connection->remote_port)
+        {
+            all_packets_valid = false;
             continue;
         }
 
-        memcpy(buffer + header_size, packet->data, packet->len);
+        if (!rudp_conn_process_at(connection, buffer, received, recv_ns ? recv_ns : system_time_ns()))
+        {
+            all_packets_valid = false;
+        }
+    }
 
-        size_t total_size = header_size + packet->len;
-        const int sent =
-            socket_send(
-                connection->socket_handle,
-                buffer,
-                total_size,
-                connection->remote_address,
-                connection->remote_port);
-        if (sent != total_size)
+    return all_packets_valid;
+}
+
+static bool _rudp_tick_send(struct rudp_conn* connection)
+{
+    bool all_sends_succeeded = true;
+    for (int p = 0; p < connection->packets_to_send; ++p)
+    {
+        struct rudp_queued_packet* packet = &connection->packet_pool[p];
+        if (!_rudp_send_packet(connection, NULL, packet->data, packet->len))
         {
-            fprintf(stderr, "Send failed - total-size: %d sent: %d\n", total_size, sent);
             all_sends_succeeded = false;
         }
     }
@@ -165,6 +829,33 @@ bool _rudp_tick_send(struct rudp_conn* connection)
     return all_sends_succeeded;
 }
 
+bool rudp_conn_update(struct rudp_conn* connection)
+{
+    const uint64_t now_ns = system_time_ns();
+    if (rudp_conn_is_active(connection) &&
+        now_ns - connection->prev_recv_ns >= connection->timeout_ns)
+    {
+        connection->packets_to_send = 0;
+        _rudp_set_state(connection, RUDP_STATUS_TIMEOUT);
+        return false;
+    }
+
+    if (connection->state == RUDP_STATUS_CONNECTING &&
+        now_ns - connection->prev_status_ns >= RUDP_CONNECT_RETRY_NS)
+    {
+        connection->prev_status_ns = now_ns;
+        _rudp_send_status(connection, RUDP_STATUS_CONNECTING);
+    }
+
+    if (connection->state != RUDP_STATUS_CONNECTED)
+    {
+        return true;
+    }
+
+    _rudp_update_probe(connection, now_ns);
+    return _rudp_tick_send(connection);
+}
+
 bool rudp_tick(struct rudp_conn* connection)
 {
     if (!_rudp_tick_recv(connection))
@@ -172,16 +863,30 @@ bool rudp_tick(struct rudp_conn* connection)
         // TODO: Log something
     }
 
-    if (!_rudp_tick_send(connection))
+    if (!rudp_conn_update(connection))
     {
         // TODO: Log something
     }
 
-    return true;
+    return rudp_conn_is_active(connection);
 }
 
 bool rudp_send(struct rudp_conn* connection, void* data, size_t len)
 {
-    // TODO: enqueue packet data
-    return false;
-}
\ No newline at end of file
+    if (connection->packets_to_send >= connection->packet_pool_size)
+    {
+        return false;
+    }
+
+    struct rudp_queued_packet* packet =
+        &connection->packet_pool[connection->packets_to_send];
+    if (len > rudp_conn_max_payload(connection))
+    {
+        return false;
+    }
+
+    memcpy(packet->data, data, len);
+    packet->len = len;
+    connection->packets_to_send++;
+    return true;
+}
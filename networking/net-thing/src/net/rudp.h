@@ -0,0 +1,297 @@
+#ifndef __RUDP_H__
+#define __RUDP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <net/common.h>
+#include <net/crypto.h>
+#include <system/time.h>
+
+// I dunno I'm hungry
+#define RUDP_PROTOCOL_ID 0xFEED
+#define RUDP_DEFAULT_PACKET_POOL_SIZE 16
+
+#define RUDP_DEFAULT_TIMEOUT_NS (5 * BILLION)
+#define RUDP_CONNECT_RETRY_NS (BILLION / 10)
+
+// Random per-connection handshake input for session key derivation
+#define RUDP_HANDSHAKE_NONCE_SIZE 16
+
+// Width of the replay window, packets older than this are dropped
+#define RUDP_REPLAY_WINDOW 64
+
+// Goodbyes aren't acked, so send a handful and hope one makes it. If none do
+// the remote end falls back to timing out.
+#define RUDP_GOODBYE_REDUNDANCY 4
+
+// Path MTU probing, see rudp_config. A probe that hasn't been acked after
+// this many tries, one retry interval apart, is taken as too big.
+#define RUDP_PROBE_RETRY_NS (BILLION / 10)
+#define RUDP_PROBE_ATTEMPTS 3
+
+enum rudp_status
+{
+    // A sentinel for uninitialized state
+    RUDP_STATUS_INVALID = 0,
+
+    // Waiting on the remote end to acknowledge a hello
+    RUDP_STATUS_CONNECTING,
+
+    // Connection is established
+    RUDP_STATUS_CONNECTED,
+
+    // Local end is saying goodbye
+    RUDP_STATUS_DISCONNECTING,
+
+    // Connection has timed out
+    RUDP_STATUS_TIMEOUT,
+
+    // Connection has gracefully disconnected
+    RUDP_STATUS_DISCONNECTED
+};
+
+struct rudp_queued_packet
+{
+    uint8_t* data;
+    size_t len;
+};
+
+typedef void(*rudp_read_fn)(int address, int port, uint8_t* data, size_t len, void* context);
+typedef void(*rudp_status_fn)(enum rudp_status status, void* context);
+
+// Pluggable payload compression. Both return the number of bytes written to
+// dst, or 0 on failure (including "didn't fit").
+typedef size_t(*rudp_codec_fn)(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap, void* state);
+
+struct rudp_codec
+{
+    const char* name;
+    rudp_codec_fn compress;
+    rudp_codec_fn decompress;
+    void* state;
+};
+
+// Packets smaller than this aren't worth the cycles
+#define RUDP_DEFAULT_COMPRESS_THRESHOLD 128
+
+struct rudp_compress_stats
+{
+    uint64_t packets_compressed;
+    uint64_t packets_uncompressed;
+    uint64_t bytes_before;
+    uint64_t bytes_after;
+    uint64_t compress_ns;
+    uint64_t decompress_ns;
+    uint64_t packets_decompressed;
+};
+
+struct rudp_crypto_stats
+{
+    uint64_t packets_sealed;
+    uint64_t packets_opened;
+    uint64_t auth_failures;
+    uint64_t replays_rejected;
+    uint64_t seal_ns;
+    uint64_t open_ns;
+};
+
+struct rudp_traffic_stats
+{
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+
+    // Gaps in the remote end's sequence numbers. Anything arriving late was
+    // already counted and stays counted.
+    uint64_t packets_lost;
+};
+
+struct rudp_conn
+{
+    int socket_handle;
+    int remote_address;
+    int remote_port;
+    uint16_t ack;
+    uint16_t remote_ack;
+    uint64_t prev_recv_ns;
+    uint64_t prev_status_ns;
+    uint64_t timeout_ns;
+    enum rudp_status state;
+    rudp_read_fn read_callback;
+    rudp_status_fn status_callback;
+    void* context;
+    struct rudp_codec* codec;
+    size_t compress_threshold;
+    struct rudp_compress_stats compress_stats;
+
+    // Encryption, see rudp_conn_set_key. Once keyed, everything but the
+    // handshake is sealed with the session key.
+    bool has_key;
+    bool keyed;
+    bool is_server;
+    uint8_t psk[CRYPTO_KEY_SIZE];
+    uint8_t session_key[CRYPTO_KEY_SIZE];
+    uint8_t local_nonce[RUDP_HANDSHAKE_NONCE_SIZE];
+    uint32_t send_sequence;
+    uint32_t recv_sequence;
+    uint64_t recv_window;
+    struct rudp_crypto_stats crypto_stats;
+
+    uint32_t recv_highest_sequence;
+    struct rudp_traffic_stats traffic_stats;
+
+    // Datagram size, header and tag included, see rudp_config. Starts at
+    // base_mtu and grows as probes up to max_mtu are acked.
+    size_t mtu;
+    size_t base_mtu;
+    size_t max_mtu;
+
+    // Binary search between mtu (known good) and probe_high (not known bad),
+    // done once they meet. probe_size is the one in flight, 0 for none.
+    size_t probe_high;
+    size_t probe_size;
+    int probe_attempts;
+    uint64_t probe_sent_ns;
+
+    // Sized at init, the payloads live in one allocation behind the pool
+    struct rudp_queued_packet* packet_pool;
+    int packet_pool_size;
+    int packets_to_send;
+};
+
+// Per-connection limits, fixed for the life of the connection
+struct rudp_config
+{
+    // Largest datagram sent, header and tag included, until probing finds
+    // something bigger. Should be safe on any path the connection will see.
+    size_t mtu;
+
+    // Once connected, probes with padded packets of up to this size to find
+    // the largest the path takes. At most COMMON_MAX_MTU, the same as mtu
+    // to turn probing off. Probes only mean anything on a socket with
+    // fragmentation disabled, see socket_set_dont_fragment.
+    size_t max_mtu;
+
+    // Packets that can be queued between updates
+    int packet_pool_size;
+
+    uint64_t timeout_ns;
+};
+
+struct rudp_header
+{
+    uint16_t protocol_id;
+    uint32_t ack_bits;
+    uint32_t sequence;
+    bool     has_status;
+    bool     has_probe;
+    bool     compressed;
+    bool     encrypted;
+};
+
+// Follows the header when has_status is set. The nonce is only meaningful on
+// the handshake (connecting/connected) and only if encryption is on.
+struct rudp_status_payload
+{
+    uint8_t status;
+    uint8_t nonce[RUDP_HANDSHAKE_NONCE_SIZE];
+};
+
+enum rudp_probe_kind
+{
+    RUDP_PROBE_REQUEST = 1,
+    RUDP_PROBE_ACK
+};
+
+// Follows the status payload (if any) when has_probe is set. A request is
+// padded out to mtu, header and tag included, and the ack echoes mtu back.
+// Neither carries data.
+struct rudp_probe_payload
+{
+    uint8_t kind;
+    uint16_t mtu;
+};
+
+// Leaves room for the AEAD tag whether or not the connection is encrypted
+#define RUDP_PACKET_OVERHEAD (sizeof(struct rudp_header) + CRYPTO_TAG_SIZE)
+
+// Payload that fits in the largest MTU, use it to size buffers. What a given
+// connection will actually take is rudp_conn_max_payload.
+#define RUDP_MAX_PAYLOAD_SIZE (COMMON_MAX_MTU - RUDP_PACKET_OVERHEAD)
+
+void rudp_config_default(struct rudp_config* config);
+
+// config may be NULL for the defaults. Allocates the packet pool, which
+// rudp_conn_close frees again.
+bool rudp_conn_init(
+    int socket_handle,
+    int remote_address,
+    int remote_port,
+    rudp_read_fn read_callback,
+    rudp_status_fn status_callback,
+    void* context,
+    const struct rudp_config* config,
+    struct rudp_conn* connection_out);
+
+// Largest len rudp_send will take, which grows as the MTU is discovered
+size_t rudp_conn_max_payload(const struct rudp_conn* connection);
+
+// True once probing has found the largest MTU it's going to, or is off
+bool rudp_conn_mtu_settled(const struct rudp_conn* connection);
+
+// Both ends need the same codec (and dictionary, if it uses one)
+void rudp_conn_set_codec(struct rudp_conn* connection, struct rudp_codec* codec, size_t threshold);
+
+// Pre-shared key, both ends must have the same one. The session key is derived
+// from it and both handshake nonces, so every connection gets its own.
+//
+// Note the hello itself can't be authenticated, a spoofed one still gets a
+// slot but can't do anything with it other than time out.
+void rudp_conn_set_key(struct rudp_conn* connection, const uint8_t key[CRYPTO_KEY_SIZE]);
+
+const char* rudp_status_name(enum rudp_status status);
+
+bool rudp_conn_connect(struct rudp_conn* connection);
+
+// Builds [header][status payload][data] into buffer, compressed and sealed as
+// configured, and returns its length or 0 on failure. Either of status/data
+// may be left out. Consumes a sequence number, normally only called on the
+// way to the socket.
+size_t rudp_conn_encode(
+    struct rudp_conn* connection,
+    const struct rudp_status_payload* status,
+    const uint8_t* data,
+    size_t len,
+    uint8_t buffer[COMMON_MAX_MTU]);
+
+// Reads the status payload out of a packet, if it has one, without touching
+// any connection state. Handy for servers deciding whether an unknown sender
+// should get a slot.
+bool rudp_peek_status(uint8_t* data, size_t len, struct rudp_status_payload* payload_out);
+
+// Server side of the handshake, call with the hello that came in
+bool rudp_conn_accept(struct rudp_conn* connection, uint8_t* hello, size_t len);
+
+bool rudp_conn_is_active(const struct rudp_conn* connection);
+
+// Says goodbye if still active, then frees and clears the connection
+bool rudp_conn_close(struct rudp_conn* connection);
+
+// Processes a packet which has already been read off the socket and matched to
+// this connection. recv_ns is when it arrived, read callbacks can find that in
+// prev_recv_ns if they need better than tick resolution.
+bool rudp_conn_process_at(struct rudp_conn* connection, uint8_t* buffer, size_t received, uint64_t recv_ns);
+bool rudp_conn_process(struct rudp_conn* connection, uint8_t* buffer, size_t received);
+
+// Handles handshake retries, timeouts and flushes queued packets. Servers
+// sharing a socket between connections call this instead of rudp_tick and
+// feed received packets through rudp_conn_process.
+bool rudp_conn_update(struct rudp_conn* connection);
+
+bool rudp_tick(struct rudp_conn* connection);
+bool rudp_send(struct rudp_conn* connection, void* data, size_t len);
+
+#endif // __RUDP_H__
@@ -0,0 +1,253 @@
+#include <net/sched.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <system/time.h>
+
+void sched_conn_init(struct sched_conn* conn, uint32_t kbps)
+{
+    memset(conn, 0, sizeof(*conn));
+    conn->kbps = kbps;
+    conn->stats.kbps = kbps;
+    conn->packet_size = SCHED_DEFAULT_PACKET_SIZE;
+}
+
+void sched_set_kbps(struct sched_conn* conn, uint32_t kbps)
+{
+    conn->kbps = kbps;
+    conn->stats.kbps = kbps;
+}
+
+void sched_set_packet_size(struct sched_conn* conn, size_t packet_size)
+{
+    if (packet_size > SCHED_MAX_PACKET_SIZE)
+    {
+        packet_size = SCHED_MAX_PACKET_SIZE;
+    }
+
+    if (packet_size >= conn->packet_size)
+    {
+        conn->packet_size = packet_size;
+        return;
+    }
+
+    // Whatever no longer fits would sit in the queue forever
+    conn->packet_size = packet_size;
+    int next = 0;
+    for (int m = 0; m < conn->num_messages; ++m)
+    {
+        if (conn->messages[m].len + SCHED_MESSAGE_PREFIX_SIZE > packet_size)
+        {
+            conn->stats.messages_dropped++;
+            continue;
+        }
+
+        if (next != m)
+        {
+            conn->messages[next] = conn->messages[m];
+        }
+        ++next;
+    }
+    conn->num_messages = next;
+}
+
+bool sched_enqueue(struct sched_conn* conn, void* data, size_t len, float priority)
+{
+    if (len + SCHED_MESSAGE_PREFIX_SIZE > conn->packet_size)
+    {
+        fprintf(stderr, "Scheduled message too large - len: %zu\n", len);
+        conn->stats.messages_dropped++;
+        return false;
+    }
+
+    if (conn->num_messages >= SCHED_MAX_MESSAGES)
+    {
+        conn->stats.messages_dropped++;
+        return false;
+    }
+
+    struct sched_message* message = &conn->messages[conn->num_messages++];
+    memcpy(message->data, data, len);
+    message->len = len;
+    message->priority = priority;
+    message->accumulator = 0.f;
+
+    return true;
+}
+
+static uint64_t _sched_bytes_per_sec(const struct sched_conn* conn)
+{
+    return (uint64_t)conn->kbps * 1000 / 8;
+}
+
+static void _sched_refill_budget(struct sched_conn* conn, uint64_t now_ns)
+{
+    const uint64_t bytes_per_sec = _sched_bytes_per_sec(conn);
+    if (conn->prev_tick_ns == 0)
+    {
+        conn->prev_tick_ns = now_ns;
+        conn->window_start_ns = now_ns;
+    }
+
+    const uint64_t delta_ns = now_ns - conn->prev_tick_ns;
+    conn->prev_tick_ns = now_ns;
+    conn->budget_bytes += (int64_t)(bytes_per_sec * delta_ns / BILLION);
+
+    // Always enough for one full packet, or a slow connection would never
+    // get one out
+    const int64_t packet_wire_size = conn->packet_size + RUDP_PACKET_OVERHEAD;
+    int64_t max_budget = bytes_per_sec / SCHED_MAX_BURST_DIVISOR;
+    if (max_budget < packet_wire_size)
+    {
+        max_budget = packet_wire_size;
+    }
+
+    if (conn->budget_bytes > max_budget)
+    {
+        conn->budget_bytes = max_budget;
+    }
+}
+
+static void _sched_update_window(struct sched_conn* conn, uint64_t now_ns)
+{
+    if (now_ns - conn->window_start_ns < BILLION)
+    {
+        return;
+    }
+
+    const uint64_t window_ns = now_ns - conn->window_start_ns;
+    const uint64_t bytes_per_sec = _sched_bytes_per_sec(conn);
+    const double allowed = (double)bytes_per_sec * window_ns / BILLION;
+
+    conn->stats.window_bytes = conn->window_bytes;
+    conn->stats.utilization = allowed > 0.0 ? conn->window_bytes / allowed : 0.f;
+    conn->window_bytes = 0;
+    conn->window_start_ns = now_ns;
+}
+
+// Sorts message indices by accumulated priority, highest first. The queue is
+// small enough that insertion sort is plenty.
+static void _sched_sort(struct sched_conn* conn, int* order)
+{
+    for (int m = 0; m < conn->num_messages; ++m)
+    {
+        const float accumulator = conn->messages[m].accumulator;
+        int i = m;
+        while (i > 0 && conn->messages[order[i - 1]].accumulator < accumulator)
+        {
+            order[i] = order[i - 1];
+            --i;
+        }
+        order[i] = m;
+    }
+}
+
+bool sched_tick(struct sched_conn* conn, uint64_t now_ns, sched_write_fn write_callback, void* context)
+{
+    _sched_refill_budget(conn, now_ns);
+
+    for (int m = 0; m < conn->num_messages; ++m)
+    {
+        struct sched_message* message = &conn->messages[m];
+        message->accumulator += message->priority;
+    }
+
+    int order[SCHED_MAX_MESSAGES];
+    _sched_sort(conn, order);
+
+    bool sent[SCHED_MAX_MESSAGES] = {0};
+    int remaining = conn->num_messages;
+    bool all_writes_succeeded = true;
+    while (remaining > 0 && conn->budget_bytes > 0)
+    {
+        uint8_t packet[SCHED_MAX_PACKET_SIZE];
+        size_t packet_len = 0;
+        int packed[SCHED_MAX_MESSAGES];
+        int num_packed = 0;
+        for (int o = 0; o < conn->num_messages; ++o)
+        {
+            const int m = order[o];
+            struct sched_message* message = &conn->messages[m];
+            const size_t framed_len = SCHED_MESSAGE_PREFIX_SIZE + message->len;
+            if (sent[m] || packet_len + framed_len > conn->packet_size)
+            {
+                continue;
+            }
+
+            const uint16_t len = message->len;
+            memcpy(packet + packet_len, &len, sizeof(len));
+            memcpy(packet + packet_len + sizeof(len), message->data, len);
+            packet_len += framed_len;
+            sent[m] = true;
+            packed[num_packed++] = m;
+            --remaining;
+        }
+
+        // Nothing went out, e.g. rudp's packet pool is full. What was packed
+        // stays queued with its accumulator for the next tick, and isn't
+        // charged against the budget.
+        if (!write_callback(packet, packet_len, context))
+        {
+            for (int p = 0; p < num_packed; ++p)
+            {
+                sent[packed[p]] = false;
+            }
+            all_writes_succeeded = false;
+            break;
+        }
+
+        // Charge the header and tag too, that's real bandwidth
+        const size_t wire_len = packet_len + RUDP_PACKET_OVERHEAD;
+        conn->budget_bytes -= wire_len;
+        conn->window_bytes += wire_len;
+        conn->stats.bytes_sent += wire_len;
+        conn->stats.packets_sent++;
+    }
+
+    // Compact whatever didn't make it out, it keeps its accumulator
+    int next = 0;
+    for (int m = 0; m < conn->num_messages; ++m)
+    {
+        if (sent[m])
+        {
+            conn->stats.messages_sent++;
+            continue;
+        }
+
+        if (next != m)
+        {
+            conn->messages[next] = conn->messages[m];
+        }
+        ++next;
+    }
+    conn->num_messages = next;
+    conn->stats.messages_deferred = next;
+
+    _sched_update_window(conn, now_ns);
+    return all_writes_succeeded;
+}
+
+void sched_get_stats(const struct sched_conn* conn, struct sched_stats* stats_out)
+{
+    *stats_out = conn->stats;
+}
+
+void sched_read_packet(uint8_t* data, size_t len, rudp_read_fn read_callback, int address, int port, void* context)
+{
+    size_t offset = 0;
+    while (offset + SCHED_MESSAGE_PREFIX_SIZE <= len)
+    {
+        uint16_t message_len;
+        memcpy(&message_len, data + offset, sizeof(message_len));
+        offset += sizeof(message_len);
+        if (offset + message_len > len)
+        {
+            fprintf(stderr, "Truncated scheduled message, dropping remainder\n");
+            return;
+        }
+
+        read_callback(address, port, data + offset, message_len, context);
+        offset += message_len;
+    }
+}
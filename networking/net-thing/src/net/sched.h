@@ -0,0 +1,89 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+// Per-connection bandwidth budget + priority scheduler. Messages queued on a
+// connection accumulate priority every tick they wait; each tick the highest
+// accumulated messages are packed into MTU-sized packets for as long as the
+// connection's byte budget allows.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <net/rudp.h>
+
+#define SCHED_MAX_MESSAGES 64
+
+// Each message in a packet is prefixed by its length. Packets are never
+// bigger than the largest payload rudp allows, and default to what fits in
+// the default MTU.
+#define SCHED_MESSAGE_PREFIX_SIZE sizeof(uint16_t)
+#define SCHED_MAX_PACKET_SIZE RUDP_MAX_PAYLOAD_SIZE
+#define SCHED_DEFAULT_PACKET_SIZE (COMMON_MTU - RUDP_PACKET_OVERHEAD)
+#define SCHED_MAX_MESSAGE_SIZE (SCHED_MAX_PACKET_SIZE - SCHED_MESSAGE_PREFIX_SIZE)
+
+// Don't let an idle connection bank more than this fraction of a second's
+// worth of budget, otherwise it can burst way over its cap
+#define SCHED_MAX_BURST_DIVISOR 10
+
+struct sched_message
+{
+    uint8_t data[SCHED_MAX_MESSAGE_SIZE];
+    uint16_t len;
+    float priority;
+    float accumulator;
+};
+
+struct sched_stats
+{
+    uint32_t kbps;
+    uint64_t bytes_sent;
+    uint64_t packets_sent;
+    uint64_t messages_sent;
+    uint64_t messages_dropped;
+
+    // Messages which were queued but didn't make it out on the last tick
+    int messages_deferred;
+
+    // Bytes sent during the last full stats window, and that as a fraction of
+    // the configured cap
+    uint64_t window_bytes;
+    float utilization;
+};
+
+typedef bool(*sched_write_fn)(uint8_t* data, size_t len, void* context);
+
+struct sched_conn
+{
+    uint32_t kbps;
+    int64_t budget_bytes;
+    uint64_t prev_tick_ns;
+    size_t packet_size;
+
+    struct sched_message messages[SCHED_MAX_MESSAGES];
+    int num_messages;
+
+    uint64_t window_start_ns;
+    uint64_t window_bytes;
+    struct sched_stats stats;
+};
+
+void sched_conn_init(struct sched_conn* conn, uint32_t kbps);
+void sched_set_kbps(struct sched_conn* conn, uint32_t kbps);
+
+// Largest packet handed to the write callback, normally the connection's
+// rudp_conn_max_payload. Messages that don't fit are refused at enqueue, or
+// dropped if they were queued before it shrank.
+void sched_set_packet_size(struct sched_conn* conn, size_t packet_size);
+
+bool sched_enqueue(struct sched_conn* conn, void* data, size_t len, float priority);
+// Packs and writes as much of the queue as the budget allows. A write that
+// fails stops the tick, and its messages stay queued uncharged. False if
+// any write failed.
+bool sched_tick(struct sched_conn* conn, uint64_t now_ns, sched_write_fn write_callback, void* context);
+void sched_get_stats(const struct sched_conn* conn, struct sched_stats* stats_out);
+
+// Splits a scheduled packet back into its messages
+void sched_read_packet(uint8_t* data, size_t len, rudp_read_fn read_callback, int address, int port, void* context);
+
+#endif // __SCHED_H__
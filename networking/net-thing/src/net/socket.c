@@ -1,4 +1,7 @@
-#include <net/common.h>
+#include <net/socket.h>
+
+#include <string.h>
+#include <time.h>
 
 int socket_create_udp()
 {
@@ -36,7 +39,7 @@ bool socket_set_nonblocking(int socket)
     return true;
 }
 
-int socket_send(int socket, char* buffer, size_t len, int address, int port)
+int socket_send(int socket, void* buffer, size_t len, int address, int port)
 {
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
@@ -58,7 +61,7 @@ int socket_send(int socket, char* buffer, size_t len, int address, int port)
     return sent;
 }
 
-int socket_recv(int socket, char* buffer, size_t maxlen, int* address, int* port)
+int socket_recv(int socket, void* buffer, size_t maxlen, int* address, int* port)
 {
     *address = -1;
     *port = -1;
@@ -82,6 +85,117 @@ int socket_recv(int socket, char* buffer, size_t maxlen, int* address, int* port
     return received;
 }
 
+bool socket_set_timestamping(int socket)
+{
+    const int enable = 1;
+    if (setsockopt(socket,
+                   SOL_SOCKET,
+                   SO_TIMESTAMPNS,
+                   &enable,
+                   sizeof(enable)))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool socket_set_dont_fragment(int socket)
+{
+    const int discover = IP_PMTUDISC_DO;
+    if (setsockopt(socket,
+                   IPPROTO_IP,
+                   IP_MTU_DISCOVER,
+                   &discover,
+                   sizeof(discover)))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool socket_set_buffer_sizes(int socket, int rcvbuf, int sndbuf)
+{
+    if (rcvbuf > 0 &&
+        setsockopt(socket,
+                   SOL_SOCKET,
+                   SO_RCVBUF,
+                   &rcvbuf,
+                   sizeof(rcvbuf)))
+    {
+        return false;
+    }
+
+    if (sndbuf > 0 &&
+        setsockopt(socket,
+                   SOL_SOCKET,
+                   SO_SNDBUF,
+                   &sndbuf,
+                   sizeof(sndbuf)))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool socket_set_busy_poll(int socket, int us)
+{
+    if (setsockopt(socket,
+                   SOL_SOCKET,
+                   SO_BUSY_POLL,
+                   &us,
+                   sizeof(us)))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+int socket_recv_timestamped(int socket, void* buffer, size_t maxlen, int* address, int* port, uint64_t* recv_ns)
+{
+    *address = -1;
+    *port = -1;
+    *recv_ns = 0;
+
+    struct sockaddr_in from;
+    struct iovec iov = {
+        .iov_base = buffer,
+        .iov_len = maxlen
+    };
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct msghdr message = {
+        .msg_name = &from,
+        .msg_namelen = sizeof(from),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    const int received = recvmsg(socket, &message, 0);
+    if (received <= 0)
+    {
+        return received;
+    }
+
+    *address = ntohl(from.sin_addr.s_addr);
+    *port = ntohs(from.sin_port);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec spec;
+            memcpy(&spec, CMSG_DATA(cmsg), sizeof(spec));
+            *recv_ns = (uint64_t)spec.tv_sec * 1000000000ull + spec.tv_nsec;
+        }
+    }
+
+    return received;
+}
+
 void socket_close(int socket)
 {
     close(socket);
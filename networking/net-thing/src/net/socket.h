@@ -0,0 +1,40 @@
+#ifndef __SOCKET_H__
+#define __SOCKET_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <net/common.h>
+
+int socket_create_udp();
+bool socket_bind(int socket, int port);
+bool socket_set_nonblocking(int socket);
+int socket_send(int socket, void* buffer, size_t len, int address, int port);
+int socket_recv(int socket, void* buffer, size_t maxlen, int* address, int* port);
+
+// Has the kernel stamp datagrams as they arrive, for callers that care how
+// long a packet sat in the socket buffer before they got to it
+bool socket_set_timestamping(int socket);
+
+// Sets DF on everything sent, so datagrams too big for the path are dropped
+// (or refused with EMSGSIZE, once the kernel has heard about the path MTU)
+// instead of fragmented. MTU probing needs it to learn anything.
+bool socket_set_dont_fragment(int socket);
+
+// Kernel buffer sizes in bytes, 0 leaves that one alone. The kernel caps
+// these at net.core.rmem_max/wmem_max unless we're privileged.
+bool socket_set_buffer_sizes(int socket, int rcvbuf, int sndbuf);
+
+// Has the kernel spin on the device queue for up to us microseconds on a
+// blocking read before sleeping. Needs a driver that supports it, and
+// CAP_NET_ADMIN to go above net.core.busy_read.
+bool socket_set_busy_poll(int socket, int us);
+
+// Like socket_recv, also returns the arrival time in CLOCK_REALTIME
+// nanoseconds. That's 0 if timestamping isn't enabled on the socket.
+int socket_recv_timestamped(int socket, void* buffer, size_t maxlen, int* address, int* port, uint64_t* recv_ns);
+
+void socket_close(int socket);
+
+#endif // __SOCKET_H__
@@ -0,0 +1,288 @@
+#include <server/config.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <system/time.h>
+#include <util/util.h>
+
+struct server_config_option
+{
+    const char* key;
+    size_t offset;
+    int min;
+    int max;
+    const char* help;
+};
+
+#define SERVER_CONFIG_OPTION(key, field, min, max, help) \
+        { key, offsetof(struct server_config, field), min, max, help }
+
+static const struct server_config_option s_options[] = {
+    SERVER_CONFIG_OPTION("port", port, 1, 65535, "UDP port to listen on"),
+    SERVER_CONFIG_OPTION("tick-freq", tick_freq, 1, 1000, "Server ticks per second"),
+    SERVER_CONFIG_OPTION("timeout-sec", timeout_sec, 1, 3600, "Drop clients silent for this long"),
+    SERVER_CONFIG_OPTION("max-connections", max_connections, 1, 65536, "Client slots"),
+    SERVER_CONFIG_OPTION("client-kbps", client_kbps, 1, INT_MAX, "Outgoing bandwidth cap per client"),
+    SERVER_CONFIG_OPTION("num-entities", num_entities, 0, INT_MAX, "Simulated entities"),
+    SERVER_CONFIG_OPTION(
+        "mtu",
+        mtu,
+        RUDP_PACKET_OVERHEAD + sizeof(struct rudp_status_payload) + 1,
+        COMMON_MAX_MTU,
+        "Datagram size to start at, headers included"),
+    SERVER_CONFIG_OPTION(
+        "max-mtu",
+        max_mtu,
+        RUDP_PACKET_OVERHEAD + sizeof(struct rudp_status_payload) + 1,
+        COMMON_MAX_MTU,
+        "Largest datagram MTU probing may try, mtu for no probing"),
+    SERVER_CONFIG_OPTION("packet-pool-size", packet_pool_size, 1, 65536, "Packets queued per client per tick"),
+    SERVER_CONFIG_OPTION("rcvbuf", rcvbuf, 0, INT_MAX, "SO_RCVBUF in bytes, 0 for the default"),
+    SERVER_CONFIG_OPTION("sndbuf", sndbuf, 0, INT_MAX, "SO_SNDBUF in bytes, 0 for the default"),
+    SERVER_CONFIG_OPTION("busy-poll-us", busy_poll_us, 0, INT_MAX, "SO_BUSY_POLL, 0 for off"),
+    SERVER_CONFIG_OPTION("cpu", cpu, -1, INT_MAX, "Pin the tick thread to this CPU, -1 for off"),
+};
+
+// Options that take a path rather than a number, empty means unset
+struct server_config_path_option
+{
+    const char* key;
+    size_t offset;
+    const char* help;
+};
+
+#define SERVER_CONFIG_PATH_OPTION(key, field, help) \
+        { key, offsetof(struct server_config, field), help }
+
+static const struct server_config_path_option s_path_options[] = {
+    SERVER_CONFIG_PATH_OPTION("dictionary", dictionary, "Compression dictionary, clients need the same one"),
+    SERVER_CONFIG_PATH_OPTION("capture", capture, "Append every payload here for dict_train"),
+};
+
+void server_config_default(struct server_config* config)
+{
+    config->port = SERVER_PORT;
+    config->tick_freq = SERVER_DEFAULT_TICK_FREQ;
+    config->timeout_sec = SERVER_DEFAULT_TIMEOUT_SEC;
+    config->max_connections = SERVER_DEFAULT_MAX_CONNECTIONS;
+    config->client_kbps = SERVER_DEFAULT_CLIENT_KBPS;
+    config->num_entities = SERVER_DEFAULT_NUM_ENTITIES;
+    config->mtu = COMMON_MTU;
+    config->max_mtu = COMMON_MAX_MTU;
+    config->packet_pool_size = RUDP_DEFAULT_PACKET_POOL_SIZE;
+    config->rcvbuf = 0;
+    config->sndbuf = 0;
+    config->busy_poll_us = 0;
+    config->cpu = -1;
+    config->dictionary[0] = '\0';
+    config->capture[0] = '\0';
+}
+
+static int* _server_config_field(struct server_config* config, const struct server_config_option* option)
+{
+    return (int*)((char*)config + option->offset);
+}
+
+static char* _server_config_path(struct server_config* config, const struct server_config_path_option* option)
+{
+    return (char*)config + option->offset;
+}
+
+bool server_config_set(struct server_config* config, const char* key, const char* value)
+{
+    for (size_t o = 0; o < ARRAY_SIZE(s_path_options); ++o)
+    {
+        const struct server_config_path_option* option = &s_path_options[o];
+        if (strcmp(option->key, key) != 0)
+        {
+            continue;
+        }
+
+        const size_t len = strlen(value);
+        if (len >= SERVER_CONFIG_MAX_PATH)
+        {
+            fprintf(stderr,
+                    "Path too long for %s - len: %zu max: %d\n",
+                    key,
+                    len,
+                    SERVER_CONFIG_MAX_PATH - 1);
+            return false;
+        }
+
+        memcpy(_server_config_path(config, option), value, len + 1);
+        return true;
+    }
+
+    for (size_t o = 0; o < ARRAY_SIZE(s_options); ++o)
+    {
+        const struct server_config_option* option = &s_options[o];
+        if (strcmp(option->key, key) != 0)
+        {
+            continue;
+        }
+
+        char* end = NULL;
+        errno = 0;
+        const long parsed = strtol(value, &end, 10);
+        if (errno != 0 || end == value || *end != '\0' ||
+            parsed < option->min || parsed > option->max)
+        {
+            fprintf(stderr,
+                    "Bad value for %s - value: '%s' expected: [%d, %d]\n",
+                    key,
+                    value,
+                    option->min,
+                    option->max);
+            return false;
+        }
+
+        *_server_config_field(config, option) = (int)parsed;
+        return true;
+    }
+
+    fprintf(stderr, "Unknown config key - key: '%s'\n", key);
+    return false;
+}
+
+static char* _server_config_trim(char* text)
+{
+    while (isspace((unsigned char)*text))
+    {
+        ++text;
+    }
+
+    char* end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+    {
+        --end;
+    }
+    *end = '\0';
+    return text;
+}
+
+bool server_config_load(struct server_config* config, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open config - path: %s errno: %d\n", path, errno);
+        return false;
+    }
+
+    char line[SERVER_CONFIG_MAX_LINE];
+    int line_number = 0;
+    bool valid = true;
+    while (fgets(line, sizeof(line), file))
+    {
+        ++line_number;
+        char* comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char* text = _server_config_trim(line);
+        if (*text == '\0')
+        {
+            continue;
+        }
+
+        char* equals = strchr(text, '=');
+        if (!equals)
+        {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+            valid = false;
+            continue;
+        }
+
+        *equals = '\0';
+        if (!server_config_set(config, _server_config_trim(text), _server_config_trim(equals + 1)))
+        {
+            fprintf(stderr, "  at %s:%d\n", path, line_number);
+            valid = false;
+        }
+    }
+
+    fclose(file);
+    return valid;
+}
+
+static void _server_config_usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [--config path] [--<key> value]...\n\n", program);
+    fprintf(stderr, "  %-18s %s\n", "--config", "Read key = value lines from a file first");
+    for (size_t o = 0; o < ARRAY_SIZE(s_options); ++o)
+    {
+        fprintf(stderr, "  --%-16s %s\n", s_options[o].key, s_options[o].help);
+    }
+    for (size_t o = 0; o < ARRAY_SIZE(s_path_options); ++o)
+    {
+        fprintf(stderr, "  --%-16s %s\n", s_path_options[o].key, s_path_options[o].help);
+    }
+}
+
+bool server_config_parse_args(struct server_config* config, int argc, char** argv)
+{
+    // Options must come in pairs, and the file goes first so the command
+    // line can override bits of it
+    for (int a = 1; a < argc; a += 2)
+    {
+        if (strncmp(argv[a], "--", 2) != 0 || a + 1 >= argc)
+        {
+            _server_config_usage(argv[0]);
+            return false;
+        }
+
+        if (strcmp(argv[a], "--config") == 0 && !server_config_load(config, argv[a + 1]))
+        {
+            return false;
+        }
+    }
+
+    for (int a = 1; a < argc; a += 2)
+    {
+        if (strcmp(argv[a], "--config") == 0)
+        {
+            continue;
+        }
+
+        if (!server_config_set(config, argv[a] + 2, argv[a + 1]))
+        {
+            _server_config_usage(argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void server_config_rudp(const struct server_config* config, struct rudp_config* rudp_out)
+{
+    rudp_config_default(rudp_out);
+    rudp_out->mtu = config->mtu;
+    rudp_out->max_mtu = config->max_mtu > config->mtu ? config->max_mtu : config->mtu;
+    rudp_out->packet_pool_size = config->packet_pool_size;
+    rudp_out->timeout_ns = (uint64_t)config->timeout_sec * BILLION;
+}
+
+void server_config_print(const struct server_config* config, FILE* stream)
+{
+    for (size_t o = 0; o < ARRAY_SIZE(s_options); ++o)
+    {
+        const int* value = (const int*)((const char*)config + s_options[o].offset);
+        fprintf(stream, "%s = %d\n", s_options[o].key, *value);
+    }
+    for (size_t o = 0; o < ARRAY_SIZE(s_path_options); ++o)
+    {
+        const char* path = (const char*)config + s_path_options[o].offset;
+        if (*path != '\0')
+        {
+            fprintf(stream, "%s = %s\n", s_path_options[o].key, path);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef __SERVER_CONFIG_H__
+#define __SERVER_CONFIG_H__
+
+// Everything about the server that can be tuned per box without a rebuild.
+// Starts from the defaults below, then a config file if one is given, then
+// whatever else is on the command line, each overriding the last.
+//
+// The config file has one "key = value" per line, # starts a comment. Keys
+// are the command line options without the dashes:
+//
+//     # Small box, low latency
+//     tick-freq = 60
+//     max-connections = 64
+//     max-mtu = 1400
+//     busy-poll-us = 50
+//     cpu = 2
+//     dictionary = snapshots.dict
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <net/common.h>
+#include <net/rudp.h>
+
+#define SERVER_DEFAULT_TICK_FREQ 120
+#define SERVER_DEFAULT_TIMEOUT_SEC 5
+#define SERVER_DEFAULT_MAX_CONNECTIONS 2
+
+// Outgoing bandwidth cap per client
+#define SERVER_DEFAULT_CLIENT_KBPS 256
+
+// Simulated world, nothing is replicated to clients yet
+#define SERVER_DEFAULT_NUM_ENTITIES 4096
+
+// Longest line a config file may have
+#define SERVER_CONFIG_MAX_LINE 256
+
+// Longest path a path option may hold
+#define SERVER_CONFIG_MAX_PATH 256
+
+struct server_config
+{
+    int port;
+    int tick_freq;
+    int timeout_sec;
+    int max_connections;
+    int client_kbps;
+    int num_entities;
+
+    // Per connection, see rudp_config. max_mtu the same as mtu turns MTU
+    // probing off.
+    int mtu;
+    int max_mtu;
+    int packet_pool_size;
+
+    // Socket tuning, 0 leaves the kernel's defaults alone. See
+    // socket_set_buffer_sizes and socket_set_busy_poll.
+    int rcvbuf;
+    int sndbuf;
+    int busy_poll_us;
+
+    // CPU the tick thread is pinned to, -1 to let the scheduler decide
+    int cpu;
+
+    // Compression dictionary from dict_train, empty for none. Clients have
+    // to be started with the same file or nothing will decompress.
+    char dictionary[SERVER_CONFIG_MAX_PATH];
+
+    // Every payload sent or received gets appended here as dict_train
+    // input, empty to not capture
+    char capture[SERVER_CONFIG_MAX_PATH];
+};
+
+void server_config_default(struct server_config* config);
+
+// Sets one option by name, as it appears in a config file. False (and a
+// message) if the key is unknown, the value isn't a number in range or a
+// path is too long.
+bool server_config_set(struct server_config* config, const char* key, const char* value);
+
+bool server_config_load(struct server_config* config, const char* path);
+
+// Applies --config <path> first wherever it appears, then every other
+// --<key> <value> in order. False on anything it doesn't understand, after
+// printing usage.
+bool server_config_parse_args(struct server_config* config, int argc, char** argv);
+
+// Connection settings every client connection gets
+void server_config_rudp(const struct server_config* config, struct rudp_config* rudp_out);
+
+void server_config_print(const struct server_config* config, FILE* stream);
+
+#endif // __SERVER_CONFIG_H__
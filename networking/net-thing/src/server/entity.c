@@ -0,0 +1,282 @@
+#include <server/entity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+static enum entity_simd s_entity_simd = ENTITY_SIMD_AVX2;
+
+enum entity_simd entity_best_simd()
+{
+#if defined(__AVX2__)
+    return ENTITY_SIMD_AVX2;
+#elif defined(__SSE2__)
+    return ENTITY_SIMD_SSE2;
+#else
+    return ENTITY_SIMD_SCALAR;
+#endif
+}
+
+void entity_set_simd(enum entity_simd simd)
+{
+    s_entity_simd = simd;
+}
+
+enum entity_simd entity_get_simd()
+{
+    const enum entity_simd best = entity_best_simd();
+    return s_entity_simd < best ? s_entity_simd : best;
+}
+
+const char* entity_simd_name(enum entity_simd simd)
+{
+    switch (simd)
+    {
+    case ENTITY_SIMD_SCALAR: return "scalar";
+    case ENTITY_SIMD_SSE2: return "sse2";
+    case ENTITY_SIMD_AVX2: return "avx2";
+    }
+
+    return "unknown";
+}
+
+bool entity_store_init(struct entity_store* store, uint32_t capacity, float world_size)
+{
+    memset(store, 0, sizeof(*store));
+
+    // 32 byte aligned and padded so every path can use aligned full width loads
+    const uint32_t padded = (capacity + ENTITY_LANES - 1) / ENTITY_LANES * ENTITY_LANES;
+    const size_t size = (size_t)padded * sizeof(float);
+    store->x = aligned_alloc(32, size);
+    store->y = aligned_alloc(32, size);
+    store->vx = aligned_alloc(32, size);
+    store->vy = aligned_alloc(32, size);
+    store->flags = aligned_alloc(32, size);
+    if (!store->x || !store->y || !store->vx || !store->vy || !store->flags)
+    {
+        fprintf(stderr, "Failed to allocate entity store - capacity: %u\n", capacity);
+        entity_store_free(store);
+        return false;
+    }
+
+    // Padding lanes sit still at the origin, which never counts as a bounce
+    memset(store->x, 0, size);
+    memset(store->y, 0, size);
+    memset(store->vx, 0, size);
+    memset(store->vy, 0, size);
+    memset(store->flags, 0, size);
+    store->capacity = capacity;
+    store->world_size = world_size;
+    return true;
+}
+
+void entity_store_free(struct entity_store* store)
+{
+    free(store->x);
+    free(store->y);
+    free(store->vx);
+    free(store->vy);
+    free(store->flags);
+    memset(store, 0, sizeof(*store));
+}
+
+int entity_spawn(struct entity_store* store, float x, float y, float vx, float vy, uint32_t flags)
+{
+    if (store->count >= store->capacity)
+    {
+        return -1;
+    }
+
+    const uint32_t index = store->count++;
+    store->x[index] = x;
+    store->y[index] = y;
+    store->vx[index] = vx;
+    store->vy[index] = vy;
+    store->flags[index] = flags;
+    return index;
+}
+
+void entity_remove(struct entity_store* store, uint32_t index)
+{
+    if (index >= store->count)
+    {
+        return;
+    }
+
+    const uint32_t last = --store->count;
+    store->x[index] = store->x[last];
+    store->y[index] = store->y[last];
+    store->vx[index] = store->vx[last];
+    store->vy[index] = store->vy[last];
+    store->flags[index] = store->flags[last];
+
+    store->x[last] = 0.f;
+    store->y[last] = 0.f;
+    store->vx[last] = 0.f;
+    store->vy[last] = 0.f;
+    store->flags[last] = 0;
+}
+
+// Moves one axis and reflects off [0, world_size], true if it bounced
+static bool _entity_move_axis(float* position, float* velocity, float step, float world_size)
+{
+    float p = *position + step;
+    if (p < 0.f)
+    {
+        p = -p;
+        *velocity = -*velocity;
+        *position = p;
+        return true;
+    }
+
+    if (p > world_size)
+    {
+        p = world_size + world_size - p;
+        *velocity = -*velocity;
+        *position = p;
+        return true;
+    }
+
+    *position = p;
+    return false;
+}
+
+static void _entity_update_scalar(struct entity_store* store, float dt)
+{
+    for (uint32_t i = 0; i < store->count; ++i)
+    {
+        const uint32_t flags = store->flags[i];
+        const float scale = (flags & ENTITY_FLAG_FROZEN) ? 0.f : dt;
+        bool bounced = _entity_move_axis(&store->x[i], &store->vx[i], store->vx[i] * scale, store->world_size);
+        bounced |= _entity_move_axis(&store->y[i], &store->vy[i], store->vy[i] * scale, store->world_size);
+        store->flags[i] = (flags & ~ENTITY_FLAG_BOUNCED) | (bounced ? ENTITY_FLAG_BOUNCED : 0);
+    }
+}
+
+#ifdef __SSE2__
+
+static __m128 _entity_select_sse2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Same as _entity_move_axis, four lanes at a time. Returns the bounce mask.
+static __m128 _entity_move_axis_sse2(float* position, float* velocity, __m128 scale, __m128 world_size)
+{
+    const __m128 sign = _mm_set1_ps(-0.f);
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 v = _mm_load_ps(velocity);
+    __m128 p = _mm_add_ps(_mm_load_ps(position), _mm_mul_ps(v, scale));
+
+    const __m128 low = _mm_cmplt_ps(p, zero);
+    const __m128 high = _mm_cmpgt_ps(p, world_size);
+    p = _entity_select_sse2(low, _mm_xor_ps(p, sign), p);
+    p = _entity_select_sse2(high, _mm_sub_ps(_mm_add_ps(world_size, world_size), p), p);
+
+    const __m128 bounced = _mm_or_ps(low, high);
+    v = _mm_xor_ps(v, _mm_and_ps(bounced, sign));
+
+    _mm_store_ps(position, p);
+    _mm_store_ps(velocity, v);
+    return bounced;
+}
+
+static void _entity_update_sse2(struct entity_store* store, float dt)
+{
+    const __m128i frozen = _mm_set1_epi32(ENTITY_FLAG_FROZEN);
+    const __m128i bounced_flag = _mm_set1_epi32(ENTITY_FLAG_BOUNCED);
+    const __m128 dt4 = _mm_set1_ps(dt);
+    const __m128 world_size = _mm_set1_ps(store->world_size);
+    for (uint32_t i = 0; i < store->count; i += 4)
+    {
+        __m128i flags = _mm_load_si128((const __m128i*)&store->flags[i]);
+        const __m128i is_frozen = _mm_cmpeq_epi32(_mm_and_si128(flags, frozen), frozen);
+        const __m128 scale = _mm_andnot_ps(_mm_castsi128_ps(is_frozen), dt4);
+
+        const __m128 bounced = _mm_or_ps(
+            _entity_move_axis_sse2(&store->x[i], &store->vx[i], scale, world_size),
+            _entity_move_axis_sse2(&store->y[i], &store->vy[i], scale, world_size));
+
+        flags = _mm_andnot_si128(bounced_flag, flags);
+        flags = _mm_or_si128(flags, _mm_and_si128(_mm_castps_si128(bounced), bounced_flag));
+        _mm_store_si128((__m128i*)&store->flags[i], flags);
+    }
+}
+
+#endif // __SSE2__
+
+#ifdef __AVX2__
+
+static __m256 _entity_move_axis_avx2(float* position, float* velocity, __m256 scale, __m256 world_size)
+{
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    __m256 v = _mm256_load_ps(velocity);
+    __m256 p = _mm256_add_ps(_mm256_load_ps(position), _mm256_mul_ps(v, scale));
+
+    const __m256 low = _mm256_cmp_ps(p, zero, _CMP_LT_OQ);
+    const __m256 high = _mm256_cmp_ps(p, world_size, _CMP_GT_OQ);
+    p = _mm256_blendv_ps(p, _mm256_xor_ps(p, sign), low);
+    p = _mm256_blendv_ps(p, _mm256_sub_ps(_mm256_add_ps(world_size, world_size), p), high);
+
+    const __m256 bounced = _mm256_or_ps(low, high);
+    v = _mm256_xor_ps(v, _mm256_and_ps(bounced, sign));
+
+    _mm256_store_ps(position, p);
+    _mm256_store_ps(velocity, v);
+    return bounced;
+}
+
+static void _entity_update_avx2(struct entity_store* store, float dt)
+{
+    const __m256i frozen = _mm256_set1_epi32(ENTITY_FLAG_FROZEN);
+    const __m256i bounced_flag = _mm256_set1_epi32(ENTITY_FLAG_BOUNCED);
+    const __m256 dt8 = _mm256_set1_ps(dt);
+    const __m256 world_size = _mm256_set1_ps(store->world_size);
+    for (uint32_t i = 0; i < store->count; i += 8)
+    {
+        __m256i flags = _mm256_load_si256((const __m256i*)&store->flags[i]);
+        const __m256i is_frozen = _mm256_cmpeq_epi32(_mm256_and_si256(flags, frozen), frozen);
+        const __m256 scale = _mm256_andnot_ps(_mm256_castsi256_ps(is_frozen), dt8);
+
+        const __m256 bounced = _mm256_or_ps(
+            _entity_move_axis_avx2(&store->x[i], &store->vx[i], scale, world_size),
+            _entity_move_axis_avx2(&store->y[i], &store->vy[i], scale, world_size));
+
+        flags = _mm256_andnot_si256(bounced_flag, flags);
+        flags = _mm256_or_si256(flags, _mm256_and_si256(_mm256_castps_si256(bounced), bounced_flag));
+        _mm256_store_si256((__m256i*)&store->flags[i], flags);
+    }
+}
+
+#endif // __AVX2__
+
+void entity_store_update(struct entity_store* store, float dt)
+{
+    switch (entity_get_simd())
+    {
+#ifdef __AVX2__
+    case ENTITY_SIMD_AVX2:
+        _entity_update_avx2(store, dt);
+        return;
+#endif
+#ifdef __SSE2__
+    case ENTITY_SIMD_SSE2:
+        _entity_update_sse2(store, dt);
+        return;
+#endif
+    default:
+        _entity_update_scalar(store, dt);
+        return;
+    }
+}
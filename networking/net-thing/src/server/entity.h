@@ -0,0 +1,63 @@
+#ifndef __ENTITY_H__
+#define __ENTITY_H__
+
+// Server side entities, stored as structure of arrays so the per tick update
+// walks contiguous floats and vectorizes. Each tick moves everything by its
+// velocity and bounces it off the edges of a square world.
+//
+// The update has an AVX2 path (eight entities at a time), an SSE2 path (four)
+// and a scalar one. Which ones exist is decided at compile time, AVX2 needs
+// -march with AVX2 in it, e.g. build.sh native.
+//
+// Indices aren't stable, removing an entity moves the last one into its slot.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Doesn't move
+#define ENTITY_FLAG_FROZEN (1u << 0)
+
+// Set by the update if the entity hit the edge of the world this tick
+#define ENTITY_FLAG_BOUNCED (1u << 1)
+
+// Arrays are padded to a multiple of this so the SIMD paths never need a
+// scalar tail
+#define ENTITY_LANES 8
+
+enum entity_simd
+{
+    ENTITY_SIMD_SCALAR,
+    ENTITY_SIMD_SSE2,
+    ENTITY_SIMD_AVX2,
+};
+
+struct entity_store
+{
+    uint32_t count;
+    uint32_t capacity;
+    float world_size;
+
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    uint32_t* flags;
+};
+
+bool entity_store_init(struct entity_store* store, uint32_t capacity, float world_size);
+void entity_store_free(struct entity_store* store);
+
+// Index of the new entity, or -1 if the store is full
+int entity_spawn(struct entity_store* store, float x, float y, float vx, float vy, uint32_t flags);
+void entity_remove(struct entity_store* store, uint32_t index);
+
+void entity_store_update(struct entity_store* store, float dt);
+
+// Lets benchmarks compare the kernels, the best one compiled in is used by
+// default. Asking for one that isn't compiled in gets the best one that is.
+void entity_set_simd(enum entity_simd simd);
+enum entity_simd entity_get_simd();
+enum entity_simd entity_best_simd();
+const char* entity_simd_name(enum entity_simd simd);
+
+#endif // __ENTITY_H__
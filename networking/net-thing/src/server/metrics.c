@@ -0,0 +1,306 @@
+#include <server/metrics.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <server/server.h>
+#include <system/time.h>
+
+static void _metrics_shm_name(int port, char* name, size_t len)
+{
+    snprintf(name, len, METRICS_SHM_PREFIX "%d", port);
+}
+
+static size_t _metrics_region_size(uint32_t max_connections)
+{
+    return sizeof(struct metrics_region) + max_connections * sizeof(struct metrics_connection);
+}
+
+bool metrics_publisher_init(struct metrics_publisher* publisher, int port, uint32_t max_connections)
+{
+    memset(publisher, 0, sizeof(*publisher));
+
+    char name[64];
+    _metrics_shm_name(port, name, sizeof(name));
+
+    // Always a fresh object. Resizing one left by a previous run would pull
+    // pages out from under a reader still mapping it, which then faults.
+    // Unlinked, the old one stays valid for anyone attached until they
+    // notice it's been replaced.
+    if (shm_unlink(name) != 0 && errno != ENOENT)
+    {
+        fprintf(stderr, "Failed to remove old metrics region %s - errno: %d\n", name, errno);
+        return false;
+    }
+
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to create metrics region %s - errno: %d\n", name, errno);
+        return false;
+    }
+
+    const size_t size = _metrics_region_size(max_connections);
+    if (ftruncate(fd, size) != 0)
+    {
+        fprintf(stderr, "Failed to size metrics region %s - errno: %d\n", name, errno);
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map metrics region %s - errno: %d\n", name, errno);
+        shm_unlink(name);
+        return false;
+    }
+
+    // A reader can open it before it's filled in, so that's a write like
+    // any other
+    struct metrics_region* region = mapped;
+    atomic_store_explicit(&region->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memset(&region->server, 0, size - offsetof(struct metrics_region, server));
+    region->magic = METRICS_MAGIC;
+    region->version = METRICS_VERSION;
+    region->max_connections = max_connections;
+    region->server.pid = getpid();
+    region->server.start_ns = system_time_ns();
+    region->server.max_connections = max_connections;
+    for (uint32_t c = 0; c < max_connections; ++c)
+    {
+        region->connections[c].client_id = -1;
+    }
+
+    atomic_store_explicit(&region->sequence, 2, memory_order_release);
+
+    publisher->region = region;
+    publisher->size = size;
+    return true;
+}
+
+void metrics_publisher_free(struct metrics_publisher* publisher, int port)
+{
+    if (!publisher->region)
+    {
+        return;
+    }
+
+    char name[64];
+    _metrics_shm_name(port, name, sizeof(name));
+    munmap(publisher->region, publisher->size);
+    shm_unlink(name);
+    memset(publisher, 0, sizeof(*publisher));
+}
+
+static void _metrics_add_traffic(struct metrics_server* server, const struct rudp_traffic_stats* traffic)
+{
+    server->packets_sent += traffic->packets_sent;
+    server->bytes_sent += traffic->bytes_sent;
+    server->packets_received += traffic->packets_received;
+    server->bytes_received += traffic->bytes_received;
+    server->packets_lost += traffic->packets_lost;
+}
+
+static void _metrics_update_tick_times(struct metrics_publisher* publisher, uint64_t now_ns, uint64_t tick_ns)
+{
+    publisher->window_ticks++;
+    publisher->window_total_ns += tick_ns;
+    if (tick_ns > publisher->window_max_ns)
+    {
+        publisher->window_max_ns = tick_ns;
+    }
+
+    if (now_ns - publisher->window_start_ns < SERVER_STATS_INTERVAL_SEC * BILLION)
+    {
+        return;
+    }
+
+    publisher->tick_mean_ns = publisher->window_total_ns / publisher->window_ticks;
+    publisher->tick_max_ns = publisher->window_max_ns;
+    publisher->window_start_ns = now_ns;
+    publisher->window_ticks = 0;
+    publisher->window_total_ns = 0;
+    publisher->window_max_ns = 0;
+}
+
+void metrics_publish(struct metrics_publisher* publisher, const struct server_context* server, uint64_t tick_ns)
+{
+    struct metrics_region* region = publisher->region;
+    if (!region)
+    {
+        return;
+    }
+
+    const uint64_t now_ns = system_time_ns();
+    _metrics_update_tick_times(publisher, now_ns, tick_ns);
+
+    const uint32_t sequence = atomic_load_explicit(&region->sequence, memory_order_relaxed);
+    atomic_store_explicit(&region->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    struct metrics_server* out = &region->server;
+    out->publish_ns = now_ns;
+    out->tick = server->tick;
+    out->tick_freq = server->config.tick_freq;
+    out->num_connections = server->num_connections;
+    out->num_entities = server->entities.count;
+    out->tick_last_ns = tick_ns;
+    out->tick_mean_ns = publisher->tick_mean_ns;
+    out->tick_max_ns = publisher->tick_max_ns;
+
+    out->packets_sent = 0;
+    out->bytes_sent = 0;
+    out->packets_received = 0;
+    out->bytes_received = 0;
+    out->packets_lost = 0;
+    _metrics_add_traffic(out, &server->retired_traffic);
+
+    for (uint32_t c = 0; c < region->max_connections; ++c)
+    {
+        const struct client_connection* connection = &server->connections[c];
+        struct metrics_connection* connection_out = &region->connections[c];
+        connection_out->client_id = connection->client_id;
+        if (connection->client_id < 0)
+        {
+            continue;
+        }
+
+        const struct rudp_traffic_stats* traffic = &connection->rudp.traffic_stats;
+        _metrics_add_traffic(out, traffic);
+
+        struct sched_stats sched_stats;
+        sched_get_stats(&connection->sched, &sched_stats);
+
+        connection_out->address = connection->address;
+        connection_out->port = connection->port;
+        connection_out->state = connection->rudp.state;
+        connection_out->encrypted = connection->rudp.keyed;
+        connection_out->packets_sent = traffic->packets_sent;
+        connection_out->bytes_sent = traffic->bytes_sent;
+        connection_out->packets_received = traffic->packets_received;
+        connection_out->bytes_received = traffic->bytes_received;
+        connection_out->packets_lost = traffic->packets_lost;
+        connection_out->client_rtt_ns = connection->client_rtt_ns;
+        connection_out->kbps = sched_stats.kbps;
+        connection_out->utilization = sched_stats.utilization;
+        connection_out->messages_dropped = sched_stats.messages_dropped;
+    }
+
+    atomic_store_explicit(&region->sequence, sequence + 2, memory_order_release);
+}
+
+bool metrics_reader_open(struct metrics_reader* reader, int port)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    char name[64];
+    _metrics_shm_name(port, name, sizeof(name));
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct metrics_region))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+
+    reader->region = mapped;
+    reader->size = info.st_size;
+    reader->device = info.st_dev;
+    reader->inode = info.st_ino;
+    return true;
+}
+
+bool metrics_reader_is_current(const struct metrics_reader* reader, int port)
+{
+    char name[64];
+    _metrics_shm_name(port, name, sizeof(name));
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    const bool current = fstat(fd, &info) == 0 && info.st_dev == reader->device && info.st_ino == reader->inode;
+    close(fd);
+    return current;
+}
+
+void metrics_reader_close(struct metrics_reader* reader)
+{
+    if (reader->region)
+    {
+        munmap((void*)reader->region, reader->size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
+
+bool metrics_read(
+    const struct metrics_reader* reader,
+    struct metrics_server* server_out,
+    struct metrics_connection* connections_out,
+    uint32_t max_connections)
+{
+    const struct metrics_region* region = reader->region;
+    if (!region || region->magic != METRICS_MAGIC || region->version != METRICS_VERSION)
+    {
+        return false;
+    }
+
+    // Never more connections than the mapping holds, whatever the header says
+    uint32_t count = region->max_connections;
+    if (_metrics_region_size(count) > reader->size)
+    {
+        return false;
+    }
+    if (count > max_connections)
+    {
+        count = max_connections;
+    }
+
+    for (int attempt = 0; attempt < METRICS_READ_RETRIES; ++attempt)
+    {
+        const uint32_t before = atomic_load_explicit(
+            (_Atomic uint32_t*)&region->sequence, memory_order_acquire);
+        if (before & 1)
+        {
+            continue;
+        }
+
+        memcpy(server_out, &region->server, sizeof(*server_out));
+        memcpy(connections_out, region->connections, count * sizeof(*connections_out));
+
+        atomic_thread_fence(memory_order_acquire);
+        const uint32_t after = atomic_load_explicit(
+            (_Atomic uint32_t*)&region->sequence, memory_order_relaxed);
+        if (before == after)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,138 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+// Live server counters in shared memory, for net-thing-top and anything else
+// that wants a look without attaching to the process.
+//
+// The server rewrites the whole region once per tick under a seqlock: the
+// sequence number is odd while a write is in progress. Readers copy
+// everything out and retry if the sequence was odd or changed underneath
+// them, so the server never waits on a reader and a reader never sees half a
+// tick. Readers map the region read-only and can't slow the server down
+// beyond sharing a few cache lines.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// One region per server port, /dev/shm/net-thing-<port>
+#define METRICS_SHM_PREFIX "/net-thing-"
+#define METRICS_MAGIC 0x4E544D45
+#define METRICS_VERSION 1
+
+// Readers give up after this many torn reads in a row
+#define METRICS_READ_RETRIES 1000
+
+struct server_context;
+
+struct metrics_connection
+{
+    int32_t client_id;
+    uint32_t address;
+    uint16_t port;
+    uint8_t state;
+    bool encrypted;
+
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_lost;
+
+    // Client reported, from its clock sync, 0 until it has synced. Not
+    // measured by the server.
+    uint64_t client_rtt_ns;
+
+    uint32_t kbps;
+    float utilization;
+    uint64_t messages_dropped;
+};
+
+struct metrics_server
+{
+    uint64_t pid;
+    uint64_t start_ns;
+    uint64_t publish_ns;
+    uint32_t tick;
+    uint32_t tick_freq;
+    uint32_t num_connections;
+    uint32_t max_connections;
+    uint32_t num_entities;
+
+    // How long server_tick took, not counting the sleep until the next one.
+    // Mean and max cover the last full stats interval.
+    uint64_t tick_last_ns;
+    uint64_t tick_mean_ns;
+    uint64_t tick_max_ns;
+
+    // Everything since startup, including connections that have since left
+    uint64_t packets_sent;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t bytes_received;
+    uint64_t packets_lost;
+};
+
+struct metrics_region
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t max_connections;
+    _Atomic uint32_t sequence;
+
+    struct metrics_server server;
+    struct metrics_connection connections[];
+};
+
+// Server side, owned by server_context
+struct metrics_publisher
+{
+    struct metrics_region* region;
+    size_t size;
+
+    uint64_t window_start_ns;
+    uint64_t window_ticks;
+    uint64_t window_total_ns;
+    uint64_t window_max_ns;
+    uint64_t tick_mean_ns;
+    uint64_t tick_max_ns;
+};
+
+// Creates the region for port, replacing any left by an earlier run. False if
+// shared memory isn't available, the server carries on without it.
+bool metrics_publisher_init(struct metrics_publisher* publisher, int port, uint32_t max_connections);
+void metrics_publisher_free(struct metrics_publisher* publisher, int port);
+
+// Call at the end of each tick with how long it took
+void metrics_publish(struct metrics_publisher* publisher, const struct server_context* server, uint64_t tick_ns);
+
+// Reader side. Maps the region for port read-only.
+struct metrics_reader
+{
+    const struct metrics_region* region;
+    size_t size;
+
+    // Which object was mapped, a restarted server makes a new one
+    uint64_t device;
+    uint64_t inode;
+};
+
+bool metrics_reader_open(struct metrics_reader* reader, int port);
+void metrics_reader_close(struct metrics_reader* reader);
+
+// False once the mapped region is no longer the one published for port,
+// after a server restart say. The old mapping stays readable but frozen, so
+// reopen to follow the new server.
+bool metrics_reader_is_current(const struct metrics_reader* reader, int port);
+
+// Copies a consistent snapshot into server_out and up to max_connections
+// entries of connections_out. False if the server kept writing through every
+// retry or the region isn't one we understand.
+bool metrics_read(
+    const struct metrics_reader* reader,
+    struct metrics_server* server_out,
+    struct metrics_connection* connections_out,
+    uint32_t max_connections);
+
+#endif // __METRICS_H__
@@ -0,0 +1,521 @@
+#include <server/server.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <net/socket.h>
+#include <system/time.h>
+
+static void _client_connection_init(struct client_connection* connection, const struct server_config* config)
+{
+    memset(connection, 0, sizeof(*connection));
+    connection->client_id = -1;
+    sched_conn_init(&connection->sched, config->client_kbps);
+}
+
+int server_find_connection(struct server_context* context, int address, int port)
+{
+    for (int c = 0; c < context->config.max_connections; ++c)
+    {
+        struct client_connection* connection = &context->connections[c];
+        if (connection->client_id >= 0 &&
+            connection->address == address &&
+            connection->port == port)
+        {
+            return c;
+        }
+    }
+
+    return -1;
+}
+
+// Scattered at random with random velocities, seeded so every run starts the
+// same
+static bool _server_spawn_entities(struct server_context* context)
+{
+    const int num_entities = context->config.num_entities;
+    if (!entity_store_init(&context->entities, num_entities, SERVER_WORLD_SIZE))
+    {
+        return false;
+    }
+
+    uint32_t rng = 0x9E3779B9u;
+    float values[4];
+    for (int e = 0; e < num_entities; ++e)
+    {
+        for (int v = 0; v < 4; ++v)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            values[v] = (float)rng / (float)UINT32_MAX;
+        }
+
+        entity_spawn(
+            &context->entities,
+            values[0] * SERVER_WORLD_SIZE,
+            values[1] * SERVER_WORLD_SIZE,
+            (values[2] * 2.f - 1.f) * SERVER_ENTITY_MAX_SPEED,
+            (values[3] * 2.f - 1.f) * SERVER_ENTITY_MAX_SPEED,
+            0);
+    }
+
+    fprintf(stdout,
+            "Simulating %u entities (%s)\n",
+            context->entities.count,
+            entity_simd_name(entity_get_simd()));
+    return true;
+}
+
+bool server_init(struct server_context* context, const struct server_config* config)
+{
+    if (!context)
+    {
+        return false;
+    }
+
+    memset(context, 0, sizeof(*context));
+    context->config = *config;
+    server_config_rudp(config, &context->rudp_config);
+    context->socket_handle = -1;
+    context->num_connections = 0;
+    context->last_client_id = -1;
+    context->last_stats_ns = 0;
+    context->tick = 0;
+    context->tick_start_ns = 0;
+    context->capture = NULL;
+    if (config->dictionary[0] != '\0')
+    {
+        // No falling back to plain lz, clients using the dictionary couldn't
+        // read a thing
+        if (!lz_dictionary_load(config->dictionary, &context->dictionary))
+        {
+            return false;
+        }
+        lz_codec_init(&context->codec, &context->dictionary);
+    }
+    else
+    {
+        lz_codec_init(&context->codec, NULL);
+    }
+    fprintf(stdout, "Compression %s\n", context->codec.name);
+
+    if (config->capture[0] != '\0')
+    {
+        context->capture = fopen(config->capture, "ab");
+        if (!context->capture)
+        {
+            fprintf(stderr, "Failed to open capture - path: %s errno: %d\n", config->capture, errno);
+            return false;
+        }
+    }
+
+    context->has_key = crypto_load_key(SERVER_KEY_PATH, context->key);
+    fprintf(stdout, "Encryption %s\n", context->has_key ? "enabled" : "disabled");
+    context->connections = malloc(config->max_connections * sizeof(struct client_connection));
+    if (!context->connections)
+    {
+        fprintf(stderr, "Failed to allocate connections - max-connections: %d\n", config->max_connections);
+        return false;
+    }
+
+    for (int c = 0; c < config->max_connections; ++c)
+    {
+        _client_connection_init(&context->connections[c], config);
+    }
+
+    if (!_server_spawn_entities(context))
+    {
+        return false;
+    }
+
+    if (!metrics_publisher_init(&context->metrics, config->port, config->max_connections))
+    {
+        fprintf(stderr, "Metrics unavailable, net-thing-top won't see this server\n");
+    }
+
+    context->socket_handle = socket_create_udp();
+    if (context->socket_handle <= 0)
+    {
+        fprintf(stderr, "Failed to create server socket\n");
+        return false;
+    }
+
+    if (!socket_bind(context->socket_handle, config->port))
+    {
+        fprintf(stderr, "Failed to bind server socket\n");
+        return false;
+    }
+
+    // Without it MTU probes would just get fragmented and always make it
+    if (!socket_set_dont_fragment(context->socket_handle))
+    {
+        fprintf(stderr, "Failed to disable fragmentation, MTU probing will overshoot\n");
+    }
+
+    // Tuning is best effort, a box that won't take it still works
+    if (!socket_set_buffer_sizes(context->socket_handle, config->rcvbuf, config->sndbuf))
+    {
+        fprintf(stderr, "Failed to set socket buffer sizes - errno: %d\n", errno);
+    }
+
+    if (config->busy_poll_us > 0 &&
+        !socket_set_busy_poll(context->socket_handle, config->busy_poll_us))
+    {
+        fprintf(stderr, "Failed to enable busy polling - errno: %d\n", errno);
+    }
+
+    if (!socket_set_nonblocking(context->socket_handle))
+    {
+        fprintf(stderr, "Failed to configure server socket as nonblocking\n");
+        return false;
+    }
+
+    // Clock sync is only as good as our receive times
+    if (!socket_set_timestamping(context->socket_handle))
+    {
+        fprintf(stderr, "Failed to enable receive timestamps, clock sync will be coarse\n");
+    }
+
+    return true;
+}
+
+void server_free(struct server_context* context)
+{
+    if (context->connections)
+    {
+        for (int c = 0; c < context->config.max_connections; ++c)
+        {
+            if (context->connections[c].client_id >= 0)
+            {
+                rudp_conn_close(&context->connections[c].rudp);
+            }
+        }
+        free(context->connections);
+    }
+
+    if (context->socket_handle > 0)
+    {
+        socket_close(context->socket_handle);
+    }
+
+    if (context->capture)
+    {
+        fclose(context->capture);
+    }
+
+    metrics_publisher_free(&context->metrics, context->config.port);
+    entity_store_free(&context->entities);
+    memset(context, 0, sizeof(*context));
+    context->socket_handle = -1;
+}
+
+// Payloads as the codec sees them, so dict_train learns from the real thing.
+// A failed write stops the capture rather than leave a torn record behind
+// every later one.
+static void _server_capture(struct server_context* server, const uint8_t* data, size_t len)
+{
+    if (server->capture && !lz_capture_write(server->capture, data, len))
+    {
+        fprintf(stderr, "Failed to write capture, stopping - path: %s\n", server->config.capture);
+        fclose(server->capture);
+        server->capture = NULL;
+    }
+}
+
+// Stamped and queued just before the connection flushes, ahead of whatever
+// the scheduler has. Stamping it when the request was read would count the
+// rest of the tick as network delay on the way back and skew the client's
+// offset by half of it.
+static void _server_reply_clock_sync(struct client_connection* connection)
+{
+    struct server_context* server = connection->server;
+    struct clock_sync_message message = connection->clock_sync_request;
+    connection->clock_sync_pending = false;
+    clock_sync_make_reply(
+        &message,
+        connection->clock_sync_recv_ns,
+        system_time_ns(),
+        server->tick,
+        server->tick_start_ns,
+        BILLION / server->config.tick_freq);
+    _server_capture(server, (const uint8_t*)&message, sizeof(message));
+    if (!rudp_send(&connection->rudp, &message, sizeof(message)))
+    {
+        fprintf(stderr, "Failed to queue clock sync reply for client %d\n", connection->client_id);
+    }
+}
+
+static void _server_on_read(int address, int port, uint8_t* data, size_t len, void* context)
+{
+    struct client_connection* connection = (struct client_connection*)context;
+    _server_capture(connection->server, data, len);
+    if (clock_sync_is_message(data, len))
+    {
+        // Only the newest gets answered, the client treats the rest as lost
+        memcpy(&connection->clock_sync_request, data, sizeof(connection->clock_sync_request));
+        connection->clock_sync_recv_ns = connection->rudp.prev_recv_ns;
+        connection->clock_sync_pending = true;
+        connection->client_rtt_ns = connection->clock_sync_request.client_rtt_ns;
+        return;
+    }
+
+    fprintf(stdout,
+            "msg from existing client %d: %.*s\n",
+            connection->client_id,
+            (int)len,
+            data);
+
+    // Echo back through the scheduler so replies respect the client's
+    // bandwidth budget
+    sched_enqueue(&connection->sched, data, len, 1.f);
+}
+
+static void _server_on_status(enum rudp_status status, void* context)
+{
+    struct client_connection* connection = (struct client_connection*)context;
+    fprintf(stdout,
+            "Client %d status: %s\n",
+            connection->client_id,
+            rudp_status_name(status));
+}
+
+static bool _server_send_packet(uint8_t* data, size_t len, void* context)
+{
+    struct client_connection* connection = (struct client_connection*)context;
+    _server_capture(connection->server, data, len);
+    return rudp_send(&connection->rudp, data, len);
+}
+
+static void _server_remove_connection(struct server_context* context, struct client_connection* connection)
+{
+    // Goodbyes only go out if we're the ones hanging up, otherwise this just
+    // clears the connection. Closing wipes the stats, so count them first
+    // (less the goodbyes, which are hardly worth it).
+    const struct rudp_traffic_stats* traffic = &connection->rudp.traffic_stats;
+    context->retired_traffic.packets_sent += traffic->packets_sent;
+    context->retired_traffic.bytes_sent += traffic->bytes_sent;
+    context->retired_traffic.packets_received += traffic->packets_received;
+    context->retired_traffic.bytes_received += traffic->bytes_received;
+    context->retired_traffic.packets_lost += traffic->packets_lost;
+    rudp_conn_close(&connection->rudp);
+    _client_connection_init(connection, &context->config);
+    context->num_connections--;
+}
+
+static struct client_connection*
+_server_accept_connection(struct server_context* context, int address, int port, uint8_t* hello, size_t len)
+{
+    if (context->num_connections >= context->config.max_connections)
+    {
+        fprintf(stderr, "Skipping new connection, already at max\n");
+        return NULL;
+    }
+
+    struct client_connection* next_connection = NULL;
+    for (int c = 0; c < context->config.max_connections; ++c)
+    {
+        if (context->connections[c].client_id < 0)
+        {
+            next_connection = &context->connections[c];
+            break;
+        }
+    }
+
+    if (!next_connection)
+    {
+        fprintf(stderr, "Unexpected: could not find free client slot\n");
+        return NULL;
+    }
+
+    next_connection->server = context;
+    next_connection->client_id = ++context->last_client_id;
+    next_connection->address = address;
+    next_connection->port = port;
+    if (!rudp_conn_init(
+            context->socket_handle,
+            address,
+            port,
+            _server_on_read,
+            _server_on_status,
+            next_connection,
+            &context->rudp_config,
+            &next_connection->rudp))
+    {
+        _client_connection_init(next_connection, &context->config);
+        return NULL;
+    }
+
+    sched_set_packet_size(&next_connection->sched, rudp_conn_max_payload(&next_connection->rudp));
+    rudp_conn_set_codec(&next_connection->rudp, &context->codec, RUDP_DEFAULT_COMPRESS_THRESHOLD);
+    if (context->has_key)
+    {
+        rudp_conn_set_key(&next_connection->rudp, context->key);
+    }
+
+    // Counted first so a failed accept can go out the usual way, which frees
+    // the slot and its packet pool again
+    ++context->num_connections;
+    if (!rudp_conn_accept(&next_connection->rudp, hello, len))
+    {
+        fprintf(stderr,
+                "Failed to accept client %d (port=%d)\n",
+                next_connection->client_id,
+                next_connection->port);
+        _server_remove_connection(context, next_connection);
+        return NULL;
+    }
+
+    fprintf(stdout,
+            "New connection: %d (port=%d)\n",
+            next_connection->client_id,
+            next_connection->port);
+
+    return next_connection;
+}
+
+static void _server_update_connections(struct server_context* context)
+{
+    const uint64_t now_ns = system_time_ns();
+    for (int c = 0; c < context->config.max_connections; ++c)
+    {
+        struct client_connection* connection = &context->connections[c];
+        if (connection->client_id < 0)
+        {
+            continue;
+        }
+
+        if (connection->clock_sync_pending)
+        {
+            _server_reply_clock_sync(connection);
+        }
+
+        // Packs to whatever MTU probing has found so far
+        sched_set_packet_size(&connection->sched, rudp_conn_max_payload(&connection->rudp));
+        if (!sched_tick(&connection->sched, now_ns, _server_send_packet, connection))
+        {
+            fprintf(stderr, "Failed to queue packets for client %d\n", connection->client_id);
+        }
+
+        rudp_conn_update(&connection->rudp);
+
+        // Timed out or said goodbye, either way the slot is free now
+        if (!rudp_conn_is_active(&connection->rudp))
+        {
+            fprintf(stdout,
+                    "Removing client %d (%s)\n",
+                    connection->client_id,
+                    rudp_status_name(connection->rudp.state));
+            _server_remove_connection(context, connection);
+        }
+    }
+
+    if (now_ns - context->last_stats_ns < SERVER_STATS_INTERVAL_SEC * BILLION)
+    {
+        return;
+    }
+
+    context->last_stats_ns = now_ns;
+    for (int c = 0; c < context->config.max_connections; ++c)
+    {
+        struct client_connection* connection = &context->connections[c];
+        if (connection->client_id < 0)
+        {
+            continue;
+        }
+
+        struct sched_stats stats;
+        sched_get_stats(&connection->sched, &stats);
+
+        const struct rudp_compress_stats* compress_stats = &connection->rudp.compress_stats;
+        const double compress_ratio = compress_stats->bytes_after ?
+            (double)compress_stats->bytes_before / compress_stats->bytes_after : 1.0;
+        const double compress_us = compress_stats->packets_compressed ?
+            (double)compress_stats->compress_ns / compress_stats->packets_compressed / 1000.0 : 0.0;
+        fprintf(stdout,
+                "client %d: %lu B/s (%.1f%% of %u kbps), deferred=%d dropped=%lu, %s x%.2f (%.2f us/packet)\n",
+                connection->client_id,
+                stats.window_bytes,
+                stats.utilization * 100.f,
+                stats.kbps,
+                stats.messages_deferred,
+                stats.messages_dropped,
+                context->codec.name,
+                compress_ratio,
+                compress_us);
+    }
+}
+
+bool server_tick(struct server_context* context)
+{
+    context->tick_start_ns = system_time_ns();
+
+    uint8_t buffer[COMMON_MAX_MTU] = {0};
+    const size_t max_packet_size = sizeof(buffer);
+    bool looping = true;
+    while (looping)
+    {
+        int address, port;
+        uint64_t recv_ns;
+        const int received =
+            socket_recv_timestamped(context->socket_handle,
+                                    buffer,
+                                    max_packet_size,
+                                    &address,
+                                    &port,
+                                    &recv_ns);
+
+        if (received > 0)
+        {
+            int index = server_find_connection(context, address, port);
+            if (index < 0)
+            {
+                // Only a hello gets a slot, stray goodbyes from connections
+                // we've already dropped are ignored
+                struct rudp_status_payload status;
+                if (!rudp_peek_status(buffer, received, &status) ||
+                    status.status != RUDP_STATUS_CONNECTING)
+                {
+                    continue;
+                }
+
+                _server_accept_connection(context, address, port, buffer, received);
+                continue;
+            }
+
+            struct client_connection* connection = &context->connections[index];
+            rudp_conn_process_at(&connection->rudp, buffer, received, recv_ns ? recv_ns : system_time_ns());
+
+            // Reclaim the slot right away on goodbye, a reconnect from the
+            // same port may well be next in the queue
+            if (!rudp_conn_is_active(&connection->rudp))
+            {
+                fprintf(stdout,
+                        "Removing client %d (%s)\n",
+                        connection->client_id,
+                        rudp_status_name(connection->rudp.state));
+                _server_remove_connection(context, connection);
+            }
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            looping = false;
+        }
+    }
+
+    entity_store_update(&context->entities, 1.f / context->config.tick_freq);
+    _server_update_connections(context);
+    metrics_publish(&context->metrics, context, system_time_ns() - context->tick_start_ns);
+
+    // Nothing catches SIGINT, whatever's still buffered when the server is
+    // stopped would never make it out
+    if (context->capture)
+    {
+        fflush(context->capture);
+    }
+
+    context->tick++;
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <net/crypto.h>
+#include <net/rudp.h>
+#include <net/sched.h>
+#include <net/lz.h>
+#include <net/clock.h>
+#include <server/config.h>
+#include <server/entity.h>
+#include <server/metrics.h>
+
+#define SERVER_STATS_INTERVAL_SEC 1
+
+// Simulated world, see server_config for how many entities are in it
+#define SERVER_WORLD_SIZE 1024.f
+#define SERVER_ENTITY_MAX_SPEED 64.f
+
+// If this file exists, clients must know the same 32 byte key
+#define SERVER_KEY_PATH "net-thing.key"
+
+struct server_context;
+
+struct client_connection 
+{
+    struct server_context* server;
+    int client_id;
+    int address;
+    int port;
+    struct rudp_conn rudp;
+    struct sched_conn sched;
+
+    // Whatever the client put in its last clock sync request. The server
+    // doesn't time round trips itself, so this is only as honest as the
+    // client.
+    uint64_t client_rtt_ns;
+
+    // Latest clock sync request, answered when the tick flushes so the
+    // reply's send time is the time it actually goes out
+    bool clock_sync_pending;
+    uint64_t clock_sync_recv_ns;
+    struct clock_sync_message clock_sync_request;
+};
+
+struct server_context
+{
+    struct server_config config;
+    struct rudp_config rudp_config;
+
+    int socket_handle;
+    int num_connections;
+    int last_client_id;
+    uint64_t last_stats_ns;
+
+    // Numbered so clients can line up with the server's timeline
+    uint32_t tick;
+    uint64_t tick_start_ns;
+
+    struct entity_store entities;
+    struct metrics_publisher metrics;
+
+    // Traffic from connections which have since been removed
+    struct rudp_traffic_stats retired_traffic;
+
+    struct rudp_codec codec;
+    struct lz_dictionary dictionary;
+
+    // Open while config.capture is set, see _server_capture
+    FILE* capture;
+
+    bool has_key;
+    uint8_t key[CRYPTO_KEY_SIZE];
+
+    // config.max_connections of them
+    struct client_connection* connections;
+};
+
+bool server_init(struct server_context* context, const struct server_config* config);
+void server_free(struct server_context* context);
+
+// Index into connections, or -1 if nobody's connected from there
+int server_find_connection(struct server_context* context, int address, int port);
+
+bool server_tick(struct server_context* context);
+
+#endif // __SERVER_H__
@@ -0,0 +1,197 @@
+#include <system/arena.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DIRTY_WORD_BITS 64
+
+bool arena_init(struct arena* arena, size_t capacity)
+{
+    memset(arena, 0, sizeof(*arena));
+
+    capacity = (capacity + ARENA_PAGE_SIZE - 1) / ARENA_PAGE_SIZE * ARENA_PAGE_SIZE;
+    if (capacity == 0 || capacity > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid arena capacity - capacity: %zu\n", capacity);
+        return false;
+    }
+
+    arena->num_pages = capacity / ARENA_PAGE_SIZE;
+    const size_t dirty_words = (arena->num_pages + ARENA_DIRTY_WORD_BITS - 1) / ARENA_DIRTY_WORD_BITS;
+    arena->base = aligned_alloc(ARENA_PAGE_SIZE, capacity);
+    arena->dirty = calloc(dirty_words, sizeof(uint64_t));
+    if (!arena->base || !arena->dirty)
+    {
+        fprintf(stderr, "Failed to allocate arena - capacity: %zu\n", capacity);
+        arena_free(arena);
+        return false;
+    }
+
+    memset(arena->base, 0, capacity);
+    arena->capacity = capacity;
+    arena->used = ARENA_ALIGNMENT;
+    return true;
+}
+
+void arena_free(struct arena* arena)
+{
+    free(arena->base);
+    free(arena->dirty);
+    memset(arena, 0, sizeof(*arena));
+}
+
+static void _arena_mark_dirty(struct arena* arena, size_t offset, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    const size_t first = offset / ARENA_PAGE_SIZE;
+    const size_t last = (offset + size - 1) / ARENA_PAGE_SIZE;
+    for (size_t page = first; page <= last; page++)
+    {
+        arena->dirty[page / ARENA_DIRTY_WORD_BITS] |= 1ull << (page % ARENA_DIRTY_WORD_BITS);
+    }
+}
+
+arena_handle arena_alloc(struct arena* arena, size_t size)
+{
+    const size_t offset = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (size > arena->capacity - offset)
+    {
+        return ARENA_NULL;
+    }
+
+    // Zeroed so whatever was there before a reset or restore can't leak into
+    // the simulation, both peers have to agree on every byte
+    memset(arena->base + offset, 0, size);
+    _arena_mark_dirty(arena, offset, size);
+    arena->used = offset + size;
+    return (arena_handle)offset;
+}
+
+void arena_reset(struct arena* arena)
+{
+    _arena_mark_dirty(arena, 0, arena->used);
+    arena->used = ARENA_ALIGNMENT;
+}
+
+void* arena_get(const struct arena* arena, arena_handle handle)
+{
+    return arena->base + handle;
+}
+
+void* arena_write(struct arena* arena, arena_handle handle, size_t size)
+{
+    _arena_mark_dirty(arena, handle, size);
+    return arena->base + handle;
+}
+
+bool arena_snapshot_init(struct arena_snapshot* snapshot, const struct arena* arena)
+{
+    snapshot->data = aligned_alloc(ARENA_PAGE_SIZE, arena->capacity);
+    if (!snapshot->data)
+    {
+        fprintf(stderr, "Failed to allocate arena snapshot - capacity: %zu\n", arena->capacity);
+        return false;
+    }
+
+    memset(snapshot->data, 0, arena->capacity);
+    snapshot->capacity = arena->capacity;
+    snapshot->used = 0;
+    return true;
+}
+
+void arena_snapshot_free(struct arena_snapshot* snapshot)
+{
+    free(snapshot->data);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+static void _arena_clear_dirty(struct arena* arena, const struct arena_snapshot* snapshot)
+{
+    const size_t dirty_words = (arena->num_pages + ARENA_DIRTY_WORD_BITS - 1) / ARENA_DIRTY_WORD_BITS;
+    memset(arena->dirty, 0, dirty_words * sizeof(uint64_t));
+    arena->tracked = snapshot;
+}
+
+void arena_save(struct arena* arena, struct arena_snapshot* snapshot)
+{
+    memcpy(snapshot->data, arena->base, arena->used);
+    snapshot->used = arena->used;
+    _arena_clear_dirty(arena, snapshot);
+}
+
+void arena_restore(struct arena* arena, const struct arena_snapshot* snapshot)
+{
+    memcpy(arena->base, snapshot->data, snapshot->used);
+    arena->used = snapshot->used;
+    _arena_clear_dirty(arena, snapshot);
+}
+
+// Copies every dirty page from src to dst and clears the bits. Runs of dirty
+// pages go in one memcpy.
+static void _arena_copy_dirty(struct arena* arena, uint8_t* dst, const uint8_t* src)
+{
+    const size_t dirty_words = (arena->num_pages + ARENA_DIRTY_WORD_BITS - 1) / ARENA_DIRTY_WORD_BITS;
+    size_t run_start = 0;
+    size_t run_length = 0;
+    for (size_t w = 0; w < dirty_words; w++)
+    {
+        uint64_t bits = arena->dirty[w];
+        if (bits == 0)
+        {
+            continue;
+        }
+
+        arena->dirty[w] = 0;
+        while (bits)
+        {
+            const size_t page = w * ARENA_DIRTY_WORD_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (run_length > 0 && page == run_start + run_length)
+            {
+                run_length++;
+                continue;
+            }
+
+            if (run_length > 0)
+            {
+                memcpy(dst + run_start * ARENA_PAGE_SIZE, src + run_start * ARENA_PAGE_SIZE, run_length * ARENA_PAGE_SIZE);
+            }
+            run_start = page;
+            run_length = 1;
+        }
+    }
+
+    if (run_length > 0)
+    {
+        memcpy(dst + run_start * ARENA_PAGE_SIZE, src + run_start * ARENA_PAGE_SIZE, run_length * ARENA_PAGE_SIZE);
+    }
+}
+
+bool arena_save_dirty(struct arena* arena, struct arena_snapshot* snapshot)
+{
+    if (arena->tracked != snapshot)
+    {
+        return false;
+    }
+
+    _arena_copy_dirty(arena, snapshot->data, arena->base);
+    snapshot->used = arena->used;
+    return true;
+}
+
+bool arena_restore_dirty(struct arena* arena, const struct arena_snapshot* snapshot)
+{
+    if (arena->tracked != snapshot)
+    {
+        return false;
+    }
+
+    _arena_copy_dirty(arena, arena->base, snapshot->data);
+    arena->used = snapshot->used;
+    return true;
+}
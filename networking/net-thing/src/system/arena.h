@@ -0,0 +1,78 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+// Bump allocator over one contiguous block, for state that has to be copied
+// as a whole (snapshots, rollback, lag compensation). Allocations are
+// referred to by handle, an offset from the start of the block, so a copy of
+// the block is a valid copy of everything in it without any pointer fixups.
+// Nothing is freed individually, only the whole arena is reset.
+//
+// Snapshots are a memcpy of the used part of the arena. For big states where
+// little changes between snapshots, writes can go through arena_write, which
+// marks the pages it touches, and the *_dirty variants then only copy those.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_PAGE_SIZE 4096
+
+// The first ARENA_ALIGNMENT bytes are never handed out, so 0 is never valid
+#define ARENA_NULL 0
+
+typedef uint32_t arena_handle;
+
+struct arena_snapshot;
+
+struct arena
+{
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+
+    // One bit per page written since the last save or restore of tracked.
+    // Only meaningful for that snapshot, anything else needs a full copy.
+    uint64_t* dirty;
+    size_t num_pages;
+    const struct arena_snapshot* tracked;
+};
+
+struct arena_snapshot
+{
+    uint8_t* data;
+    size_t capacity;
+    size_t used;
+};
+
+// Capacity is rounded up to whole pages and can't exceed what a handle can
+// address. The arena starts zeroed.
+bool arena_init(struct arena* arena, size_t capacity);
+void arena_free(struct arena* arena);
+
+// Zeroed and ARENA_ALIGNMENT aligned, ARENA_NULL if it doesn't fit
+arena_handle arena_alloc(struct arena* arena, size_t size);
+
+// Forgets every allocation, handles from before are invalid
+void arena_reset(struct arena* arena);
+
+// Handles are only good for the arena (or a copy of it) they came from.
+// arena_get doesn't mark anything dirty, writing through it is fine as long
+// as the *_dirty snapshot functions aren't used.
+void* arena_get(const struct arena* arena, arena_handle handle);
+void* arena_write(struct arena* arena, arena_handle handle, size_t size);
+
+bool arena_snapshot_init(struct arena_snapshot* snapshot, const struct arena* arena);
+void arena_snapshot_free(struct arena_snapshot* snapshot);
+
+// Copies the used part of the arena, one memcpy each
+void arena_save(struct arena* arena, struct arena_snapshot* snapshot);
+void arena_restore(struct arena* arena, const struct arena_snapshot* snapshot);
+
+// Only copies pages written through arena_write since snapshot was last saved
+// or restored. False (and nothing copied) if another snapshot has been saved
+// or restored since, use the full versions then.
+bool arena_save_dirty(struct arena* arena, struct arena_snapshot* snapshot);
+bool arena_restore_dirty(struct arena* arena, const struct arena_snapshot* snapshot);
+
+#endif // __ARENA_H__
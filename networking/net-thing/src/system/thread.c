@@ -0,0 +1,28 @@
+#define _GNU_SOURCE
+#include <system/thread.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+
+bool thread_pin_to_cpu(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        fprintf(stderr, "No such CPU - cpu: %d\n", cpu);
+        return false;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    // 0 is the calling thread, not the whole process
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+    {
+        fprintf(stderr, "Failed to pin thread - cpu: %d errno: %d\n", cpu, errno);
+        return false;
+    }
+
+    return true;
+}
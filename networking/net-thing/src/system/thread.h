@@ -0,0 +1,10 @@
+#ifndef __SYSTEM_THREAD_H__
+#define __SYSTEM_THREAD_H__
+
+#include <stdbool.h>
+
+// Pins the calling thread to one CPU, so the tick loop doesn't get migrated
+// away from a warm cache or onto a core busy with interrupts
+bool thread_pin_to_cpu(int cpu);
+
+#endif // __SYSTEM_THREAD_H__
@@ -1,8 +1,7 @@
-#include <stdint.h>
-#include <time.h>
+#include <system/time.h>
 
-#define BILLION 1000000000L
-#define MILLION 1000000L
+#include <errno.h>
+#include <time.h>
 
 uint64_t system_time_ns()
 {
@@ -14,9 +13,14 @@ uint64_t system_time_ns()
 
 void sleep_ns(uint64_t ns)
 {
+    // tv_nsec has to stay under a second or nanosleep fails straight away
     struct timespec spec = {
-        .tv_sec = 0,
-        .tv_nsec = ns
+        .tv_sec = ns / BILLION,
+        .tv_nsec = ns % BILLION
     };
-    nanosleep(&spec, NULL);
+
+    // A signal cuts it short, carry on with what's left
+    while (nanosleep(&spec, &spec) != 0 && errno == EINTR)
+    {
+    }
 }
@@ -0,0 +1,12 @@
+#ifndef __SYSTEM_TIME_H__
+#define __SYSTEM_TIME_H__
+
+#include <stdint.h>
+
+#define BILLION 1000000000L
+#define MILLION 1000000L
+
+uint64_t system_time_ns();
+void sleep_ns(uint64_t ns);
+
+#endif // __SYSTEM_TIME_H__
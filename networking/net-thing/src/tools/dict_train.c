@@ -0,0 +1,76 @@
+// Trains a static compression dictionary from replay captures, offline.
+//
+// Usage: dict_train <out.dict> <capture> [capture...]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/socket.h>
+#include <system/time.h>
+#include <net/crypto.h>
+#include <net/rudp.h>
+#include <net/lz.h>
+
+#define DICT_TRAIN_MAX_SAMPLES (1 << 16)
+#define DICT_TRAIN_MAX_DATA (DICT_TRAIN_MAX_SAMPLES * COMMON_MTU)
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <out.dict> <capture> [capture...]\n", argv[0]);
+        return -1;
+    }
+
+    uint8_t* data = (uint8_t*)malloc(DICT_TRAIN_MAX_DATA);
+    size_t* lens = (size_t*)malloc(DICT_TRAIN_MAX_SAMPLES * sizeof(size_t));
+    if (!data || !lens)
+    {
+        fprintf(stderr, "Failed to allocate sample buffers\n");
+        return -1;
+    }
+
+    size_t num_samples = 0;
+    size_t data_len = 0;
+    for (int a = 2; a < argc; ++a)
+    {
+        const size_t read =
+            lz_capture_read(
+                argv[a],
+                data + data_len,
+                DICT_TRAIN_MAX_DATA - data_len,
+                lens + num_samples,
+                DICT_TRAIN_MAX_SAMPLES - num_samples);
+        for (size_t s = num_samples; s < num_samples + read; ++s)
+        {
+            data_len += lens[s];
+        }
+        num_samples += read;
+    }
+
+    struct lz_dictionary dictionary;
+    if (num_samples == 0 ||
+        !lz_dictionary_train(data, lens, num_samples, LZ_MAX_DICTIONARY_SIZE, &dictionary))
+    {
+        fprintf(stderr, "Failed to train dictionary\n");
+        return -1;
+    }
+
+    if (!lz_dictionary_save(argv[1], &dictionary))
+    {
+        return -1;
+    }
+
+    fprintf(stdout,
+            "Trained %zu byte dictionary from %zu samples (%zu bytes)\n",
+            dictionary.len,
+            num_samples,
+            data_len);
+
+    free(lens);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,299 @@
+// Live view of a running server's metrics, read out of shared memory. Never
+// talks to the server, so it can't slow it down or wedge it. Round trip times
+// (cli rtt, in ms) are what each client reports, the server doesn't measure
+// them.
+//
+// Usage: net-thing-top [--port n] [--interval ms] [--once]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <net/common.h>
+#include <net/rudp.h>
+#include <server/metrics.h>
+#include <system/time.h>
+
+#define TOP_DEFAULT_INTERVAL_MS 1000
+
+// Anything older than this and the server has probably stopped ticking
+#define TOP_STALE_NS (2 * BILLION)
+
+struct top_snapshot
+{
+    uint64_t read_ns;
+    struct metrics_server server;
+
+    // Grown to fit whatever the server was started with
+    struct metrics_connection* connections;
+    uint32_t capacity;
+};
+
+bool _top_reserve(struct top_snapshot* snapshot, uint32_t capacity)
+{
+    if (snapshot->capacity >= capacity)
+    {
+        return true;
+    }
+
+    struct metrics_connection* connections = realloc(snapshot->connections, capacity * sizeof(*connections));
+    if (!connections)
+    {
+        fprintf(stderr, "Failed to allocate snapshot - connections: %u\n", capacity);
+        return false;
+    }
+
+    snapshot->connections = connections;
+    snapshot->capacity = capacity;
+    return true;
+}
+
+uint32_t _top_num_connections(const struct top_snapshot* snapshot)
+{
+    return snapshot->server.max_connections < snapshot->capacity ?
+        snapshot->server.max_connections : snapshot->capacity;
+}
+
+double _top_rate(uint64_t now, uint64_t before, uint64_t elapsed_ns)
+{
+    if (elapsed_ns == 0 || now < before)
+    {
+        return 0.0;
+    }
+
+    return (double)(now - before) * BILLION / elapsed_ns;
+}
+
+double _top_loss_pct(uint64_t lost, uint64_t received)
+{
+    return lost + received ? 100.0 * lost / (lost + received) : 0.0;
+}
+
+const struct metrics_connection* _top_find_connection(const struct top_snapshot* snapshot, int32_t client_id)
+{
+    if (!snapshot)
+    {
+        return NULL;
+    }
+
+    const uint32_t count = _top_num_connections(snapshot);
+    for (uint32_t c = 0; c < count; ++c)
+    {
+        if (snapshot->connections[c].client_id == client_id)
+        {
+            return &snapshot->connections[c];
+        }
+    }
+
+    return NULL;
+}
+
+void _top_print(int port, const struct top_snapshot* current, const struct top_snapshot* previous)
+{
+    const struct metrics_server* server = &current->server;
+
+    // Rates only make sense against the same server process
+    if (previous && previous->server.pid != server->pid)
+    {
+        previous = NULL;
+    }
+
+    const uint64_t elapsed_ns = previous ? current->read_ns - previous->read_ns : 0;
+    const uint64_t uptime_s = (server->publish_ns - server->start_ns) / BILLION;
+    const bool stale = current->read_ns - server->publish_ns > TOP_STALE_NS;
+
+    fprintf(stdout,
+            "net-thing-top  port %d  pid %lu  up %02lu:%02lu:%02lu  tick %u @ %u Hz%s\n",
+            port,
+            server->pid,
+            uptime_s / 3600,
+            uptime_s / 60 % 60,
+            uptime_s % 60,
+            server->tick,
+            server->tick_freq,
+            stale ? "  (stale, server not ticking?)" : "");
+
+    const double budget_ms = server->tick_freq ? 1000.0 / server->tick_freq : 0.0;
+    fprintf(stdout,
+            "tick time  last %.3f ms  mean %.3f ms  max %.3f ms  budget %.3f ms\n",
+            (double)server->tick_last_ns / MILLION,
+            (double)server->tick_mean_ns / MILLION,
+            (double)server->tick_max_ns / MILLION,
+            budget_ms);
+
+    fprintf(stdout,
+            "entities %u  connections %u/%u\n",
+            server->num_entities,
+            server->num_connections,
+            server->max_connections);
+
+    const struct metrics_server* before = previous ? &previous->server : server;
+    fprintf(stdout,
+            "traffic  in %.0f pkt/s %.1f KB/s  out %.0f pkt/s %.1f KB/s  lost %.2f%%  (total in %lu out %lu)\n\n",
+            _top_rate(server->packets_received, before->packets_received, elapsed_ns),
+            _top_rate(server->bytes_received, before->bytes_received, elapsed_ns) / 1024.0,
+            _top_rate(server->packets_sent, before->packets_sent, elapsed_ns),
+            _top_rate(server->bytes_sent, before->bytes_sent, elapsed_ns) / 1024.0,
+            _top_loss_pct(server->packets_lost, server->packets_received),
+            server->packets_received,
+            server->packets_sent);
+
+    fprintf(stdout,
+            "%5s  %-21s %-13s %3s %8s %9s %8s %9s %8s %7s %6s %6s\n",
+            "id", "address", "state", "enc", "cli rtt", "in pkt/s", "in KB/s",
+            "out pkt/s", "out KB/s", "loss %", "kbps", "util %");
+
+    const uint32_t count = _top_num_connections(current);
+    for (uint32_t c = 0; c < count; ++c)
+    {
+        const struct metrics_connection* connection = &current->connections[c];
+        if (connection->client_id < 0)
+        {
+            continue;
+        }
+
+        const struct metrics_connection* last = _top_find_connection(previous, connection->client_id);
+        const uint64_t connection_elapsed_ns = last ? elapsed_ns : 0;
+        if (!last)
+        {
+            last = connection;
+        }
+
+        char address[32];
+        snprintf(address,
+                 sizeof(address),
+                 "%u.%u.%u.%u:%u",
+                 connection->address >> 24,
+                 (connection->address >> 16) & 0xFF,
+                 (connection->address >> 8) & 0xFF,
+                 connection->address & 0xFF,
+                 connection->port);
+
+        fprintf(stdout,
+                "%5d  %-21s %-13s %3s %8.2f %9.0f %8.1f %9.0f %8.1f %7.2f %6u %6.1f\n",
+                connection->client_id,
+                address,
+                rudp_status_name(connection->state),
+                connection->encrypted ? "yes" : "no",
+                (double)connection->client_rtt_ns / MILLION,
+                _top_rate(connection->packets_received, last->packets_received, connection_elapsed_ns),
+                _top_rate(connection->bytes_received, last->bytes_received, connection_elapsed_ns) / 1024.0,
+                _top_rate(connection->packets_sent, last->packets_sent, connection_elapsed_ns),
+                _top_rate(connection->bytes_sent, last->bytes_sent, connection_elapsed_ns) / 1024.0,
+                _top_loss_pct(connection->packets_lost, connection->packets_received),
+                connection->kbps,
+                connection->utilization * 100.f);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int port = SERVER_PORT;
+    int interval_ms = TOP_DEFAULT_INTERVAL_MS;
+    bool once = false;
+    for (int a = 1; a < argc; ++a)
+    {
+        const bool has_value = a + 1 < argc;
+        if (strcmp(argv[a], "--port") == 0 && has_value)
+        {
+            port = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--interval") == 0 && has_value)
+        {
+            interval_ms = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--once") == 0)
+        {
+            once = true;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--port n] [--interval ms] [--once]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (interval_ms <= 0)
+    {
+        fprintf(stderr, "Interval must be positive\n");
+        return -1;
+    }
+
+    static struct top_snapshot snapshots[2];
+    struct top_snapshot* current = &snapshots[0];
+    struct top_snapshot* previous = NULL;
+    struct metrics_reader reader;
+    bool attached = false;
+    while (true)
+    {
+        // The server may not be up yet, or may have restarted and published
+        // a new region, so reattach until a read of the current one works
+        if (attached && !metrics_reader_is_current(&reader, port))
+        {
+            metrics_reader_close(&reader);
+            attached = false;
+        }
+
+        if (!attached)
+        {
+            attached = metrics_reader_open(&reader, port);
+            if (attached &&
+                (!_top_reserve(&snapshots[0], reader.region->max_connections) ||
+                 !_top_reserve(&snapshots[1], reader.region->max_connections)))
+            {
+                return -1;
+            }
+        }
+
+        bool read = false;
+        if (attached)
+        {
+            read = metrics_read(&reader, &current->server, current->connections, current->capacity);
+            current->read_ns = system_time_ns();
+            if (!read)
+            {
+                metrics_reader_close(&reader);
+                attached = false;
+            }
+        }
+
+        // A single snapshot has no rates, --once takes two an interval apart
+        if (once && read && !previous)
+        {
+            previous = current;
+            current = &snapshots[1];
+            sleep_ns((uint64_t)interval_ms * MILLION);
+            continue;
+        }
+
+        if (!once)
+        {
+            // Home and clear, like top
+            fprintf(stdout, "\033[H\033[2J");
+        }
+
+        if (read)
+        {
+            _top_print(port, current, previous);
+            previous = current;
+            current = current == &snapshots[0] ? &snapshots[1] : &snapshots[0];
+        }
+        else
+        {
+            fprintf(stdout, "No server metrics for port %d (is it running?)\n", port);
+            previous = NULL;
+        }
+        fflush(stdout);
+
+        if (once)
+        {
+            return read ? 0 : -1;
+        }
+
+        sleep_ns((uint64_t)interval_ms * MILLION);
+    }
+
+    return 0;
+}